@@ -0,0 +1,123 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+#include "VM.h"
+
+using namespace r5rs;
+
+namespace {
+  // thrown by the `escape` primitive, the way a non-local exit had to be
+  // written before call/cc
+  struct Escape {
+    GCRef value;
+  };
+
+  GCRef escape(std::span<const GCRef> args) { throw Escape{ args[0] }; }
+
+  const int searches = 20000;
+
+  const std::string common = R"(
+(define (range i n) (if (< i n) (cons i (range (+ i 1) n)) '()))
+(define data (range 0 100))
+(define (walk exit l) (if (> (car l) 4) (exit (car l)) (walk exit (cdr l))))
+(define (search-cc) (call/cc (lambda (k) (walk k data))))
+(define (search-exception) (walk escape data))
+(define (make-gen lst)
+  (define return #f)
+  (define resume #f)
+  (define (next l)
+    (if (empty? l)
+        (return (- 1))
+        ((lambda ()
+           (call/cc (lambda (k) (set! resume k) (return (car l))))
+           (next (cdr l))))))
+  (lambda ()
+    (call/cc (lambda (r)
+      (set! return r)
+      (if resume (resume #f) (next lst))))))
+(define (drain g acc) ((lambda (v) (if (< v 0) acc (drain g (+ acc v)))) (g)))
+(define (sum l acc) (if (empty? l) acc (sum (cdr l) (+ acc (car l)))))
+)";
+
+  // runs every form of `source` but the last, which is only compiled
+  const vm::Function* compile(vm::VM& machine, const std::string& source) {
+    auto stream = ast(tokens(stringIStream(source)));
+    const vm::Function* res = nullptr;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      if (res) {
+        machine.execute(res);
+      }
+      res = machine.compile(cod->get());
+      stream += 1;
+    }
+    return res;
+  }
+
+  template <typename F> double time(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  void report(const std::string& name, double ms, const std::string& result) {
+    std::cout << std::left << std::setw(20) << name << std::fixed
+      << std::setprecision(1) << ms << "ms  " << result << std::endl;
+  }
+} // namespace
+
+// Times non-local exits with call/cc against the same exits thrown as C++
+// exceptions out of the vm, and a call/cc generator against a plain loop.
+int main(int argc, char* argv[]) {
+  Interpreter interpreter;
+  interpreter.env->set("escape", Primitive{ &escape, 1 });
+  vm::VM machine(*interpreter.env);
+  machine.execute(compile(machine, common));
+
+  auto cc = compile(machine, "(search-cc)");
+  std::string result;
+  auto ms = time([&] {
+    for (int i = 0; i < searches; ++i) {
+      result = std::visit(String(), *machine.execute(cc));
+    }
+  });
+  report("escape call/cc", ms, result);
+
+  auto thrown = compile(machine, "(search-exception)");
+  ms = time([&] {
+    for (int i = 0; i < searches; ++i) {
+      try {
+        machine.execute(thrown);
+      }
+      catch (const Escape& e) {
+        result = std::visit(String(), *e.value);
+      }
+    }
+  });
+  report("escape exception", ms, result);
+
+  auto generator = compile(machine, "(drain (make-gen data) 0)");
+  ms = time([&] {
+    for (int i = 0; i < searches / 100; ++i) {
+      result = std::visit(String(), *machine.execute(generator));
+    }
+  });
+  report("generator call/cc", ms, result);
+
+  auto loop = compile(machine, "(sum data 0)");
+  ms = time([&] {
+    for (int i = 0; i < searches / 100; ++i) {
+      result = std::visit(String(), *machine.execute(loop));
+    }
+  });
+  report("loop", ms, result);
+  return 0;
+}
@@ -0,0 +1,141 @@
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Closure.h"
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+#include "VM.h"
+
+using namespace r5rs;
+
+namespace {
+  struct Program {
+    std::string name;
+    std::string source;
+  };
+
+  struct Engine {
+    std::string name;
+    std::function<std::function<GCRef(expression::COD*)>()> make;
+  };
+
+  const std::vector<Program> programs{
+      { "loop", R"(
+(define (loop i n) (if (< i n) (loop (+ i 1) n) i))
+(loop 0 1000000)
+)" },
+      { "tree", R"(
+(define (tree d m) (if (< d m) (+ (tree (+ d 1) m) (tree (+ d 1) m)) 1))
+(tree 0 18)
+)" },
+      { "closure", R"(
+(define (counter)
+  (define n 0)
+  (lambda () (set! n (+ n 1)) n))
+(define c (counter))
+(define (repeat i n) (if (< i n) (repeat (+ (* 0 (c)) i 1) n) (c)))
+(repeat 0 300000)
+)" },
+      { "list", R"(
+(define (build i n acc) (if (< i n) (build (+ i 1) n (cons i acc)) acc))
+(define (sum l acc) (if (empty? l) acc (sum (cdr l) (+ acc (car l)))))
+(sum (build 0 50000 '()) 0)
+)" },
+      { "quote", R"(
+(define (table) '((1 10) (2 20) (3 30) (4 40) (5 50) (6 60) (7 70) (8 80)))
+(define (lookup k l) (if (= k (car (car l))) (car (cdr (car l))) (lookup k (cdr l))))
+(define (run i n acc) (if (< i n) (run (+ i 1) n (+ acc (lookup 7 (table)))) acc))
+(run 0 100000 0)
+)" },
+  };
+
+  const std::vector<Engine> engines{
+      { "ast",
+        [] {
+          auto interpreter = std::make_shared<Interpreter>();
+          return [=](expression::COD* cod) {
+            return std::invoke(*interpreter, cod);
+          };
+        } },
+      { "vm",
+        [] {
+          auto machine = std::make_shared<vm::VM>(*Interpreter().env);
+          return [=](expression::COD* cod) {
+            return std::invoke(*machine, cod);
+          };
+        } },
+      { "jit",
+        [] {
+          auto machine = std::make_shared<vm::VM>(*Interpreter().env);
+          machine->enable_jit();
+          return [=](expression::COD* cod) {
+            return std::invoke(*machine, cod);
+          };
+        } },
+      { "closure",
+        [] {
+          auto evaluator =
+            std::make_shared<closure::Evaluator>(*Interpreter().env);
+          return [=](expression::COD* cod) {
+            return std::invoke(*evaluator, cod);
+          };
+        } },
+  };
+
+  std::pair<double, std::string> run(const Engine& engine,
+    const Program& program) {
+    auto eval = engine.make();
+    auto stream = ast(tokens(stringIStream(program.source)));
+
+    auto start = std::chrono::steady_clock::now();
+    std::string result;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      result = std::visit(String(), *eval(cod->get()));
+      stream += 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    return { std::chrono::duration<double, std::milli>(end - start).count(),
+            result };
+  }
+} // namespace
+
+// Runs every program under every engine and prints the wall time of each,
+// relative to the AST interpreter. Parsing is included in the timings.
+int main(int argc, char* argv[]) {
+  std::cout << std::left << std::setw(10) << "program";
+  for (auto&& engine : engines) {
+    std::cout << std::setw(20) << engine.name;
+  }
+  std::cout << std::endl;
+
+  for (auto&& program : programs) {
+    std::cout << std::setw(10) << program.name;
+    double base = 0;
+    std::string expect;
+    for (auto&& engine : engines) {
+      auto [ms, result] = run(engine, program);
+      if (&engine == &engines.front()) {
+        base = ms;
+        expect = result;
+      }
+      std::stringstream cell;
+      cell << std::fixed << std::setprecision(1) << ms << "ms ("
+        << std::setprecision(2) << base / ms << "x)";
+      if (result != expect) {
+        cell << " MISMATCH";
+      }
+      std::cout << std::setw(20) << cell.str();
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+
+using namespace r5rs;
+
+namespace {
+  const int rounds = 100000;
+
+  // The same loop guarding a call that succeeds, one that fails in-band and
+  // one whose primitive still throws, so the guard catches a C++ exception
+  // as every error was before.
+  const std::string common = R"(
+(define (loop f n acc)
+  (if (= n 0) acc (loop f (- n 1) (+ acc (guard (e (#t 1)) (f n))))))
+(define (fine n) 0)
+(define (in-band n) (car n))
+(define (thrown n) (%parallel-map fine n))
+)";
+
+  // the code run so far, which the closures it defined point into
+  std::vector<expression::CODPtr> program;
+
+  GCRef run(Interpreter& interpreter, const std::string& source) {
+    auto stream = ast(tokens(stringIStream(source)));
+    GCRef res = nullptr;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      program.push_back(*cod);
+      res = interpreter(cod->get());
+      stream += 1;
+    }
+    return res;
+  }
+
+  template <typename F> double time(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+} // namespace
+
+// Times `rounds` guarded calls of each kind and prints the cost of one.
+int main() {
+  Interpreter interpreter;
+  run(interpreter, common);
+
+  for (auto f : { "fine", "in-band", "thrown" }) {
+    std::string result;
+    auto ms = time([&] {
+      result = std::visit(String(), *run(interpreter,
+        "(loop " + std::string(f) + " " + std::to_string(rounds) + " 0)"));
+    });
+    std::cout << std::left << std::setw(10) << f << std::fixed
+      << std::setprecision(1) << ms << "ms  " << std::setprecision(0)
+      << ms * 1e6 / rounds << "ns a call  " << result << std::endl;
+  }
+  return 0;
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+
+using namespace r5rs;
+
+namespace {
+  const std::string source = R"(
+(define (tree d m) (if (< d m) (+ (tree (+ d 1) m) (tree (+ d 1) m)) 1))
+(define (build i n acc) (if (< i n) (build (+ i 1) n (cons i acc)) acc))
+(define (sum l acc) (if (empty? l) acc (sum (cdr l) (+ acc (car l)))))
+(+ (tree 0 15) (sum (build 0 20000 '()) 0))
+)";
+
+  const int scripts = 4;
+
+  // one isolate: a fresh interpreter that parses and runs the script
+  std::string run() {
+    Interpreter interpreter;
+    auto stream = ast(tokens(stringIStream(source)));
+    std::string result;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      result = std::visit(String(), *interpreter(cod->get()));
+      stream += 1;
+    }
+    return result;
+  }
+} // namespace
+
+// Runs `scripts` scripts on each of n threads, every one in an interpreter of
+// its own, and prints the throughput against a single thread. The threads
+// share no heap or parser, so it should grow with the cores up to
+// hardware_concurrency, or the thread count given as the argument.
+int main(int argc, char* argv[]) {
+  unsigned max = argc > 1 ? std::stoul(argv[1])
+    : std::max(std::thread::hardware_concurrency(), 1u);
+  const auto expect = run();
+
+  std::cout << std::left << std::setw(10) << "threads" << std::setw(16)
+    << "wall" << std::setw(20) << "scripts/s" << std::endl;
+  std::vector<unsigned> counts;
+  for (unsigned n = 1; n < max; n *= 2) {
+    counts.push_back(n);
+  }
+  counts.push_back(max);
+
+  double base = 0;
+  for (auto n : counts) {
+    std::vector<std::string> results(n);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < n; ++i) {
+      threads.emplace_back([&results, i] {
+        for (int j = 0; j < scripts; ++j) {
+          results[i] = run();
+        }
+      });
+    }
+    for (auto&& thread : threads) {
+      thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+    auto rate = n * scripts * 1000 / ms;
+    if (n == 1) {
+      base = rate;
+    }
+    std::stringstream cell;
+    cell << std::fixed << std::setprecision(1) << rate << " ("
+      << std::setprecision(2) << rate / base << "x)";
+    std::cout << std::setw(10) << n << std::setw(16)
+      << std::to_string(static_cast<int>(ms)) + "ms" << std::setw(20)
+      << cell.str();
+    if (std::count(results.begin(), results.end(), expect) != n) {
+      std::cout << " MISMATCH";
+    }
+    std::cout << std::endl;
+  }
+  return 0;
+}
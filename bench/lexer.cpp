@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Lex.h"
+
+using namespace r5rs;
+
+namespace {
+  // a stretch of ordinary code, repeated to the size wanted
+  const std::string unit = R"(
+;; the n-th fibonacci number, the slow way
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(define (greet name) ; strings, characters and quoted data
+  (list "hello, " name #\! '(1 2 3) `(a ,name ,@'(b c)) #(4 5 6) #t))
+
+(define (count-up i n acc)
+  (if (= i n) (reverse acc) (count-up (+ i 1) n (cons (* i 12345) acc))))
+)";
+
+  std::string program(size_t bytes) {
+    std::string res;
+    while (res.size() < bytes) {
+      res += unit;
+    }
+    return res;
+  }
+
+  // the tokens lex::token() finds one after another, as tokens() did
+  IStream<Token> combinators(IStream<Char> input) {
+    auto parser = select<1>(lex::intertoken_space(), lex::token() ||
+      lex::eof());
+    return IStream<Token>(make_function(
+      [input, parser]() mutable -> Try<Token> {
+        auto&& res = std::invoke(*parser, input);
+        if (!res) {
+          return Error{ "error." };
+        }
+        input = res->second;
+        return res->first;
+      }));
+  }
+
+  template <typename F> void report(const char* name, size_t bytes, F f) {
+    auto start = std::chrono::steady_clock::now();
+    auto stream = f();
+    size_t n = 0;
+    while (stream[0]) {
+      stream += 1;
+      ++n;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto s = std::chrono::duration<double>(end - start).count();
+    std::cout << std::left << std::setw(24) << name << std::fixed
+      << std::setprecision(2) << bytes / 1e6 / s << " MB/s  " << n
+      << " tokens in " << std::setprecision(3) << s << "s" << std::endl;
+  }
+} // namespace
+
+// Lexes generated code of the given size in MB, 1 by default, with the
+// combinators and by hand from an IStream and from a string. The
+// combinators get a tenth of it, as they would take minutes on more.
+int main(int argc, char* argv[]) {
+  auto bytes = size_t((argc > 1 ? std::atof(argv[1]) : 1) * 1e6);
+  auto source = program(bytes);
+  auto small = program(bytes / 10);
+
+  report("combinators, IStream", small.size(),
+    [&] { return combinators(stringIStream(small)); });
+  report("by hand, IStream", source.size(),
+    [&] { return tokens(stringIStream(source)); });
+  report("by hand, string", source.size(), [&] { return tokens(source); });
+  return 0;
+}
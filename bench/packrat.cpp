@@ -0,0 +1,99 @@
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+#include "Expressions.h"
+#include "Lex.h"
+
+using namespace r5rs;
+
+namespace {
+  // conds nested in the test of a clause, which is tried as an arrow
+  // clause before it is taken for a plain one
+  std::string conds(int depth) {
+    std::string res = "x";
+    for (int i = 0; i < depth; ++i) {
+      res = "(cond (" + res + " " + std::to_string(i) + "))";
+    }
+    return res;
+  }
+
+  // begins nested in begins, each taken for definitions until the call at
+  // the bottom, and then for forms
+  std::string begins(int depth) {
+    std::string res = "(f)";
+    for (int i = depth; i > 0; --i) {
+      res = "(begin (define a" + std::to_string(i) + " " +
+        std::to_string(i) + ") " + res + ")";
+    }
+    return res;
+  }
+
+  // lets, lambdas and calls nested in one another, which parse once at
+  // each position without memoizing too
+  std::string lets(int depth) {
+    std::string res = "x";
+    for (int i = 0; i < depth; ++i) {
+      auto v = "v" + std::to_string(i);
+      res = "(let ((" + v + " (+ " + v + " 1))) ((lambda (y) (g y " + v +
+        ")) " + res + "))";
+    }
+    return res;
+  }
+
+  void report(const std::string& name, const std::string& source,
+    bool memoizing) {
+    memo_stats = {};
+    auto start = std::chrono::steady_clock::now();
+    auto toks = tokens(source);
+    toks.memoize(memoizing);
+    size_t n = 0;
+    for (auto forms = ast(toks); forms[0]; forms += 1) {
+      ++n;
+    }
+    auto end = std::chrono::steady_clock::now();
+    auto ms = std::chrono::duration<double, std::milli>(end - start).count();
+    std::cout << std::left << std::setw(16) << name
+      << std::setw(8) << (memoizing ? "packrat" : "plain") << std::right
+      << std::fixed << std::setprecision(2) << std::setw(10) << ms << " ms";
+    if (memoizing) {
+      std::cout << std::setw(10) << memo_stats.lookups << " lookups "
+        << std::setprecision(1) << std::setw(5) << 100 * memo_stats.rate()
+        << "% hits";
+    }
+    std::cout << (n == 1 ? "" : "  parse error") << std::endl;
+  }
+} // namespace
+
+// Parses deeply nested generated programs with and without memoizing.
+// Without it conds take twice as long for each level, so the deepest are
+// left to the packrat parser alone; the argument makes that depth, 64 by
+// default.
+int main(int argc, char* argv[]) {
+  auto deepest = argc > 1 ? std::atoi(argv[1]) : 64;
+  for (auto depth : { 8, 12, 14 }) {
+    auto source = conds(depth);
+    auto name = "cond " + std::to_string(depth);
+    report(name, source, false);
+    report(name, source, true);
+  }
+  report("cond " + std::to_string(deepest), conds(deepest), true);
+
+  for (auto depth : { 16, 64, 256 }) {
+    auto source = begins(depth);
+    auto name = "begin " + std::to_string(depth);
+    report(name, source, false);
+    report(name, source, true);
+  }
+
+  for (auto depth : { 100, 400 }) {
+    auto source = lets(depth);
+    auto name = "let " + std::to_string(depth);
+    report(name, source, false);
+    report(name, source, true);
+  }
+  return 0;
+}
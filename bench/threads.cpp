@@ -0,0 +1,165 @@
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+#include "VM.h"
+
+using namespace r5rs;
+
+namespace {
+  const int handlers = 1000;
+  const int requests = 20;
+  const int rounds = 100000;
+
+  // Each handler is a green thread reading lines off a pipe of its own and
+  // answering on a channel; a request is a line written to every pipe.
+  const std::string common = R"(
+(define ping (make-channel))
+(define pong (make-channel))
+(define (echo) (channel-send pong (+ 1 (channel-receive ping))) (echo))
+(define (rally i n acc)
+  (if (< i n)
+      ((lambda ()
+         (channel-send ping acc)
+         (rally (+ i 1) n (channel-receive pong))))
+      acc))
+(define replies (make-channel))
+(define (handler port)
+  ((lambda (line)
+     (if line
+         ((lambda () (channel-send replies 1) (handler port)))
+         (close-port port)))
+   (read-line port)))
+(define (pipes i n) (if (< i n) (cons (pipe) (pipes (+ i 1) n)) '()))
+(define (serve ports)
+  (if (empty? ports)
+      #t
+      ((lambda ()
+         (spawn (lambda () (handler (car (car ports)))))
+         (serve (cdr ports))))))
+(define (request ports)
+  (if (empty? ports)
+      #t
+      ((lambda ()
+         (write-string (cdr (car ports)) "GET
+")
+         (request (cdr ports))))))
+(define (count l n) (if (empty? l) n (count (cdr l) (+ n 1))))
+(define (collect i n acc)
+  (if (< i n) (collect (+ i 1) n (+ acc (channel-receive replies))) acc))
+(define (load ports i n acc)
+  (if (< i n)
+      ((lambda ()
+         (request ports)
+         (load ports (+ i 1) n (+ acc (collect 0 (count ports 0) 0)))))
+      acc))
+)";
+
+  GCRef run(vm::VM& machine, const std::string& source) {
+    auto stream = ast(tokens(stringIStream(source)));
+    GCRef res = nullptr;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      res = machine(cod->get());
+      stream += 1;
+    }
+    return res;
+  }
+
+  template <typename F> double time(F f) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+  }
+
+  void report(const std::string& name, double ms, const std::string& result) {
+    std::cout << std::left << std::setw(24) << name << std::fixed
+      << std::setprecision(1) << ms << "ms  " << result << std::endl;
+  }
+
+  // the same handlers as OS threads blocked in read(2)
+  int os_threads() {
+    std::vector<std::array<int, 2>> fds(handlers);
+    std::atomic<int> replies = 0;
+    std::mutex mutex;
+    std::condition_variable answered;
+    std::vector<std::thread> threads;
+    for (auto&& fd : fds) {
+      if (::pipe(fd.data()) < 0) {
+        throw std::runtime_error("pipe failed!");
+      }
+      threads.emplace_back([&, in = fd[0]] {
+        char c;
+        while (::read(in, &c, 1) == 1) {
+          if (c == '\n' && ++replies % handlers == 0) {
+            std::lock_guard lock(mutex);
+            answered.notify_one();
+          }
+        }
+        ::close(in);
+      });
+    }
+    for (int i = 0; i < requests; ++i) {
+      for (auto&& fd : fds) {
+        if (::write(fd[1], "GET\n", 4) != 4) {
+          throw std::runtime_error("write failed!");
+        }
+      }
+      std::unique_lock lock(mutex);
+      answered.wait(lock, [&] { return replies >= (i + 1) * handlers; });
+    }
+    for (auto&& fd : fds) {
+      ::close(fd[1]);
+    }
+    for (auto&& thread : threads) {
+      thread.join();
+    }
+    return replies;
+  }
+} // namespace
+
+// Times switches between two green threads over channels, and `handlers`
+// green threads serving requests off pipes against one OS thread each.
+int main() {
+  Interpreter interpreter;
+  vm::VM machine(*interpreter.env);
+  run(machine, common);
+  run(machine, "(spawn echo)");
+
+  std::string result;
+  auto ms = time([&] {
+    result = std::visit(String(),
+      *run(machine, "(rally 0 " + std::to_string(rounds) + " 0)"));
+  });
+  std::ostringstream rate;
+  rate << result << " (" << std::fixed << std::setprecision(0)
+    << ms * 1e6 / rounds << "ns a round trip)";
+  report("channel round trips", ms, rate.str());
+
+  ms = time([&] {
+    run(machine, "(define ports (pipes 0 " + std::to_string(handlers) +
+      "))(serve ports)");
+    result = std::visit(String(), *run(machine,
+      "(load ports 0 " + std::to_string(requests) + " 0)"));
+  });
+  report("green handlers", ms, result);
+
+  ms = time([&] { result = std::to_string(os_threads()); });
+  report("os thread handlers", ms, result);
+  return 0;
+}
@@ -1,56 +1,212 @@
+#include <chrono>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <optional>
 
+#include "Closure.h"
 #include "Expressions.h"
 #include "GC.h"
 #include "Interpreter.h"
 #include "Lex.h"
+#include "Metrics.h"
+#include "Optimizer.h"
+#include "Pool.h"
+#include "Profiler.h"
+#include "Source.h"
 #include "String.h"
+#include "Trace.h"
+#include "VM.h"
 #include "color.h"
 
 using namespace std;
 using namespace r5rs;
 
 int main(int argc, char* argv[]) {
-  if (argc == 1) {
-    // r5rs::expression::init();
+  bool vm = false;
+  bool closure = false;
+  bool jit = false;
+  bool optimize = false;
+  bool dump = false;
+  // the budget of each top-level form the interpreter evaluates
+  std::optional<uint64_t> steps;
+  std::optional<int64_t> timeout;
+  // where the folded stacks of the interpreter's profile go
+  std::optional<std::string> profile;
+  // where the trace of the run goes
+  std::optional<std::string> trace;
+  // whether the interpreter's counters are written after each form
+  bool metrics = false;
+  // whether the parser memoizes, its hit rate written at the end
+  bool packrat = false;
 
-    std::cout << "start" << std::endl;
+  std::vector<std::string> args;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--vm") {
+      vm = true;
+    }
+    else if (arg == "--jit") {
+      vm = true;
+      jit = true;
+    }
+    else if (arg == "--optimize") {
+      optimize = true;
+    }
+    else if (arg == "--dump-optimized") {
+      optimize = true;
+      dump = true;
+    }
+    else if (arg == "--closure") {
+      closure = true;
+    }
+    else if (arg.starts_with("--steps=")) {
+      steps = std::stoull(arg.substr(8));
+    }
+    else if (arg.starts_with("--timeout=")) {
+      timeout = std::stoll(arg.substr(10));
+    }
+    else if (arg.starts_with("--trace=")) {
+      trace = arg.substr(8);
+      r5rs::trace::enabled = true;
+    }
+    else if (arg == "--metrics") {
+      metrics = true;
+    }
+    else if (arg == "--packrat") {
+      packrat = true;
+    }
+    else if (arg.starts_with("--profile=")) {
+      profile = arg.substr(10);
+      r5rs::profile::enabled = true;
+    }
+    else {
+      args.push_back(std::move(arg));
+    }
+  }
 
-    auto toks = tokens(cinIStream());
+  // only the interpreter keeps to a budget
+  if (args.size() > 1 || ((steps || timeout) && (vm || closure))) {
+    std::cerr << "usage: r5rs [--vm | --jit | --closure]"
+      " [--optimize | --dump-optimized] [--steps=N] [--timeout=MS]"
+      " [--profile=FILE] [--metrics] [--packrat]"
+      " [--trace=FILE] [filename]" << std::endl;
+    return -1;
+  }
+
+  // a script is mapped and lexed in place, standard input read as it comes
+  std::shared_ptr<const MappedFile> file;
+  if (!args.empty()) {
+    try {
+      file = std::make_shared<const MappedFile>(args[0]);
+    }
+    catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return -1;
+    }
+  }
 
-    // for (size_t i = 0; toks[i]; ++i)
-    // {
-    //   auto && tok = *toks[i];
-    //   std::cout
-    //     << C_BOLD << r5rs::to_string(tok.type)
-    //     << C_BLACK << "[" << tok.row << ":" << tok.col << "]:"
-    //     << C_GREEN << std::visit(String(), tok.value)
-    //     << C_BLACK << std::endl;
-    // }
+  // r5rs::expression::init();
 
-    auto stream = ast(toks);
+  if (!file) {
+    std::cout << "start" << std::endl;
+  }
 
-    Interpreter interpreter;
+  auto toks = file ? tokens(file) : tokens(cinIStream());
+  toks.memoize(packrat);
 
-    Try<r5rs::expression::CODPtr> cod;
+  // for (size_t i = 0; toks[i]; ++i)
+  // {
+  //   auto && tok = *toks[i];
+  //   std::cout
+  //     << C_BOLD << r5rs::to_string(tok.type)
+  //     << C_BLACK << "[" << tok.row << ":" << tok.col << "]:"
+  //     << C_GREEN << std::visit(String(), tok.value)
+  //     << C_BLACK << std::endl;
+  // }
 
-    std::string mem_dot = "../dot/mem.dot";
+  auto stream = ast(toks);
+  // the optimizer needs the whole program, so this reads all of the input
+  // before evaluating any of it
+  if (optimize) {
+    stream = r5rs::optimize::optimize(stream);
+  }
 
-    while ((cod = stream[0])) {
-      std::cout << std::visit(String(), *std::invoke(interpreter, cod->get()))
-        << std::endl;
-      stream += 1;
+  // the interpreter holds the global environment, so it is always made, and
+  // another engine only when it runs the program
+  Interpreter interpreter;
+  std::optional<r5rs::vm::VM> machine;
+  if (vm) {
+    machine.emplace(*interpreter.env);
+    if (jit) {
+      machine->enable_jit();
     }
+  }
+  std::optional<r5rs::closure::Evaluator> evaluator;
+  if (closure) {
+    evaluator.emplace(*interpreter.env);
+  }
 
-    std::cout << "end" << std::endl;
+  Try<r5rs::expression::CODPtr> cod;
+
+  std::string mem_dot = "../dot/mem.dot";
+
+  // The forms evaluated that made procedures, which the closures and the
+  // procedures sampled point into. The stream lets go of every form, and of
+  // the tokens and characters it was read from, once it is evaluated, so
+  // the others are freed then.
+  std::vector<r5rs::expression::CODPtr> program;
+  std::optional<r5rs::profile::Profiler> profiler;
+  // leaves out what the library took to load
+  r5rs::metrics::reset();
+  if (profile) {
+    profiler.emplace();
   }
-  else if (argc == 2) {
 
+  while ((cod = stream[0])) {
+    if (dump) {
+      std::cerr << r5rs::optimize::to_string(cod->get()) << std::endl;
+    }
+    Interpreter::Budget budget{ steps, std::nullopt };
+    if (timeout) {
+      budget.deadline = std::chrono::steady_clock::now() +
+        std::chrono::milliseconds(*timeout);
+    }
+    auto value = machine ? std::invoke(*machine, cod->get())
+      : evaluator ? std::invoke(*evaluator, cod->get())
+                : std::invoke(interpreter, cod->get(), budget);
+    std::cout << std::visit(String(), *value) << std::endl;
+    if (metrics) {
+      r5rs::metrics::json(std::cerr);
+    }
+    if (r5rs::expression::encloses(cod->get())) {
+      program.push_back(*cod);
+    }
+    stream += 1;
+    stream.commit();
   }
-  else {
-    std::cerr << "usage: r5rs [filename]" << std::endl;
-    return -1;
+  if (profiler) {
+    profiler->stop();
+    std::ofstream out(*profile);
+    profiler->folded(out);
+    profiler->report(std::cerr);
+  }
+  // futures nobody touched must not outlive the program they run
+  r5rs::parallel::Pool::instance().drain();
+  if (trace) {
+    std::ofstream out(*trace);
+    r5rs::trace::json(out);
+  }
+  if (packrat) {
+    std::cerr << "packrat: " << memo_stats.hits << " hits in "
+      << memo_stats.lookups << " lookups, " << std::fixed
+      << std::setprecision(1) << 100 * memo_stats.rate() << '%'
+      << std::endl;
+  }
+
+  if (!file) {
+    std::cout << "end" << std::endl;
   }
   return 0;
 }
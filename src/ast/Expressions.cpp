@@ -1,369 +1,946 @@
 #include "Expressions.h"
 
+#include "Combinators.h"
 #include "Lex.h"
-#include <mutex>
+#include "Trace.h"
+#include <algorithm>
 
 using namespace r5rs;
 using namespace expression;
+using namespace combinators;
 
-ParserPtr<Token, std::string> r5rs::expression::variable() {
-  static auto parser = make_parser<Token, std::string>();
-  return parser;
+namespace {
+  // the text of an identifier or string, whether it is a copy or a view
+  std::optional<std::string_view> text(const Token& token) {
+    if (auto view = std::get_if<std::string_view>(&token.value)) {
+      return *view;
+    }
+    if (auto string = std::get_if<std::string>(&token.value)) {
+      return *string;
+    }
+    return std::nullopt;
+  }
+
+  // a token of the type, holding a T
+  template <typename T = nullptr_t> constexpr auto match(TokenType type) {
+    return leaf<Token>([type](Tokens& in) -> std::optional<T> {
+      auto token = in.at(0);
+      if (!token || token->type != type) {
+        return std::nullopt;
+      }
+      std::optional<T> res;
+      if constexpr (std::is_same_v<T, std::string>) {
+        if (auto view = std::get_if<std::string_view>(&token->value)) {
+          res.emplace(*view);
+        }
+      }
+      if (!res) {
+        auto value = std::get_if<T>(&token->value);
+        if (!value) {
+          return std::nullopt;
+        }
+        res = *value;
+      }
+      in += 1;
+      return res;
+      });
+  }
+
+  auto match(Keyword keyword) {
+    return leaf<Token>([name = to_string(keyword)](Tokens& in)
+      -> std::optional<nullptr_t> {
+        auto token = in.at(0);
+        if (!token || token->type != TokenType::identifier ||
+          text(*token) != name) {
+          return std::nullopt;
+        }
+        in += 1;
+        return nullptr;
+      });
+  }
+
+  constexpr auto lp = match(TokenType::left_paren);
+  constexpr auto rp = match(TokenType::right_paren);
+} // namespace
+
+namespace {
+  using Bindings = std::list<std::pair<std::string, ExpPtr>>;
+
+  // the value of a do loop without result expressions
+  ExpPtr nil() {
+    return std::make_shared<Literal>(
+      std::make_shared<ListDatum>(std::list<DatumPtr>{}));
+  }
+
+  // the expressions evaluated in order, as one expression (let () exp ...)
+  ExpPtr sequence(std::list<ExpPtr> exps) {
+    if (exps.size() == 1) {
+      return exps.front();
+    }
+    return std::make_shared<Let>(std::nullopt, std::list<std::string>{},
+      std::list<ExpPtr>{},
+      std::make_shared<Body>(std::list<DefinitionPtr>{}, std::move(exps)));
+  }
+
+  ExpPtr let(std::optional<std::string> name, Bindings bindings, Body body) {
+    std::list<std::string> variables;
+    std::list<ExpPtr> inits;
+    for (auto&& [variable, init] : bindings) {
+      variables.push_back(variable);
+      inits.push_back(init);
+    }
+    return std::make_shared<Let>(std::move(name), std::move(variables),
+      std::move(inits), std::make_shared<Body>(std::move(body)));
+  }
+
+  // let* as one let for each binding
+  ExpPtr sequential(Bindings bindings, Body body) {
+    if (bindings.size() <= 1) {
+      return let(std::nullopt, std::move(bindings), std::move(body));
+    }
+    Bindings first{ bindings.front() };
+    bindings.pop_front();
+    auto inner = sequential(std::move(bindings), std::move(body));
+    return let(std::nullopt, std::move(first), Body{ {}, { inner } });
+  }
+
+  // (op (lambda () exp)): delay and its relatives call the promise
+  // primitives on thunks, as future calls %future
+  ExpPtr thunk_call(const std::string& op, ExpPtr exp) {
+    auto thunk = std::make_shared<Lambda>(std::make_shared<Formals>(),
+      std::make_shared<Body>(std::list<DefinitionPtr>{},
+        std::list<ExpPtr>{ exp }));
+    return std::make_shared<Call>(std::make_shared<Variable>(op),
+      std::list<ExpPtr>{ thunk });
+  }
+
+  ExpPtr lazy(ExpPtr exp) { return thunk_call("%lazy", std::move(exp)); }
+
+  ExpPtr delay(ExpPtr exp) {
+    return lazy(std::make_shared<Call>(std::make_shared<Variable>("%eager"),
+      std::list<ExpPtr>{ exp }));
+  }
+
+  // (guard (var clause ...) body ...) as (%guard thunk handler): the thunk
+  // runs the body and the handler is a cond on var over the clauses, which
+  // raises the condition again when none of them applies
+  ExpPtr guard(std::string variable, std::list<Cond::Clause> clauses,
+    Body body) {
+    if (clauses.back().test) {
+      auto reraise = std::make_shared<Call>(
+        std::make_shared<Variable>("%reraise"),
+        std::list<ExpPtr>{ std::make_shared<Variable>(variable) });
+      clauses.push_back({ nullptr, { reraise }, nullptr });
+    }
+    auto thunk = std::make_shared<Lambda>(std::make_shared<Formals>(),
+      std::make_shared<Body>(std::move(body)));
+    auto handler = std::make_shared<Lambda>(
+      std::make_shared<Formals>(std::list<std::string>{ std::move(variable) }),
+      std::make_shared<Body>(std::list<DefinitionPtr>{},
+        std::list<ExpPtr>{ std::make_shared<Cond>(std::move(clauses)) }));
+    return std::make_shared<Call>(std::make_shared<Variable>("%guard"),
+      std::list<ExpPtr>{ thunk, handler });
+  }
+
+  struct Position {
+    size_t line;
+    size_t col;
+  };
+
+  // where the next token is, which is left in the input
+  constexpr auto position = leaf<Token>([](Tokens& in)
+    -> std::optional<Position> {
+      auto token = in.at(0);
+      if (!token) {
+        return std::nullopt;
+      }
+      return Position{ token->row, token->col };
+    });
+
+  // letrec as internal definitions of a lambda called on the spot
+  ExpPtr recursive(Bindings bindings, Body body) {
+    std::list<DefinitionPtr> defs;
+    for (auto&& [variable, init] : bindings) {
+      defs.push_back(std::make_shared<Define>(variable, init));
+    }
+    defs.splice(defs.end(), body.defs);
+    auto lambda = std::make_shared<Lambda>(std::make_shared<Formals>(),
+      std::make_shared<Body>(std::move(defs), std::move(body.exps)));
+    return std::make_shared<Call>(lambda, std::list<ExpPtr>{});
+  }
+} // namespace
+
+std::optional<std::string> r5rs::expression::variable(Tokens& in) {
+  static const auto parser = match<std::string>(TokenType::identifier)
+    .filter([](const std::string& id) { return !keywords().contains(id); });
+  return parser(in);
 }
 
-ParserPtr<Token, DatumPtr> r5rs::expression::simpleDatum() {
-  static auto parser = make_parser<Token, DatumPtr>();
-  return parser;
+std::optional<DatumPtr> r5rs::expression::simpleDatum(Tokens& in) {
+  static const auto parser =
+    (match<bool>(TokenType::boolean).as<SimpleDatum>() ||
+      match<int64_t>(TokenType::number).as<SimpleDatum>() ||
+      match<char>(TokenType::character).as<SimpleDatum>() ||
+      match<std::string>(TokenType::string).as<SimpleDatum>() ||
+      match<std::string>(TokenType::identifier)
+      .as<Symbol>()
+      .as<SimpleDatum>())
+    .shared()
+    .as<DatumPtr>();
+  return parser(in);
 }
 
-ParserPtr<Token, DatumPtr> r5rs::expression::listDatum() {
-  static auto parser = make_parser<Token, DatumPtr>();
-  return parser;
+std::optional<DatumPtr> r5rs::expression::listDatum(Tokens& in) {
+  static const auto parser = select<1>(lp, rule(datum).many(), rp)
+    .as<ListDatum>()
+    .shared()
+    .as<DatumPtr>();
+  return parser(in);
 }
 
-ParserPtr<Token, DatumPtr> r5rs::expression::vectorDatum() {
-  static auto parser = make_parser<Token, DatumPtr>();
-  return parser;
+std::optional<DatumPtr> r5rs::expression::vectorDatum(Tokens& in) {
+  static const auto parser =
+    select<1>(match(TokenType::vector_paren), rule(datum).many(), rp)
+    .as<VectorDatum>()
+    .shared()
+    .as<DatumPtr>();
+  return parser(in);
 }
 
-ParserPtr<Token, std::shared_ptr<Datum>> r5rs::datum() {
-  static auto parser = make_parser<Token, DatumPtr>();
-  return parser;
+std::optional<DatumPtr> r5rs::expression::datum(Tokens& in) {
+  static const auto parser =
+    rule(simpleDatum) || rule(listDatum) || rule(vectorDatum);
+  return parser(in);
 }
 
-ParserPtr<Token, std::shared_ptr<Definition>> r5rs::definition() {
-  static auto parser = make_parser<Token, DefinitionPtr>();
-  return parser;
+std::optional<ExpPtr> r5rs::expression::exp(Tokens& in) {
+  static const auto parser =
+    (rule(variable).as<Variable>().shared().as<ExpPtr>() ||
+      rule(literal).shared().as<ExpPtr>() ||
+      rule(call).shared().as<ExpPtr>() ||
+      rule(lambda).shared().as<ExpPtr>() ||
+      rule(conditional).shared().as<ExpPtr>() ||
+      rule(assignment).shared().as<ExpPtr>() || rule(derived))
+    .memo();
+  return parser(in);
 }
 
-ParserPtr<Token, DatumPtr> r5rs::expression::quotation() {
-  static auto parser = make_parser<Token, DatumPtr>();
-  return parser;
+std::optional<DatumPtr> r5rs::expression::quotation(Tokens& in) {
+  static const auto parser = select<1>(match(TokenType::quote_symbol),
+    rule(datum)) ||
+    select<2>(lp, match(Keyword::quote), rule(datum), rp);
+  return parser(in);
 }
 
-ParserPtr<Token, Literal> r5rs::expression::literal() {
-  static auto parser = make_parser<Token, Literal>();
-  return parser;
+std::optional<Literal> r5rs::expression::literal(Tokens& in) {
+  static const auto parser = match<bool>(TokenType::boolean).as<Literal>() ||
+    match<int64_t>(TokenType::number).as<Literal>() ||
+    match<char>(TokenType::character).as<Literal>() ||
+    match<std::string>(TokenType::string).as<Literal>() ||
+    rule(quotation).as<Literal>();
+  return parser(in);
 }
 
-ParserPtr<Token, Call> r5rs::expression::call() {
-  static auto parser = make_parser<Token, Call>();
-  return parser;
+std::optional<Call> r5rs::expression::call(Tokens& in) {
+  static const auto parser = combine(
+    [](nullptr_t, ExpPtr op, std::list<ExpPtr> ops, nullptr_t) {
+      return Call{ std::move(op), std::move(ops) };
+    },
+    lp, rule(exp), rule(exp).many(), rp);
+  return parser(in);
 }
 
-ParserPtr<Token, Formals> r5rs::expression::formals() {
-  static auto parser = make_parser<Token, Formals>();
-  return parser;
+std::optional<Formals> r5rs::expression::formals(Tokens& in) {
+  static const auto parser =
+    select<1>(lp, rule(variable).many(), rp)
+    .map([](std::list<std::string> fixed) {
+      return Formals{ std::move(fixed) };
+      }) ||
+    rule(variable).map([](std::string binding) {
+      return Formals{ {}, std::move(binding) };
+      }) ||
+    combine([](nullptr_t, std::list<std::string> fixed, nullptr_t,
+      std::string binding, nullptr_t) {
+        return Formals{ std::move(fixed), std::move(binding) };
+      },
+      lp, rule(variable).some(), match(TokenType::dot), rule(variable), rp);
+  return parser(in);
 }
 
-ParserPtr<Token, Formals> r5rs::expression::defFormals() {
-  static auto parser = make_parser<Token, Formals>();
-  return parser;
+std::optional<Formals> r5rs::expression::defFormals(Tokens& in) {
+  static const auto parser = combine(
+    [](std::list<std::string> fixed, std::optional<std::string> binding) {
+      return Formals{ std::move(fixed), std::move(binding) };
+    },
+    rule(variable).many(),
+    select<1>(match(TokenType::dot), rule(variable))
+    .as<std::optional<std::string>>()
+    .otherwise(std::optional<std::string>()));
+  return parser(in);
 }
 
-ParserPtr<Token, Body> r5rs::expression::body() {
-  static auto parser = make_parser<Token, Body>();
-  return parser;
+std::optional<Body> r5rs::expression::body(Tokens& in) {
+  static const auto parser = combine(
+    [](std::list<DefinitionPtr> defs, std::list<ExpPtr> exps) {
+      return Body{ std::move(defs), std::move(exps) };
+    },
+    rule(definition).many(), rule(exp).some());
+  return parser(in);
 }
 
-ParserPtr<Token, Lambda> r5rs::expression::lambda() {
-  static auto parser = make_parser<Token, Lambda>();
-  return parser;
+std::optional<DefinitionPtr> r5rs::expression::definition(Tokens& in) {
+  static const auto var_parser = combine([](std::string name, ExpPtr exp) {
+    auto lambda = std::dynamic_pointer_cast<Lambda>(exp);
+    if (lambda && lambda->name.empty()) {
+      lambda->name = name;
+    }
+    return Define{ std::move(name), std::move(exp) };
+    }, rule(variable), rule(exp));
+
+  static const auto fun_parser = combine([](Position at, nullptr_t,
+    std::string name, Formals formals, nullptr_t, Body body) {
+      auto lambda = std::make_shared<Lambda>(
+        std::make_shared<Formals>(std::move(formals)),
+        std::make_shared<Body>(std::move(body)));
+      lambda->name = name;
+      lambda->line = at.line;
+      lambda->col = at.col;
+      return Define{ std::move(name), lambda };
+    },
+    position, lp, rule(variable), rule(defFormals), rp, rule(body));
+
+  static const auto parser =
+    (select<2>(lp, match(Keyword::define),
+      (fun_parser || var_parser).shared().as<DefinitionPtr>(), rp) ||
+      rule(definitions))
+    .memo();
+  return parser(in);
+}
+
+std::optional<Lambda> r5rs::expression::lambda(Tokens& in) {
+  static const auto parser = combine([](Position at, nullptr_t, nullptr_t,
+    Formals formals, Body body, nullptr_t) {
+      Lambda lambda{ std::make_shared<Formals>(std::move(formals)),
+                    std::make_shared<Body>(std::move(body)) };
+      lambda.line = at.line;
+      lambda.col = at.col;
+      return lambda;
+    },
+    position, lp, match(Keyword::lambda), rule(formals), rule(body), rp);
+  return parser(in);
 }
 
-ParserPtr<Token, Conditional> r5rs::expression::conditional() {
-  static auto parser = make_parser<Token, Conditional>();
-  return parser;
+std::optional<Conditional> r5rs::expression::conditional(Tokens& in) {
+  static const auto parser = select<2>(lp, match(Keyword::If),
+    combine([](ExpPtr test, ExpPtr consequent, ExpPtr alternate) {
+      return Conditional{ std::move(test), std::move(consequent),
+        std::move(alternate) };
+      },
+      rule(exp), rule(exp), rule(exp).otherwise(ExpPtr())),
+    rp);
+  return parser(in);
 }
 
-ParserPtr<Token, Assignment> r5rs::expression::assignment() {
-  static auto parser = make_parser<Token, Assignment>();
-  return parser;
+std::optional<Assignment> r5rs::expression::assignment(Tokens& in) {
+  static const auto parser = select<2>(lp, match(Keyword::set_),
+    combine([](std::string var, ExpPtr exp) {
+      return Assignment{ std::move(var), std::move(exp) };
+      },
+      rule(variable), rule(exp)),
+    rp);
+  return parser(in);
+}
+
+std::optional<ExpPtr> r5rs::expression::derived(Tokens& in) {
+  static const auto exp = rule(expression::exp);
+
+  static const auto conjunction =
+    select<2>(lp, match(Keyword::And), exp.many(), rp)
+    .as<And>()
+    .shared()
+    .as<ExpPtr>();
+  static const auto disjunction =
+    select<2>(lp, match(Keyword::Or), exp.many(), rp)
+    .as<Or>()
+    .shared()
+    .as<ExpPtr>();
+
+  static const auto clause =
+    select<2>(lp, match(Keyword::Else), exp.some(), rp)
+    .map([](std::list<ExpPtr> exps) {
+      return Cond::Clause{ nullptr, std::move(exps), nullptr };
+      }) ||
+    combine([](nullptr_t, ExpPtr test, nullptr_t, ExpPtr receiver,
+      nullptr_t) {
+        return Cond::Clause{ std::move(test), {}, std::move(receiver) };
+      },
+      lp, exp, match(Keyword::evaluates_to), exp, rp) ||
+    combine([](nullptr_t, ExpPtr test, std::list<ExpPtr> exps, nullptr_t) {
+      return Cond::Clause{ std::move(test), std::move(exps), nullptr };
+      },
+      lp, exp, exp.many(), rp);
+  static const auto cond = select<2>(lp, match(Keyword::cond), clause.some(),
+    rp)
+    .as<Cond>()
+    .shared()
+    .as<ExpPtr>();
+
+  static const auto handling = combine([](nullptr_t, nullptr_t, nullptr_t,
+    std::string variable, std::list<Cond::Clause> clauses, nullptr_t,
+    Body body, nullptr_t) {
+      return guard(std::move(variable), std::move(clauses), std::move(body));
+    },
+    lp, match(Keyword::guard), lp, rule(variable), clause.some(), rp,
+    rule(body), rp);
+
+  static const auto data = select<1>(lp, rule(datum).many(), rp);
+  static const auto case_clauses = select<1>(lp,
+    combine([](std::list<DatumPtr> data, std::list<ExpPtr> exps) {
+      return Case::Clause{ std::move(data), std::move(exps) };
+      },
+      data, exp.some()),
+    rp)
+    .many();
+  static const auto otherwise =
+    select<2>(lp, match(Keyword::Else), exp.some(), rp)
+    .otherwise(std::list<ExpPtr>());
+  static const auto selection = combine([](nullptr_t, nullptr_t, ExpPtr key,
+    std::list<Case::Clause> clauses, std::list<ExpPtr> otherwise,
+    nullptr_t) -> ExpPtr {
+      return std::make_shared<Case>(std::move(key),
+        std::vector<Case::Clause>(std::make_move_iterator(clauses.begin()),
+          std::make_move_iterator(clauses.end())),
+        std::move(otherwise));
+    },
+    lp, match(Keyword::Case), exp, case_clauses, otherwise, rp);
+
+  static const auto bindings = select<1>(lp,
+    combine([](nullptr_t, std::string variable, ExpPtr init, nullptr_t) {
+      return std::make_pair(std::move(variable), std::move(init));
+      },
+      lp, rule(variable), exp, rp)
+    .many(),
+    rp);
+  static const auto let_form = combine([](nullptr_t, nullptr_t,
+    std::optional<std::string> name, Bindings bindings, Body body,
+    nullptr_t) {
+      return let(std::move(name), std::move(bindings), std::move(body));
+    },
+    lp, match(Keyword::let), rule(variable).maybe(), bindings, rule(body),
+    rp);
+  static const auto let_star = combine([](nullptr_t, nullptr_t,
+    Bindings bindings, Body body, nullptr_t) {
+      return sequential(std::move(bindings), std::move(body));
+    },
+    lp, match(Keyword::let_), bindings, rule(body), rp);
+  static const auto letrec_form = combine([](nullptr_t, nullptr_t,
+    Bindings bindings, Body body, nullptr_t) {
+      return recursive(std::move(bindings), std::move(body));
+    },
+    lp, match(Keyword::letrec), bindings, rule(body), rp);
+
+  static const auto steps = select<1>(lp,
+    combine([](nullptr_t, std::string variable, ExpPtr init, ExpPtr step,
+      nullptr_t) {
+        return Do::Step{ std::move(variable), std::move(init),
+          std::move(step) };
+      },
+      lp, rule(variable), exp, exp.otherwise(ExpPtr()), rp)
+    .many(),
+    rp);
+  static const auto loop = combine([](nullptr_t, nullptr_t,
+    std::list<Do::Step> steps, nullptr_t, ExpPtr test,
+    std::list<ExpPtr> results, nullptr_t, std::list<ExpPtr> commands,
+    nullptr_t) -> ExpPtr {
+      return std::make_shared<Do>(std::move(steps), std::move(test),
+        std::move(results), std::move(commands));
+    },
+    lp, match(Keyword::Do), steps, lp, exp, exp.many(), rp, exp.many(), rp);
+
+  static const auto promise =
+    combine([](nullptr_t, nullptr_t, ExpPtr exp, nullptr_t) {
+      return delay(std::move(exp));
+      },
+      lp, match(Keyword::delay), exp, rp) ||
+    combine([](nullptr_t, nullptr_t, ExpPtr exp, nullptr_t) {
+      return lazy(std::move(exp));
+      },
+      lp, match(Keyword::delay_force), exp, rp) ||
+    combine([](nullptr_t, nullptr_t, ExpPtr first, ExpPtr rest,
+      nullptr_t) -> ExpPtr {
+        auto op = std::make_shared<Variable>("%stream-cons");
+        return std::make_shared<Call>(op,
+          std::list<ExpPtr>{ delay(std::move(first)), lazy(std::move(rest)) });
+      },
+      lp, match(Keyword::stream_cons), exp, exp, rp) ||
+    combine([](nullptr_t, nullptr_t, Formals formals, Body body,
+      nullptr_t) -> ExpPtr {
+        auto exp = lazy(let(std::nullopt, {}, std::move(body)));
+        return std::make_shared<Lambda>(
+          std::make_shared<Formals>(std::move(formals)),
+          std::make_shared<Body>(std::list<DefinitionPtr>{},
+            std::list<ExpPtr>{ exp }));
+      },
+      lp, match(Keyword::stream_lambda), rule(formals), rule(body), rp) ||
+    combine([](nullptr_t, nullptr_t, ExpPtr exp, nullptr_t) {
+      return thunk_call("%future", std::move(exp));
+      },
+      lp, match(Keyword::future), exp, rp);
+
+  static const auto parser = conjunction || disjunction || cond ||
+    selection || let_form || let_star || letrec_form || loop || promise ||
+    handling;
+  return parser(in);
 }
 
-ParserPtr<Token, DefinitionPtr> r5rs::expression::definitions() {
-  static auto parser = make_parser<Token, DefinitionPtr>();
-  return parser;
+std::optional<DefinitionPtr> r5rs::expression::definitions(Tokens& in) {
+  static const auto parser =
+    select<2>(lp, match(Keyword::begin), rule(definition).many(), rp)
+    .as<Definitions>()
+    .shared()
+    .as<DefinitionPtr>();
+  return parser(in);
 }
 
-ParserPtr<Token, CODPtr> r5rs::expression::cod() {
-  static auto parser = make_parser<Token, CODPtr>();
-  return parser;
+std::optional<CODPtr> r5rs::expression::cod(Tokens& in) {
+  static const auto parser =
+    (rule(exp).as<CODPtr>() || rule(definition).as<CODPtr>() ||
+      rule(cods).shared().as<CODPtr>())
+    .memo();
+  return parser(in);
 }
 
-ParserPtr<Token, CODs> r5rs::expression::cods() {
-  static auto parser = make_parser<Token, CODs>();
-  return parser;
+std::optional<CODs> r5rs::expression::cods(Tokens& in) {
+  static const auto parser =
+    select<2>(lp, match(Keyword::begin), rule(cod).many(), rp).as<CODs>();
+  return parser(in);
 }
 
-ParserPtr<Token, std::shared_ptr<Exp>> r5rs::exp() {
-  static auto parser = make_parser<Token, ExpPtr>();
-  return parser;
+GCRef r5rs::expression::value(Datum* datum) {
+  auto visitor = overloaded{
+      [](SimpleDatum* simple) -> GCRef {
+        return std::visit([](auto v) -> GCValue { return v; },
+          simple->value);
+      },
+      [](ListDatum* list) -> GCRef {
+        GCRef head = nullptr;
+        for (auto it = list->list.rbegin(); it != list->list.rend(); ++it) {
+          head = Pair{ value(it->get()), head };
+        }
+        return head;
+      },
+      [](VectorDatum* vec) -> GCRef {
+        Vector res;
+        for (auto&& datum : vec->list) {
+          res.push_back(value(datum.get()));
+        }
+        return res;
+      } };
+  return std::visit(visitor, datum->datum_type());
 }
 
-// ParserPtr<Token, Program> r5rs::program()
-// {
-//   static auto parser = make_parser<Token, Program>();
-//   return parser;
-// }
-
-ParserPtr<Token, nullptr_t> r5rs::expression::match(Keyword keyword) {
-  return match<std::string>(TokenType::identifier)
-    ->filter(make_function(
-      [=](std::string id) -> bool { return to_string(keyword) == id; }))
-    ->as(nullptr);
+DatumPtr r5rs::expression::quote(const GCValue& value) {
+  auto visitor = overloaded{
+      [](nullptr_t) -> DatumPtr {
+        return std::make_shared<ListDatum>(std::list<DatumPtr>{});
+      },
+      [](const Pair& pair) -> DatumPtr {
+        std::list<DatumPtr> list;
+        const GCValue* it = &*pair.first;
+        const GCValue* rest = &*pair.second;
+        while (true) {
+          auto element = quote(*it);
+          if (!element) {
+            return nullptr;
+          }
+          list.push_back(std::move(element));
+          if (std::holds_alternative<nullptr_t>(*rest)) {
+            return std::make_shared<ListDatum>(std::move(list));
+          }
+          auto next = std::get_if<Pair>(rest);
+          if (!next) {
+            return nullptr;
+          }
+          it = &*next->first;
+          rest = &*next->second;
+        }
+      },
+      [](const Vector& vec) -> DatumPtr {
+        std::list<DatumPtr> list;
+        for (auto&& element : vec) {
+          auto res = quote(*element);
+          if (!res) {
+            return nullptr;
+          }
+          list.push_back(std::move(res));
+        }
+        return std::make_shared<VectorDatum>(std::move(list));
+      },
+      [](const Symbol& symbol) -> DatumPtr {
+        return std::make_shared<SimpleDatum>(symbol);
+      },
+      [](bool b) -> DatumPtr { return std::make_shared<SimpleDatum>(b); },
+      [](char c) -> DatumPtr { return std::make_shared<SimpleDatum>(c); },
+      [](int64_t i) -> DatumPtr { return std::make_shared<SimpleDatum>(i); },
+      [](const std::string& s) -> DatumPtr {
+        return std::make_shared<SimpleDatum>(s);
+      },
+      [](auto&&) -> DatumPtr { return nullptr; },
+  };
+  return std::visit(visitor, value);
 }
 
 namespace {
-  void variableInit() {
-    *variable() = *match<std::string>(TokenType::identifier)
-      ->filter(make_function([=](std::string id) -> bool {
-      return keywords().find(id) == keywords().end();
-        }));
-  }
+  struct Enclosure {
+    bool operator()(COD* cod) { return std::visit(*this, cod->cod_type()); }
+    bool operator()(Definition* def) {
+      return std::visit(*this, def->def_type());
+    }
+    bool operator()(Exp* exp) {
+      return exp && std::visit(*this, exp->exp_type());
+    }
 
-  void simpleDatumInit() {
-    *simpleDatum() = *(match<bool>(TokenType::boolean)->as<SimpleDatum>() ||
-      match<int64_t>(TokenType::number)->as<SimpleDatum>() ||
-      match<char>(TokenType::character)->as<SimpleDatum>() ||
-      match<std::string>(TokenType::string)->as<SimpleDatum>() ||
-      match<std::string>(TokenType::identifier)
-      ->as<Symbol>()
-      ->as<SimpleDatum>())
-      ->shared()
-      ->as<DatumPtr>();
-  }
+    bool operator()(CODs* cods) { return any(cods->cods); }
+    bool operator()(Define* def) { return (*this)(def->exp.get()); }
+    bool operator()(Definitions* defs) { return any(defs->defs); }
 
-  void listDatumInit() {
-    *listDatum() = *select<1>(match<>(TokenType::left_paren), datum()->many(),
-      match<>(TokenType::right_paren))
-      ->as<ListDatum>()
-      ->shared()
-      ->as<DatumPtr>();
-  }
+    bool operator()(Variable*) { return false; }
+    bool operator()(Literal*) { return false; }
+    bool operator()(Lambda*) { return true; }
+    bool operator()(Call* call) {
+      return (*this)(call->op.get()) || any(call->operands);
+    }
+    bool operator()(Conditional* condition) {
+      return (*this)(condition->test.get()) ||
+        (*this)(condition->consequent.get()) ||
+        (*this)(condition->alternate.get());
+    }
+    bool operator()(Assignment* assign) {
+      return (*this)(assign->exp.get());
+    }
+    bool operator()(And* conjunction) { return any(conjunction->exps); }
+    bool operator()(Or* disjunction) { return any(disjunction->exps); }
+    bool operator()(Cond* cond) {
+      for (auto&& clause : cond->clauses) {
+        if ((*this)(clause.test.get()) || any(clause.exps) ||
+          (*this)(clause.receiver.get())) {
+          return true;
+        }
+      }
+      return false;
+    }
+    bool operator()(Case* selection) {
+      if ((*this)(selection->key.get()) || any(selection->otherwise)) {
+        return true;
+      }
+      for (auto&& clause : selection->clauses) {
+        if (any(clause.exps)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    // the let's own procedure is only made when it is a named let that
+    // is not inlined
+    bool operator()(Let* let) {
+      auto&& body = *let->lambda->body;
+      return (let->name && !let->inlined) || any(let->inits) ||
+        any(body.defs) || any(body.exps);
+    }
+    bool operator()(Do* loop) { return (*this)(loop->loop.get()); }
+
+    template <typename T> bool any(const std::list<T>& nodes) {
+      for (auto&& node : nodes) {
+        if ((*this)(node.get())) {
+          return true;
+        }
+      }
+      return false;
+    }
+  };
+} // namespace
 
-  void vectorDatumInit() {
-    *vectorDatum() = *select<1>(match<>(TokenType::vector_paren), datum()->many(),
-      match<>(TokenType::right_paren))
-      ->as<VectorDatum>()
-      ->shared()
-      ->as<DatumPtr>();
-  }
+bool r5rs::expression::encloses(COD* cod) { return Enclosure()(cod); }
 
-  void datumInit() {
-    *datum() = *(simpleDatum() || listDatum() || vectorDatum());
+namespace {
+  GCRef build(const Literal::value_t& value) {
+    auto visitor = overloaded{
+        [](const DatumPtr& datum) -> GCRef {
+          return expression::value(datum.get());
+        },
+        [](auto v) -> GCRef { return v; } };
+    return std::visit(visitor, value);
   }
+} // namespace
 
-  void expInit() {
-    *exp() =
-      *(variable()->as<Variable>()->shared()->as<ExpPtr>() ||
-        literal()->shared()->as<ExpPtr>() || call()->shared()->as<ExpPtr>() ||
-        lambda()->shared()->as<ExpPtr>() ||
-        conditional()->shared()->as<ExpPtr>() ||
-        assignment()->shared()->as<ExpPtr>());
+r5rs::expression::Literal::Literal(value_t value)
+  : value(std::move(value)), pooled(build(this->value)) {}
+
+r5rs::expression::Dispatch::Dispatch(
+  const std::vector<std::list<DatumPtr>>& data)
+  : clauses(data.size()), booleans{ data.size(), data.size() },
+  empty(data.size()) {
+  // the first clause a datum appears in wins
+  for (size_t i = 0; i < data.size(); ++i) {
+    auto simple = overloaded{
+        [&](int64_t n) { fixnums.emplace(n, i); },
+        [&](char c) {
+          chars.resize(256, clauses);
+          auto&& slot = chars[static_cast<unsigned char>(c)];
+          slot = std::min(slot, i);
+        },
+        [&](bool b) { booleans[b] = std::min(booleans[b], i); },
+        [&](const Symbol& symbol) { symbols.emplace(symbol.name, i); },
+        // a string is never eqv? to another
+        [](const std::string&) {},
+    };
+    auto visitor = overloaded{
+        [&](SimpleDatum* datum) { std::visit(simple, datum->value); },
+        [&](ListDatum* list) {
+          if (list->list.empty()) {
+            empty = std::min(empty, i);
+          }
+        },
+        [](VectorDatum*) {},
+    };
+    for (auto&& datum : data[i]) {
+      std::visit(visitor, datum->datum_type());
+    }
   }
 
-  // void programInit()
-  // {
-  //   *program() = *select<0>(cod()->many()->as<CODs>(),
-  //   match<>(TokenType::eof));
-  // }
-
-  void quotationInit() {
-    *quotation() =
-      *(select<1>(match(TokenType::quote_symbol), datum()) ||
-        select<2>(match(TokenType::left_paren), match(Keyword::quote), datum(),
-          match(TokenType::right_paren)));
+  if (fixnums.empty()) {
+    return;
   }
-
-  void literalInit() {
-    *literal() = *(match<bool>(TokenType::boolean)->as<Literal>() ||
-      match<int64_t>(TokenType::number)->as<Literal>() ||
-      match<char>(TokenType::character)->as<Literal>() ||
-      match<std::string>(TokenType::string)->as<Literal>() ||
-      quotation()->as<Literal>());
+  auto [min, max] = std::minmax_element(fixnums.begin(), fixnums.end());
+  auto span = static_cast<uint64_t>(max->first) -
+    static_cast<uint64_t>(min->first);
+  if (span >= 2 * fixnums.size() + 16) {
+    return;
   }
-
-  void callInit() {
-    static auto ctor =
-      make_function([](nullptr_t, ExpPtr op, std::list<ExpPtr> ops, nullptr_t) {
-      return Call{ op, ops };
-        });
-    *call() = *combine(ctor, match<>(TokenType::left_paren), exp(), exp()->many(),
-      match<>(TokenType::right_paren));
+  low = min->first;
+  dense.assign(span + 1, clauses);
+  for (auto&& [n, i] : fixnums) {
+    dense[static_cast<uint64_t>(n) - static_cast<uint64_t>(low)] = i;
   }
+  fixnums.clear();
+}
 
-  void formalsInit() {
-    static auto fixed_ctor = make_function(
-      [](std::list<std::string> fixed) { return Formals{ std::move(fixed) }; });
-    static auto binding_ctor = make_function([](std::string binding) {
-      return Formals{ {}, std::move(binding) };
-      });
-    static auto both_ctor =
-      make_function([](nullptr_t, std::list<std::string> fixed, nullptr_t,
-        std::string binding, nullptr_t) {
-          return Formals{ std::move(fixed), std::move(binding) };
-        });
-    *formals() = *(select<1>(match(TokenType::left_paren), variable()->many(),
-      match(TokenType::right_paren))
-      ->map(fixed_ctor) ||
-      variable()->map(binding_ctor) ||
-      combine(both_ctor, match(TokenType::left_paren),
-        variable()->some(), match(TokenType::dot), variable(),
-        match(TokenType::right_paren)));
-  }
+size_t r5rs::expression::Dispatch::operator()(const GCValue& key) const {
+  auto visitor = overloaded{
+      [&](int64_t n) -> size_t {
+        if (dense.empty()) {
+          auto it = fixnums.find(n);
+          return it == fixnums.end() ? clauses : it->second;
+        }
+        auto at = static_cast<uint64_t>(n) - static_cast<uint64_t>(low);
+        return at < dense.size() ? dense[at] : clauses;
+      },
+      [&](char c) -> size_t {
+        return chars.empty() ? clauses : chars[static_cast<unsigned char>(c)];
+      },
+      [&](const Symbol& symbol) -> size_t {
+        auto it = symbols.find(symbol.name);
+        return it == symbols.end() ? clauses : it->second;
+      },
+      [&](bool b) -> size_t { return booleans[b]; },
+      [&](nullptr_t) -> size_t { return empty; },
+      [&](const auto&) -> size_t { return clauses; },
+  };
+  return std::visit(visitor, key);
+}
 
-  void defFormalsInit() {
-    static auto ctor = make_function(
-      [](std::list<std::string> fixed, std::optional<std::string> binding) {
-        return Formals{ std::move(fixed), std::move(binding) };
-      });
-    *defFormals() = *combine(ctor, variable()->many(),
-      select<1>(match(TokenType::dot), variable())
-      ->as<std::optional<std::string>>()
-      ->otherwise(std::nullopt));
+r5rs::expression::Case::Case(ExpPtr key, std::vector<Clause> clauses,
+  std::list<ExpPtr> otherwise)
+  : key(key), clauses(std::move(clauses)), otherwise(std::move(otherwise)) {
+  std::vector<std::list<DatumPtr>> data;
+  for (auto&& clause : this->clauses) {
+    data.push_back(clause.data);
   }
+  dispatch = std::make_shared<Dispatch>(data);
+}
 
-  void bodyInit() {
-    static auto ctor =
-      make_function([](std::list<DefinitionPtr> defs, std::list<ExpPtr> exps) {
-      return Body{ std::move(defs), std::move(exps) };
-        });
-    *body() = *combine(ctor, definition()->many(), exp()->some());
-  }
+namespace {
+  // Checks that a let body creates no procedure and, for a named let, refers
+  // to the name only as the operator of a call in tail position with one
+  // operand per variable. Those calls are collected to become jumps.
+  class Iteration {
+  public:
+    Iteration(const std::optional<std::string>& name, size_t arity)
+      : name(name), arity(arity) {}
+
+    bool sequence(const std::list<ExpPtr>& exps, bool tail) {
+      for (auto it = exps.begin(); it != exps.end(); ++it) {
+        if (!walk(it->get(), tail && std::next(it) == exps.end())) {
+          return false;
+        }
+      }
+      return true;
+    }
 
-  void definitionInit() {
-    static auto var_ctor = make_function([](std::string name, ExpPtr exp) {
-      return Define{ std::move(name), exp };
-      });
+    bool operator()(Variable* var) { return var->id != name; }
+    bool operator()(Literal*) { return true; }
+    bool operator()(Lambda*) { return false; }
+
+    bool operator()(Call* call) {
+      auto t = tail;
+      auto type = call->op->exp_type();
+      auto var = std::get_if<Variable*>(&type);
+      if (var && (*var)->id == name) {
+        if (!t || call->operands.size() != arity) {
+          return false;
+        }
+        calls.push_back(call);
+      }
+      else if (!walk(call->op.get(), false)) {
+        return false;
+      }
+      return sequence(call->operands, false);
+    }
 
-    static auto fun_ctor = make_function(
-      [](nullptr_t, std::string name, Formals formals, nullptr_t, Body body) {
-        auto lambda = std::make_shared<Lambda>(
-          std::make_shared<Formals>(std::move(formals)),
-          std::make_shared<Body>(std::move(body)));
-        return Define{ std::move(name), lambda };
-      });
+    bool operator()(Conditional* condition) {
+      auto t = tail;
+      return walk(condition->test.get(), false) &&
+        walk(condition->consequent.get(), t) &&
+        walk(condition->alternate.get(), t);
+    }
 
-    static auto fun_parser =
-      combine(fun_ctor, match(TokenType::left_paren), variable(), defFormals(),
-        match(TokenType::right_paren), body());
+    bool operator()(Assignment* assign) {
+      return assign->variable != name && walk(assign->exp.get(), false);
+    }
 
-    static auto var_parser = combine(var_ctor, variable(), exp());
+    bool operator()(And* conjunction) {
+      return sequence(conjunction->exps, tail);
+    }
+    bool operator()(Or* disjunction) {
+      return sequence(disjunction->exps, tail);
+    }
 
-    *definition() =
-      *(select<2>(match(TokenType::left_paren), match(Keyword::define),
-        (fun_parser || var_parser)->shared()->as<DefinitionPtr>(),
-        match(TokenType::right_paren)) ||
-        definitions());
-  }
+    bool operator()(Cond* cond) {
+      auto t = tail;
+      for (auto&& clause : cond->clauses) {
+        if (!walk(clause.test.get(), false) || !sequence(clause.exps, t) ||
+          !walk(clause.receiver.get(), false)) {
+          return false;
+        }
+      }
+      return true;
+    }
 
-  void lambdaInit() {
-    static auto ctor = make_function([](Formals formals, Body body) {
-      return Lambda{ std::make_shared<Formals>(std::move(formals)),
-                    std::make_shared<Body>(std::move(body)) };
-      });
-    *lambda() = *select<2>(match(TokenType::left_paren), match(Keyword::lambda),
-      combine(ctor, formals(), body()),
-      match(TokenType::right_paren));
-  }
+    bool operator()(Case* selection) {
+      auto t = tail;
+      if (!walk(selection->key.get(), false)) {
+        return false;
+      }
+      for (auto&& clause : selection->clauses) {
+        if (!sequence(clause.exps, t)) {
+          return false;
+        }
+      }
+      return sequence(selection->otherwise, t);
+    }
 
-  void conditionalInit() {
-    static auto ctor =
-      make_function([](ExpPtr test, ExpPtr consequent, ExpPtr alternate) {
-      return Conditional{ test, consequent, alternate };
-        });
-    *conditional() =
-      *select<2>(match(TokenType::left_paren), match(Keyword::If),
-        combine(ctor, exp(), exp(), exp()->otherwise(nullptr)),
-        match(TokenType::right_paren));
-  }
+    bool operator()(Let* let) {
+      auto t = tail;
+      if (!let->inlined || !sequence(let->inits, false)) {
+        return false;
+      }
+      // an inlined let has no procedures, so only the name is left to find
+      auto&& variables = let->lambda->formals->fixed;
+      if (!name || let->name == name ||
+        std::find(variables.begin(), variables.end(), *name) !=
+        variables.end()) {
+        return true;
+      }
+      return sequence(let->lambda->body->exps, t);
+    }
 
-  void assignmentInit() {
-    static auto ctor = make_function([](std::string var, ExpPtr exp) {
-      return Assignment{ std::move(var), exp };
-      });
-    *assignment() = *select<2>(match(TokenType::left_paren), match(Keyword::set_),
-      combine(ctor, variable(), exp()),
-      match(TokenType::right_paren));
-  }
+    bool operator()(Do* loop) { return (*this)(loop->loop.get()); }
 
-  void definitionsInit() {
-    *definitions() =
-      *select<2>(match(TokenType::left_paren), match(Keyword::begin),
-        definition()->many(), match(TokenType::right_paren))
-      ->as<Definitions>()
-      ->shared()
-      ->as<DefinitionPtr>();
-  }
+    std::vector<Call*> calls;
 
-  void codInit() {
-    *cod() = *(exp()->as<CODPtr>() || definition()->as<CODPtr>() ||
-      cods()->shared()->as<CODPtr>());
-  }
+  private:
+    bool walk(Exp* exp, bool tail) {
+      if (!exp) {
+        return true;
+      }
+      this->tail = tail;
+      return std::visit(*this, exp->exp_type());
+    }
+
+    const std::optional<std::string>& name;
+    size_t arity;
+    bool tail = false;
+  };
+} // namespace
 
-  void codsInit() {
-    *cods() = *select<2>(match(TokenType::left_paren), match(Keyword::begin),
-      cod()->many(), match(TokenType::right_paren))
-      ->as<CODs>();
+r5rs::expression::Let::Let(std::optional<std::string> name,
+  std::list<std::string> variables, std::list<ExpPtr> inits,
+  std::shared_ptr<Body> body)
+  : name(std::move(name)), inits(std::move(inits)),
+  lambda(std::make_shared<Lambda>(
+    std::make_shared<Formals>(std::move(variables)), std::move(body))) {
+  ExpPtr op = lambda;
+  if (this->name) {
+    lambda->name = *this->name;
+    auto bind = std::make_shared<Body>(
+      std::list<DefinitionPtr>{ std::make_shared<Define>(*this->name, lambda) },
+      std::list<ExpPtr>{ std::make_shared<Variable>(*this->name) });
+    op = std::make_shared<Call>(
+      std::make_shared<Lambda>(std::make_shared<Formals>(), bind),
+      std::list<ExpPtr>{});
   }
+  core = std::make_shared<Call>(op, this->inits);
+
+  auto&& fixed = lambda->formals->fixed;
+  Iteration iteration(this->name, fixed.size());
+  inlined = lambda->body->defs.empty() &&
+    (!this->name ||
+      std::find(fixed.begin(), fixed.end(), *this->name) == fixed.end()) &&
+    iteration.sequence(lambda->body->exps, true);
+  if (inlined) {
+    for (auto&& call : iteration.calls) {
+      call->loop = this;
+    }
+  }
+}
 
-} // namespace
+// (let <loop> ((variable init) ...)
+//   (if test (begin result ...) (begin command ... (<loop> step ...))))
+// where the loop has a name no program can refer to.
+r5rs::expression::Do::Do(std::list<Step> steps, ExpPtr test,
+  std::list<ExpPtr> results, std::list<ExpPtr> commands)
+  : steps(std::move(steps)), test(test), results(std::move(results)),
+  commands(std::move(commands)) {
+  const std::string name = " do";
+  std::list<std::string> variables;
+  std::list<ExpPtr> inits;
+  std::list<ExpPtr> next;
+  for (auto&& step : this->steps) {
+    variables.push_back(step.variable);
+    inits.push_back(step.init);
+    next.push_back(
+      step.step ? step.step : std::make_shared<Variable>(step.variable));
+  }
 
-void r5rs::expression::init() {
-  variableInit();
-  simpleDatumInit();
-  listDatumInit();
-  vectorDatumInit();
-  datumInit();
-  expInit();
-  // programInit();
-  quotationInit();
-  literalInit();
-  callInit();
-  formalsInit();
-  defFormalsInit();
-  bodyInit();
-  definitionInit();
-  lambdaInit();
-  conditionalInit();
-  assignmentInit();
-  definitionsInit();
-  codInit();
-  codsInit();
-
-  assert(*variable());
-  assert(*simpleDatum());
-  assert(*listDatum());
-  assert(*vectorDatum());
-  assert(*datum());
-  assert(*exp());
-  // assert(*program());
-  assert(*quotation());
-  assert(*literal());
-  assert(*call());
-  assert(*formals());
-  assert(*defFormals());
-  assert(*body());
-  assert(*definition());
-  assert(*lambda());
-  assert(*conditional());
-  assert(*assignment());
-  assert(*definitions());
-  assert(*cod());
-  assert(*cods());
+  auto again = this->commands;
+  again.push_back(
+    std::make_shared<Call>(std::make_shared<Variable>(name), std::move(next)));
+  auto done = this->results.empty() ? nil() : sequence(this->results);
+  auto body = std::make_shared<Body>(std::list<DefinitionPtr>{},
+    std::list<ExpPtr>{
+      std::make_shared<Conditional>(test, done, sequence(std::move(again))) });
+  loop = std::make_shared<Let>(name, std::move(variables), std::move(inits),
+    std::move(body));
 }
 
 IStream<expression::CODPtr> r5rs::ast(IStream<Token> input) {
-  static std::once_flag flag;
-  std::call_once(flag, []() { init(); });
-
   return IStream<CODPtr>(make_function([input]() mutable -> Try<CODPtr> {
-    auto&& res = std::invoke(*cod(), input);
+    trace::Span span("parse");
+    auto res = cod(input);
     if (!res) {
       return Error{ "error." };
     }
-    input = res->second;
-    return res->first;
-    }));
+    input.commit();
+    return std::move(*res);
+    }), input.bounded());
 }
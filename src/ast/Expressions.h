@@ -4,9 +4,11 @@
 #include <list>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
-#include "Parse.h"
+#include "GC.h"
+#include "Stream.h"
 #include "Token.h"
 #include "Type.h"
 
@@ -33,6 +35,12 @@ namespace r5rs
     class Lambda;
     class Conditional;
     class Assignment;
+    class And;
+    class Or;
+    class Cond;
+    class Case;
+    class Let;
+    class Do;
     class Define;
     class Definitions;
 
@@ -70,7 +78,7 @@ namespace r5rs
     struct Exp: COD
     {
       using exp_t = std::variant<Variable *, Literal *, Call *, Lambda *,
-        Conditional *, Assignment *>;
+        Conditional *, Assignment *, And *, Or *, Cond *, Case *, Let *, Do *>;
 
       ~Exp() override = default;
       cod_t cod_type() final { return this; }
@@ -151,7 +159,17 @@ namespace r5rs
 
       exp_t exp_type() override { return this; }
       value_t value;
-      explicit Literal(value_t value): value(std::move(value)) {}
+      explicit Literal(value_t value);
+
+      // The value, built with the node and shared by every evaluation, so
+      // it must never be written to: set! rebinds a variable rather than
+      // writing into the value it holds. The reference keeps it alive as a
+      // root for as long as the node. Being built up front, it is only ever
+      // read, also by other threads running the same code.
+      const GCRef& constant() const { return pooled; }
+
+    private:
+      GCRef pooled;
     };
 
     class Call: public Exp
@@ -159,6 +177,8 @@ namespace r5rs
     public:
       ExpPtr op;
       std::list<ExpPtr> operands;
+      // the inlined named let this call is the next iteration of
+      Let *loop = nullptr;
 
       exp_t exp_type() override { return this; }
       explicit Call(ExpPtr op, std::list<ExpPtr> ops)
@@ -179,6 +199,11 @@ namespace r5rs
 
       std::shared_ptr<Formals> formals;
       std::shared_ptr<Body> body;
+      // for profiles: the name it is defined under, empty if it has none,
+      // and the line and column its source starts at
+      std::string name;
+      size_t line = 0;
+      size_t col = 0;
     };
 
     class Conditional: public Exp
@@ -210,6 +235,139 @@ namespace r5rs
       ExpPtr exp;
     };
 
+    class And: public Exp
+    {
+    public:
+      exp_t exp_type() override { return this; }
+
+      explicit And(std::list<ExpPtr> exps): exps(std::move(exps)) {}
+
+      std::list<ExpPtr> exps;
+    };
+
+    class Or: public Exp
+    {
+    public:
+      exp_t exp_type() override { return this; }
+
+      explicit Or(std::list<ExpPtr> exps): exps(std::move(exps)) {}
+
+      std::list<ExpPtr> exps;
+    };
+
+    class Cond: public Exp
+    {
+    public:
+      // (test exp ...), (test => receiver), or (else exp ...) with a null
+      // test. A clause of just a test has no exps and no receiver.
+      struct Clause
+      {
+        ExpPtr test;
+        std::list<ExpPtr> exps;
+        ExpPtr receiver;
+      };
+
+      exp_t exp_type() override { return this; }
+
+      explicit Cond(std::list<Clause> clauses): clauses(std::move(clauses)) {}
+
+      std::list<Clause> clauses;
+    };
+
+    // Finds the clause of a case expression a key selects: through a table
+    // indexed by the key for characters and for fixnum data in a dense
+    // range, and by hashing for sparse fixnums and symbols.
+    class Dispatch
+    {
+    public:
+      explicit Dispatch(const std::vector<std::list<DatumPtr>> &data);
+
+      // the index of the first clause with a datum eqv? to `key`, or the
+      // number of clauses if there is none
+      size_t operator()(const GCValue &key) const;
+
+    private:
+      size_t clauses;
+      int64_t low = 0;
+      std::vector<size_t> dense;
+      std::unordered_map<int64_t, size_t> fixnums;
+      std::vector<size_t> chars;
+      std::unordered_map<std::string, size_t> symbols;
+      size_t booleans[2];
+      size_t empty;
+    };
+
+    class Case: public Exp
+    {
+    public:
+      struct Clause
+      {
+        std::list<DatumPtr> data;
+        std::list<ExpPtr> exps;
+      };
+
+      exp_t exp_type() override { return this; }
+
+      explicit Case(ExpPtr key, std::vector<Clause> clauses,
+        std::list<ExpPtr> otherwise);
+
+      ExpPtr key;
+      std::vector<Clause> clauses;
+      // the else clause, empty if there is none
+      std::list<ExpPtr> otherwise;
+      std::shared_ptr<const Dispatch> dispatch;
+    };
+
+    // (let ((variable init) ...) body) or the named let (let name ...),
+    // which binds name to the procedure in its own body. let* and letrec
+    // are parsed into let and lambda.
+    class Let: public Exp
+    {
+    public:
+      exp_t exp_type() override { return this; }
+
+      explicit Let(std::optional<std::string> name,
+        std::list<std::string> variables, std::list<ExpPtr> inits,
+        std::shared_ptr<Body> body);
+
+      std::optional<std::string> name;
+      std::list<ExpPtr> inits;
+      // the procedure the inits are passed to
+      std::shared_ptr<Lambda> lambda;
+      // the same as a call of core forms, ((lambda ...) init ...) or for
+      // a named let (((lambda () (define name (lambda ...)) name)) init ...)
+      ExpPtr core;
+      // Whether the variables can live in the frame of the enclosing
+      // procedure: the body defines nothing and creates no procedure, and a
+      // named let only calls itself from tail position, so those calls can
+      // update the variables in place and jump back to the body.
+      bool inlined = false;
+    };
+
+    class Do: public Exp
+    {
+    public:
+      // a variable, its init and its step, null when it keeps its value
+      struct Step
+      {
+        std::string variable;
+        ExpPtr init;
+        ExpPtr step;
+      };
+
+      exp_t exp_type() override { return this; }
+
+      explicit Do(std::list<Step> steps, ExpPtr test, std::list<ExpPtr> results,
+        std::list<ExpPtr> commands);
+
+      std::list<Step> steps;
+      ExpPtr test;
+      std::list<ExpPtr> results;
+      std::list<ExpPtr> commands;
+      // the loop as a named let
+      std::shared_ptr<Let> loop;
+    };
+
     class Define: public Definition
     {
     public:
@@ -234,49 +392,44 @@ namespace r5rs
       std::list<DefinitionPtr> defs;
     };
 
-    template <typename T = nullptr_t> ParserPtr<Token, T> match(TokenType type)
-    {
-      return make_parser(
-        make_function([=](IStream<Token> input) -> ParserResult<Token, T> {
-          if (input.eof())
-          {
-            return Error{ "eof", input.current() };
-          }
-          if (type != input[0]->type)
-          {
-            return Error{ "match fail.", input.current() };
-          }
-          if (!std::holds_alternative<T>(input[0]->value))
-          {
-            return Error{ "type error.", input.current() };
-          }
-          return std::make_pair(std::get<T>(input[0]->value), input + 1);
-                      }));
-    }
-
-    ParserPtr<Token, nullptr_t> match(Keyword keyword);
-    ParserPtr<Token, std::string> variable();
-
-    ParserPtr<Token, DatumPtr> simpleDatum();
-    ParserPtr<Token, DatumPtr> listDatum();
-    ParserPtr<Token, DatumPtr> vectorDatum();
-    ParserPtr<Token, DatumPtr> quotation();
-
-    ParserPtr<Token, Literal> literal();
-    ParserPtr<Token, Call> call();
-    ParserPtr<Token, Lambda> lambda();
-    ParserPtr<Token, Conditional> conditional();
-    ParserPtr<Token, Assignment> assignment();
-
-    ParserPtr<Token, Formals> formals();
-    ParserPtr<Token, Formals> defFormals();
-    ParserPtr<Token, Body> body();
-
-    ParserPtr<Token, DefinitionPtr> definitions();
-    ParserPtr<Token, CODPtr> cod();
-    ParserPtr<Token, CODs> cods();
-
-    void init();
+    using Tokens = IStream<Token>;
+
+    // The nonterminals of the grammar, each of which parses one where the
+    // tokens are, or nothing and leaves them there.
+    std::optional<std::string> variable(Tokens& in);
+
+    std::optional<DatumPtr> datum(Tokens& in);
+    std::optional<DatumPtr> simpleDatum(Tokens& in);
+    std::optional<DatumPtr> listDatum(Tokens& in);
+    std::optional<DatumPtr> vectorDatum(Tokens& in);
+    std::optional<DatumPtr> quotation(Tokens& in);
+
+    std::optional<ExpPtr> exp(Tokens& in);
+    std::optional<Literal> literal(Tokens& in);
+    std::optional<Call> call(Tokens& in);
+    std::optional<Lambda> lambda(Tokens& in);
+    std::optional<Conditional> conditional(Tokens& in);
+    std::optional<Assignment> assignment(Tokens& in);
+    std::optional<ExpPtr> derived(Tokens& in);
+
+    std::optional<Formals> formals(Tokens& in);
+    std::optional<Formals> defFormals(Tokens& in);
+    std::optional<Body> body(Tokens& in);
+
+    std::optional<DefinitionPtr> definition(Tokens& in);
+    std::optional<DefinitionPtr> definitions(Tokens& in);
+    std::optional<CODPtr> cod(Tokens& in);
+    std::optional<CODs> cods(Tokens& in);
+
+    // a fresh value for a datum
+    GCRef value(Datum* datum);
+    // a value as the datum that evaluates to it, nullptr if there is none
+    DatumPtr quote(const GCValue& value);
+    // Whether evaluating `cod` can make a procedure: it has a lambda, a
+    // named let that is not inlined, or a delay. Procedures point into the
+    // form they were made by, so only such forms must be kept once they
+    // are evaluated.
+    bool encloses(COD* cod);
   } // namespace expression
 
   using Program = expression::CODs;
@@ -284,11 +437,9 @@ namespace r5rs
   using Exp = expression::Exp;
   using Definition = expression::Definition;
 
-  ParserPtr<Token, std::shared_ptr<Datum>> datum();
-  ParserPtr<Token, std::shared_ptr<Exp>> exp();
-  ParserPtr<Token, Program> program();
-  ParserPtr<Token, std::shared_ptr<Definition>> definition();
-
+  // The forms of the tokens. Expressions, definitions and forms are parsed
+  // once at each position if the tokens memoize, which nested code where
+  // alternatives share a prefix, like cond clauses, needs.
   IStream<expression::CODPtr> ast(IStream<Token> input);
 } // namespace r5rs
 
@@ -0,0 +1,919 @@
+#include "Closure.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+#include "Lex.h"
+#include "Primitives.h"
+
+using namespace r5rs;
+using namespace r5rs::closure;
+using vm::Frame;
+
+namespace {
+  bool truthy(const GCValue& value) {
+    auto visitor = overloaded{
+        [](nullptr_t) -> bool { return false; },
+        [](bool b) -> bool { return b; },
+        [](auto&&) -> bool { return true; },
+    };
+    return std::visit(visitor, value);
+  }
+
+  std::runtime_error undefined(const std::string& name) {
+    return std::runtime_error("variable " + name + " is not defined!");
+  }
+
+  Frame* up(Frame* frame, uint32_t depth, uint32_t index) {
+    for (; depth; --depth) {
+      frame = frame->parent.get();
+    }
+    if (index >= frame->slots.size()) {
+      throw undefined((*frame->locals)[index]);
+    }
+    return frame;
+  }
+
+  bool bound(std::optional<GCRef>* slot, Primitive target) {
+    if (!*slot) {
+      return false;
+    }
+    auto primitive = std::get_if<Primitive>(&***slot);
+    return primitive && *primitive == target;
+  }
+
+  template <size_t... I>
+  std::array<GCRef, sizeof...(I)> evaluate(
+    const std::array<Code, sizeof...(I)>& ops, [[maybe_unused]] Frame* f,
+    std::index_sequence<I...>) {
+    return { ops[I](f)... };
+  }
+
+  // the operands of a call with more than three of them, kept on the
+  // evaluator's argument stack and popped on exit
+  class Operands {
+  public:
+    explicit Operands(std::vector<GCRef>& stack)
+      : stack(stack), base(stack.size()) {}
+    ~Operands() { stack.erase(stack.begin() + base, stack.end()); }
+
+    GCRef* data() { return stack.data() + base; }
+    size_t size() const { return stack.size() - base; }
+
+  private:
+    std::vector<GCRef>& stack;
+    size_t base;
+  };
+
+  template <size_t N>
+  std::array<Code, N> fix(std::vector<Code>& ops) {
+    return [&]<size_t... I>(std::index_sequence<I...>) {
+      return std::array<Code, N>{ std::move(ops[I])... };
+    }(std::make_index_sequence<N>());
+  }
+
+  // (op a ...) with N operands
+  template <bool Tail, size_t N>
+  Code call(Evaluator& evaluator, Code op, std::array<Code, N> ops) {
+    return [&evaluator, op = std::move(op), ops = std::move(ops)](
+      Frame* f) -> GCRef {
+        auto fn = op(f);
+        auto args = evaluate(ops, f, std::make_index_sequence<N>());
+        if constexpr (Tail) {
+          return evaluator.tail_call(fn, args.data(), N);
+        }
+        else {
+          return evaluator.call(fn, args.data(), N);
+        }
+      };
+  }
+
+  // (op a ...) with any number of operands
+  template <bool Tail>
+  Code call(Evaluator& evaluator, Code op, std::vector<Code> ops) {
+    return [&evaluator, op = std::move(op), ops = std::move(ops)](
+      Frame* f) -> GCRef {
+        auto fn = op(f);
+        Operands args(evaluator.stack);
+        for (auto&& code : ops) {
+          auto arg = code(f);
+          evaluator.stack.push_back(std::move(arg));
+        }
+        if constexpr (Tail) {
+          return evaluator.tail_call(fn, args.data(), args.size());
+        }
+        else {
+          return evaluator.call(fn, args.data(), args.size());
+        }
+      };
+  }
+
+  // calls the primitive an operator was bound to at compile time
+  struct Apply {
+    template <size_t N>
+    GCRef operator()(Primitive target, const std::array<GCRef, N>& args) const {
+      return std::invoke(target.fn, std::span<const GCRef>(args));
+    }
+  };
+
+  // evaluates one of the R5RS_BUILTIN primitives by its inline form
+  template <auto F> struct Inline {
+    template <size_t N>
+    GCRef operator()(Primitive, const std::array<GCRef, N>& args) const {
+      return std::apply(F, args);
+    }
+  };
+
+  // a fixnum comparison in the test of an if, without boxing its result
+  template <typename F, auto Generic> struct Compare {
+    bool operator()(Primitive, const std::array<GCRef, 2>& args) const {
+      auto x = std::get_if<int64_t>(&*args[0]);
+      auto y = std::get_if<int64_t>(&*args[1]);
+      if (x && y) {
+        return F()(*x, *y);
+      }
+      return truthy(*Generic(args));
+    }
+  };
+
+  // (op a ...) where op named a primitive at compile time; falls back to a
+  // generic call once the global is bound to something else
+  template <bool Tail, size_t N, typename Fast>
+  Code call(Evaluator& evaluator, std::optional<GCRef>* slot,
+    Primitive target, std::string name, std::array<Code, N> ops) {
+    return [&evaluator, slot, target, name = std::move(name),
+      ops = std::move(ops)](Frame* f) -> GCRef {
+        if (bound(slot, target)) {
+          auto args = evaluate(ops, f, std::make_index_sequence<N>());
+          return Fast()(target, args);
+        }
+        if (!*slot) {
+          throw undefined(name);
+        }
+        GCRef fn = **slot;
+        auto args = evaluate(ops, f, std::make_index_sequence<N>());
+        if constexpr (Tail) {
+          return evaluator.tail_call(fn, args.data(), N);
+        }
+        else {
+          return evaluator.call(fn, args.data(), N);
+        }
+      };
+  }
+
+  template <bool Tail, size_t N>
+  Code call(Evaluator& evaluator, Code op, std::optional<GCRef>* slot,
+    Primitive target, const std::string& name, std::vector<Code>& ops) {
+    if (target.fn) {
+      return call<Tail, N, Apply>(evaluator, slot, target, name, fix<N>(ops));
+    }
+    return call<Tail, N>(evaluator, std::move(op), fix<N>(ops));
+  }
+
+  template <size_t N, typename Fast>
+  Code call(Evaluator& evaluator, bool tail, std::optional<GCRef>* slot,
+    Primitive target, const std::string& name, std::vector<Code>& ops) {
+    if (tail) {
+      return call<true, N, Fast>(evaluator, slot, target, name, fix<N>(ops));
+    }
+    return call<false, N, Fast>(evaluator, slot, target, name, fix<N>(ops));
+  }
+
+  template <bool Tail>
+  Code call(Evaluator& evaluator, Code op, std::optional<GCRef>* slot,
+    Primitive target, const std::string& name, std::vector<Code>& ops) {
+    switch (ops.size()) {
+    case 0:
+      return call<Tail, 0>(evaluator, std::move(op), slot, target, name, ops);
+    case 1:
+      return call<Tail, 1>(evaluator, std::move(op), slot, target, name, ops);
+    case 2:
+      return call<Tail, 2>(evaluator, std::move(op), slot, target, name, ops);
+    case 3:
+      return call<Tail, 3>(evaluator, std::move(op), slot, target, name, ops);
+    default:
+      return call<Tail>(evaluator, std::move(op), std::move(ops));
+    }
+  }
+
+  // a primitive call used as the test of an if
+  template <size_t N, typename Fast>
+  Test test(std::optional<GCRef>* slot, Primitive target,
+    std::vector<Code>& operands, Code fallback) {
+    return [slot, target, ops = fix<N>(operands),
+      fallback = std::move(fallback)](Frame* f) -> bool {
+        if (!bound(slot, target)) {
+          return truthy(*fallback(f));
+        }
+        auto args = evaluate(ops, f, std::make_index_sequence<N>());
+        if constexpr (std::is_same_v<decltype(Fast()(target, args)), bool>) {
+          return Fast()(target, args);
+        }
+        else {
+          return truthy(*Fast()(target, args));
+        }
+      };
+  }
+} // namespace
+
+Code r5rs::closure::Compiler::compile(expression::COD* cod) {
+  scope = nullptr;
+  tail = false;
+  return std::invoke(*this, cod);
+}
+
+Code r5rs::closure::Compiler::operator()(expression::COD* cod) {
+  return std::visit(*this, cod->cod_type());
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Definition* def) {
+  return std::visit(*this, def->def_type());
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Exp* exp) {
+  return std::visit(*this, exp->exp_type());
+}
+
+Code r5rs::closure::Compiler::operator()(expression::CODs* cods) {
+  std::vector<Code> codes;
+  for (auto&& cod : cods->cods) {
+    codes.push_back(std::invoke(*this, cod.get()));
+  }
+  return [codes = std::move(codes), nil = evaluator.nil](Frame* f) {
+    GCRef res = nil;
+    for (auto&& code : codes) {
+      res = code(f);
+    }
+    return res;
+  };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Define* def) {
+  auto t = tail;
+  tail = false;
+  auto value = std::invoke(*this, def->exp.get());
+  tail = t;
+
+  if (!scope) {
+    auto slot =
+      &evaluator.globals.values[evaluator.globals.intern(def->variable)];
+    return [slot, name = def->variable, value = std::move(value),
+      nil = evaluator.nil](Frame* f) -> GCRef {
+        if (*slot) {
+          throw std::runtime_error("redefine variable '" + name + "'!");
+        }
+        *slot = value(f);
+        return nil;
+      };
+  }
+
+  auto index = scope->find(def->variable)->index;
+  return [index, value = std::move(value), nil = evaluator.nil](
+    Frame* f) -> GCRef {
+      f->define(index, value(f));
+      return nil;
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Definitions* defs) {
+  std::vector<Code> codes;
+  for (auto&& def : defs->defs) {
+    codes.push_back(std::invoke(*this, def.get()));
+  }
+  return [codes = std::move(codes), nil = evaluator.nil](Frame* f) {
+    for (auto&& code : codes) {
+      code(f);
+    }
+    return nil;
+  };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Variable* var) {
+  auto address = scope ? scope->find(var->id) : std::nullopt;
+  if (!address) {
+    auto slot = &evaluator.globals.values[evaluator.globals.intern(var->id)];
+    return [slot, name = var->id](Frame*) -> GCRef {
+      if (!*slot) {
+        throw undefined(name);
+      }
+      return **slot;
+    };
+  }
+  if (address->depth == 0) {
+    return [index = address->index](Frame* f) -> GCRef {
+      if (index >= f->slots.size()) {
+        throw undefined((*f->locals)[index]);
+      }
+      return f->slots[index];
+    };
+  }
+  return [address = *address](Frame* f) -> GCRef {
+    return up(f, address.depth, address.index)->slots[address.index];
+  };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Literal* literal) {
+  return [value = literal->constant()](Frame*) { return value; };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Call* call) {
+  auto loop = std::find_if(loops.rbegin(), loops.rend(),
+    [&](const Loop& loop) { return loop.let == call->loop; });
+  if (loop != loops.rend()) {
+    // operands may hold loops of their own, so copy this one first
+    auto slots = loop->slots;
+    auto again = loop->again;
+    auto t = tail;
+    tail = false;
+    std::vector<Code> ops;
+    for (auto&& operand : call->operands) {
+      ops.push_back(std::invoke(*this, operand.get()));
+    }
+    tail = t;
+    // the operands are all evaluated before any variable changes
+    return [&evaluator = evaluator, ops = std::move(ops),
+      slots = std::move(slots), again](Frame* f) -> GCRef {
+        Operands args(evaluator.stack);
+        for (auto&& code : ops) {
+          auto arg = code(f);
+          evaluator.stack.push_back(std::move(arg));
+        }
+        for (size_t i = 0; i != slots.size(); ++i) {
+          f->slots[slots[i]] = args.data()[i];
+        }
+        return again;
+      };
+  }
+
+  auto t = tail;
+  tail = false;
+  auto op = std::invoke(*this, call->op.get());
+  std::vector<Code> ops;
+  for (auto&& operand : call->operands) {
+    ops.push_back(std::invoke(*this, operand.get()));
+  }
+  tail = t;
+
+  std::optional<GCRef>* slot = nullptr;
+  auto target = primitive(call->op.get(), ops.size(), slot);
+  auto name = target.fn ? std::get<expression::Variable*>(call->op->exp_type())->id
+                     : std::string();
+
+  if (target.fn) {
+#define R5RS_BUILTIN_ACCESS(id, n)                                             \
+    if (target.fn == &r5rs::primitive::id && ops.size() == n) {                \
+      using Fast = Inline<&r5rs::primitive::inlined::id>;                      \
+      return ::call<n, Fast>(evaluator, tail, slot, target, name, ops);        \
+    }
+    R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+  }
+
+  if (tail) {
+    return ::call<true>(evaluator, std::move(op), slot, target, name, ops);
+  }
+  return ::call<false>(evaluator, std::move(op), slot, target, name, ops);
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Lambda* lambda) {
+  auto res = std::make_unique<closure::Lambda>();
+  res->fixed = lambda->formals->fixed.size();
+  res->rest = lambda->formals->binding.has_value();
+
+  vm::Scope inner(scope);
+  for (auto&& name : lambda->formals->fixed) {
+    inner.names.push_back(name);
+  }
+  if (lambda->formals->binding) {
+    inner.names.push_back(*lambda->formals->binding);
+  }
+
+  auto s = scope;
+  auto t = tail;
+  scope = &inner;
+  tail = true;
+
+  res->body = std::invoke(*this, lambda->body.get());
+  res->locals = inner.names;
+
+  scope = s;
+  tail = t;
+
+  auto ptr = res.get();
+  evaluator.lambdas.push_back(std::move(res));
+  return [ptr](Frame* f) -> GCRef {
+    return ClosureCompiled{ ptr, f ? f->shared_from_this() : nullptr };
+  };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Conditional* condition) {
+  auto t = tail;
+  tail = false;
+  auto check = test(condition->test.get());
+  tail = t;
+
+  auto consequent = std::invoke(*this, condition->consequent.get());
+  if (!condition->alternate) {
+    return [check = std::move(check), consequent = std::move(consequent),
+      nil = evaluator.nil](Frame* f) -> GCRef {
+        return check(f) ? consequent(f) : nil;
+      };
+  }
+
+  auto alternate = std::invoke(*this, condition->alternate.get());
+  return [check = std::move(check), consequent = std::move(consequent),
+    alternate = std::move(alternate)](Frame* f) -> GCRef {
+      return check(f) ? consequent(f) : alternate(f);
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Assignment* assign) {
+  auto t = tail;
+  tail = false;
+  auto value = std::invoke(*this, assign->exp.get());
+  tail = t;
+
+  auto nil = evaluator.nil;
+  auto address = scope ? scope->find(assign->variable) : std::nullopt;
+  if (!address) {
+    auto slot =
+      &evaluator.globals.values[evaluator.globals.intern(assign->variable)];
+    return [slot, value = std::move(value), nil](Frame* f) -> GCRef {
+      if (!*slot) {
+        throw std::runtime_error("variable not found");
+      }
+      **slot = value(f);
+      return nil;
+    };
+  }
+  return [address = *address, value = std::move(value), nil](
+    Frame* f) -> GCRef {
+      auto res = value(f);
+      up(f, address.depth, address.index)->slots[address.index] = res;
+      return nil;
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::And* conjunction) {
+  auto&& exps = conjunction->exps;
+  if (exps.empty()) {
+    return [value = GCRef(true)](Frame*) { return value; };
+  }
+
+  auto t = tail;
+  tail = false;
+  std::vector<Code> codes;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    codes.push_back(std::invoke(*this, it->get()));
+  }
+  tail = t;
+  auto last = std::invoke(*this, back->get());
+
+  return [codes = std::move(codes), last = std::move(last)](
+    Frame* f) -> GCRef {
+      for (auto&& code : codes) {
+        auto value = code(f);
+        if (!truthy(*value)) {
+          return value;
+        }
+      }
+      return last(f);
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Or* disjunction) {
+  auto&& exps = disjunction->exps;
+  if (exps.empty()) {
+    return [value = GCRef(false)](Frame*) { return value; };
+  }
+
+  auto t = tail;
+  tail = false;
+  std::vector<Code> codes;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    codes.push_back(std::invoke(*this, it->get()));
+  }
+  tail = t;
+  auto last = std::invoke(*this, back->get());
+
+  return [codes = std::move(codes), last = std::move(last)](
+    Frame* f) -> GCRef {
+      for (auto&& code : codes) {
+        auto value = code(f);
+        if (truthy(*value)) {
+          return value;
+        }
+      }
+      return last(f);
+    };
+}
+
+// A clause with expressions only needs its test to be true or false; one
+// without them needs the value.
+Code r5rs::closure::Compiler::operator()(expression::Cond* cond) {
+  struct Clause {
+    Test check;
+    Code value;
+    Code body;
+    Code receiver;
+  };
+
+  std::vector<Clause> clauses;
+  auto t = tail;
+  Code otherwise = sequence({});
+  for (auto&& clause : cond->clauses) {
+    if (!clause.test) {
+      otherwise = sequence(clause.exps);
+      break;
+    }
+    Clause res;
+    tail = false;
+    if (clause.exps.empty()) {
+      res.value = std::invoke(*this, clause.test.get());
+    }
+    else {
+      res.check = test(clause.test.get());
+    }
+    if (clause.receiver) {
+      res.receiver = std::invoke(*this, clause.receiver.get());
+    }
+    tail = t;
+    if (!clause.exps.empty()) {
+      res.body = sequence(clause.exps);
+    }
+    clauses.push_back(std::move(res));
+  }
+
+  return [&evaluator = evaluator, clauses = std::move(clauses),
+    otherwise = std::move(otherwise), t](Frame* f) -> GCRef {
+      for (auto&& clause : clauses) {
+        if (clause.check) {
+          if (clause.check(f)) {
+            return clause.body(f);
+          }
+          continue;
+        }
+        auto value = clause.value(f);
+        if (!truthy(*value)) {
+          continue;
+        }
+        if (!clause.receiver) {
+          return value;
+        }
+        auto fn = clause.receiver(f);
+        return t ? evaluator.tail_call(fn, &value, 1)
+                 : evaluator.call(fn, &value, 1);
+      }
+      return otherwise(f);
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Case* selection) {
+  auto t = tail;
+  tail = false;
+  auto key = std::invoke(*this, selection->key.get());
+  tail = t;
+
+  std::vector<Code> bodies;
+  for (auto&& clause : selection->clauses) {
+    bodies.push_back(sequence(clause.exps));
+  }
+  auto otherwise = sequence(selection->otherwise);
+
+  return [key = std::move(key), dispatch = selection->dispatch,
+    bodies = std::move(bodies), otherwise = std::move(otherwise)](
+      Frame* f) -> GCRef {
+      auto i = (*dispatch)(*key(f));
+      return i < bodies.size() ? bodies[i](f) : otherwise(f);
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Let* let) {
+  if (!let->inlined) {
+    return std::invoke(*this, let->core.get());
+  }
+  if (!scope) {
+    return function_of(let);
+  }
+
+  // the variables take new slots of this frame, each bound as soon as its
+  // init is evaluated since no init can see them
+  std::vector<Code> inits;
+  std::vector<uint32_t> slots;
+  auto t = tail;
+  tail = false;
+  for (auto&& init : let->inits) {
+    inits.push_back(std::invoke(*this, init.get()));
+    slots.push_back(scope->names.size());
+    scope->names.emplace_back();
+  }
+  tail = t;
+
+  auto slot = slots.begin();
+  for (auto&& name : let->lambda->formals->fixed) {
+    scope->names[*slot++] = name;
+  }
+  GCRef again = nullptr;
+  if (let->name) {
+    again = Symbol{ "#<loop " + *let->name + ">" };
+    loops.push_back({ let, slots, again });
+  }
+  auto body = sequence(let->lambda->body->exps);
+  if (let->name) {
+    loops.pop_back();
+  }
+  for (auto&& slot : slots) {
+    scope->unbind(slot);
+  }
+
+  if (!let->name) {
+    return [inits = std::move(inits), slots = std::move(slots),
+      body = std::move(body)](Frame* f) -> GCRef {
+        for (size_t i = 0; i != slots.size(); ++i) {
+          f->define(slots[i], inits[i](f));
+        }
+        return body(f);
+      };
+  }
+  return [inits = std::move(inits), slots = std::move(slots),
+    body = std::move(body), again](Frame* f) -> GCRef {
+      for (size_t i = 0; i != slots.size(); ++i) {
+        f->define(slots[i], inits[i](f));
+      }
+      while (true) {
+        auto res = body(f);
+        if (res.obj != again.obj) {
+          return res;
+        }
+      }
+    };
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Do* loop) {
+  return std::invoke(*this, loop->loop.get());
+}
+
+Code r5rs::closure::Compiler::operator()(expression::Body* body) {
+  if (body->exps.empty()) {
+    throw std::runtime_error("empty body!");
+  }
+
+  for (auto&& def : body->defs) {
+    scope->declare(def.get());
+  }
+
+  auto t = tail;
+  tail = false;
+  std::vector<Code> codes;
+  for (auto&& def : body->defs) {
+    codes.push_back(std::invoke(*this, def.get()));
+  }
+  tail = t;
+  auto rest = sequence(body->exps);
+
+  if (codes.empty()) {
+    return rest;
+  }
+  return [codes = std::move(codes), rest = std::move(rest)](Frame* f) {
+    for (auto&& code : codes) {
+      code(f);
+    }
+    return rest(f);
+  };
+}
+
+// Calls a procedure of no arguments with `exp` as its body, which gives an
+// inlined let at top level a frame for its variables.
+Code r5rs::closure::Compiler::function_of(expression::Exp* exp) {
+  auto res = std::make_unique<closure::Lambda>();
+
+  vm::Scope inner;
+  auto s = scope;
+  auto t = tail;
+  scope = &inner;
+  tail = true;
+
+  res->body = std::invoke(*this, exp);
+  res->locals = inner.names;
+
+  scope = s;
+  tail = t;
+
+  GCRef closure = ClosureCompiled{ res.get(), nullptr };
+  evaluator.lambdas.push_back(std::move(res));
+  if (tail) {
+    return [&evaluator = evaluator, closure](Frame*) -> GCRef {
+      return evaluator.tail_call(closure, nullptr, 0);
+    };
+  }
+  return [&evaluator = evaluator, closure](Frame*) -> GCRef {
+    return evaluator.call(closure, nullptr, 0);
+  };
+}
+
+// `exps` in order with the value of the last, nil if there are none
+Code r5rs::closure::Compiler::sequence(
+  const std::list<expression::ExpPtr>& exps) {
+  if (exps.empty()) {
+    return [nil = evaluator.nil](Frame*) { return nil; };
+  }
+
+  auto t = tail;
+  tail = false;
+  std::vector<Code> codes;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    codes.push_back(std::invoke(*this, it->get()));
+  }
+  tail = t;
+  auto last = std::invoke(*this, back->get());
+
+  if (codes.empty()) {
+    return last;
+  }
+  return [codes = std::move(codes), last = std::move(last)](Frame* f) {
+    for (auto&& code : codes) {
+      code(f);
+    }
+    return last(f);
+  };
+}
+
+Test r5rs::closure::Compiler::test(expression::Exp* exp) {
+  auto type = exp->exp_type();
+  auto call = std::get_if<expression::Call*>(&type);
+  std::optional<GCRef>* slot = nullptr;
+  auto target = call && (*call)->operands.size() <= 3
+    ? primitive((*call)->op.get(), (*call)->operands.size(), slot)
+    : Primitive{};
+  if (target.fn) {
+    auto fallback = std::invoke(*this, exp);
+    std::vector<Code> ops;
+    for (auto&& operand : (*call)->operands) {
+      ops.push_back(std::invoke(*this, operand.get()));
+    }
+    if (ops.size() == 2) {
+#define R5RS_COMPARE(id, F)                                                    \
+      if (target.fn == &r5rs::primitive::id) {                                 \
+        return ::test<2, Compare<F, &r5rs::primitive::id>>(slot, target, ops,  \
+          std::move(fallback));                                                \
+      }
+      R5RS_COMPARE(less, std::less<int64_t>)
+      R5RS_COMPARE(greater, std::greater<int64_t>)
+      R5RS_COMPARE(equal, std::equal_to<int64_t>)
+      R5RS_COMPARE(eqv, std::equal_to<int64_t>)
+#undef R5RS_COMPARE
+    }
+#define R5RS_BUILTIN_ACCESS(id, n)                                             \
+    if (target.fn == &r5rs::primitive::id && ops.size() == n) {                \
+      using Fast = Inline<&r5rs::primitive::inlined::id>;                      \
+      return ::test<n, Fast>(slot, target, ops, std::move(fallback));          \
+    }
+    R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+    switch (ops.size()) {
+    case 0:
+      return ::test<0, Apply>(slot, target, ops, std::move(fallback));
+    case 1:
+      return ::test<1, Apply>(slot, target, ops, std::move(fallback));
+    case 2:
+      return ::test<2, Apply>(slot, target, ops, std::move(fallback));
+    default:
+      return ::test<3, Apply>(slot, target, ops, std::move(fallback));
+    }
+  }
+
+  auto code = std::invoke(*this, exp);
+  return [code = std::move(code)](Frame* f) { return truthy(*code(f)); };
+}
+
+// The primitive a global operator is bound to right now, if any, and if it
+// accepts `n` arguments; calls to it then skip the arity check.
+Primitive r5rs::closure::Compiler::primitive(expression::Exp* op, size_t n,
+  std::optional<GCRef>*& slot) {
+  auto type = op->exp_type();
+  auto var = std::get_if<expression::Variable*>(&type);
+  if (!var || (scope && scope->find((*var)->id))) {
+    return {};
+  }
+  slot = &evaluator.globals.values[evaluator.globals.intern((*var)->id)];
+  if (!*slot) {
+    return {};
+  }
+  auto primitive = std::get_if<Primitive>(&***slot);
+  if (!primitive ||
+    (primitive->arity != Primitive::variadic && primitive->arity != n)) {
+    return {};
+  }
+  return *primitive;
+}
+
+r5rs::closure::Evaluator::Evaluator(const Env& env) {
+  // only the primitives carry over; the library is evaluated again here
+  for (auto&& [name, value] : env.variables) {
+    if (std::holds_alternative<Primitive>(*value)) {
+      globals.values[globals.intern(name)] = value;
+    }
+  }
+
+  auto stream = ast(tokens(primitive::library));
+  Try<expression::CODPtr> cod;
+  while ((cod = stream[0])) {
+    (*this)(cod->get());
+    stream += 1;
+  }
+}
+
+GCRef r5rs::closure::Evaluator::operator()(expression::COD* cod) {
+  return compiler.compile(cod)(nullptr);
+}
+
+GCRef r5rs::closure::Evaluator::call(const GCRef& op, GCRef* args, size_t n) {
+  if (auto primitive = std::get_if<Primitive>(&*op)) {
+    primitive->check(n);
+    return std::invoke(primitive->fn, std::span<const GCRef>(args, n));
+  }
+  if (auto closure = std::get_if<ClosureCompiled>(&*op)) {
+    auto callee = bind(*closure, args, n);
+    // the frame holds the arguments now; the caller letting go of them lets
+    // a callee looping by tail calls drop the ones it is done with, such as
+    // the head of a stream
+    std::fill(args, args + n, nil);
+    return run(closure->lambda, std::move(callee));
+  }
+  throw std::runtime_error("expression is not a function");
+}
+
+GCRef r5rs::closure::Evaluator::tail_call(const GCRef& op, GCRef* args,
+  size_t n) {
+  if (auto primitive = std::get_if<Primitive>(&*op)) {
+    primitive->check(n);
+    return std::invoke(primitive->fn, std::span<const GCRef>(args, n));
+  }
+  if (auto closure = std::get_if<ClosureCompiled>(&*op)) {
+    frame = bind(*closure, args, n);
+    next = closure->lambda;
+    return tail;
+  }
+  throw std::runtime_error("expression is not a function");
+}
+
+// Runs `lambda` and every closure it tail calls in this loop, so tail calls
+// do not grow the C++ stack.
+GCRef r5rs::closure::Evaluator::run(const Lambda* lambda,
+  std::shared_ptr<vm::Frame> current) {
+  while (true) {
+    auto res = lambda->body(current.get());
+    release(std::move(current));
+    if (!pending(res)) {
+      return res;
+    }
+    lambda = next;
+    current = std::move(frame);
+  }
+}
+
+std::shared_ptr<vm::Frame> r5rs::closure::Evaluator::bind(
+  const ClosureCompiled& closure, GCRef* args, size_t n) {
+  auto lambda = closure.lambda;
+  if (n < lambda->fixed) {
+    throw std::runtime_error("Insufficient number of parameters");
+  }
+  if (!lambda->rest && n > lambda->fixed) {
+    throw std::runtime_error("redundant arguments");
+  }
+
+  std::shared_ptr<vm::Frame> res;
+  if (frames.empty()) {
+    res = std::make_shared<vm::Frame>();
+  }
+  else {
+    res = std::move(frames.back());
+    frames.pop_back();
+  }
+  res->parent = closure.frame;
+  res->locals = &lambda->locals;
+  res->slots.reserve(lambda->locals.size());
+  res->slots.insert(res->slots.end(), args, args + lambda->fixed);
+
+  if (lambda->rest) {
+    GCRef head = nullptr;
+    for (auto it = args + n; it != args + lambda->fixed; --it) {
+      head = Pair{ *std::prev(it), head };
+    }
+    res->slots.push_back(std::move(head));
+  }
+  return res;
+}
+
+void r5rs::closure::Evaluator::release(std::shared_ptr<vm::Frame> frame) {
+  if (!frame || frame.use_count() != 1) {
+    return;
+  }
+  frame->parent = nullptr;
+  frame->slots.clear();
+  frames.push_back(std::move(frame));
+}
@@ -0,0 +1,120 @@
+#ifndef R5RS_CLOSURE_H
+#define R5RS_CLOSURE_H
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "Env.h"
+#include "Expressions.h"
+#include "Frame.h"
+#include "GC.h"
+
+namespace r5rs {
+  namespace closure {
+    class Evaluator;
+
+    // An expression compiled to a C++ callable that evaluates it in a frame.
+    using Code = std::function<GCRef(vm::Frame*)>;
+    using Test = std::function<bool(vm::Frame*)>;
+
+    struct Lambda {
+      size_t fixed = 0;
+      bool rest = false;
+      std::vector<std::string> locals;
+      Code body;
+    };
+
+    // Converts each node once into a Code specialised for its shape: variables
+    // become frame slot or global addresses, calls are split by operand count
+    // and calls to a primitive bound at compile time skip the operator lookup.
+    class Compiler {
+    public:
+      explicit Compiler(Evaluator& evaluator) : evaluator(evaluator) {}
+
+      Code compile(expression::COD* cod);
+
+      // forward
+      Code operator()(expression::COD*);
+      Code operator()(expression::Definition*);
+      Code operator()(expression::Exp*);
+
+      // cods
+      Code operator()(expression::CODs*);
+
+      // Definition
+      Code operator()(expression::Define*);
+      Code operator()(expression::Definitions*);
+
+      // Exp
+      Code operator()(expression::Variable*);
+      Code operator()(expression::Literal*);
+      Code operator()(expression::Call*);
+      Code operator()(expression::Lambda*);
+      Code operator()(expression::Conditional*);
+      Code operator()(expression::Assignment*);
+      Code operator()(expression::And*);
+      Code operator()(expression::Or*);
+      Code operator()(expression::Cond*);
+      Code operator()(expression::Case*);
+      Code operator()(expression::Let*);
+      Code operator()(expression::Do*);
+
+      Code operator()(expression::Body*);
+
+    private:
+      // an inlined named let being compiled: the slots of its variables and
+      // what its iterations return to the loop after rebinding them
+      struct Loop {
+        expression::Let* let;
+        std::vector<uint32_t> slots;
+        GCRef again;
+      };
+
+      Test test(expression::Exp* exp);
+      Code sequence(const std::list<expression::ExpPtr>& exps);
+      Code function_of(expression::Exp* exp);
+      Primitive primitive(expression::Exp* op, size_t n,
+        std::optional<GCRef>*& slot);
+
+      Evaluator& evaluator;
+      vm::Scope* scope = nullptr;
+      bool tail = false;
+      std::vector<Loop> loops;
+    };
+
+    class Evaluator {
+    public:
+      explicit Evaluator(const Env& env);
+
+      GCRef operator()(expression::COD* cod);
+
+      GCRef call(const GCRef& op, GCRef* args, size_t n);
+      GCRef tail_call(const GCRef& op, GCRef* args, size_t n);
+
+      bool pending(const GCRef& value) const { return value.obj == tail.obj; }
+
+      vm::Globals globals;
+      std::vector<std::unique_ptr<Lambda>> lambdas;
+      std::vector<GCRef> stack;
+      GCRef nil = nullptr;
+
+    private:
+      GCRef run(const Lambda* lambda, std::shared_ptr<vm::Frame> frame);
+      std::shared_ptr<vm::Frame> bind(const ClosureCompiled& closure,
+        GCRef* args, size_t n);
+      void release(std::shared_ptr<vm::Frame> frame);
+
+      Compiler compiler{ *this };
+
+      // returned by a call in tail position after it stored its callee here
+      GCRef tail = Symbol{ "#<tail call>" };
+      const Lambda* next = nullptr;
+      std::shared_ptr<vm::Frame> frame;
+
+      std::vector<std::shared_ptr<vm::Frame>> frames;
+    };
+  } // namespace closure
+} // namespace r5rs
+
+#endif
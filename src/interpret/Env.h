@@ -6,6 +6,7 @@
 
 #include "Expressions.h"
 #include "GC.h"
+#include "Metrics.h"
 #include "Type.h"
 
 namespace r5rs {
@@ -13,12 +14,15 @@ namespace r5rs {
   public:
     std::shared_ptr<Env> parent = nullptr;
     std::unordered_map<std::string, GCRef> variables;
-    explicit Env(std::shared_ptr<Env> parent = nullptr) : parent(parent) {}
+    explicit Env(std::shared_ptr<Env> parent = nullptr) : parent(parent) {
+      metrics::framed();
+    }
 
     explicit Env(const expression::Formals& formals,
-      const std::list<GCRef>& args,
+      std::span<const GCRef> args,
       std::shared_ptr<Env> parent = nullptr)
       : parent(parent) {
+      metrics::framed();
       if (args.size() < formals.fixed.size()) {
         throw std::runtime_error("Insufficient number of parameters");
       }
@@ -46,6 +50,18 @@ namespace r5rs {
 
     void set(const std::string& var, GCRef val) { variables[var] = val; }
 
+    // rebinds the variable where it is bound, false if it is not
+    bool assign(const std::string& var, GCRef val) {
+      for (auto env = this; env; env = env->parent.get()) {
+        auto it = env->variables.find(var);
+        if (it != env->variables.end()) {
+          it->second = val;
+          return true;
+        }
+      }
+      return false;
+    }
+
     std::optional<GCRef> get(const std::string& var) {
       auto it = variables.find(var);
       if (it != variables.end()) {
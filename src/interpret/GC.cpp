@@ -3,6 +3,7 @@
 #include <cstdlib>
 
 #include "GetRef.h"
+#include "Trace.h"
 
 using namespace r5rs;
 
@@ -11,7 +12,8 @@ void r5rs::GC::ref(GC *obj) { obj->inc(); }
 void r5rs::GC::unref(GC *obj) {
   obj->dec();
 
-  if (obj->count() == 0) {
+  // another thread's object is left to its owner's next collection
+  if (obj->count() == 0 && obj->local()) {
     rem(obj);
     obj->~GC();
     std::free(obj);
@@ -46,8 +48,15 @@ void r5rs::GC::sweep_objects() {
 }
 
 void r5rs::GC::mark_and_sweep() {
+  // references dropped by the objects a sweep frees do not start another
+  if (collecting) {
+    return;
+  }
+  collecting = true;
+  trace::Span span("gc");
   mark_objects();
   sweep_objects();
+  collecting = false;
   auto new_size = GC::size + GC::size / 2;
   GC::capacity = std::max(new_size, GC::capacity);
 }
@@ -96,7 +105,7 @@ InternalGCRef &r5rs::InternalGCRef::operator=(nullptr_t) {
 }
 
 void r5rs::InternalGCRef::mark() {
-  if (!obj->is_marked()) {
+  if (!obj->is_marked() && obj->local()) {
     obj->mark();
     for (auto &&child : std::visit(GetRef(), obj->value)) {
       child->mark();
@@ -106,6 +115,12 @@ void r5rs::InternalGCRef::mark() {
 
 GCRef::~GCRef() {
   rem(this);
+  // drop the reference first: a collection would not see it as a root and
+  // could free the object under it
+  if (obj) {
+    GC::unref(obj);
+    obj = nullptr;
+  }
   if (GC::size > GC::capacity) {
     GC::mark_and_sweep();
   }
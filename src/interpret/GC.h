@@ -51,12 +51,35 @@ namespace r5rs {
   static_assert(std::is_copy_constructible_v<InternalGCRef>);
   static_assert(std::is_copy_assignable_v<InternalGCRef>);
 
+  // A promise refers to its (done . value) box, where the value is a thunk
+  // until it is forced. Forcing a delay-force gives the promise its thunk
+  // returned the same box, so the result is remembered for both.
+  class Promise {
+  public:
+    InternalGCRef box;
+  };
+
+  // an error object, as raised by error and by failing primitives and
+  // calls, with the list of irritants error was given
+  class Condition {
+  public:
+    std::string message;
+    InternalGCRef irritants;
+  };
+
   class GC final : public List<GC> {
     friend class InternalGCRef;
     friend class GCRef;
 
     constexpr inline static unsigned MARK = 1 << 31;
-    inline static size_t capacity = 0x10;
+    inline static thread_local size_t capacity = 0x10;
+    inline static thread_local bool collecting = false;
+
+    // Every object records the heap of the thread that made it. A thread
+    // marks and frees only its own, so one that reads another's objects,
+    // such as a pool worker running a future, never collects them.
+    inline static thread_local uint32_t heap = 0;
+    inline static std::atomic_uint32_t heaps = 0;
 
   public:
     static void mark_and_sweep();
@@ -64,7 +87,7 @@ namespace r5rs {
     template <typename T>
     explicit GC(T&& value)
       requires std::is_nothrow_constructible_v<GCValue, T>
-    : value{ std::forward<T>(value) }, mask{ 0 } {}
+    : value{ std::forward<T>(value) }, mask{ 0 }, owner{ heap } {}
 
   private:
   public:
@@ -78,6 +101,8 @@ namespace r5rs {
     static void ref(GC* obj);
     static void unref(GC* obj);
 
+    bool local() const { return owner == heap; }
+
     bool is_marked() const { return mask & MARK; }
     void mark() { mask |= MARK; }
     void unmark() { mask &= ~MARK; }
@@ -95,6 +120,7 @@ namespace r5rs {
   public:
     GCValue value;
     std::atomic_uint32_t mask;
+    uint32_t owner;
   };
 
   class GCRef : public InternalGCRef, public List<GCRef> {
@@ -129,6 +155,9 @@ namespace r5rs {
   GC* GC::gc(T&& value)
     requires std::is_nothrow_constructible_v<GCValue, T>
   {
+    if (!heap) {
+      heap = ++heaps;
+    }
     auto obj = static_cast<GC*>(std::malloc(sizeof(GC)));
     new (obj) GC(std::forward<T>(value));
     add(obj);
@@ -50,11 +50,45 @@ r5rs::GetRef::operator()(std::vector<InternalGCRef>& value) {
   return children;
 }
 
+std::vector<InternalGCRef*> r5rs::GetRef::operator()(Promise& promise) {
+  return std::vector<InternalGCRef*>{ &promise.box };
+}
+
+// a future keeps what it runs as roots until it is done with them
+std::vector<InternalGCRef*> r5rs::GetRef::operator()(const Future& future) {
+  return std::vector<InternalGCRef*>();
+}
+
 std::vector<InternalGCRef*>
 r5rs::GetRef::operator()(ClosureLambda lambda) {
   return std::vector<InternalGCRef*>();
 }
 
+std::vector<InternalGCRef*>
+r5rs::GetRef::operator()(const ClosureFunction& closure) {
+  return std::vector<InternalGCRef*>();
+}
+
+std::vector<InternalGCRef*>
+r5rs::GetRef::operator()(const ClosureCompiled& closure) {
+  return std::vector<InternalGCRef*>();
+}
+
+std::vector<InternalGCRef*>
+r5rs::GetRef::operator()(const Continuation& k) {
+  return std::vector<InternalGCRef*>();
+}
+
+// the values and threads waiting in a channel are roots until received
+std::vector<InternalGCRef*>
+r5rs::GetRef::operator()(const Channel& channel) {
+  return std::vector<InternalGCRef*>();
+}
+
+std::vector<InternalGCRef*> r5rs::GetRef::operator()(Condition& condition) {
+  return std::vector<InternalGCRef*>{ &condition.irritants };
+}
+
 std::vector<InternalGCRef*> r5rs::GetRef::operator()(Primitive primitive) {
   return std::vector<InternalGCRef*>();
 }
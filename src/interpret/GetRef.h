@@ -20,7 +20,14 @@ namespace r5rs {
     std::vector<InternalGCRef*> operator()(Pair& value);
     std::vector<InternalGCRef*>
       operator()(std::vector<InternalGCRef>& value);
+    std::vector<InternalGCRef*> operator()(Promise& promise);
+    std::vector<InternalGCRef*> operator()(const Future& future);
     std::vector<InternalGCRef*> operator()(ClosureLambda lambda);
+    std::vector<InternalGCRef*> operator()(const ClosureFunction& closure);
+    std::vector<InternalGCRef*> operator()(const ClosureCompiled& closure);
+    std::vector<InternalGCRef*> operator()(const Continuation& k);
+    std::vector<InternalGCRef*> operator()(const Channel& channel);
+    std::vector<InternalGCRef*> operator()(Condition& condition);
     std::vector<InternalGCRef*> operator()(Primitive primitive);
   };
 } // namespace r5rs
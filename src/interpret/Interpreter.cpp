@@ -1,152 +1,105 @@
 #include "Interpreter.h"
 
-#include <fstream>
+#include <algorithm>
+#include <tuple>
+#include <utility>
+
+#include "Future.h"
+#include "Lex.h"
+#include "Metrics.h"
+#include "Primitives.h"
+#include "Profiler.h"
+#include "Trace.h"
 
 using namespace r5rs;
 using namespace expression;
 
 namespace {
-  template <size_t n> void check_num(std::list<GCRef>& args) {
-    if (args.size() != n) {
-      throw std::runtime_error("Argument number error!");
-    }
-  }
-
-  template <typename T> void check_type(GCRef arg) {
-    if (!std::holds_alternative<T>(*arg)) {
-      throw std::runtime_error("Argument type error!");
-    }
-  }
-
-  template <typename T> T cast(GCRef arg) {
-    if (!std::holds_alternative<T>(*arg)) {
-      throw std::runtime_error("Argument type error!");
-    }
-    return std::get<T>(*arg);
-  }
-
-  template <size_t I> GCRef index(std::list<GCRef>& args) {
-    auto it = args.begin();
-    std::advance(it, I);
-    return *it;
-  }
-
-  GCRef add(std::list<GCRef>& args) {
-    int64_t sum = 0;
-    for (auto&& arg : args) {
-      sum += cast<int64_t>(arg);
-    }
-    return sum;
-  }
-
-  GCRef mul(std::list<GCRef>& args) {
-    int64_t prod = 1;
-    for (auto&& arg : args) {
-      prod *= cast<int64_t>(arg);
-    }
-    return prod;
-  }
-
-  GCRef is_empty(std::list<GCRef>& args) {
-    check_num<1>(args);
-    if (std::holds_alternative<nullptr_t>(*index<0>(args))) {
-      return true;
-    }
-    return false;
-  }
-
-  GCRef cons(std::list<GCRef>& args) {
-    check_num<2>(args);
-    return Pair{ index<0>(args), index<1>(args) };
-  }
-
-  GCRef car(std::list<GCRef>& args) {
-    check_num<1>(args);
-    return cast<Pair>(index<0>(args)).first;
-  }
-
-  GCRef cdr(std::list<GCRef>& args) {
-    check_num<1>(args);
-    return cast<Pair>(index<0>(args)).second;
-  }
-
-  GCRef Or(std::list<GCRef>& args) {
+  bool truthy(const GCValue& value) {
     auto visitor = overloaded{
         [](nullptr_t) -> bool { return false; },
         [](bool b) -> bool { return b; },
         [](auto&&) -> bool { return true; },
     };
-    for (auto&& arg : args) {
-      if (std::visit(visitor, *arg)) {
-        return true;
-      }
-    }
-    return false;
+    return std::visit(visitor, value);
   }
 
-  GCRef And(std::list<GCRef>& args) {
-    auto visitor = overloaded{
-        [](nullptr_t) -> bool { return false; },
-        [](bool b) -> bool { return b; },
-        [](auto&&) -> bool { return true; },
-    };
-    for (auto&& arg : args) {
-      if (!std::visit(visitor, *arg)) {
-        return false;
-      }
+  // why a closure with `formals` cannot take `n` arguments, if it cannot
+  const char* mismatch(const Formals& formals, size_t n) {
+    if (n < formals.fixed.size()) {
+      return "Insufficient number of parameters";
+    }
+    if (!formals.binding && n > formals.fixed.size()) {
+      return "redundant arguments";
     }
-    return true;
+    return nullptr;
   }
 
-  GCRef eqv(std::list<GCRef>& args) {
-    check_num<2>(args);
-    return cast<int64_t>(index<0>(args)) == cast<int64_t>(index<1>(args));
+  // the expressions tail() evaluates, and counts, itself
+  bool compound(const Exp::exp_t& type) {
+    return !std::holds_alternative<Variable*>(type) &&
+      !std::holds_alternative<Literal*>(type) &&
+      !std::holds_alternative<Lambda*>(type) &&
+      !std::holds_alternative<Assignment*>(type);
   }
 
-  GCRef less(std::list<GCRef>& args) {
-    check_num<2>(args);
-    return cast<int64_t>(index<0>(args)) < cast<int64_t>(index<1>(args));
-  }
+  using Unary = GCRef (*)(const GCRef&);
+  using Binary = GCRef (*)(const GCRef&, const GCRef&);
 
-  GCRef greater(std::list<GCRef>& args) {
-    check_num<2>(args);
-    return cast<int64_t>(index<0>(args)) > cast<int64_t>(index<1>(args));
+  // the inline forms of the fixnum and pair primitives, by the arity they
+  // are inlined at
+  Unary unary(GCRef (*fn)(std::span<const GCRef>)) {
+    if (fn == &primitive::car) {
+      return &primitive::inlined::car;
+    }
+    if (fn == &primitive::cdr) {
+      return &primitive::inlined::cdr;
+    }
+    return nullptr;
   }
 
-  GCRef read(std::list<GCRef>& args) {
-    check_num<1>(args);
-    auto name = cast<std::string>(index<0>(args));
-
-    std::ifstream file(name);
-
-    std::vector<int64_t> v;
-    int64_t n;
-    while (file >> n) {
-      v.push_back(n);
+  Binary binary(GCRef (*fn)(std::span<const GCRef>)) {
+    if (fn == &primitive::add) {
+      return &primitive::inlined::add;
     }
-
-    GCRef list = nullptr;
-    for (auto it = v.rbegin(); it != v.rend(); ++it) {
-      list = Pair{ *it, list };
+    if (fn == &primitive::sub) {
+      return &primitive::inlined::sub;
+    }
+    if (fn == &primitive::mul) {
+      return &primitive::inlined::mul;
+    }
+    if (fn == &primitive::less) {
+      return &primitive::inlined::less;
+    }
+    if (fn == &primitive::greater) {
+      return &primitive::inlined::greater;
     }
+    if (fn == &primitive::equal) {
+      return &primitive::inlined::equal;
+    }
+    if (fn == &primitive::eqv) {
+      return &primitive::inlined::eqv;
+    }
+    return nullptr;
+  }
 
-    return list;
+  // the primitives the interpreter evaluates itself
+  bool controls(GCRef (*fn)(std::span<const GCRef>)) {
+    return fn == &primitive::raise || fn == &primitive::raise_continuable ||
+      fn == &primitive::with_exception_handler || fn == &primitive::guard;
   }
 } // namespace
 
 r5rs::Interpreter::Interpreter() : env{ std::make_shared<Env>() } {
-  env->set("+", &add);
-  env->set("*", &mul);
-  env->set("cons", &cons);
-  env->set("car", &car);
-  env->set("cdr", &cdr);
-  env->set("empty?", &is_empty);
-  env->set("read", &read);
-  env->set("eqv?", &eqv);
-  env->set("<", &less);
-  env->set(">", &greater);
-  env->set("or", &Or);
-  env->set("and", &And);
+  primitive::define(*env);
+
+  auto stream = ast(tokens(primitive::library));
+  Try<expression::CODPtr> cod;
+  while ((cod = stream[0])) {
+    library.push_back(*cod);
+    std::invoke(*this, cod->get());
+    stream += 1;
+  }
 }
 
 void r5rs::Interpreter::push() {
@@ -160,8 +113,44 @@ void r5rs::Interpreter::pop() {
   env = env->parent;
 }
 
+// An entry point: errors are raised in-band while it evaluates, and one no
+// guard caught is thrown once env is back where it was.
 GCRef r5rs::Interpreter::operator()(expression::COD* cod) {
-  return std::visit(*this, cod->cod_type());
+  trace::Span span("eval");
+  auto saved = env;
+  auto outer = std::exchange(primitive::in_band, true);
+  try {
+    auto res = std::visit(*this, cod->cod_type());
+    primitive::in_band = outer;
+    env = saved;
+    rethrow();
+    return res;
+  }
+  catch (...) {
+    primitive::in_band = outer;
+    env = saved;
+    throw;
+  }
+}
+
+// the budget is put back however the evaluation ends, for one it is nested
+// in
+GCRef r5rs::Interpreter::operator()(expression::COD* cod,
+  const Budget& budget) {
+  auto outer = std::make_tuple(fuel, reserve, deadline, spent);
+  fuel = 0;
+  reserve = budget.steps;
+  deadline = budget.deadline;
+  spent = false;
+  try {
+    auto res = (*this)(cod);
+    std::tie(fuel, reserve, deadline, spent) = outer;
+    return res;
+  }
+  catch (...) {
+    std::tie(fuel, reserve, deadline, spent) = outer;
+    throw;
+  }
 }
 
 GCRef r5rs::Interpreter::operator()(expression::Datum* datum) {
@@ -173,7 +162,11 @@ GCRef r5rs::Interpreter::operator()(expression::Definition* def) {
 }
 
 GCRef r5rs::Interpreter::operator()(expression::Exp* exp) {
-  return std::visit(*this, exp->exp_type());
+  auto type = exp->exp_type();
+  if (metrics::compiled && !compound(type)) {
+    metrics::evaluated(type.index());
+  }
+  return std::visit(*this, type);
 }
 
 GCRef r5rs::Interpreter::operator()(expression::CODs* cods) {
@@ -181,10 +174,18 @@ GCRef r5rs::Interpreter::operator()(expression::CODs* cods) {
   auto start = cods->cods.begin();
   auto back = std::prev(cods->cods.end());
   while (start != back) {
-    std::visit(*this, (*start)->cod_type());
+    auto res = std::visit(*this, (*start)->cod_type());
+    if (raised) {
+      return res;
+    }
     ++start;
   }
-  return std::visit(*this, (*start)->cod_type());
+  // the last form is in tail position, like the last expression of a body
+  auto last = (*start)->cod_type();
+  if (auto exp = std::get_if<Exp*>(&last)) {
+    return tail(*exp);
+  }
+  return std::visit(*this, last);
 }
 
 GCRef r5rs::Interpreter::operator()(expression::SimpleDatum* datum) {
@@ -211,10 +212,17 @@ GCRef r5rs::Interpreter::operator()(expression::Define* def) {
   auto&& vars = env->variables;
 
   if (vars.find(def->variable) != vars.end()) {
-    throw std::runtime_error("redefine variable '" + def->variable + "'!");
+    return error("redefine variable '" + def->variable + "'!");
   }
 
-  vars.insert({ def->variable, std::invoke(*this, def->exp.get()) });
+  auto value = std::invoke(*this, def->exp.get());
+  if (raised) {
+    return value;
+  }
+  if (!env->parent) {
+    parallel::settle();
+  }
+  vars.insert({ def->variable, value });
 
   return nullptr;
 }
@@ -222,7 +230,11 @@ GCRef r5rs::Interpreter::operator()(expression::Define* def) {
 GCRef r5rs::Interpreter::operator()(expression::Definitions* defs) {
   push();
   for (auto&& def : defs->defs) {
-    std::invoke(*this, def.get());
+    auto res = std::invoke(*this, def.get());
+    if (raised) {
+      pop();
+      return res;
+    }
   }
   pop();
   return nullptr;
@@ -231,93 +243,548 @@ GCRef r5rs::Interpreter::operator()(expression::Definitions* defs) {
 GCRef r5rs::Interpreter::operator()(expression::Variable* var) {
   auto&& res = env->get(var->id);
   if (!res) {
-    throw std::runtime_error("variable " + var->id + " is not defined!");
+    return error("variable " + var->id + " is not defined!");
   }
   return *res;
 }
 
 GCRef r5rs::Interpreter::operator()(expression::Literal* literal) {
-  auto visitor = overloaded{ [this](DatumPtr datum) -> GCRef {
-                              return std::invoke(*this, datum.get());
-                            },
-                            [](auto v) -> GCRef { return std::move(v); } };
-
-  return std::visit(visitor, literal->value);
+  return literal->constant();
 }
 
 GCRef r5rs::Interpreter::operator()(expression::Call* call) {
-  auto op = std::invoke(*this, call->op.get());
+  return tail(call);
+}
+
+GCRef r5rs::Interpreter::operator()(expression::Lambda* lambda) {
+  return ClosureLambda{ lambda, env };
+}
+
+GCRef r5rs::Interpreter::operator()(expression::Conditional* condition) {
+  return tail(condition);
+}
 
-  std::list<GCRef> args;
-  for (auto&& exp : call->operands) {
-    args.push_back(std::invoke(*this, exp.get()));
+// Rebinds the variable rather than writing into the value it holds, which
+// may be shared, as a literal's constant is.
+GCRef r5rs::Interpreter::operator()(expression::Assignment* assign) {
+  if (!env->get(assign->variable)) {
+    return error("variable not found");
   }
+  auto value = std::invoke(*this, assign->exp.get());
+  if (raised) {
+    return value;
+  }
+  env->assign(assign->variable, value);
+  return nullptr;
+}
 
-  auto visitor = overloaded{
-      [&args](Primitive primitive) -> GCRef {
-        return std::invoke(*primitive, args);
-      },
-      [&args, this](ClosureLambda lambda) -> GCRef {
-        auto e = this->env;
+GCRef r5rs::Interpreter::operator()(expression::And* conjunction) {
+  return tail(conjunction);
+}
 
-        this->env = lambda.env;
-        this->env = std::make_shared<Env>(*lambda.lambda->formals, args, env);
-        auto res = std::invoke(*this, lambda.lambda->body.get());
+GCRef r5rs::Interpreter::operator()(expression::Or* disjunction) {
+  return tail(disjunction);
+}
 
-        this->env = e;
-        return res;
-      },
-      [](auto&&) -> GCRef {
-        throw std::runtime_error("expression is not a function");
-      } };
+GCRef r5rs::Interpreter::operator()(expression::Cond* cond) {
+  return tail(cond);
+}
 
-  return std::visit(visitor, *op);
+GCRef r5rs::Interpreter::operator()(expression::Case* selection) {
+  return tail(selection);
 }
 
-GCRef r5rs::Interpreter::operator()(expression::Lambda* lambda) {
-  return ClosureLambda{ lambda, env };
+GCRef r5rs::Interpreter::operator()(expression::Let* let) { return tail(let); }
+
+GCRef r5rs::Interpreter::operator()(expression::Do* loop) { return tail(loop); }
+
+GCRef r5rs::Interpreter::operator()(expression::Body* body) {
+  return tail(enter(body));
 }
 
-GCRef r5rs::Interpreter::operator()(expression::Conditional* condition) {
-  auto cond = std::invoke(*this, condition->test.get());
-  auto visitor = overloaded{
-      [](nullptr_t) -> bool { return false; },
-      [](bool b) -> bool { return b; },
-      [](auto&&) -> bool { return true; },
-  };
+// env is put back however the call ends, so the interpreter holds on to
+// nothing of the closure afterwards
+GCRef r5rs::Interpreter::apply(const ClosureLambda& closure,
+  std::span<const GCRef> args) {
+  auto saved = env;
+  auto outer = std::exchange(primitive::in_band, true);
+  try {
+    auto res = call(closure, args);
+    primitive::in_band = outer;
+    rethrow();
+    return res;
+  }
+  catch (...) {
+    primitive::in_band = outer;
+    env = saved;
+    throw;
+  }
+}
+
+GCRef r5rs::Interpreter::call(const GCRef& procedure,
+  std::span<const GCRef> args) {
+  if (auto primitive = std::get_if<Primitive>(&*procedure)) {
+    metrics::called(false, args.size());
+    if (!primitive->accepts(args.size())) {
+      return error("Argument number error!");
+    }
+    if (controls(primitive->fn)) {
+      return control(*primitive, args);
+    }
+    auto res = std::invoke(primitive->fn, args);
+    if (primitive::failure) {
+      return error(std::exchange(primitive::failure, nullptr));
+    }
+    return res;
+  }
 
-  if (std::visit(visitor, *cond)) {
-    return std::invoke(*this, condition->consequent.get());
+  auto closure = std::get_if<ClosureLambda>(&*procedure);
+  if (!closure) {
+    return error("expression is not a function");
+  }
+  auto&& lambda = *closure->lambda;
+  if (auto message = mismatch(*lambda.formals, args.size())) {
+    return error(message);
+  }
+  if (!spend()) {
+    return *raised;
+  }
+  metrics::called(true, args.size());
+  metrics::Depth depth;
+  depth.enter();
+  profile::Frame running;
+  running.enter(&lambda);
+  auto saved = env;
+  env = std::make_shared<Env>(*lambda.formals, args, closure->env);
+  auto res = tail(enter(lambda.body.get()));
+  env = saved;
+  return res;
+}
+
+// A call of a fixnum or pair primitive, while its name is still bound to
+// it, skips the argument stack and the generic apply for the primitive's
+// inline form. Nothing if the call is not one.
+std::optional<GCRef> r5rs::Interpreter::builtin(expression::Call* call,
+  const GCRef& op) {
+  auto primitive = std::get_if<Primitive>(&*op);
+  if (!primitive) {
+    return std::nullopt;
+  }
+  auto&& operands = call->operands;
+  auto one = operands.size() == 1 ? unary(primitive->fn) : nullptr;
+  auto two = operands.size() == 2 ? binary(primitive->fn) : nullptr;
+  if (!one && !two) {
+    return std::nullopt;
+  }
+
+  auto a = std::invoke(*this, operands.front().get());
+  if (raised) {
+    return *raised;
+  }
+  std::optional<GCRef> res;
+  if (two) {
+    auto b = std::invoke(*this, operands.back().get());
+    if (raised) {
+      return *raised;
+    }
+    res.emplace(two(a, b));
   }
   else {
-    return std::invoke(*this, condition->alternate.get());
+    res.emplace(one(a));
   }
+  metrics::called(false, operands.size());
+  if (primitive::failure) {
+    return error(std::exchange(primitive::failure, nullptr));
+  }
+  return res;
 }
 
-GCRef r5rs::Interpreter::operator()(expression::Assignment* assign) {
-  auto var = env->get(assign->variable);
-  if (!var) {
-    throw std::runtime_error("variable not found");
+// Guard and with-exception-handler run the thunk with their entry on the
+// handler stack. An exception thrown within, as the primitives that do not
+// fail in-band throw, is raised at a guard, after the frames it left.
+GCRef r5rs::Interpreter::control(const Primitive& primitive,
+  std::span<const GCRef> args) {
+  if (primitive.fn == &primitive::raise) {
+    return raise(args[0], false);
   }
-  **var = *std::invoke(*this, assign->exp.get());
-  return nullptr;
+  if (primitive.fn == &primitive::raise_continuable) {
+    return raise(args[0], true);
+  }
+
+  auto guard = primitive.fn == &primitive::guard;
+  GCRef thunk = args[guard ? 0 : 1];
+  GCRef handler = args[guard ? 1 : 0];
+  if (guard) {
+    handlers.emplace_back();
+  }
+  else {
+    handlers.emplace_back(handler);
+  }
+
+  auto saved = env;
+  std::optional<GCRef> res;
+  try {
+    res = call(thunk, {});
+  }
+  catch (const std::exception& e) {
+    env = saved;
+    if (!guard) {
+      handlers.pop_back();
+      throw;
+    }
+    raised = GCRef(Condition{ e.what(), nullptr });
+  }
+  catch (...) {
+    env = saved;
+    handlers.pop_back();
+    throw;
+  }
+  handlers.pop_back();
+
+  if (!guard || !raised) {
+    return *res;
+  }
+  // a spent budget is not caught, but goes on to the entry point
+  if (spent) {
+    return *raised;
+  }
+  auto condition = std::move(*raised);
+  raised.reset();
+  return call(handler, { &condition, 1 });
 }
 
-GCRef r5rs::Interpreter::operator()(expression::Body* body) {
+GCRef r5rs::Interpreter::raise(GCRef condition, bool continuable) {
+  if (spent || handlers.empty() || !handlers.back()) {
+    raised = std::move(condition);
+    return *raised;
+  }
+
+  auto handler = std::move(*handlers.back());
+  handlers.pop_back();
+  std::optional<GCRef> res;
+  try {
+    res = call(handler, { &condition, 1 });
+    if (!raised && !continuable) {
+      res = error("handler returned from non-continuable raise");
+    }
+  }
+  catch (...) {
+    handlers.push_back(std::move(handler));
+    throw;
+  }
+  handlers.push_back(std::move(handler));
+  return *res;
+}
+
+GCRef r5rs::Interpreter::error(std::string message) {
+  return raise(Condition{ std::move(message), nullptr }, false);
+}
+
+// Moves the next round of steps from the budget into `fuel`, the step that
+// ran out being the first of them. With a deadline a round is short enough
+// for the clock to be read every millisecond or so. Once the budget is
+// spent, `fuel` is left to run out again at the next step.
+bool r5rs::Interpreter::refuel() {
+  if (deadline && std::chrono::steady_clock::now() >= *deadline) {
+    fuel = 0;
+    spent = true;
+    error("evaluation timed out!");
+    return false;
+  }
+  uint64_t round = deadline ? 1024 : -1;
+  if (reserve) {
+    if (!*reserve) {
+      fuel = 0;
+      spent = true;
+      error("evaluation ran out of steps!");
+      return false;
+    }
+    round = std::min(round, *reserve);
+    *reserve -= round;
+  }
+  fuel = round - 1;
+  return true;
+}
+
+void r5rs::Interpreter::rethrow() {
+  if (raised) {
+    auto condition = std::move(*raised);
+    raised.reset();
+    throw std::runtime_error(primitive::uncaught(*condition));
+  }
+}
+
+// Evaluates everything in `body` except its last expression, which is
+// returned so the caller can evaluate it in tail position. It stops early
+// when something is raised, which the caller checks for.
+Exp* r5rs::Interpreter::enter(expression::Body* body) {
   if (body->exps.empty()) {
     throw std::runtime_error("empty body!");
   }
 
   for (auto&& def : body->defs) {
     std::invoke(*this, def.get());
+    if (raised) {
+      return body->exps.back().get();
+    }
   }
 
-  auto it = body->exps.begin();
-  auto back = std::prev(body->exps.end());
+  return enter(body->exps);
+}
+
+// the same for a nonempty sequence of expressions
+Exp* r5rs::Interpreter::enter(const std::list<ExpPtr>& exps) {
+  auto it = exps.begin();
+  auto back = std::prev(exps.end());
 
-  for (; it != back; ++it) {
+  for (; it != back && !raised; ++it) {
     std::invoke(*this, it->get());
   }
 
-  return std::invoke(*this, back->get());
+  return back->get();
+}
+
+// Conditionals, the last expression of the derived forms and closure calls
+// in tail position replace `exp` and `env` and go around the loop instead of
+// recursing, so a tail call reuses this C++ frame and iterative Scheme code
+// runs in constant stack. A raise leaves through unwind() from wherever it
+// is noticed.
+GCRef r5rs::Interpreter::tail(expression::Exp* exp) {
+  auto e = env;
+  // the environments of the inlined named lets entered so far, which their
+  // iterations rebind in place
+  std::vector<std::pair<Let*, std::shared_ptr<Env>>> loops;
+  // the procedure being run for the profiler, once one is called
+  profile::Frame running;
+  metrics::Depth depth;
+  auto unwind = [&] {
+    env = e;
+    return *raised;
+  };
+
+  while (true) {
+    if (raised) {
+      return unwind();
+    }
+    auto type = exp->exp_type();
+    metrics::evaluated(type.index());
+
+    if (auto condition = std::get_if<Conditional*>(&type)) {
+      auto cond = std::invoke(*this, (*condition)->test.get());
+      if (raised) {
+        return unwind();
+      }
+      exp = truthy(*cond) ? (*condition)->consequent.get()
+                          : (*condition)->alternate.get();
+      if (!exp) {
+        env = e;
+        return nullptr;
+      }
+      continue;
+    }
+
+    // and and or stop at the first false or true value and return it
+    if (auto conjunction = std::get_if<And*>(&type)) {
+      auto&& exps = (*conjunction)->exps;
+      if (exps.empty()) {
+        env = e;
+        return true;
+      }
+      auto it = exps.begin();
+      for (; it != std::prev(exps.end()); ++it) {
+        auto value = std::invoke(*this, it->get());
+        if (raised) {
+          return unwind();
+        }
+        if (!truthy(*value)) {
+          env = e;
+          return value;
+        }
+      }
+      exp = it->get();
+      continue;
+    }
+
+    if (auto disjunction = std::get_if<Or*>(&type)) {
+      auto&& exps = (*disjunction)->exps;
+      if (exps.empty()) {
+        env = e;
+        return false;
+      }
+      auto it = exps.begin();
+      for (; it != std::prev(exps.end()); ++it) {
+        auto value = std::invoke(*this, it->get());
+        if (raised) {
+          return unwind();
+        }
+        if (truthy(*value)) {
+          env = e;
+          return value;
+        }
+      }
+      exp = it->get();
+      continue;
+    }
+
+    if (auto selection = std::get_if<Case*>(&type)) {
+      auto key = std::invoke(*this, (*selection)->key.get());
+      if (raised) {
+        return unwind();
+      }
+      auto&& clauses = (*selection)->clauses;
+      auto i = (*(*selection)->dispatch)(*key);
+      auto&& exps = i < clauses.size() ? clauses[i].exps
+                                       : (*selection)->otherwise;
+      if (exps.empty()) {
+        env = e;
+        return nullptr;
+      }
+      exp = enter(exps);
+      continue;
+    }
+
+    if (auto loop = std::get_if<Do*>(&type)) {
+      exp = (*loop)->loop.get();
+      continue;
+    }
+
+    // operands go on the shared argument stack; nested calls push above
+    // them and pop back to their own base before returning
+    Frame frame{ stack };
+    std::optional<GCRef> op;
+
+    if (auto call = std::get_if<Call*>(&type)) {
+      auto loop = std::find_if(loops.rbegin(), loops.rend(),
+        [&](auto&& entry) { return entry.first == (*call)->loop; });
+      if (loop == loops.rend()) {
+        op = std::invoke(*this, (*call)->op.get());
+        if (raised) {
+          return unwind();
+        }
+        if (auto res = builtin(*call, *op)) {
+          if (raised) {
+            return unwind();
+          }
+          env = e;
+          return *res;
+        }
+      }
+      for (auto&& operand : (*call)->operands) {
+        if (raised) {
+          return unwind();
+        }
+        auto arg = std::invoke(*this, operand.get());
+        stack.push_back(std::move(arg));
+      }
+      if (raised) {
+        return unwind();
+      }
+      if (loop != loops.rend()) {
+        if (!spend()) {
+          return unwind();
+        }
+        metrics::called(true, frame.args().size());
+        auto&& variables = loop->second->variables;
+        auto arg = frame.args().begin();
+        for (auto&& name : loop->first->lambda->formals->fixed) {
+          variables.find(name)->second = *arg++;
+        }
+        env = loop->second;
+        exp = enter(loop->first->lambda->body.get());
+        continue;
+      }
+    }
+    else if (auto cond = std::get_if<Cond*>(&type)) {
+      auto&& clauses = (*cond)->clauses;
+      auto clause = clauses.begin();
+      std::optional<GCRef> value;
+      for (; clause != clauses.end(); ++clause) {
+        if (!clause->test) {
+          break;
+        }
+        value = std::invoke(*this, clause->test.get());
+        if (raised) {
+          return unwind();
+        }
+        if (truthy(**value)) {
+          break;
+        }
+      }
+      if (clause == clauses.end()) {
+        env = e;
+        return nullptr;
+      }
+      if (!clause->receiver) {
+        if (clause->exps.empty()) {
+          env = e;
+          return *value;
+        }
+        exp = enter(clause->exps);
+        continue;
+      }
+      // (test => receiver) calls the receiver on the value of the test
+      stack.push_back(*value);
+      op = std::invoke(*this, clause->receiver.get());
+      if (raised) {
+        return unwind();
+      }
+    }
+    else if (auto let = std::get_if<Let*>(&type)) {
+      for (auto&& init : (*let)->inits) {
+        auto arg = std::invoke(*this, init.get());
+        if (raised) {
+          return unwind();
+        }
+        stack.push_back(std::move(arg));
+      }
+      auto&& lambda = (*let)->lambda;
+      auto parent = env;
+      if ((*let)->name && (*let)->inlined) {
+        metrics::called(true, frame.args().size());
+        env = std::make_shared<Env>(*lambda->formals, frame.args(), parent);
+        loops.emplace_back(*let, env);
+        exp = enter(lambda->body.get());
+        continue;
+      }
+      if ((*let)->name) {
+        metrics::called(true, frame.args().size());
+        depth.enter();
+        running.enter(lambda.get());
+        parent = std::make_shared<Env>(env);
+        parent->set(*(*let)->name, ClosureLambda{ lambda.get(), parent });
+      }
+      env = std::make_shared<Env>(*lambda->formals, frame.args(), parent);
+      exp = enter(lambda->body.get());
+      continue;
+    }
+    else {
+      auto res = std::visit(*this, type);
+      env = e;
+      return res;
+    }
+
+    auto args = frame.args();
+
+    if (!std::holds_alternative<ClosureLambda>(**op)) {
+      auto res = call(*op, args);
+      env = e;
+      return res;
+    }
+
+    if (!spend()) {
+      return unwind();
+    }
+    auto lambda = std::get<ClosureLambda>(**op);
+    if (auto message = mismatch(*lambda.lambda->formals, args.size())) {
+      error(message);
+      return unwind();
+    }
+    metrics::called(true, args.size());
+    depth.enter();
+    running.enter(lambda.lambda);
+    // the loops entered so far are left behind with the caller's body
+    loops.clear();
+    env = std::make_shared<Env>(*lambda.lambda->formals, args, lambda.env);
+    exp = enter(lambda.lambda->body.get());
+  }
 }
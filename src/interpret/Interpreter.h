@@ -1,20 +1,43 @@
 #ifndef R5RS_INTERPRETER_H
 #define R5RS_INTERPRETER_H
 
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
 #include "Env.h"
 #include "Expressions.h"
 #include "GC.h"
 #include "Type.h"
 
 namespace r5rs {
+  // The heap and the parsers are per thread, so interpreters made on
+  // different threads share nothing and run in parallel. An interpreter and
+  // its values must stay on the thread that made them.
+  //
+  // Errors are raised in-band: a failing primitive or call, raise and error
+  // set `raised`, and every evaluation returns as soon as it is set, back
+  // to the innermost guard or out of the entry points as an exception.
   class Interpreter {
   public:
     Interpreter();
 
+    // What one evaluation may take: a number of steps, each a procedure
+    // call or an iteration of a loop, and a time to be done by.
+    struct Budget {
+      std::optional<uint64_t> steps{};
+      std::optional<std::chrono::steady_clock::time_point> deadline{};
+    };
+
     std::shared_ptr<Env> env;
     void push();
     void pop();
 
+    // Evaluates `cod` within `budget`. Running out raises an error that no
+    // guard or handler sees, and again at every step after it, so the
+    // program cannot catch it and carry on; it is thrown from here.
+    GCRef operator()(expression::COD*, const Budget& budget);
+
     // forward
     GCRef operator()(expression::COD*);
     GCRef operator()(expression::Datum*);
@@ -40,8 +63,71 @@ namespace r5rs {
     GCRef operator()(expression::Lambda*);
     GCRef operator()(expression::Conditional*);
     GCRef operator()(expression::Assignment*);
+    GCRef operator()(expression::And*);
+    GCRef operator()(expression::Or*);
+    GCRef operator()(expression::Cond*);
+    GCRef operator()(expression::Case*);
+    GCRef operator()(expression::Let*);
+    GCRef operator()(expression::Do*);
 
     GCRef operator()(expression::Body*);
+
+    // tail position
+    expression::Exp* enter(expression::Body*);
+    expression::Exp* enter(const std::list<expression::ExpPtr>& exps);
+    GCRef tail(expression::Exp*);
+
+    // calls a closure from outside any evaluation, as a pool worker does
+    GCRef apply(const ClosureLambda& closure, std::span<const GCRef> args);
+
+  private:
+    // the operands of one call, popped off the argument stack on exit
+    class Frame {
+    public:
+      explicit Frame(std::vector<GCRef>& stack)
+        : stack(stack), base(stack.size()) {}
+      ~Frame() { stack.erase(stack.begin() + base, stack.end()); }
+
+      std::span<const GCRef> args() const {
+        return { stack.data() + base, stack.size() - base };
+      }
+
+    private:
+      std::vector<GCRef>& stack;
+      size_t base;
+    };
+
+    // calls `procedure` from C++, as guard and raise call thunks and
+    // handlers
+    GCRef call(const GCRef& procedure, std::span<const GCRef> args);
+    GCRef control(const Primitive& primitive, std::span<const GCRef> args);
+    std::optional<GCRef> builtin(expression::Call* call, const GCRef& op);
+    // Calls the innermost handler on `condition` with the outer ones in
+    // place, or unwinds to the innermost guard if there is no handler
+    // within it. A handler returns only from a continuable raise.
+    GCRef raise(GCRef condition, bool continuable);
+    GCRef error(std::string message);
+    // throws what is left raised when evaluation gets back to an entry point
+    void rethrow();
+    // counts a step, false once the budget is spent and the error raised
+    bool spend() { return fuel-- != 0 || refuel(); }
+    bool refuel();
+
+    std::vector<GCRef> stack;
+    std::optional<GCRef> raised;
+    // the handlers with-exception-handler installed, innermost last, with
+    // an empty one where a guard is
+    std::vector<std::optional<GCRef>> handlers;
+    // Steps left before the budget is looked at again. With no budget it is
+    // never used up, so a step costs no more than a decrement and a branch.
+    uint64_t fuel = -1;
+    // the steps of the budget not yet handed to `fuel`
+    std::optional<uint64_t> reserve;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    // whether the budget ran out, after which raises skip the handlers
+    bool spent = false;
+    // the parsed library, which the closures it defines point into
+    std::vector<expression::CODPtr> library;
   };
 } // namespace r5rs
 
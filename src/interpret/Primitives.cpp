@@ -0,0 +1,412 @@
+#include "Primitives.h"
+
+#include <fstream>
+
+#include "Future.h"
+#include "Metrics.h"
+#include "String.h"
+
+using namespace r5rs;
+
+namespace {
+  const char* const type_error = "Argument type error!";
+
+  template <typename T> const T* cast(const GCRef& arg) {
+    return std::get_if<T>(&*arg);
+  }
+
+  // a fixnum comparison, or the type error
+  template <typename F> GCRef compare(std::span<const GCRef> args, F f) {
+    auto a = cast<int64_t>(args[0]);
+    auto b = cast<int64_t>(args[1]);
+    if (!a || !b) {
+      return primitive::fail(type_error);
+    }
+    return f(*a, *b);
+  }
+} // namespace
+
+GCRef r5rs::primitive::fail(const char* message) {
+  if (!in_band) {
+    throw std::runtime_error(message);
+  }
+  failure = message;
+  return nullptr;
+}
+
+GCRef r5rs::primitive::add(std::span<const GCRef> args) {
+  int64_t sum = 0;
+  for (auto&& arg : args) {
+    auto n = cast<int64_t>(arg);
+    if (!n) {
+      return fail(type_error);
+    }
+    sum += *n;
+  }
+  return sum;
+}
+
+GCRef r5rs::primitive::sub(std::span<const GCRef> args) {
+  if (args.empty()) {
+    return fail("Argument number error!");
+  }
+  auto diff = cast<int64_t>(args[0]);
+  if (!diff) {
+    return fail(type_error);
+  }
+  if (args.size() == 1) {
+    return -*diff;
+  }
+  auto res = *diff;
+  for (auto&& arg : args.subspan(1)) {
+    auto n = cast<int64_t>(arg);
+    if (!n) {
+      return fail(type_error);
+    }
+    res -= *n;
+  }
+  return res;
+}
+
+GCRef r5rs::primitive::mul(std::span<const GCRef> args) {
+  int64_t prod = 1;
+  for (auto&& arg : args) {
+    auto n = cast<int64_t>(arg);
+    if (!n) {
+      return fail(type_error);
+    }
+    prod *= *n;
+  }
+  return prod;
+}
+
+GCRef r5rs::primitive::is_empty(std::span<const GCRef> args) {
+  if (std::holds_alternative<nullptr_t>(*args[0])) {
+    return true;
+  }
+  return false;
+}
+
+GCRef r5rs::primitive::cons(std::span<const GCRef> args) {
+  return Pair{ args[0], args[1] };
+}
+
+GCRef r5rs::primitive::car(std::span<const GCRef> args) {
+  auto pair = cast<Pair>(args[0]);
+  if (!pair) {
+    return fail(type_error);
+  }
+  return pair->first;
+}
+
+GCRef r5rs::primitive::cdr(std::span<const GCRef> args) {
+  auto pair = cast<Pair>(args[0]);
+  if (!pair) {
+    return fail(type_error);
+  }
+  return pair->second;
+}
+
+GCRef r5rs::primitive::eqv(std::span<const GCRef> args) {
+  return compare(args, std::equal_to<int64_t>());
+}
+
+GCRef r5rs::primitive::equal(std::span<const GCRef> args) {
+  return compare(args, std::equal_to<int64_t>());
+}
+
+GCRef r5rs::primitive::less(std::span<const GCRef> args) {
+  return compare(args, std::less<int64_t>());
+}
+
+GCRef r5rs::primitive::greater(std::span<const GCRef> args) {
+  return compare(args, std::greater<int64_t>());
+}
+
+GCRef r5rs::primitive::read(std::span<const GCRef> args) {
+  auto name = cast<std::string>(args[0]);
+  if (!name) {
+    return fail(type_error);
+  }
+
+  std::ifstream file(*name);
+
+  std::vector<int64_t> v;
+  int64_t n;
+  while (file >> n) {
+    v.push_back(n);
+  }
+
+  GCRef list = nullptr;
+  for (auto it = v.rbegin(); it != v.rend(); ++it) {
+    list = Pair{ *it, list };
+  }
+
+  return list;
+}
+
+GCRef r5rs::primitive::is_vector(std::span<const GCRef> args) {
+  return std::holds_alternative<Vector>(*args[0]);
+}
+
+GCRef r5rs::primitive::vector_to_list(std::span<const GCRef> args) {
+  auto vector = cast<Vector>(args[0]);
+  if (!vector) {
+    return fail(type_error);
+  }
+  GCRef list = nullptr;
+  for (auto it = vector->rbegin(); it != vector->rend(); ++it) {
+    list = Pair{ *it, list };
+  }
+  return list;
+}
+
+GCRef r5rs::primitive::list_to_vector(std::span<const GCRef> args) {
+  Vector vector;
+  const GCValue* rest = &*args[0];
+  while (auto pair = std::get_if<Pair>(rest)) {
+    vector.push_back(pair->first);
+    rest = &*pair->second;
+  }
+  if (!std::holds_alternative<nullptr_t>(*rest)) {
+    return fail(type_error);
+  }
+  return vector;
+}
+
+namespace {
+  GCRef promise(bool done, const GCRef& value) {
+    GCRef box = Pair{ done, value };
+    return Promise{ box };
+  }
+} // namespace
+
+GCRef r5rs::primitive::make_promise(std::span<const GCRef> args) {
+  if (std::holds_alternative<Promise>(*args[0])) {
+    return args[0];
+  }
+  return promise(true, args[0]);
+}
+
+GCRef r5rs::primitive::is_promise(std::span<const GCRef> args) {
+  return std::holds_alternative<Promise>(*args[0]);
+}
+
+GCRef r5rs::primitive::eager(std::span<const GCRef> args) {
+  return promise(true, args[0]);
+}
+
+GCRef r5rs::primitive::lazy(std::span<const GCRef> args) {
+  return promise(false, args[0]);
+}
+
+// a forced stream pair, (delay first) and (delay-force rest) as its car and
+// cdr
+GCRef r5rs::primitive::stream_cons(std::span<const GCRef> args) {
+  return promise(true, Pair{ args[0], args[1] });
+}
+
+GCRef r5rs::primitive::promise_done(std::span<const GCRef> args) {
+  auto promise = cast<Promise>(args[0]);
+  if (!promise) {
+    return fail(type_error);
+  }
+  return std::get<Pair>(*promise->box).first;
+}
+
+GCRef r5rs::primitive::promise_value(std::span<const GCRef> args) {
+  auto promise = cast<Promise>(args[0]);
+  if (!promise) {
+    return fail(type_error);
+  }
+  return std::get<Pair>(*promise->box).second;
+}
+
+// Moves the state of the promise a delay-force thunk returned into the one
+// being forced and lets both share it from then on.
+GCRef r5rs::primitive::promise_update(std::span<const GCRef> args) {
+  if (!cast<Promise>(args[0]) || !cast<Promise>(args[1])) {
+    return fail(type_error);
+  }
+  GCRef next = args[0];
+  GCRef forced = args[1];
+  auto&& box = std::get<Promise>(*forced).box;
+  std::get<Pair>(*box) = std::get<Pair>(*std::get<Promise>(*next).box);
+  std::get<Promise>(*next).box = box;
+  return nullptr;
+}
+
+GCRef r5rs::primitive::make_error(std::span<const GCRef> args) {
+  auto message = cast<std::string>(args[0]);
+  if (!message) {
+    return fail(type_error);
+  }
+  return Condition{ *message, args[1] };
+}
+
+GCRef r5rs::primitive::is_error_object(std::span<const GCRef> args) {
+  return std::holds_alternative<Condition>(*args[0]);
+}
+
+GCRef r5rs::primitive::error_object_message(std::span<const GCRef> args) {
+  auto condition = cast<Condition>(args[0]);
+  if (!condition) {
+    return fail(type_error);
+  }
+  return std::string(condition->message);
+}
+
+GCRef r5rs::primitive::error_object_irritants(std::span<const GCRef> args) {
+  auto condition = cast<Condition>(args[0]);
+  if (!condition) {
+    return fail(type_error);
+  }
+  return condition->irritants;
+}
+
+GCRef r5rs::primitive::raise(std::span<const GCRef> args) {
+  throw std::runtime_error(uncaught(*args[0]));
+}
+
+GCRef r5rs::primitive::raise_continuable(std::span<const GCRef> args) {
+  throw std::runtime_error(uncaught(*args[0]));
+}
+
+GCRef r5rs::primitive::with_exception_handler(std::span<const GCRef>) {
+  throw std::runtime_error("exception handlers need the interpreter");
+}
+
+GCRef r5rs::primitive::guard(std::span<const GCRef>) {
+  throw std::runtime_error("guard needs the interpreter");
+}
+
+// an error object's message followed by its irritants, as error reports
+std::string r5rs::primitive::uncaught(const GCValue& obj) {
+  auto condition = std::get_if<Condition>(&obj);
+  if (!condition) {
+    return "uncaught exception: " + std::visit(String(), obj);
+  }
+  auto res = condition->message;
+  const GCValue* rest = &*condition->irritants;
+  while (auto pair = std::get_if<Pair>(rest)) {
+    res += " " + std::visit(String(), *pair->first);
+    rest = &*pair->second;
+  }
+  return res;
+}
+
+// force runs thunks until the promise is done, in a tail loop so a chain of
+// delay-force promises takes constant stack. A stream is a promise of '() or
+// of a pair of a promise of its first element and the stream of the rest.
+// The stream procedures recurse through their own definitions rather than a
+// named let, so no thunk holds on to the head of the stream it was given
+// and a pipeline keeps only the elements still in use. A future and
+// parallel-map call the procedure themselves when it cannot run on the pool.
+const char* const r5rs::primitive::library = R"(
+(define (not obj) (if obj #f #t))
+(define (error message . irritants) (raise (%make-error message irritants)))
+(define (force promise)
+  (if (promise? promise)
+      (if (%promise-done? promise)
+          (%promise-value promise)
+          ((lambda (next)
+             (if (%promise-done? promise) #f (%promise-update! next promise))
+             (force promise))
+           ((%promise-value promise))))
+      promise))
+(define stream-null (%eager '()))
+(define (stream? obj) (promise? obj))
+(define (stream-null? s) (empty? (force s)))
+(define (stream-pair? s) (if (promise? s) (if (force s) #t #f) #f))
+(define (stream-car s) (force (car (force s))))
+(define (stream-cdr s) (cdr (force s)))
+(define (list->stream xs)
+  (if (empty? xs) stream-null (stream-cons (car xs) (list->stream (cdr xs)))))
+(define (stream->list s)
+  (let loop ((s s) (xs '()))
+    (if (stream-pair? s)
+        (loop (stream-cdr s) (cons (stream-car s) xs))
+        (let reverse ((xs xs) (res '()))
+          (if (empty? xs) res (reverse (cdr xs) (cons (car xs) res)))))))
+(define (stream-from first . step)
+  (let ((step (if (empty? step) 1 (car step))))
+    (let from ((n first)) (stream-cons n (from (+ n step))))))
+(define (stream-map f s)
+  (delay-force
+    (if (stream-pair? s)
+        (stream-cons (f (stream-car s)) (stream-map f (stream-cdr s)))
+        stream-null)))
+(define (stream-filter keep? s)
+  (delay-force
+    (cond ((not (stream-pair? s)) stream-null)
+          ((keep? (stream-car s))
+           (stream-cons (stream-car s) (stream-filter keep? (stream-cdr s))))
+          (else (stream-filter keep? (stream-cdr s))))))
+(define (stream-take n s)
+  (delay-force
+    (if (and (> n 0) (stream-pair? s))
+        (stream-cons (stream-car s) (stream-take (- n 1) (stream-cdr s)))
+        stream-null)))
+(define (stream-drop n s)
+  (delay-force
+    (if (and (> n 0) (stream-pair? s)) (stream-drop (- n 1) (stream-cdr s)) s)))
+(define (stream-ref s n)
+  (if (> n 0) (stream-ref (stream-cdr s) (- n 1)) (stream-car s)))
+(define (stream-fold f base s)
+  (if (stream-pair? s) (stream-fold f (f base (stream-car s)) (stream-cdr s))
+      base))
+(define (stream-for-each f s)
+  (if (stream-pair? s)
+      (let () (f (stream-car s)) (stream-for-each f (stream-cdr s)))))
+(define (%future thunk) (or (%fork thunk) (thunk)))
+(define (parallel-map f xs)
+  (cond ((%parallel-map f xs))
+        ((vector? xs) (list->vector (parallel-map f (vector->list xs))))
+        (else
+         (let loop ((xs xs) (ys '()))
+           (if (empty? xs)
+               (let reverse ((ys ys) (res '()))
+                 (if (empty? ys) res (reverse (cdr ys) (cons (car ys) res))))
+               (loop (cdr xs) (cons (f (car xs)) ys)))))))
+)";
+
+void r5rs::primitive::define(Env& env) {
+  env.set("+", Primitive{ &add });
+  env.set("-", Primitive{ &sub });
+  env.set("*", Primitive{ &mul });
+  env.set("cons", Primitive{ &cons, 2 });
+  env.set("car", Primitive{ &car, 1 });
+  env.set("cdr", Primitive{ &cdr, 1 });
+  env.set("empty?", Primitive{ &is_empty, 1 });
+  env.set("read", Primitive{ &read, 1 });
+  env.set("eqv?", Primitive{ &eqv, 2 });
+  env.set("=", Primitive{ &equal, 2 });
+  env.set("<", Primitive{ &less, 2 });
+  env.set(">", Primitive{ &greater, 2 });
+  env.set("make-promise", Primitive{ &make_promise, 1 });
+  env.set("promise?", Primitive{ &is_promise, 1 });
+  env.set("%eager", Primitive{ &eager, 1 });
+  env.set("%lazy", Primitive{ &lazy, 1 });
+  env.set("%stream-cons", Primitive{ &stream_cons, 2 });
+  env.set("%promise-done?", Primitive{ &promise_done, 1 });
+  env.set("%promise-value", Primitive{ &promise_value, 1 });
+  env.set("%promise-update!", Primitive{ &promise_update, 2 });
+  env.set("vector?", Primitive{ &is_vector, 1 });
+  env.set("vector->list", Primitive{ &vector_to_list, 1 });
+  env.set("list->vector", Primitive{ &list_to_vector, 1 });
+  env.set("%make-error", Primitive{ &make_error, 2 });
+  env.set("error-object?", Primitive{ &is_error_object, 1 });
+  env.set("error-object-message", Primitive{ &error_object_message, 1 });
+  env.set("error-object-irritants", Primitive{ &error_object_irritants, 1 });
+  env.set("raise", Primitive{ &raise, 1 });
+  env.set("raise-continuable", Primitive{ &raise_continuable, 1 });
+  env.set("%reraise", Primitive{ &raise_continuable, 1 });
+  env.set("with-exception-handler",
+    Primitive{ &with_exception_handler, 2 });
+  env.set("%guard", Primitive{ &guard, 2 });
+  env.set("%fork", Primitive{ &parallel::fork, 1 });
+  env.set("touch", Primitive{ &parallel::touch, 1 });
+  env.set("future?", Primitive{ &parallel::is_future, 1 });
+  env.set("%parallel-map", Primitive{ &parallel::parallel_map, 2 });
+  env.set("evaluator-metrics", Primitive{ &metrics::evaluator_metrics, 0 });
+}
@@ -0,0 +1,144 @@
+#ifndef R5RS_PRIMITIVES_H
+#define R5RS_PRIMITIVES_H
+
+#include <span>
+#include <string>
+
+#include "Env.h"
+#include "GC.h"
+#include "Type.h"
+
+// Primitives the engines evaluate inline while their global still holds
+// them, with the number of operands the inline form takes.
+#define R5RS_BUILTIN                                                           \
+  R5RS_BUILTIN_ACCESS(add, 2)                                                  \
+  R5RS_BUILTIN_ACCESS(sub, 2)                                                  \
+  R5RS_BUILTIN_ACCESS(mul, 2)                                                  \
+  R5RS_BUILTIN_ACCESS(less, 2)                                                 \
+  R5RS_BUILTIN_ACCESS(greater, 2)                                              \
+  R5RS_BUILTIN_ACCESS(equal, 2)                                                \
+  R5RS_BUILTIN_ACCESS(eqv, 2)                                                  \
+  R5RS_BUILTIN_ACCESS(car, 1)                                                  \
+  R5RS_BUILTIN_ACCESS(cdr, 1)                                                  \
+  R5RS_BUILTIN_ACCESS(cons, 2)
+
+namespace r5rs {
+  namespace primitive {
+    GCRef add(std::span<const GCRef> args);
+    GCRef sub(std::span<const GCRef> args);
+    GCRef mul(std::span<const GCRef> args);
+    GCRef less(std::span<const GCRef> args);
+    GCRef greater(std::span<const GCRef> args);
+    GCRef equal(std::span<const GCRef> args);
+    GCRef eqv(std::span<const GCRef> args);
+    GCRef car(std::span<const GCRef> args);
+    GCRef cdr(std::span<const GCRef> args);
+    GCRef cons(std::span<const GCRef> args);
+    GCRef is_empty(std::span<const GCRef> args);
+    GCRef read(std::span<const GCRef> args);
+    GCRef is_vector(std::span<const GCRef> args);
+    GCRef vector_to_list(std::span<const GCRef> args);
+    GCRef list_to_vector(std::span<const GCRef> args);
+
+    // promises; the % ones are what delay, delay-force, stream-cons and
+    // force are built on
+    GCRef make_promise(std::span<const GCRef> args);
+    GCRef is_promise(std::span<const GCRef> args);
+    GCRef eager(std::span<const GCRef> args);
+    GCRef lazy(std::span<const GCRef> args);
+    GCRef stream_cons(std::span<const GCRef> args);
+    GCRef promise_done(std::span<const GCRef> args);
+    GCRef promise_value(std::span<const GCRef> args);
+    GCRef promise_update(std::span<const GCRef> args);
+
+    // A primitive reports an error through fail(), which throws unless the
+    // engine calling it raises errors in-band, as the interpreter does while
+    // `in_band` is set; then the message is left in `failure` for the
+    // engine to raise, and the result is only a placeholder.
+    inline thread_local bool in_band = false;
+    inline thread_local const char* failure = nullptr;
+    GCRef fail(const char* message);
+
+    // error objects; error raises what %make-error makes of its message and
+    // list of irritants
+    GCRef make_error(std::span<const GCRef> args);
+    GCRef is_error_object(std::span<const GCRef> args);
+    GCRef error_object_message(std::span<const GCRef> args);
+    GCRef error_object_irritants(std::span<const GCRef> args);
+
+    // raise, raise-continuable, with-exception-handler and the %guard guard
+    // is built on. The interpreter evaluates them itself; called as plain
+    // procedures, raise throws what it raises and the others throw that
+    // they need the interpreter.
+    GCRef raise(std::span<const GCRef> args);
+    GCRef raise_continuable(std::span<const GCRef> args);
+    GCRef with_exception_handler(std::span<const GCRef> args);
+    GCRef guard(std::span<const GCRef> args);
+
+    // the message of a raise of `obj` nothing handled
+    std::string uncaught(const GCValue& obj);
+
+    // binds every primitive under its Scheme name
+    void define(Env& env);
+
+    // Scheme definitions every engine evaluates after binding the
+    // primitives: error, force, the stream procedures and the parallel ones
+    extern const char* const library;
+
+    // The inline forms: fixnum and pair fast paths that fall back to the
+    // generic primitive, which reports the type error.
+    namespace inlined {
+      template <typename F>
+      GCRef fixnum(const GCRef& a, const GCRef& b, F f,
+        GCRef(*generic)(std::span<const GCRef>)) {
+        auto x = std::get_if<int64_t>(&*a);
+        auto y = std::get_if<int64_t>(&*b);
+        if (x && y) {
+          return f(*x, *y);
+        }
+        const GCRef args[] = { a, b };
+        return generic({ args, 2 });
+      }
+
+      inline GCRef add(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::plus<int64_t>(), &primitive::add);
+      }
+      inline GCRef sub(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::minus<int64_t>(), &primitive::sub);
+      }
+      inline GCRef mul(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::multiplies<int64_t>(), &primitive::mul);
+      }
+      inline GCRef less(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::less<int64_t>(), &primitive::less);
+      }
+      inline GCRef greater(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::greater<int64_t>(), &primitive::greater);
+      }
+      inline GCRef equal(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::equal_to<int64_t>(), &primitive::equal);
+      }
+      inline GCRef eqv(const GCRef& a, const GCRef& b) {
+        return fixnum(a, b, std::equal_to<int64_t>(), &primitive::eqv);
+      }
+
+      inline GCRef car(const GCRef& a) {
+        if (auto pair = std::get_if<Pair>(&*a)) {
+          return pair->first;
+        }
+        return primitive::car({ &a, 1 });
+      }
+      inline GCRef cdr(const GCRef& a) {
+        if (auto pair = std::get_if<Pair>(&*a)) {
+          return pair->second;
+        }
+        return primitive::cdr({ &a, 1 });
+      }
+      inline GCRef cons(const GCRef& a, const GCRef& b) {
+        return Pair{ a, b };
+      }
+    } // namespace inlined
+  } // namespace primitive
+} // namespace r5rs
+
+#endif
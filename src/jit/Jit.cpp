@@ -0,0 +1,241 @@
+#include "Jit.h"
+
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define R5RS_JIT_X86_64 1
+#else
+#define R5RS_JIT_X86_64 0
+#endif
+
+using namespace r5rs;
+using namespace r5rs::jit;
+
+namespace {
+  // x86-64 encodings for the few instructions the templates use
+  class Assembler {
+  public:
+    void bytes(std::initializer_list<uint8_t> values) {
+      code.insert(code.end(), values);
+    }
+
+    void u32(uint32_t value) {
+      for (int i = 0; i < 4; ++i) {
+        code.push_back(value >> i * 8 & 0xff);
+      }
+    }
+
+    void u64(uint64_t value) {
+      for (int i = 0; i < 8; ++i) {
+        code.push_back(value >> i * 8 & 0xff);
+      }
+    }
+
+    // a rel32 to be patched with the distance to `target` later
+    void rel32(size_t target) {
+      fixups.push_back({ code.size(), target });
+      u32(0);
+    }
+
+    // target of rel32 fixups naming `target`
+    void patch(const std::vector<size_t>& targets) {
+      for (auto&& [at, target] : fixups) {
+        int32_t rel = targets[target] - (at + 4);
+        std::memcpy(&code[at], &rel, 4);
+      }
+    }
+
+    // mov rdi, rbx; mov esi, arg; mov rax, helper; call rax
+    void call(Helper helper, uint32_t arg) {
+      bytes({ 0x48, 0x89, 0xdf });
+      bytes({ 0xbe });
+      u32(arg);
+      bytes({ 0x48, 0xb8 });
+      u64(reinterpret_cast<uint64_t>(helper));
+      bytes({ 0xff, 0xd0 });
+    }
+
+    // mov eax, pc; jmp epilogue
+    void exit(uint32_t pc, size_t epilogue) {
+      bytes({ 0xb8 });
+      u32(pc);
+      bytes({ 0xe9 });
+      rel32(epilogue);
+    }
+
+    // test eax, eax; jz over the exit
+    void exit_if_nonzero(uint32_t pc, size_t epilogue) {
+      bytes({ 0x85, 0xc0, 0x74, 0x0a });
+      exit(pc, epilogue);
+    }
+
+    std::vector<uint8_t> code;
+
+  private:
+    struct Fixup {
+      size_t at;
+      size_t target;
+    };
+    std::vector<Fixup> fixups;
+  };
+
+  // a local or a constant, which a fused helper can read in place
+  bool operand(vm::Op op) {
+    return op == vm::Op::local || op == vm::Op::constant;
+  }
+
+  // which fused helper runs the instructions from code[pc], if any
+  enum class Fusion { none, arithmetic, branch };
+
+  Fusion fusion(const std::vector<uint32_t>& code, size_t pc) {
+    using vm::Op;
+    if (pc + 3 > code.size() || !operand(vm::opcode(code[pc])) ||
+      !operand(vm::opcode(code[pc + 1]))) {
+      return Fusion::none;
+    }
+    switch (vm::opcode(code[pc + 2])) {
+    case Op::add:
+    case Op::sub:
+    case Op::mul:
+      return Fusion::arithmetic;
+    case Op::less:
+    case Op::greater:
+    case Op::equal:
+      return pc + 3 < code.size() && vm::opcode(code[pc + 3]) == Op::jump_false
+        ? Fusion::branch
+        : Fusion::none;
+    default:
+      return Fusion::none;
+    }
+  }
+} // namespace
+
+r5rs::jit::Jit::Jit(const std::array<Helper, 256>& helpers, Fused fused)
+  : helpers(helpers), fused(fused) {}
+
+r5rs::jit::Jit::~Jit() {
+#if R5RS_JIT_X86_64
+  for (auto&& mapping : mappings) {
+    munmap(mapping.address, mapping.size);
+  }
+#endif
+}
+
+bool r5rs::jit::Jit::supported() { return R5RS_JIT_X86_64; }
+
+vm::Native r5rs::jit::Jit::compile(const vm::Function& function) {
+#if R5RS_JIT_X86_64
+  using vm::Op;
+
+  auto n = function.code.size();
+  // labels[pc] for each instruction, then the epilogue and the jump to the
+  // pc in eax
+  std::vector<size_t> labels(n + 2);
+  auto epilogue = n;
+  auto indirect = n + 1;
+
+  Assembler a;
+  // push rbx, which also aligns the stack for calls; mov rbx, rdi (the
+  // context); mov eax, esi (the pc)
+  a.bytes({ 0x53, 0x48, 0x89, 0xfb, 0x89, 0xf0 });
+  // lea rcx, [rip + table]; jmp [rcx + rax * 8]
+  labels[indirect] = a.code.size();
+  a.bytes({ 0x48, 0x8d, 0x0d });
+  auto table_disp = a.code.size();
+  a.u32(0);
+  a.bytes({ 0xff, 0x24, 0xc1 });
+
+  for (uint32_t pc = 0; pc != n; ++pc) {
+    labels[pc] = a.code.size();
+    auto op = vm::opcode(function.code[pc]);
+    auto arg = vm::operand(function.code[pc]);
+    auto helper = helpers[static_cast<uint8_t>(op)];
+
+    // A fused run jumps past itself, or exits to let the vm run it from pc.
+    // The instructions after its first are still compiled one by one, for
+    // whatever enters or jumps between them.
+    auto fuse = fusion(function.code, pc);
+    if (fuse == Fusion::arithmetic && fused.arithmetic) {
+      a.call(fused.arithmetic, pc);
+      a.exit_if_nonzero(pc, epilogue);
+      a.bytes({ 0xe9 });
+      a.rel32(pc + 3);
+      continue;
+    }
+    else if (fuse == Fusion::branch && fused.branch) {
+      a.call(fused.branch, pc);
+      // cmp eax, 1; je target
+      a.bytes({ 0x83, 0xf8, 0x01, 0x0f, 0x84 });
+      a.rel32(vm::operand(function.code[pc + 3]));
+      a.exit_if_nonzero(pc, epilogue);
+      a.bytes({ 0xe9 });
+      a.rel32(pc + 4);
+      continue;
+    }
+
+    if (op == Op::jump) {
+      a.bytes({ 0xe9 });
+      a.rel32(arg);
+    }
+    else if (op == Op::jump_false && helper) {
+      a.call(helper, arg);
+      // cmp eax, 1; je target
+      a.bytes({ 0x83, 0xf8, 0x01, 0x0f, 0x84 });
+      a.rel32(arg);
+      a.exit_if_nonzero(pc, epilogue);
+    }
+    else if (op == Op::dispatch && helper) {
+      a.call(helper, arg);
+      // cmp eax, 3; jb to the exit; sub eax, 3; jmp indirect
+      a.bytes({ 0x83, 0xf8, 0x03, 0x72, 0x08, 0x83, 0xe8, 0x03, 0xe9 });
+      a.rel32(indirect);
+      a.exit(pc, epilogue);
+    }
+    else if (helper) {
+      a.call(helper, arg);
+      a.exit_if_nonzero(pc, epilogue);
+    }
+    else {
+      a.exit(pc, epilogue);
+    }
+  }
+
+  labels[epilogue] = a.code.size();
+  // pop rbx; ret
+  a.bytes({ 0x5b, 0xc3 });
+  a.patch(labels);
+
+  while (a.code.size() % 8) {
+    a.bytes({ 0xcc });
+  }
+  auto table = a.code.size();
+  int32_t disp = table - (table_disp + 4);
+  std::memcpy(&a.code[table_disp], &disp, 4);
+
+  auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  auto size = (table + n * 8 + page - 1) / page * page;
+  auto memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    throw std::runtime_error("jit: out of executable memory");
+  }
+  mappings.push_back({ memory, size });
+
+  auto base = static_cast<uint8_t*>(memory);
+  std::memcpy(base, a.code.data(), a.code.size());
+  for (size_t pc = 0; pc != n; ++pc) {
+    auto address = reinterpret_cast<uint64_t>(base + labels[pc]);
+    std::memcpy(base + table + pc * 8, &address, 8);
+  }
+
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    throw std::runtime_error("jit: cannot map code executable");
+  }
+  return reinterpret_cast<vm::Native>(memory);
+#else
+  return nullptr;
+#endif
+}
@@ -0,0 +1,62 @@
+#ifndef R5RS_JIT_H
+#define R5RS_JIT_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Bytecode.h"
+
+namespace r5rs {
+  namespace jit {
+    // Runs one instruction natively with the operand `arg`. Returns 0 when
+    // done, or nonzero to leave native code and let the VM execute the
+    // instruction. For jump_false, 1 means the jump is taken and anything
+    // else nonzero leaves native code.
+    using Helper = uint32_t (*)(void* context, uint32_t arg);
+
+    // Helpers for runs of instructions the jit fuses, called with the pc of
+    // the first: two operands, each a local or a constant, and a binary
+    // builtin. `arithmetic` runs an add, sub or mul, returning 0 when done.
+    // `branch` runs a <, > or = and the jump_false after it, returning 0 or 1
+    // like jump_false. Anything else leaves native code at that pc.
+    struct Fused {
+      Helper arithmetic = nullptr;
+      Helper branch = nullptr;
+    };
+
+    // A baseline template jit for x86-64. Each instruction of a function
+    // becomes a call to its helper, jumps become native jumps, and the VM
+    // takes over at calls into other functions and at returns. Native code
+    // is entered through a table with one address per pc. Fixnum arithmetic
+    // on locals and constants, and comparisons of them feeding a jump, take
+    // a single call to a fused helper, so their operands and the boolean are
+    // never pushed.
+    class Jit {
+    public:
+      explicit Jit(const std::array<Helper, 256>& helpers, Fused fused = {});
+      ~Jit();
+
+      Jit(const Jit&) = delete;
+      Jit& operator=(const Jit&) = delete;
+
+      // nullptr when this platform has no native code generator
+      vm::Native compile(const vm::Function& function);
+
+      static bool supported();
+
+    private:
+      std::array<Helper, 256> helpers;
+      Fused fused;
+
+      struct Mapping {
+        void* address;
+        size_t size;
+      };
+      std::vector<Mapping> mappings;
+    };
+  } // namespace jit
+} // namespace r5rs
+
+#endif
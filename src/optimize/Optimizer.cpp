@@ -0,0 +1,916 @@
+#include "Optimizer.h"
+
+#include "GC.h"
+
+using namespace r5rs;
+using namespace r5rs::expression;
+using namespace r5rs::optimize;
+
+namespace {
+  // primitives without side effects, folded when every operand is constant
+  const std::unordered_set<std::string> pure{ "+", "-", "*", "=", "<", ">",
+    "eqv?", "car", "cdr", "empty?" };
+
+  // the largest global function inlined, in nodes
+  const size_t inline_limit = 16;
+
+  void names(Definition* def, std::unordered_set<std::string>& res) {
+    auto visitor = overloaded{
+        [&](Define* define) { res.insert(define->variable); },
+        [&](Definitions* defs) {
+          for (auto&& def : defs->defs) {
+            names(def.get(), res);
+          }
+        },
+    };
+    std::visit(visitor, def->def_type());
+  }
+
+  // The names an expression binds anywhere inside it, those it uses free
+  // and those it assigns, and its size in nodes.
+  class Names {
+  public:
+    explicit Names(std::unordered_set<std::string> scope = {}) {
+      scopes.push_back(std::move(scope));
+    }
+
+    std::unordered_set<std::string> bound;
+    std::unordered_set<std::string> free;
+    std::unordered_set<std::string> assigned;
+    size_t size = 0;
+
+    void operator()(COD* cod) { std::visit(*this, cod->cod_type()); }
+    void operator()(Exp* exp) { std::visit(*this, exp->exp_type()); }
+    void operator()(Definition* def) { std::visit(*this, def->def_type()); }
+
+    void operator()(CODs* cods) {
+      for (auto&& cod : cods->cods) {
+        (*this)(cod.get());
+      }
+    }
+
+    void operator()(Variable* var) {
+      ++size;
+      use(var->id);
+    }
+
+    void operator()(Literal*) { ++size; }
+
+    void operator()(Call* call) {
+      ++size;
+      (*this)(call->op.get());
+      for (auto&& operand : call->operands) {
+        (*this)(operand.get());
+      }
+    }
+
+    void operator()(Lambda* lambda) {
+      ++size;
+      std::unordered_set<std::string> scope(lambda->formals->fixed.begin(),
+        lambda->formals->fixed.end());
+      if (lambda->formals->binding) {
+        scope.insert(*lambda->formals->binding);
+      }
+      for (auto&& def : lambda->body->defs) {
+        names(def.get(), scope);
+      }
+      bound.insert(scope.begin(), scope.end());
+
+      scopes.push_back(std::move(scope));
+      for (auto&& def : lambda->body->defs) {
+        (*this)(def.get());
+      }
+      for (auto&& exp : lambda->body->exps) {
+        (*this)(exp.get());
+      }
+      scopes.pop_back();
+    }
+
+    void operator()(Conditional* condition) {
+      ++size;
+      (*this)(condition->test.get());
+      (*this)(condition->consequent.get());
+      if (condition->alternate) {
+        (*this)(condition->alternate.get());
+      }
+    }
+
+    void operator()(Assignment* assign) {
+      ++size;
+      assigned.insert(assign->variable);
+      use(assign->variable);
+      (*this)(assign->exp.get());
+    }
+
+    void operator()(And* conjunction) {
+      ++size;
+      for (auto&& exp : conjunction->exps) {
+        (*this)(exp.get());
+      }
+    }
+
+    void operator()(Or* disjunction) {
+      ++size;
+      for (auto&& exp : disjunction->exps) {
+        (*this)(exp.get());
+      }
+    }
+
+    void operator()(Cond* cond) {
+      ++size;
+      for (auto&& clause : cond->clauses) {
+        if (clause.test) {
+          (*this)(clause.test.get());
+        }
+        for (auto&& exp : clause.exps) {
+          (*this)(exp.get());
+        }
+        if (clause.receiver) {
+          (*this)(clause.receiver.get());
+        }
+      }
+    }
+
+    void operator()(Case* selection) {
+      ++size;
+      (*this)(selection->key.get());
+      for (auto&& clause : selection->clauses) {
+        for (auto&& exp : clause.exps) {
+          (*this)(exp.get());
+        }
+      }
+      for (auto&& exp : selection->otherwise) {
+        (*this)(exp.get());
+      }
+    }
+
+    void operator()(Let* let) { (*this)(let->core.get()); }
+
+    void operator()(Do* loop) { (*this)(loop->loop.get()); }
+
+    void operator()(Define* define) {
+      ++size;
+      (*this)(define->exp.get());
+    }
+
+    void operator()(Definitions* defs) {
+      for (auto&& def : defs->defs) {
+        (*this)(def.get());
+      }
+    }
+
+  private:
+    void use(const std::string& name) {
+      for (auto&& scope : scopes) {
+        if (scope.count(name)) {
+          return;
+        }
+      }
+      free.insert(name);
+    }
+
+    std::vector<std::unordered_set<std::string>> scopes;
+  };
+
+  // Appends the uses of `names` an expression is sure to make, in the order
+  // it makes them, or gives false if it may also use them where they need
+  // not be evaluated, in a branch or a lambda.
+  bool sure_uses(Exp* exp, const std::unordered_set<std::string>& names,
+    std::vector<std::string>& res) {
+    auto type = exp->exp_type();
+    if (auto var = std::get_if<Variable*>(&type)) {
+      if (names.count((*var)->id)) {
+        res.push_back((*var)->id);
+      }
+      return true;
+    }
+    if (auto call = std::get_if<Call*>(&type)) {
+      if (!sure_uses((*call)->op.get(), names, res)) {
+        return false;
+      }
+      for (auto&& operand : (*call)->operands) {
+        if (!sure_uses(operand.get(), names, res)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    if (auto condition = std::get_if<Conditional*>(&type)) {
+      if (!sure_uses((*condition)->test.get(), names, res)) {
+        return false;
+      }
+      Names walk;
+      walk((*condition)->consequent.get());
+      if ((*condition)->alternate) {
+        walk((*condition)->alternate.get());
+      }
+      for (auto&& name : names) {
+        if (walk.free.count(name)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    Names walk;
+    walk(exp);
+    for (auto&& name : names) {
+      if (walk.free.count(name)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  ExpPtr nil() {
+    return std::make_shared<Literal>(
+      std::make_shared<ListDatum>(std::list<DatumPtr>{}));
+  }
+
+  // whether a constant expression is true, or nullopt if it is not constant
+  std::optional<bool> truth(Exp* exp) {
+    auto type = exp->exp_type();
+    if (std::holds_alternative<Lambda*>(type)) {
+      return true;
+    }
+    auto literal = std::get_if<Literal*>(&type);
+    if (!literal) {
+      return std::nullopt;
+    }
+    auto visitor = overloaded{
+        [](const DatumPtr& datum) -> bool {
+          auto type = datum->datum_type();
+          auto list = std::get_if<ListDatum*>(&type);
+          return !list || !(*list)->list.empty();
+        },
+        [](bool b) -> bool { return b; },
+        [](const auto&) -> bool { return true; },
+    };
+    return std::visit(visitor, (*literal)->value);
+  }
+
+  ExpPtr literal(const GCValue& value) {
+    auto visitor = overloaded{
+        [](bool b) -> ExpPtr { return std::make_shared<Literal>(b); },
+        [](char c) -> ExpPtr { return std::make_shared<Literal>(c); },
+        [](int64_t i) -> ExpPtr { return std::make_shared<Literal>(i); },
+        [](const std::string& s) -> ExpPtr {
+          return std::make_shared<Literal>(s);
+        },
+        [&](auto&&) -> ExpPtr {
+          auto res = quote(value);
+          return res ? std::make_shared<Literal>(std::move(res)) : nullptr;
+        },
+    };
+    return std::visit(visitor, value);
+  }
+
+  class Printer {
+  public:
+    std::string operator()(COD* cod) { return std::visit(*this, cod->cod_type()); }
+    std::string operator()(Exp* exp) { return std::visit(*this, exp->exp_type()); }
+    std::string operator()(Definition* def) {
+      return std::visit(*this, def->def_type());
+    }
+    std::string operator()(Datum* datum) {
+      return std::visit(*this, datum->datum_type());
+    }
+
+    std::string operator()(CODs* cods) {
+      std::string res = "(begin";
+      for (auto&& cod : cods->cods) {
+        res += " " + (*this)(cod.get());
+      }
+      return res + ")";
+    }
+
+    std::string operator()(bool b) { return b ? "#t" : "#f"; }
+    std::string operator()(char c) { return std::string("#\\") + c; }
+    std::string operator()(int64_t i) { return std::to_string(i); }
+    std::string operator()(const std::string& s) { return '"' + s + '"'; }
+    std::string operator()(const Symbol& symbol) { return symbol.name; }
+    std::string operator()(const DatumPtr& datum) {
+      return "'" + (*this)(datum.get());
+    }
+
+    std::string operator()(SimpleDatum* datum) {
+      return std::visit(*this, datum->value);
+    }
+
+    std::string operator()(ListDatum* list) {
+      return "(" + join(list->list) + ")";
+    }
+
+    std::string operator()(VectorDatum* vec) {
+      return "#(" + join(vec->list) + ")";
+    }
+
+    std::string operator()(Variable* var) { return var->id; }
+
+    std::string operator()(Literal* literal) {
+      return std::visit(*this, literal->value);
+    }
+
+    std::string operator()(Call* call) {
+      std::string res = "(" + (*this)(call->op.get());
+      for (auto&& operand : call->operands) {
+        res += " " + (*this)(operand.get());
+      }
+      return res + ")";
+    }
+
+    std::string operator()(Lambda* lambda) {
+      auto&& formals = *lambda->formals;
+      std::string params;
+      for (auto&& name : formals.fixed) {
+        params += (params.empty() ? "" : " ") + name;
+      }
+      if (formals.fixed.empty() && formals.binding) {
+        params = *formals.binding;
+      }
+      else if (formals.binding) {
+        params = "(" + params + " . " + *formals.binding + ")";
+      }
+      else {
+        params = "(" + params + ")";
+      }
+
+      std::string res = "(lambda " + params;
+      for (auto&& def : lambda->body->defs) {
+        res += " " + (*this)(def.get());
+      }
+      for (auto&& exp : lambda->body->exps) {
+        res += " " + (*this)(exp.get());
+      }
+      return res + ")";
+    }
+
+    std::string operator()(Conditional* condition) {
+      auto res = "(if " + (*this)(condition->test.get()) + " " +
+        (*this)(condition->consequent.get());
+      if (condition->alternate) {
+        res += " " + (*this)(condition->alternate.get());
+      }
+      return res + ")";
+    }
+
+    std::string operator()(Assignment* assign) {
+      return "(set! " + assign->variable + " " + (*this)(assign->exp.get()) +
+        ")";
+    }
+
+    std::string operator()(And* conjunction) {
+      return "(and" + sequence(conjunction->exps) + ")";
+    }
+
+    std::string operator()(Or* disjunction) {
+      return "(or" + sequence(disjunction->exps) + ")";
+    }
+
+    std::string operator()(Cond* cond) {
+      std::string res = "(cond";
+      for (auto&& clause : cond->clauses) {
+        res += " (" + (clause.test ? (*this)(clause.test.get()) : "else");
+        if (clause.receiver) {
+          res += " => " + (*this)(clause.receiver.get());
+        }
+        res += sequence(clause.exps) + ")";
+      }
+      return res + ")";
+    }
+
+    std::string operator()(Case* selection) {
+      auto res = "(case " + (*this)(selection->key.get());
+      for (auto&& clause : selection->clauses) {
+        res += " ((" + join(clause.data) + ")" + sequence(clause.exps) + ")";
+      }
+      if (!selection->otherwise.empty()) {
+        res += " (else" + sequence(selection->otherwise) + ")";
+      }
+      return res + ")";
+    }
+
+    std::string operator()(Let* let) {
+      std::string res = "(let ";
+      if (let->name) {
+        res += *let->name + " ";
+      }
+      std::string bindings;
+      auto init = let->inits.begin();
+      for (auto&& variable : let->lambda->formals->fixed) {
+        bindings += (bindings.empty() ? "(" : " (") + variable + " " +
+          (*this)((init++)->get()) + ")";
+      }
+      res += "(" + bindings + ")";
+      for (auto&& def : let->lambda->body->defs) {
+        res += " " + (*this)(def.get());
+      }
+      return res + sequence(let->lambda->body->exps) + ")";
+    }
+
+    std::string operator()(Do* loop) {
+      std::string steps;
+      for (auto&& step : loop->steps) {
+        steps += (steps.empty() ? "(" : " (") + step.variable + " " +
+          (*this)(step.init.get());
+        if (step.step) {
+          steps += " " + (*this)(step.step.get());
+        }
+        steps += ")";
+      }
+      return "(do (" + steps + ") (" + (*this)(loop->test.get()) +
+        sequence(loop->results) + ")" + sequence(loop->commands) + ")";
+    }
+
+    std::string operator()(Define* define) {
+      return "(define " + define->variable + " " +
+        (*this)(define->exp.get()) + ")";
+    }
+
+    std::string operator()(Definitions* defs) {
+      std::string res = "(begin";
+      for (auto&& def : defs->defs) {
+        res += " " + (*this)(def.get());
+      }
+      return res + ")";
+    }
+
+  private:
+    // each expression after a space
+    std::string sequence(const std::list<ExpPtr>& exps) {
+      std::string res;
+      for (auto&& exp : exps) {
+        res += " " + (*this)(exp.get());
+      }
+      return res;
+    }
+
+    std::string join(const std::list<DatumPtr>& list) {
+      std::string res;
+      for (auto&& datum : list) {
+        res += (res.empty() ? "" : " ") + (*this)(datum.get());
+      }
+      return res;
+    }
+  };
+} // namespace
+
+r5rs::optimize::Optimizer::Optimizer(const std::list<CODPtr>& program) {
+  auto top = [&](auto&& self, COD* cod) -> void {
+    auto type = cod->cod_type();
+    if (auto cods = std::get_if<CODs*>(&type)) {
+      for (auto&& c : (*cods)->cods) {
+        self(self, c.get());
+      }
+    }
+    else if (auto def = std::get_if<Definition*>(&type)) {
+      std::unordered_set<std::string> defs;
+      names(*def, defs);
+      for (auto&& name : defs) {
+        // defining a name twice fails at run time; treat it as assigned
+        if (!defined.insert(name).second) {
+          assigned.insert(name);
+        }
+      }
+    }
+  };
+
+  Names walk;
+  for (auto&& cod : program) {
+    top(top, cod.get());
+    walk(cod.get());
+  }
+  assigned.insert(walk.assigned.begin(), walk.assigned.end());
+}
+
+CODPtr r5rs::optimize::Optimizer::operator()(const CODPtr& cod) {
+  auto type = cod->cod_type();
+  if (auto cods = std::get_if<CODs*>(&type)) {
+    std::list<CODPtr> res;
+    for (auto&& c : (*cods)->cods) {
+      res.push_back((*this)(c));
+    }
+    return std::make_shared<CODs>(std::move(res));
+  }
+  if (std::holds_alternative<Exp*>(type)) {
+    return (*this)(std::static_pointer_cast<Exp>(cod));
+  }
+
+  auto res = (*this)(std::static_pointer_cast<Definition>(cod));
+  // a top level define that never changes makes its value known to the
+  // forms that follow
+  auto def = res->def_type();
+  if (auto define = std::get_if<Define*>(&def)) {
+    auto&& name = (*define)->variable;
+    auto&& exp = (*define)->exp;
+    auto value = exp->exp_type();
+    if (!assigned.count(name)) {
+      if (std::holds_alternative<Literal*>(value)) {
+        constants[name] = exp;
+      }
+      else if (auto lambda = std::get_if<Lambda*>(&value)) {
+        Names walk;
+        walk(*lambda);
+        if (!walk.free.count(name) && walk.size <= inline_limit) {
+          functions[name] = std::static_pointer_cast<Lambda>(exp);
+        }
+      }
+    }
+  }
+  return res;
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(const ExpPtr& exp) {
+  return std::visit(*this, exp->exp_type());
+}
+
+DefinitionPtr r5rs::optimize::Optimizer::operator()(const DefinitionPtr& def) {
+  return std::visit(*this, def->def_type());
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Variable* var) {
+  for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+    auto found = it->find(var->id);
+    if (found != it->end()) {
+      return found->second ? found->second
+                           : std::make_shared<Variable>(var->id);
+    }
+  }
+  auto constant = constants.find(var->id);
+  if (constant != constants.end()) {
+    return constant->second;
+  }
+  return std::make_shared<Variable>(var->id);
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Literal* literal) {
+  return std::make_shared<Literal>(*literal);
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Call* call) {
+  auto op = (*this)(call->op);
+  std::list<ExpPtr> operands;
+  for (auto&& operand : call->operands) {
+    operands.push_back((*this)(operand));
+  }
+
+  auto type = op->exp_type();
+  if (std::holds_alternative<Lambda*>(type)) {
+    auto lambda = std::static_pointer_cast<Lambda>(op);
+    if (auto res = inline_call(*lambda, operands, false)) {
+      return res;
+    }
+  }
+  else if (auto var = std::get_if<Variable*>(&type)) {
+    auto&& name = (*var)->id;
+    auto function = functions.find(name);
+    if (!local(name) && function != functions.end() &&
+      !inlining.count(name)) {
+      inlining.insert(name);
+      auto res = inline_call(*function->second, operands, true);
+      inlining.erase(name);
+      if (res) {
+        return res;
+      }
+    }
+    if (!local(name)) {
+      if (auto res = fold(name, operands)) {
+        return res;
+      }
+    }
+  }
+  return std::make_shared<Call>(op, std::move(operands));
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Lambda* lambda) {
+  std::unordered_map<std::string, ExpPtr> scope;
+  for (auto&& name : lambda->formals->fixed) {
+    scope[name] = nullptr;
+  }
+  if (lambda->formals->binding) {
+    scope[*lambda->formals->binding] = nullptr;
+  }
+  std::unordered_set<std::string> defs;
+  for (auto&& def : lambda->body->defs) {
+    names(def.get(), defs);
+  }
+  for (auto&& name : defs) {
+    scope[name] = nullptr;
+  }
+
+  scopes.push_back(std::move(scope));
+  auto res = std::make_shared<Lambda>(lambda->formals, body(*lambda->body));
+  res->name = lambda->name;
+  res->line = lambda->line;
+  res->col = lambda->col;
+  scopes.pop_back();
+  return res;
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Conditional* condition) {
+  auto test = (*this)(condition->test);
+  if (auto known = truth(test.get())) {
+    auto&& branch = *known ? condition->consequent : condition->alternate;
+    return branch ? (*this)(branch) : nil();
+  }
+  return std::make_shared<Conditional>(test, (*this)(condition->consequent),
+    condition->alternate ? (*this)(condition->alternate) : nullptr);
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Assignment* assign) {
+  return std::make_shared<Assignment>(assign->variable,
+    (*this)(assign->exp));
+}
+
+// Operands known to be true are dropped, and the first known to be false
+// ends the and as its value; or is the same the other way around.
+ExpPtr r5rs::optimize::Optimizer::operator()(And* conjunction) {
+  std::list<ExpPtr> exps;
+  for (auto it = conjunction->exps.begin(); it != conjunction->exps.end();
+    ++it) {
+    auto exp = (*this)(*it);
+    auto known = truth(exp.get());
+    if (known && *known && std::next(it) != conjunction->exps.end()) {
+      continue;
+    }
+    exps.push_back(std::move(exp));
+    if (known && !*known) {
+      break;
+    }
+  }
+  if (exps.empty()) {
+    return std::make_shared<Literal>(true);
+  }
+  if (exps.size() == 1) {
+    return exps.front();
+  }
+  return std::make_shared<And>(std::move(exps));
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Or* disjunction) {
+  std::list<ExpPtr> exps;
+  for (auto it = disjunction->exps.begin(); it != disjunction->exps.end();
+    ++it) {
+    auto exp = (*this)(*it);
+    auto known = truth(exp.get());
+    if (known && !*known && std::next(it) != disjunction->exps.end()) {
+      continue;
+    }
+    exps.push_back(std::move(exp));
+    if (known && *known) {
+      break;
+    }
+  }
+  if (exps.empty()) {
+    return std::make_shared<Literal>(false);
+  }
+  if (exps.size() == 1) {
+    return exps.front();
+  }
+  return std::make_shared<Or>(std::move(exps));
+}
+
+// Clauses whose test is known to be false are dropped, and those after one
+// known to be true.
+ExpPtr r5rs::optimize::Optimizer::operator()(Cond* cond) {
+  std::list<Cond::Clause> clauses;
+  for (auto&& clause : cond->clauses) {
+    Cond::Clause res{ nullptr, sequence(clause.exps), nullptr };
+    if (clause.test) {
+      res.test = (*this)(clause.test);
+    }
+    if (clause.receiver) {
+      res.receiver = (*this)(clause.receiver);
+    }
+    auto known = res.test ? truth(res.test.get()) : true;
+    if (known && !*known) {
+      continue;
+    }
+    clauses.push_back(std::move(res));
+    if (known) {
+      break;
+    }
+  }
+  if (clauses.empty()) {
+    return nil();
+  }
+  return std::make_shared<Cond>(std::move(clauses));
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Case* selection) {
+  std::vector<Case::Clause> clauses;
+  for (auto&& clause : selection->clauses) {
+    clauses.push_back({ clause.data, sequence(clause.exps) });
+  }
+  return std::make_shared<Case>((*this)(selection->key), std::move(clauses),
+    sequence(selection->otherwise));
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Let* let) {
+  std::list<ExpPtr> inits;
+  for (auto&& init : let->inits) {
+    inits.push_back((*this)(init));
+  }
+
+  if (let->name) {
+    scopes.push_back({ { *let->name, nullptr } });
+  }
+  auto lambda = std::static_pointer_cast<Lambda>((*this)(let->lambda.get()));
+  if (let->name) {
+    scopes.pop_back();
+  }
+  else if (auto res = inline_call(*lambda, inits, false)) {
+    return res;
+  }
+  return std::make_shared<Let>(let->name, lambda->formals->fixed,
+    std::move(inits), lambda->body);
+}
+
+ExpPtr r5rs::optimize::Optimizer::operator()(Do* loop) {
+  std::list<Do::Step> steps;
+  std::unordered_map<std::string, ExpPtr> scope;
+  for (auto&& step : loop->steps) {
+    steps.push_back({ step.variable, (*this)(step.init), step.step });
+    scope[step.variable] = nullptr;
+  }
+
+  scopes.push_back(std::move(scope));
+  for (auto&& step : steps) {
+    if (step.step) {
+      step.step = (*this)(step.step);
+    }
+  }
+  auto test = (*this)(loop->test);
+  auto results = sequence(loop->results);
+  auto commands = sequence(loop->commands);
+  scopes.pop_back();
+
+  return std::make_shared<Do>(std::move(steps), test, std::move(results),
+    std::move(commands));
+}
+
+DefinitionPtr r5rs::optimize::Optimizer::operator()(Define* define) {
+  return std::make_shared<Define>(define->variable, (*this)(define->exp));
+}
+
+DefinitionPtr r5rs::optimize::Optimizer::operator()(Definitions* defs) {
+  std::list<DefinitionPtr> res;
+  for (auto&& def : defs->defs) {
+    res.push_back((*this)(def));
+  }
+  return std::make_shared<Definitions>(std::move(res));
+}
+
+// A call of a pure primitive on literals as the literal for its result, or
+// nullptr. A call that fails is left for the error to happen at run time.
+ExpPtr r5rs::optimize::Optimizer::fold(const std::string& name,
+  const std::list<ExpPtr>& operands) {
+  if (!pure.count(name) || assigned.count(name) || defined.count(name)) {
+    return nullptr;
+  }
+
+  std::vector<GCRef> args;
+  for (auto&& operand : operands) {
+    auto type = operand->exp_type();
+    auto literal = std::get_if<Literal*>(&type);
+    if (!literal) {
+      return nullptr;
+    }
+    args.push_back(std::invoke(interpreter, *literal));
+  }
+
+  auto&& primitive = std::get<Primitive>(**interpreter.env->get(name));
+  try {
+    primitive.check(args.size());
+    auto res = std::invoke(primitive.fn, std::span<const GCRef>(args));
+    return literal(*res);
+  }
+  catch (const std::runtime_error&) {
+    return nullptr;
+  }
+}
+
+// The body of a lambda of one expression with its parameters replaced by
+// the operands, or nullptr. Only literals and variables nobody assigns are
+// substituted, so no evaluation is duplicated. A variable that may not be
+// bound can fail, so its parameter must be used exactly once, for sure and
+// in the order of the operands, for the failure not to be dropped or
+// reordered. A global function's free variables must not be shadowed where
+// it is called.
+ExpPtr r5rs::optimize::Optimizer::inline_call(const Lambda& lambda,
+  const std::list<ExpPtr>& operands, bool global) {
+  auto&& formals = *lambda.formals;
+  auto&& body = *lambda.body;
+  if (formals.binding || formals.fixed.size() != operands.size() ||
+    !body.defs.empty() || body.exps.size() != 1) {
+    return nullptr;
+  }
+
+  Names walk({ formals.fixed.begin(), formals.fixed.end() });
+  walk(body.exps.front().get());
+  if (global) {
+    for (auto&& name : walk.free) {
+      if (local(name)) {
+        return nullptr;
+      }
+    }
+  }
+
+  std::unordered_map<std::string, ExpPtr> scope;
+  std::vector<std::string> failing;
+  auto param = formals.fixed.begin();
+  for (auto&& operand : operands) {
+    if (assigned.count(*param) || !trivial(operand)) {
+      return nullptr;
+    }
+    auto type = operand->exp_type();
+    auto var = std::get_if<Variable*>(&type);
+    if (var && walk.bound.count((*var)->id)) {
+      return nullptr;
+    }
+    if (var && !bound((*var)->id)) {
+      failing.push_back(*param);
+    }
+    scope[*param++] = operand;
+  }
+
+  if (!failing.empty()) {
+    std::vector<std::string> uses;
+    if (!sure_uses(body.exps.front().get(),
+      { failing.begin(), failing.end() }, uses) || uses != failing) {
+      return nullptr;
+    }
+  }
+
+  scopes.push_back(std::move(scope));
+  auto res = (*this)(body.exps.front());
+  scopes.pop_back();
+  return res;
+}
+
+// Constants and lambdas before the last expression are dropped.
+std::shared_ptr<Body> r5rs::optimize::Optimizer::body(const Body& body) {
+  std::list<DefinitionPtr> defs;
+  for (auto&& def : body.defs) {
+    defs.push_back((*this)(def));
+  }
+
+  std::list<ExpPtr> exps;
+  for (auto it = body.exps.begin(); it != body.exps.end(); ++it) {
+    auto exp = (*this)(*it);
+    auto type = exp->exp_type();
+    if (std::next(it) != body.exps.end() &&
+      (std::holds_alternative<Literal*>(type) ||
+        std::holds_alternative<Lambda*>(type))) {
+      continue;
+    }
+    exps.push_back(std::move(exp));
+  }
+  return std::make_shared<Body>(std::move(defs), std::move(exps));
+}
+
+std::list<ExpPtr> r5rs::optimize::Optimizer::sequence(
+  const std::list<ExpPtr>& exps) {
+  std::list<ExpPtr> res;
+  for (auto&& exp : exps) {
+    res.push_back((*this)(exp));
+  }
+  return res;
+}
+
+bool r5rs::optimize::Optimizer::local(const std::string& name) const {
+  for (auto&& scope : scopes) {
+    if (scope.count(name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// whether reading a variable is sure not to fail
+bool r5rs::optimize::Optimizer::bound(const std::string& name) const {
+  return local(name) || constants.count(name) || functions.count(name) ||
+    interpreter.env->get(name);
+}
+
+bool r5rs::optimize::Optimizer::trivial(const ExpPtr& exp) const {
+  auto type = exp->exp_type();
+  if (std::holds_alternative<Literal*>(type)) {
+    return true;
+  }
+  auto var = std::get_if<Variable*>(&type);
+  return var && !assigned.count((*var)->id);
+}
+
+IStream<CODPtr> r5rs::optimize::optimize(IStream<CODPtr> input) {
+  auto program = input.list();
+  Optimizer optimizer(program);
+  std::vector<CODPtr> res;
+  for (auto&& cod : program) {
+    res.push_back(optimizer(cod));
+  }
+  return IStream<CODPtr>(std::move(res));
+}
+
+std::string r5rs::optimize::to_string(COD* cod) {
+  return Printer()(cod);
+}
@@ -0,0 +1,95 @@
+#ifndef R5RS_OPTIMIZER_H
+#define R5RS_OPTIMIZER_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Stream.h"
+
+namespace r5rs {
+  namespace optimize {
+    // Rewrites the forms of a program before they are evaluated. Calls of
+    // pure primitives on constants are folded, conditionals, and, or and
+    // cond with constant tests lose the parts never evaluated, and small
+    // lambdas applied directly, bound by a let or by a top level define are
+    // inlined, substituting constant and variable arguments for their
+    // parameters, as long as an unbound argument still fails where it did.
+    //
+    // Names the program assigns with set! anywhere are never taken to be a
+    // known primitive, constant or function, and neither are primitives the
+    // program defines itself, so the rewrite only needs the whole program
+    // up front.
+    class Optimizer {
+    public:
+      explicit Optimizer(const std::list<expression::CODPtr>& program);
+
+      // the next top level form of the program
+      expression::CODPtr operator()(const expression::CODPtr& cod);
+
+      expression::ExpPtr operator()(const expression::ExpPtr& exp);
+      expression::DefinitionPtr operator()(
+        const expression::DefinitionPtr& def);
+
+      expression::ExpPtr operator()(expression::Variable*);
+      expression::ExpPtr operator()(expression::Literal*);
+      expression::ExpPtr operator()(expression::Call*);
+      expression::ExpPtr operator()(expression::Lambda*);
+      expression::ExpPtr operator()(expression::Conditional*);
+      expression::ExpPtr operator()(expression::Assignment*);
+      expression::ExpPtr operator()(expression::And*);
+      expression::ExpPtr operator()(expression::Or*);
+      expression::ExpPtr operator()(expression::Cond*);
+      expression::ExpPtr operator()(expression::Case*);
+      expression::ExpPtr operator()(expression::Let*);
+      expression::ExpPtr operator()(expression::Do*);
+
+      expression::DefinitionPtr operator()(expression::Define*);
+      expression::DefinitionPtr operator()(expression::Definitions*);
+
+    private:
+      expression::ExpPtr fold(const std::string& name,
+        const std::list<expression::ExpPtr>& operands);
+      expression::ExpPtr inline_call(const expression::Lambda& lambda,
+        const std::list<expression::ExpPtr>& operands, bool global);
+      std::shared_ptr<expression::Body> body(const expression::Body& body);
+      std::list<expression::ExpPtr> sequence(
+        const std::list<expression::ExpPtr>& exps);
+
+      bool local(const std::string& name) const;
+      bool bound(const std::string& name) const;
+      bool trivial(const expression::ExpPtr& exp) const;
+
+      // names assigned or defined at top level anywhere in the program
+      std::unordered_set<std::string> assigned;
+      std::unordered_set<std::string> defined;
+
+      // top level bindings seen so far that are known never to change
+      std::unordered_map<std::string, expression::ExpPtr> constants;
+      std::unordered_map<std::string, std::shared_ptr<expression::Lambda>>
+        functions;
+
+      // local bindings, innermost last, with the expression substituted for
+      // each one or nullptr
+      std::vector<std::unordered_map<std::string, expression::ExpPtr>> scopes;
+
+      // global functions being inlined, to stop at recursion
+      std::unordered_set<std::string> inlining;
+
+      // evaluates literals and folds primitives
+      Interpreter interpreter;
+    };
+
+    // The whole of `input` optimized.
+    IStream<expression::CODPtr> optimize(IStream<expression::CODPtr> input);
+
+    // A form printed back as Scheme.
+    std::string to_string(expression::COD* cod);
+  } // namespace optimize
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,182 @@
+#include "Future.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Interpreter.h"
+
+using namespace r5rs;
+using namespace parallel;
+
+namespace {
+  // the interpreter a thread runs jobs with, apart from any it evaluates
+  // its own program with
+  Interpreter& runner() {
+    thread_local Interpreter interpreter;
+    return interpreter;
+  }
+
+  // the futures this thread forked, and whether it is running a job now
+  thread_local std::vector<std::weak_ptr<Job>> forked;
+  thread_local bool inside = false;
+} // namespace
+
+r5rs::parallel::Job::Job(GCRef procedure, std::vector<GCRef> operands)
+  : task(std::make_shared<Task>([this] { run(); })),
+  procedure(std::move(procedure)), operands(std::move(operands)) {}
+
+// A job nobody waits for is dropped if it has not started, and otherwise
+// finishes before its roots go. Running other tasks meanwhile could
+// allocate in the middle of the sweep that freed the future.
+r5rs::parallel::Job::~Job() {
+  if (!task->cancel()) {
+    task->wait(false);
+  }
+}
+
+std::vector<GCRef> r5rs::parallel::Job::results() {
+  if (!task->run()) {
+    task->wait();
+  }
+  release();
+  if (!error.empty()) {
+    throw std::runtime_error(error);
+  }
+  if (values.empty()) {
+    throw std::runtime_error("future cancelled!");
+  }
+  std::vector<GCRef> res;
+  for (auto&& value : values) {
+    res.push_back(expression::value(value.get()));
+  }
+  return res;
+}
+
+void r5rs::parallel::Job::run() {
+  auto outer = std::exchange(inside, true);
+  try {
+    auto&& closure = std::get<ClosureLambda>(**procedure);
+    auto call = [&](std::span<const GCRef> args) {
+      auto value = runner().apply(closure, args);
+      auto datum = expression::quote(*value);
+      if (!datum) {
+        throw std::runtime_error("future result is not data!");
+      }
+      values.push_back(std::move(datum));
+    };
+    if (operands.empty()) {
+      call({});
+    }
+    for (auto&& operand : operands) {
+      call({ &operand, 1 });
+    }
+  }
+  catch (const std::exception& e) {
+    error = e.what();
+  }
+  catch (...) {
+    error = "future failed!";
+  }
+  inside = outer;
+}
+
+// the roots belong to the owner's heap, so only its thread may drop them
+void r5rs::parallel::Job::release() {
+  if (std::this_thread::get_id() == owner) {
+    procedure.reset();
+    operands.clear();
+  }
+}
+
+bool r5rs::parallel::runs(const GCValue& procedure) {
+  return std::holds_alternative<ClosureLambda>(procedure);
+}
+
+GCRef r5rs::parallel::fork(std::span<const GCRef> args) {
+  if (!runs(*args[0])) {
+    return false;
+  }
+  auto job = std::make_shared<Job>(args[0], std::vector<GCRef>{});
+  Pool::instance().submit(job->task);
+  forked.push_back(job);
+  return Future{ std::move(job) };
+}
+
+// A job's own definitions go to the heap of its runner, which no other
+// job reads, so only a thread outside any job waits.
+void r5rs::parallel::settle() {
+  if (inside) {
+    return;
+  }
+  for (auto&& weak : forked) {
+    if (auto job = weak.lock()) {
+      if (!job->task->run()) {
+        job->task->wait();
+      }
+    }
+  }
+  forked.clear();
+}
+
+GCRef r5rs::parallel::touch(std::span<const GCRef> args) {
+  auto future = std::get_if<Future>(&*args[0]);
+  if (!future) {
+    return args[0];
+  }
+  return future->job->results().front();
+}
+
+GCRef r5rs::parallel::is_future(std::span<const GCRef> args) {
+  return std::holds_alternative<Future>(*args[0]);
+}
+
+GCRef r5rs::parallel::parallel_map(std::span<const GCRef> args) {
+  if (!runs(*args[0])) {
+    return false;
+  }
+
+  std::vector<GCRef> items;
+  auto vector = std::get_if<Vector>(&*args[1]);
+  if (vector) {
+    items.assign(vector->begin(), vector->end());
+  }
+  else {
+    const GCValue* rest = &*args[1];
+    while (auto pair = std::get_if<Pair>(rest)) {
+      items.emplace_back(pair->first);
+      rest = &*pair->second;
+    }
+    if (!std::holds_alternative<nullptr_t>(*rest)) {
+      throw std::runtime_error("Argument type error!");
+    }
+  }
+
+  // a few chunks for each worker and the caller, so that one slow chunk
+  // holds up little of the rest
+  auto&& pool = Pool::instance();
+  auto chunks = std::min(items.size(), (pool.size() + 1) * 4);
+  std::vector<std::shared_ptr<Job>> jobs;
+  for (size_t i = 0; i < chunks; ++i) {
+    auto begin = items.begin() + items.size() * i / chunks;
+    auto end = items.begin() + items.size() * (i + 1) / chunks;
+    jobs.push_back(
+      std::make_shared<Job>(args[0], std::vector<GCRef>(begin, end)));
+    pool.submit(jobs.back()->task);
+  }
+
+  std::vector<GCRef> results;
+  for (auto&& job : jobs) {
+    for (auto&& result : job->results()) {
+      results.push_back(result);
+    }
+  }
+
+  if (vector) {
+    return Vector(results.begin(), results.end());
+  }
+  GCRef list = nullptr;
+  for (auto it = results.rbegin(); it != results.rend(); ++it) {
+    list = Pair{ *it, list };
+  }
+  return list;
+}
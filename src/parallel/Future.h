@@ -0,0 +1,73 @@
+#ifndef R5RS_FUTURE_H
+#define R5RS_FUTURE_H
+
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Expressions.h"
+#include "GC.h"
+#include "Pool.h"
+#include "Type.h"
+
+namespace r5rs {
+  namespace parallel {
+    // Calls of an interpreter closure run on the pool for the thread that
+    // made the job, its owner.
+    //
+    // The calls read the owner's heap while the owner goes on, so whatever
+    // the procedure and operands reach must not change until the job is
+    // done: the calls may not set! variables they did not bind, nor may the
+    // owner set! the ones the calls see or define in their environments
+    // other than the global one, which settle() looks after. The job holds the
+    // procedure and operands as roots until it is done with them and drops
+    // them on the owner's thread. Anything else a call makes stays in the
+    // heap of the thread that ran it; its result comes back as data and is
+    // built again in the owner's heap, so returning a procedure fails.
+    class Job {
+    public:
+      // calls `procedure` on each operand in turn, or once with no
+      // arguments if there are none
+      Job(GCRef procedure, std::vector<GCRef> operands);
+      ~Job();
+
+      // the result of each call once all have returned, or their error
+      std::vector<GCRef> results();
+
+      std::shared_ptr<Task> task;
+
+    private:
+      void run();
+      void release();
+
+      std::thread::id owner = std::this_thread::get_id();
+      std::optional<GCRef> procedure;
+      std::vector<GCRef> operands;
+      std::vector<expression::DatumPtr> values;
+      std::string error;
+    };
+
+    // Only the interpreter's closures can run on the pool: they carry all
+    // they need, where those of the vm and the closure compiler belong to
+    // the engine that made them.
+    bool runs(const GCValue& procedure);
+
+    // (%fork thunk) is a future of the thunk's value, or #f when the thunk
+    // cannot run on the pool and the caller has to call it itself
+    GCRef fork(std::span<const GCRef> args);
+    // Waits for the futures this thread forked. Defining a global may
+    // rehash the table their calls look variables up in, so a definition at
+    // the top level settles them first.
+    void settle();
+    // the value of a future, and anything else as it is
+    GCRef touch(std::span<const GCRef> args);
+    GCRef is_future(std::span<const GCRef> args);
+    // (%parallel-map f xs) over a list or vector in chunks on the pool, or
+    // #f when f cannot run there
+    GCRef parallel_map(std::span<const GCRef> args);
+  } // namespace parallel
+} // namespace r5rs
+
+#endif
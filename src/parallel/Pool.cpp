@@ -0,0 +1,159 @@
+#include "Pool.h"
+
+#include <algorithm>
+
+using namespace r5rs;
+using namespace parallel;
+
+namespace {
+  constexpr size_t none = -1;
+
+  // the pool this thread works for and its deque there
+  thread_local const Pool* current = nullptr;
+  thread_local size_t self = none;
+} // namespace
+
+bool r5rs::parallel::Task::run() {
+  auto expected = State::queued;
+  if (!state.compare_exchange_strong(expected, State::running)) {
+    return false;
+  }
+  work();
+  state = State::done;
+  state.notify_all();
+  return true;
+}
+
+bool r5rs::parallel::Task::cancel() {
+  auto expected = State::queued;
+  if (!state.compare_exchange_strong(expected, State::done)) {
+    return false;
+  }
+  state.notify_all();
+  return true;
+}
+
+void r5rs::parallel::Task::wait(bool help) {
+  while (true) {
+    auto now = state.load();
+    if (now == State::done) {
+      return;
+    }
+    if (help && Pool::instance().help()) {
+      continue;
+    }
+    state.wait(now);
+  }
+}
+
+r5rs::parallel::Pool::Pool(unsigned workers) {
+  for (unsigned i = 0; i < workers; ++i) {
+    queues.push_back(std::make_unique<Queue>());
+  }
+  for (unsigned i = 0; i < workers; ++i) {
+    threads.emplace_back([this, i] { work(i); });
+  }
+}
+
+r5rs::parallel::Pool::~Pool() {
+  {
+    std::lock_guard lock(mutex);
+    stop = true;
+  }
+  wake.notify_all();
+  for (auto&& thread : threads) {
+    thread.join();
+  }
+}
+
+Pool& r5rs::parallel::Pool::instance() {
+  static Pool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+  return pool;
+}
+
+void r5rs::parallel::Pool::submit(std::shared_ptr<Task> task) {
+  {
+    // counted first, so the count is never short of the tasks queued, and
+    // under the lock a worker checks it with before it sleeps
+    std::lock_guard lock(mutex);
+    ++queued;
+  }
+  auto&& queue = *queues[current == this ? self : next++ % queues.size()];
+  {
+    std::lock_guard lock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+  }
+  wake.notify_one();
+}
+
+bool r5rs::parallel::Pool::help() {
+  auto task = take(current == this ? self : none);
+  if (!task) {
+    return false;
+  }
+  task->run();
+  --running;
+  running.notify_all();
+  return true;
+}
+
+void r5rs::parallel::Pool::drain() {
+  for (auto&& queue : queues) {
+    std::lock_guard lock(queue->mutex);
+    for (auto&& task : queue->tasks) {
+      task->cancel();
+    }
+    queued -= queue->tasks.size();
+    queue->tasks.clear();
+  }
+  while (auto now = running.load()) {
+    running.wait(now);
+  }
+}
+
+// the newest task of deque `own`, or else the oldest of the first other
+// deque that has one
+std::shared_ptr<Task> r5rs::parallel::Pool::take(size_t own) {
+  if (own != none) {
+    auto&& queue = *queues[own];
+    std::lock_guard lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      auto task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      --queued;
+      ++running;
+      return task;
+    }
+  }
+  auto start = own == none ? 0 : own + 1;
+  for (size_t i = 0; i < queues.size(); ++i) {
+    auto&& queue = *queues[(start + i) % queues.size()];
+    std::lock_guard lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      auto task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      --queued;
+      ++running;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void r5rs::parallel::Pool::work(size_t index) {
+  current = this;
+  self = index;
+  while (true) {
+    if (auto task = take(index)) {
+      task->run();
+      --running;
+      running.notify_all();
+      continue;
+    }
+    std::unique_lock lock(mutex);
+    wake.wait(lock, [this] { return stop || queued > 0; });
+    if (stop) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,83 @@
+#ifndef R5RS_POOL_H
+#define R5RS_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace r5rs {
+  namespace parallel {
+    // A unit of work for the pool. Whichever thread claims it first runs
+    // it: a worker, or a thread that needs it done and would otherwise wait.
+    class Task {
+    public:
+      explicit Task(std::function<void()> work) : work(std::move(work)) {}
+
+      // runs the work here unless another thread has claimed it
+      bool run();
+      // drops the work if no thread has claimed it yet
+      bool cancel();
+      // returns once the work is done, running queued tasks meanwhile
+      // unless `help` is false
+      void wait(bool help = true);
+
+    private:
+      enum class State { queued, running, done };
+
+      std::function<void()> work;
+      std::atomic<State> state = State::queued;
+    };
+
+    // Workers with a deque of tasks each. A worker runs the newest task of
+    // its own deque and steals the oldest of another once that is empty.
+    // Tasks submitted by a worker go on its own deque, those from any other
+    // thread round the deques in turn.
+    class Pool {
+    public:
+      explicit Pool(unsigned workers);
+      ~Pool();
+
+      // the pool of the process, one worker short of the cores, since the
+      // thread waiting for the results runs tasks too
+      static Pool& instance();
+
+      void submit(std::shared_ptr<Task> task);
+      // runs one queued task on the calling thread, false if there is none
+      bool help();
+      // Cancels the queued tasks and waits for those running. A program
+      // drains the pool before the code its tasks run goes away.
+      void drain();
+
+      size_t size() const { return queues.size(); }
+
+    private:
+      struct Queue {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> tasks;
+      };
+
+      std::shared_ptr<Task> take(size_t own);
+      void work(size_t index);
+
+      std::vector<std::unique_ptr<Queue>> queues;
+      std::vector<std::thread> threads;
+      std::atomic<size_t> next = 0;
+      std::atomic<size_t> queued = 0;
+      // tasks taken off a deque and not yet run, counted while the deque
+      // is still locked so that drain cannot miss one
+      std::atomic<size_t> running = 0;
+
+      // idle workers sleep here until a task is submitted
+      std::mutex mutex;
+      std::condition_variable wake;
+      bool stop = false;
+    };
+  } // namespace parallel
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef R5RS_COMBINATORS_H
+#define R5RS_COMBINATORS_H
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "Parse.h"
+#include "Stream.h"
+
+namespace r5rs {
+  // Parser combinators that compose into concrete types, which the
+  // compiler sees through and inlines, unlike the ParserPtrs of Parse.h
+  // that erase each of them behind a std::function.
+  //
+  // A parser is a value whose call on an IStream moves it past what it
+  // parsed and gives the output, or gives nothing and leaves the stream
+  // where it was. Outputs are moved from one parser to the next. Recursive
+  // grammars go through Rules, which call plain functions.
+  namespace combinators {
+    // what every parser can be made into, as Parser has it
+    template <typename Self> struct Combinator {
+      constexpr auto many() const;
+      constexpr auto some() const;
+      constexpr auto maybe() const;
+      template <typename V> auto otherwise(V other) const;
+      template <typename F> constexpr auto map(F f) const;
+      // what the parser gives when `f` takes its output
+      template <typename F> constexpr auto filter(F f) const;
+      template <typename T> constexpr auto as() const;
+      // a copy of `value` in place of the output
+      template <typename T> constexpr auto as(T value) const;
+      constexpr auto shared() const;
+      auto memo() const;
+
+    private:
+      constexpr const Self& self() const {
+        return static_cast<const Self&>(*this);
+      }
+    };
+
+    template <typename P>
+    concept parser = std::is_base_of_v<Combinator<P>, P>;
+
+    template <parser P> using output_of = typename P::output_t;
+
+    // the parser `f` is, taking values of Input to an Output
+    template <typename Input, typename Output, typename F>
+    struct Leaf : Combinator<Leaf<Input, Output, F>> {
+      using input_t = Input;
+      using output_t = Output;
+
+      F f;
+
+      std::optional<Output> operator()(IStream<Input>& in) const {
+        return f(in);
+      }
+    };
+
+    template <typename Input, typename F> constexpr auto leaf(F f) {
+      using result_t = std::invoke_result_t<F, IStream<Input>&>;
+      return Leaf<Input, typename result_t::value_type, F>{ {}, std::move(f) };
+    }
+
+    // a nonterminal, defined by a function so that it can refer to itself
+    template <typename Input, typename Output>
+    struct Rule : Combinator<Rule<Input, Output>> {
+      using input_t = Input;
+      using output_t = Output;
+
+      std::optional<Output> (*f)(IStream<Input>&);
+
+      std::optional<Output> operator()(IStream<Input>& in) const {
+        return f(in);
+      }
+    };
+
+    template <typename Input, typename Output>
+    constexpr auto rule(std::optional<Output> (*f)(IStream<Input>&)) {
+      return Rule<Input, Output>{ {}, f };
+    }
+
+    template <typename F, parser... Ps>
+    struct Combine : Combinator<Combine<F, Ps...>> {
+      using input_t =
+        typename std::tuple_element_t<0, std::tuple<Ps...>>::input_t;
+      using output_t = std::invoke_result_t<F, output_of<Ps>...>;
+
+      F f;
+      std::tuple<Ps...> parsers;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        return run(in, std::index_sequence_for<Ps...>());
+      }
+
+    private:
+      template <size_t... I>
+      std::optional<output_t> run(IStream<input_t>& in,
+        std::index_sequence<I...>) const {
+        auto start = in.current();
+        std::tuple<std::optional<output_of<Ps>>...> outputs;
+        if (((std::get<I>(outputs) = std::get<I>(parsers)(in)) && ...)) {
+          return std::invoke(f, std::move(*std::get<I>(outputs))...);
+        }
+        in.seek(start);
+        return std::nullopt;
+      }
+    };
+
+    // f of the outputs of the parsers, one after the other
+    template <typename F, parser... Ps>
+    constexpr auto combine(F f, Ps... parsers) {
+      return Combine<F, Ps...>{ {}, std::move(f),
+        std::tuple(std::move(parsers)...) };
+    }
+
+    // the output of the parser at `index`
+    template <size_t index, parser... Ps>
+    constexpr auto select(Ps... parsers) {
+      return combine([](auto&&... outputs) {
+        return std::get<index>(std::forward_as_tuple(
+          std::forward<decltype(outputs)>(outputs)...));
+        }, std::move(parsers)...);
+    }
+
+    template <parser L, parser R> struct Either : Combinator<Either<L, R>> {
+      static_assert(std::is_same_v<output_of<L>, output_of<R>>);
+      using input_t = typename L::input_t;
+      using output_t = output_of<L>;
+
+      L lhs;
+      R rhs;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        if (auto res = lhs(in)) {
+          return res;
+        }
+        return rhs(in);
+      }
+    };
+
+    template <parser L, parser R> constexpr auto operator||(L lhs, R rhs) {
+      return Either<L, R>{ {}, std::move(lhs), std::move(rhs) };
+    }
+
+    template <parser P, typename F> struct Map : Combinator<Map<P, F>> {
+      using input_t = typename P::input_t;
+      using output_t = std::invoke_result_t<F, output_of<P>>;
+
+      P p;
+      F f;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        if (auto res = p(in)) {
+          return std::invoke(f, std::move(*res));
+        }
+        return std::nullopt;
+      }
+    };
+
+    template <parser P, typename F> struct Filter : Combinator<Filter<P, F>> {
+      using input_t = typename P::input_t;
+      using output_t = output_of<P>;
+
+      P p;
+      F f;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        auto start = in.current();
+        auto res = p(in);
+        if (res && !std::invoke(f, std::as_const(*res))) {
+          in.seek(start);
+          return std::nullopt;
+        }
+        return res;
+      }
+    };
+
+    // the outputs of the parser as many times as it parses, at least
+    // `least` of them
+    template <parser P, size_t least>
+    struct Many : Combinator<Many<P, least>> {
+      using input_t = typename P::input_t;
+      using output_t = std::list<output_of<P>>;
+
+      P p;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        output_t res;
+        while (auto one = p(in)) {
+          res.push_back(std::move(*one));
+        }
+        if (res.size() < least) {
+          return std::nullopt;
+        }
+        return res;
+      }
+    };
+
+    template <parser P> struct Maybe : Combinator<Maybe<P>> {
+      using input_t = typename P::input_t;
+      using output_t = std::optional<output_of<P>>;
+
+      P p;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        return output_t(p(in));
+      }
+    };
+
+    template <parser P> struct Otherwise : Combinator<Otherwise<P>> {
+      using input_t = typename P::input_t;
+      using output_t = output_of<P>;
+
+      P p;
+      output_t other;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        if (auto res = p(in)) {
+          return res;
+        }
+        return other;
+      }
+    };
+
+    // The parser, remembering its output at each position of a stream that
+    // memoizes as Parser::memo() does, in the same statistics.
+    template <parser P> struct Memo : Combinator<Memo<P>> {
+      using input_t = typename P::input_t;
+      using output_t = output_of<P>;
+
+      P p;
+      size_t id = ++memo_ids;
+
+      std::optional<output_t> operator()(IStream<input_t>& in) const {
+        if (!in.memoizing()) {
+          return p(in);
+        }
+        ++memo_stats.lookups;
+        if (auto memo = in.template recall<Remembered>(id)) {
+          ++memo_stats.hits;
+          in.seek(memo->end);
+          return memo->output;
+        }
+        auto start = in.current();
+        auto res = p(in);
+        auto end = in.current();
+        in.seek(start);
+        in.remember(id, Remembered{ res, end });
+        in.seek(end);
+        return res;
+      }
+
+    private:
+      struct Remembered {
+        std::optional<output_t> output;
+        std::ptrdiff_t end;
+      };
+    };
+
+    template <typename Self>
+    constexpr auto Combinator<Self>::many() const {
+      return Many<Self, 0>{ {}, self() };
+    }
+
+    template <typename Self>
+    constexpr auto Combinator<Self>::some() const {
+      return Many<Self, 1>{ {}, self() };
+    }
+
+    template <typename Self>
+    constexpr auto Combinator<Self>::maybe() const {
+      return Maybe<Self>{ {}, self() };
+    }
+
+    template <typename Self>
+    template <typename V>
+    auto Combinator<Self>::otherwise(V other) const {
+      return Otherwise<Self>{ {}, self(), std::move(other) };
+    }
+
+    template <typename Self>
+    template <typename F>
+    constexpr auto Combinator<Self>::map(F f) const {
+      return Map<Self, F>{ {}, self(), std::move(f) };
+    }
+
+    template <typename Self>
+    template <typename F>
+    constexpr auto Combinator<Self>::filter(F f) const {
+      return Filter<Self, F>{ {}, self(), std::move(f) };
+    }
+
+    template <typename Self>
+    template <typename T>
+    constexpr auto Combinator<Self>::as() const {
+      return map([](auto&& output) { return T{ std::move(output) }; });
+    }
+
+    template <typename Self>
+    template <typename T>
+    constexpr auto Combinator<Self>::as(T value) const {
+      return map([value](auto&&) { return value; });
+    }
+
+    template <typename Self>
+    constexpr auto Combinator<Self>::shared() const {
+      return map([](auto&& output) {
+        using output_t = std::remove_cvref_t<decltype(output)>;
+        return std::make_shared<output_t>(std::move(output));
+        });
+    }
+
+    template <typename Self> auto Combinator<Self>::memo() const {
+      return Memo<Self>{ {}, self() };
+    }
+  } // namespace combinators
+} // namespace r5rs
+
+#endif
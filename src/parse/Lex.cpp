@@ -1,34 +1,48 @@
 #include "Lex.h"
 
+#include <array>
+#include <bit>
+#include <charconv>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
 #include <unordered_map>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Trace.h"
+
 using namespace r5rs;
 using namespace r5rs::lex;
 
 function_ptr<Char, char> r5rs::lex::char2Char() {
-  static auto func = make_function([](char ch) { return Char{ ch }; });
+  thread_local auto func = make_function([](char ch) { return Char{ ch }; });
   return func;
 }
 
 function_ptr<std::string, IStream<char>> r5rs::lex::charStream2String() {
-  static auto func = make_function([](IStream<char> stream) -> std::string {
-    return stream.foldl(make_function([](std::string string, char ch) {
-      return std::move(string) + ch;
-      }),
-      std::string());
+  thread_local auto func =
+    make_function([](IStream<char> stream) -> std::string {
+      return stream.foldl(make_function([](std::string string, char ch) {
+        return std::move(string) + ch;
+        }),
+        std::string());
     });
   return func;
 }
 
 function_ptr<std::string, std::list<char>> r5rs::lex::charList2String() {
-  static auto func = make_function([](std::list<char> stream) -> std::string {
-    return std::string(stream.cbegin(), stream.cend());
+  thread_local auto func =
+    make_function([](std::list<char> stream) -> std::string {
+      return std::string(stream.cbegin(), stream.cend());
     });
   return func;
 }
 
 ParserPtr<Char, char> r5rs::lex::any() {
-  static auto parser = make_parser(
+  thread_local auto parser = make_parser(
     make_function([](IStream<Char> input) -> ParserResult<Char, char> {
       auto&& ch = input[0];
       if (ch && ch->ch) {
@@ -87,13 +101,13 @@ ParserPtr<Char, std::string> r5rs::lex::match(std::string str) {
 }
 
 ParserPtr<Char, nullptr_t> r5rs::lex::delimiter() {
-  static auto parser =
+  thread_local auto parser =
     (match('\0') || match_any_of(" \t\r\n()\";"))->as(nullptr);
   return parser;
 }
 
 ParserPtr<Char, std::string> r5rs::lex::comment() {
-  static auto parser = select<1>(match(';'),
+  thread_local auto parser = select<1>(match(';'),
     match(make_function([](char ch) -> bool {
       return ch != '\0' && ch != '\n';
       }))
@@ -104,14 +118,15 @@ ParserPtr<Char, std::string> r5rs::lex::comment() {
 }
 
 ParserPtr<Char, nullptr_t> r5rs::lex::intertoken_space() {
-  static auto parser = (match_any_of(" \t\r\n")->as(std::string()) || comment())
+  thread_local auto parser =
+    (match_any_of(" \t\r\n")->as(std::string()) || comment())
     ->many()
     ->as(nullptr);
   return parser;
 }
 
 ParserPtr<Char, std::string> r5rs::lex::identifier() {
-  static auto parser = peculiar_identifier() ||
+  thread_local auto parser = peculiar_identifier() ||
     combine(make_function([](char lhs, std::list<char> rhs) {
     std::string id;
     id.push_back(lhs);
@@ -123,83 +138,86 @@ ParserPtr<Char, std::string> r5rs::lex::identifier() {
 }
 
 ParserPtr<Char, char> r5rs::lex::initial() {
-  static auto parser = letter() || special_initial();
+  thread_local auto parser = letter() || special_initial();
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::letter() {
-  static auto parser = match(make_function([](char c) -> bool {
+  thread_local auto parser = match(make_function([](char c) -> bool {
     return c >= 'a' && c <= 'z' || c >= 'A' && c <= 'Z';
     }));
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::special_initial() {
-  static auto parser = match_any_of(R"(!$%&*/:<=>?^_~)");
+  thread_local auto parser = match_any_of(R"(!$%&*/:<=>?^_~)");
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::subsequent() {
-  static auto parser = initial() || digit() || special_subsequent();
+  thread_local auto parser = initial() || digit() || special_subsequent();
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::digit() {
-  static auto parser = match(
+  thread_local auto parser = match(
     make_function([](char ch) -> bool { return ch >= '0' && ch <= '9'; }));
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::special_subsequent() {
-  static auto parser = match_any_of(R"(+-.@)");
+  thread_local auto parser = match_any_of(R"(+-.@)");
   return parser;
 }
 
 ParserPtr<Char, std::string> r5rs::lex::peculiar_identifier() {
-  static auto char2str = make_function([](char ch) { return std::string{ ch }; });
-  static auto parser = match_any_of(R"(+-)")->map(char2str) || match("...");
+  thread_local auto char2str =
+    make_function([](char ch) { return std::string{ ch }; });
+  thread_local auto parser =
+    match_any_of(R"(+-)")->map(char2str) || match("...");
   return parser;
 }
 
 ParserPtr<Char, bool> r5rs::lex::boolean() {
-  static auto parser = match("#t")->as(true) || match("#f")->as(false);
+  thread_local auto parser = match("#t")->as(true) || match("#f")->as(false);
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::character() {
-  static auto parser =
+  thread_local auto parser =
     select<1>(match("#\\"), (character_name() || any()))->peek(delimiter());
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::character_name() {
-  static auto parser = match("space")->as(' ') || match("newline")->as('\n');
+  thread_local auto parser =
+    match("space")->as(' ') || match("newline")->as('\n');
   return parser;
 }
 
 ParserPtr<Char, std::string> r5rs::lex::string() {
-  static auto parser =
+  thread_local auto parser =
     select<1>(match('"'), string_element()->many(), match('"'))
     ->map(charList2String());
   return parser;
 }
 
 ParserPtr<Char, char> r5rs::lex::string_element() {
-  static auto normal = match(make_function(
+  thread_local auto normal = match(make_function(
     [](char c) -> bool { return c != '\\' && c != '"' && c != '\0'; }));
-  static auto parser =
+  thread_local auto parser =
     match("\\\\")->as('\\') || match("\\\"")->as('"') || normal;
   return parser;
 }
 
 ParserPtr<Char, int64_t> r5rs::lex::number() {
-  static auto digit =
+  thread_local auto digit =
     match(make_function([](char c) -> bool { return std::isdigit(c); }));
 
-  static auto s2n =
-    make_function([](std::string str) { return std::stoll(str); });
+  thread_local auto s2n =
+    make_function([](std::string str) -> int64_t { return std::stoll(str); });
 
-  static auto parser = digit->some()->map(charList2String())->map(s2n);
+  thread_local auto parser = digit->some()->map(charList2String())->map(s2n);
 
   return parser;
 }
@@ -211,7 +229,7 @@ ParserPtr<Char, TokenType> r5rs::lex::single_symbol() {
       {',', TokenType::unquote_symbol}, {'.', TokenType::dot},
   };
 
-  static auto find = make_function([=](char ch) {
+  thread_local auto find = make_function([=](char ch) {
     auto it = single.find(ch);
     if (it == single.end()) {
       return TokenType::err;
@@ -219,10 +237,10 @@ ParserPtr<Char, TokenType> r5rs::lex::single_symbol() {
     return it->second;
     });
 
-  static auto cond =
+  thread_local auto cond =
     make_function([](TokenType type) { return type != TokenType::err; });
 
-  static auto parser = any()->map(find)->filter(cond);
+  thread_local auto parser = any()->map(find)->filter(cond);
 
   return parser;
 }
@@ -233,12 +251,12 @@ ParserPtr<Char, TokenType> r5rs::lex::two_char_symbol() {
       {",@", TokenType::unquote_splicing_symbol},
   };
 
-  static auto fail = make_parser(
+  thread_local auto fail = make_parser(
     make_function([](IStream<Char> input) -> ParserResult<Char, TokenType> {
       return Error{ "faild." };
       }));
 
-  static auto lexer = [=]() {
+  thread_local auto lexer = [=]() {
     auto lexer = fail;
     for (auto&& [symbol, type] : two) {
       lexer = lexer || match(symbol)->as(type);
@@ -250,12 +268,12 @@ ParserPtr<Char, TokenType> r5rs::lex::two_char_symbol() {
 }
 
 ParserPtr<Char, TokenType> r5rs::lex::symbol() {
-  static auto parser = two_char_symbol() || single_symbol();
+  thread_local auto parser = two_char_symbol() || single_symbol();
   return parser;
 }
 
 ParserPtr<Char, Token> r5rs::lex::token() {
-  static auto parser = make_parser(
+  thread_local auto parser = make_parser(
     make_function([&](IStream<Char> input) -> ParserResult<Char, Token> {
       if (!input[0]) {
         return Error{ "not find a char" };
@@ -294,7 +312,7 @@ ParserPtr<Char, Token> r5rs::lex::token() {
 }
 
 ParserPtr<Char, Token> r5rs::lex::eof() {
-  static auto parser = make_parser(
+  thread_local auto parser = make_parser(
     make_function([](IStream<Char> input) -> ParserResult<Char, Token> {
       if (input[0] && input[0]->ch == '\xff') {
         return std::make_pair(
@@ -306,14 +324,371 @@ ParserPtr<Char, Token> r5rs::lex::eof() {
   return parser;
 }
 
-IStream<Token> r5rs::tokens(IStream<Char> input) {
-  static auto parser = select<1>(intertoken_space(), token() || eof());
-  return IStream<Token>(make_function([input]() mutable -> Try<Token> {
-    auto&& res = std::invoke(*parser, input);
-    if (!res) {
+namespace {
+  // the classes of character the lexer tells apart, any number per one
+  enum Class : uint8_t {
+    space = 1,
+    delimiter = 2,
+    initial = 4,
+    subsequent = 8,
+    digit = 16,
+  };
+
+  constexpr auto classes = [] {
+    std::array<uint8_t, 256> res{};
+    auto add = [&](std::string_view chars, uint8_t of) {
+      for (unsigned char c : chars) {
+        res[c] |= of;
+      }
+    };
+    add(" \t\r\n", space | delimiter);
+    add(std::string_view("()\";\0", 5), delimiter);
+    add("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ",
+      initial | subsequent);
+    add("!$%&*/:<=>?^_~", initial | subsequent);
+    add("0123456789", digit | subsequent);
+    add("+-.@", subsequent);
+    return res;
+  }();
+
+  // what a source reads past its last character
+  constexpr int none = -1;
+  // the character sources end on, as their last
+  constexpr int eof = 0xff;
+
+  bool is(int c, uint8_t of) { return c != none && classes[c] & of; }
+
+  // a character literal ends at a delimiter or the end of the input
+  bool delimited(int c) { return c == none || c == eof || is(c, delimiter); }
+
+  // The characters of an IStream, one at a time.
+  class Chars {
+  public:
+    explicit Chars(IStream<Char> input) : input(std::move(input)) {}
+
+    // the character `i` past the cursor
+    int operator[](size_t i) {
+      auto ch = input[i];
+      return ch ? static_cast<unsigned char>(ch->ch) : none;
+    }
+
+    std::pair<size_t, size_t> position() {
+      auto ch = input[0];
+      return { ch->line, ch->col };
+    }
+
+    void advance(size_t n) { input += n; }
+    void commit() { input.commit(); }
+    bool bounded() const { return input.bounded(); }
+
+    std::string take(size_t n) {
+      std::string res;
+      for (size_t i = 0; i < n; ++i) {
+        res.push_back(input[i]->ch);
+      }
+      input += n;
+      return res;
+    }
+
+    Token::value_t text(size_t n) { return take(n); }
+
+    size_t spaces() {
+      size_t n = 0;
+      while (is((*this)[n], space)) {
+        ++n;
+      }
+      return n;
+    }
+
+    size_t comment() {
+      size_t n = 0;
+      for (auto c = (*this)[0]; c != none && c != '\n' && c != eof;
+           c = (*this)[++n]) {
+      }
+      return n;
+    }
+
+    size_t plain() {
+      size_t n = 0;
+      for (auto c = (*this)[0]; c != none && c != '"' && c != '\\' && c != 0;
+           c = (*this)[++n]) {
+      }
+      return n;
+    }
+
+  private:
+    IStream<Char> input;
+  };
+
+  // Characters in memory, which it skips through 16 at a time where it
+  // can. Past the last it reads an eof, as the IStreams end on. The text
+  // of tokens points into the source if it is `borrowed`, which `owner`
+  // keeps alive for as long as the lexer lives.
+  class Text {
+  public:
+    Text(std::shared_ptr<const void> owner, std::string_view source,
+      bool borrowed)
+      : owner(std::move(owner)), source(source), lines(source),
+      borrowed(borrowed) {}
+
+    int operator[](size_t i) const {
+      auto at = pos + i;
+      if (at < source.size()) {
+        return static_cast<unsigned char>(source[at]);
+      }
+      return at == source.size() ? eof : none;
+    }
+
+    std::pair<size_t, size_t> position() {
+      return lines.position(std::min(pos, source.size()));
+    }
+
+    void advance(size_t n) { pos += n; }
+
+    std::string take(size_t n) {
+      std::string res(source.substr(pos, n));
+      advance(n);
+      return res;
+    }
+
+    Token::value_t text(size_t n) {
+      if (!borrowed) {
+        return take(n);
+      }
+      auto res = source.substr(pos, n);
+      advance(n);
+      return res;
+    }
+
+    // the lengths of the runs at the cursor of whitespace, of the rest of
+    // a comment and of a string's characters that need no escaping
+    size_t spaces() const {
+      return run([](auto c) { return is(c, space); }, [](auto chunk) {
+        return any_of(chunk, " \t\r\n", true);
+      });
+    }
+
+    size_t comment() const {
+      return run([](auto c) { return c != '\n' && c != eof; },
+        [](auto chunk) { return any_of(chunk, "\n\xff", false); });
+    }
+
+    size_t plain() const {
+      return run([](auto c) { return c != '"' && c != '\\' && c != 0; },
+        [](auto chunk) {
+          return any_of(chunk, std::string_view("\"\\\0", 3), false);
+        });
+    }
+
+  private:
+#if defined(__SSE2__)
+    using Chunk = __m128i;
+
+    // a bit for each of the 16 bytes of `chunk` that is one of `set`, or
+    // that is none of it if `outside`
+    static unsigned any_of(Chunk chunk, std::string_view set, bool outside) {
+      auto hits = _mm_setzero_si128();
+      for (auto c : set) {
+        hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+      }
+      unsigned mask = _mm_movemask_epi8(hits);
+      return outside ? ~mask & 0xffff : mask;
+    }
+#endif
+
+    // the characters from the cursor `keep` holds for, the chunks `stops`
+    // finds the first that it does not in
+    template <typename Keep, typename Stops>
+    size_t run([[maybe_unused]] Keep keep, [[maybe_unused]] Stops stops) const {
+      auto data = source.data();
+      auto at = std::min(pos, source.size());
+#if defined(__SSE2__)
+      for (; at + 16 <= source.size(); at += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const Chunk*>(data + at));
+        if (auto mask = stops(chunk)) {
+          return at + std::countr_zero(mask) - pos;
+        }
+      }
+#endif
+      while (at < source.size() && keep(static_cast<unsigned char>(data[at]))) {
+        ++at;
+      }
+      return at - std::min(pos, source.size());
+    }
+
+    std::shared_ptr<const void> owner;
+    std::string_view source;
+    Lines lines;
+    bool borrowed;
+    size_t pos = 0;
+  };
+
+  // The next token of `in`, following the grammar of lex::token(): the
+  // longest identifier, boolean, number, character, string or symbol at
+  // the cursor after intertoken space, tried in that order.
+  template <typename Source> Try<Token> next(Source& in) {
+    while (true) {
+      if (is(in[0], space)) {
+        in.advance(in.spaces());
+      }
+      else if (in[0] == ';') {
+        auto n = in.comment();
+        in.advance(in[n] == '\n' ? n + 1 : n);
+      }
+      else {
+        break;
+      }
+    }
+
+    auto c = in[0];
+    if (c == none || c == 0) {
       return Error{ "error." };
     }
-    input = res->second;
-    return res->first;
+    auto [line, col] = in.position();
+    auto token = [&](TokenType type, Token::value_t value = nullptr) {
+      return Token{ type, std::move(value), line, col };
+    };
+    auto symbol = [&](TokenType type, size_t n) {
+      in.advance(n);
+      return token(type);
+    };
+
+    if (c == '+' || c == '-') {
+      return token(TokenType::identifier, in.text(1));
+    }
+    if (c == '.' && in[1] == '.' && in[2] == '.') {
+      return token(TokenType::identifier, in.text(3));
+    }
+    if (is(c, initial)) {
+      size_t n = 1;
+      while (is(in[n], subsequent)) {
+        ++n;
+      }
+      return token(TokenType::identifier, in.text(n));
+    }
+
+    if (c == '#' && (in[1] == 't' || in[1] == 'f')) {
+      auto value = in[1] == 't';
+      in.advance(2);
+      return token(TokenType::boolean, value);
+    }
+
+    if (is(c, digit)) {
+      size_t n = 1;
+      while (is(in[n], digit)) {
+        ++n;
+      }
+      auto digits = in.take(n);
+      int64_t value;
+      auto [end, err] = std::from_chars(digits.data(),
+        digits.data() + digits.size(), value);
+      if (err != std::errc()) {
+        throw std::out_of_range("number " + digits + " out of range!");
+      }
+      return token(TokenType::number, value);
+    }
+
+    // a name is only taken whole, as the character after it must delimit
+    if (c == '#' && in[1] == '\\') {
+      for (auto [name, ch] :
+        { std::pair{ "space", ' ' }, std::pair{ "newline", '\n' } }) {
+        std::string_view view(name);
+        size_t n = 0;
+        while (n < view.size() && in[2 + n] == view[n]) {
+          ++n;
+        }
+        if (n == view.size()) {
+          if (!delimited(in[2 + n])) {
+            return Error{ "error." };
+          }
+          in.advance(2 + n);
+          return token(TokenType::character, ch);
+        }
+      }
+      auto ch = in[2];
+      if (ch == none || ch == 0 || ch == eof || !delimited(in[3])) {
+        return Error{ "error." };
+      }
+      in.advance(3);
+      return token(TokenType::character, static_cast<char>(ch));
+    }
+
+    if (c == '"') {
+      in.advance(1);
+      std::string value;
+      while (true) {
+        auto n = in.plain();
+        if (value.empty() && in[n] == '"') {
+          // without escapes it is the text between the quotes
+          auto text = in.text(n);
+          in.advance(1);
+          return token(TokenType::string, std::move(text));
+        }
+        value += in.take(n);
+        auto end = in[0];
+        if (end == '"') {
+          in.advance(1);
+          return token(TokenType::string, std::move(value));
+        }
+        if (end != '\\' || (in[1] != '\\' && in[1] != '"')) {
+          return Error{ "error." };
+        }
+        value.push_back(in[1]);
+        in.advance(2);
+      }
+    }
+
+    switch (c) {
+    case '#':
+      if (in[1] == '(') {
+        return symbol(TokenType::vector_paren, 2);
+      }
+      break;
+    case ',':
+      return in[1] == '@' ? symbol(TokenType::unquote_splicing_symbol, 2)
+                          : symbol(TokenType::unquote_symbol, 1);
+    case '(':
+      return symbol(TokenType::left_paren, 1);
+    case ')':
+      return symbol(TokenType::right_paren, 1);
+    case '\'':
+      return symbol(TokenType::quote_symbol, 1);
+    case '`':
+      return symbol(TokenType::quasiquote_symbol, 1);
+    case '.':
+      return symbol(TokenType::dot, 1);
+    case eof:
+      return symbol(TokenType::eof, 1);
+    }
+    return Error{ "error." };
+  }
+} // namespace
+
+IStream<Token> r5rs::tokens(IStream<Char> input) {
+  auto bounded = input.bounded();
+  return IStream<Token>(make_function(
+    [in = Chars(std::move(input))]() mutable -> Try<Token> {
+      trace::Span span("lex");
+      auto res = next(in);
+      in.commit();
+      return res;
+    }), bounded);
+}
+
+IStream<Token> r5rs::tokens(std::string source) {
+  auto owner = std::make_shared<const std::string>(std::move(source));
+  return IStream<Token>(make_function(
+    [in = Text(owner, *owner, false)]() mutable -> Try<Token> {
+      trace::Span span("lex");
+      return next(in);
     }));
 }
+
+IStream<Token> r5rs::tokens(std::shared_ptr<const MappedFile> file) {
+  auto text = file->text();
+  return IStream<Token>(make_function(
+    [in = Text(std::move(file), text, true)]() mutable -> Try<Token> {
+      trace::Span span("lex");
+      return next(in);
+    }), true);
+}
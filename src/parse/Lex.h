@@ -2,12 +2,21 @@
 #define R5RS_LEX_H
 
 #include "Parse.h"
+#include "Source.h"
 #include "Token.h"
 
 #include <unordered_map>
 
 namespace r5rs {
+  // The tokens of `input`, lexed by hand as lex::token() describes them,
+  // ending with an eof token. A string is lexed in place, skipping over
+  // whitespace, comments and the insides of strings many bytes at a time.
   IStream<Token> tokens(IStream<Char> input);
+  IStream<Token> tokens(std::string source);
+  // The tokens of a mapped file, their identifiers and strings without
+  // escapes pointing into it rather than copied, so it must outlive them.
+  // The stream is bounded.
+  IStream<Token> tokens(std::shared_ptr<const MappedFile> file);
 
   namespace lex {
     function_ptr<Char, char> char2Char();
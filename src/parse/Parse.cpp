@@ -22,6 +22,29 @@ IStream<Char>& r5rs::cinIStream() {
       ++line, col = 0;
     }
     return Ch;
-    }));
+    }), true);
   return is;
 }
+
+IStream<Char> r5rs::stringIStream(std::string source, bool bounded) {
+  size_t index = 0;
+  size_t line = 1;
+  size_t col = 0;
+  return IStream<Char>(make_function(
+    [=, source = std::move(source)]() mutable -> Try<Char> {
+      if (index > source.size()) {
+        return Error{ "not find char" };
+      }
+      if (index == source.size()) {
+        ++index;
+        return Char{ '\xff', line, col };
+      }
+      char ch = source[index++];
+      Char Ch = Char{ ch, line, col };
+      ++col;
+      if (ch == '\n') {
+        ++line, col = 0;
+      }
+      return Ch;
+    }), bounded);
+}
@@ -1,6 +1,7 @@
 #ifndef R5RS_Parse_H
 #define R5RS_Parse_H
 
+#include <atomic>
 #include <cstddef>
 #include <functional>
 #include <iostream>
@@ -24,6 +25,19 @@ namespace r5rs {
   template <typename Input, typename Output>
   using ParserResult = Try<std::pair<Output, IStream<Input>>>;
 
+  // How often parsers made with memo() looked for what they remembered on
+  // this thread, and found it.
+  struct MemoStats {
+    size_t lookups = 0;
+    size_t hits = 0;
+
+    double rate() const { return lookups ? double(hits) / lookups : 0; }
+  };
+
+  inline thread_local MemoStats memo_stats;
+  // numbers the parsers made with memo(), of any type
+  inline std::atomic<size_t> memo_ids = 0;
+
   template <typename Input, typename Output>
   class Parser : public std::enable_shared_from_this<Parser<Input, Output>> {
     template <typename In = Input, typename Out = Output>
@@ -78,6 +92,12 @@ namespace r5rs {
 
     ParserPtr<Input, Output> otherwise(Output output);
 
+    // The same parser, but on a stream that memoizes it parses each
+    // position once and then gives back what it remembered, so that the
+    // alternatives which start with it do not parse it again: packrat
+    // parsing. On any other stream it costs a test.
+    ParserPtr<Input, Output> memo();
+
     function_t func;
   };
 
@@ -275,6 +295,34 @@ namespace r5rs {
         }));
   }
 
+  template <typename Input, typename Output>
+  inline ParserPtr<Input, Output> Parser<Input, Output>::memo() {
+    // where the result ends rather than the stream, which would hold on
+    // to the buffer that holds it
+    using memo_t = Try<std::pair<Output, std::ptrdiff_t>>;
+    return make_parser(make_function(
+      [id = ++memo_ids, self = this->shared_from_this()](
+        IStream<Input> input) -> ParserResult<Input, Output> {
+          assert(*self);
+          if (!input.memoizing()) {
+            return std::invoke(*self->func, input);
+          }
+          ++memo_stats.lookups;
+          if (auto memo = input.template recall<memo_t>(id)) {
+            ++memo_stats.hits;
+            return memo_t(*memo) >>= [&](auto&& pair) {
+              return Try(std::make_pair(pair.first,
+                input + (pair.second - input.current())));
+              };
+          }
+          auto res = std::invoke(*self->func, input);
+          input.remember(id, res
+            ? memo_t(std::make_pair(res->first, res->second.current()))
+            : memo_t(std::get<Error>(res.value)));
+          return res;
+      }));
+  }
+
   template <typename Input, typename Output>
   inline auto operator||(ParserPtr<Input, Output> lhs,
     ParserPtr<Input, Output> rhs)
@@ -285,7 +333,10 @@ namespace r5rs {
         }));
   }
 
+  // standard input, bounded so that a session holds no more than the form
+  // being read
   IStream<Char>& cinIStream();
+  IStream<Char> stringIStream(std::string source, bool bounded = false);
 } // namespace r5rs
 
 #endif
@@ -0,0 +1,60 @@
+#include "Source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace r5rs;
+
+r5rs::MappedFile::MappedFile(const std::string& path) {
+  auto fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open " + path + ": " +
+      std::strerror(errno));
+  }
+  struct stat st {};
+  if (::fstat(fd, &st) < 0) {
+    ::close(fd);
+    throw std::runtime_error("cannot stat " + path + "!");
+  }
+  size = st.st_size;
+  // an empty file cannot be mapped, and has nothing to map
+  if (size) {
+    auto mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+      ::close(fd);
+      throw std::runtime_error("cannot map " + path + "!");
+    }
+    ::madvise(mapped, size, MADV_SEQUENTIAL);
+    data = static_cast<const char*>(mapped);
+  }
+  ::close(fd);
+}
+
+r5rs::MappedFile::~MappedFile() {
+  if (data) {
+    ::munmap(const_cast<char*>(data), size);
+  }
+}
+
+std::pair<size_t, size_t> r5rs::Lines::position(size_t offset) {
+  if (starts.empty()) {
+    starts.push_back(0);
+    auto from = text.data();
+    auto end = text.data() + text.size();
+    while (auto nl = static_cast<const char*>(
+      std::memchr(from, '\n', end - from))) {
+      starts.push_back(nl - text.data() + 1);
+      from = nl + 1;
+    }
+  }
+  auto line = std::upper_bound(starts.begin(), starts.end(), offset) -
+    starts.begin();
+  return { line, offset - starts[line - 1] };
+}
@@ -0,0 +1,43 @@
+#ifndef R5RS_SOURCE_H
+#define R5RS_SOURCE_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace r5rs {
+  // A file mapped into memory read-only, which lexing reads in place and
+  // tokens point into for as long as it lives.
+  class MappedFile final {
+  public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view text() const { return { data, size }; }
+
+  private:
+    const char* data = nullptr;
+    size_t size = 0;
+  };
+
+  // Where the lines of a text start, found the first time a position is
+  // asked for rather than counted character by character.
+  class Lines final {
+  public:
+    explicit Lines(std::string_view text) : text(text) {}
+
+    // the line, from 1, and column, from 0, of the byte at `offset`
+    std::pair<size_t, size_t> position(size_t offset);
+
+  private:
+    std::string_view text;
+    // empty until indexed, and then the first line's start at least
+    std::vector<size_t> starts;
+  };
+} // namespace r5rs
+
+#endif
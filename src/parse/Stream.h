@@ -1,38 +1,110 @@
 #ifndef R5RS_STREAM_H
 #define R5RS_STREAM_H
 
+#include <algorithm>
+#include <any>
+#include <cstddef>
+#include <unordered_map>
+
 #include "Try.h"
 #include "Type.h"
 
 namespace r5rs {
+  // A stream of values read on demand, which copies share. Each copy has a
+  // position of its own, so a parser can go back to where a copy is.
+  //
+  // A stream keeps all it read for that, unless it is bounded: then
+  // commit() releases what is before a copy once nothing will go back
+  // there, and reading a released position is an error. Lexing and
+  // parsing commit each token and form as they finish it, so a bounded
+  // source holds no more than the form being read.
+  //
+  // A stream that memoizes also keeps the results parsers remember at its
+  // positions, which commit() releases with the values there.
   template <typename T> class IStream final {
   public:
-    IStream(function_ptr<Try<T>> fun)
-      : func(fun), buffer(std::make_shared<std::vector<T>>()) {
+    IStream(function_ptr<Try<T>> fun, bool bounded = false)
+      : func(fun), buffer(std::make_shared<Buffer>()) {
       assert(func);
       assert(*func);
+      buffer->bounded = bounded;
     }
 
     IStream(std::vector<T> init)
-      : buffer(std::make_shared<std::vector<T>>(std::move(init))) {}
+      : buffer(std::make_shared<Buffer>(Buffer{ std::move(init) })) {}
 
     std::ptrdiff_t current() const { return cur; }
+    void seek(std::ptrdiff_t position) { cur = position; }
 
     Try<T> operator[](std::ptrdiff_t index) {
-      if (cur + index < 0) {
-        return Error{ "access negative position." };
+      auto at = cur + index;
+      if (at < buffer->offset) {
+        return Error{ at < 0 ? "access negative position."
+                             : "access released position." };
+      }
+      if (auto value = this->at(index)) {
+        return *value;
+      }
+      return Error{ "Eof" };
+    }
+
+    // The value `index` past this position, or null past the end or before
+    // what was released. It stays put until the stream reads more.
+    const T* at(std::ptrdiff_t index) {
+      auto at = cur + index;
+      if (at < buffer->offset) {
+        return nullptr;
       }
-      while (cur + index >= buffer->size()) {
+      auto&& items = buffer->items;
+      while (at - buffer->offset >= std::ptrdiff_t(items.size())) {
         Try<T> t;
         if (!func || !(t = std::invoke(*func))) {
-          return Error{ "Eof" };
+          return nullptr;
         }
-        buffer->push_back(*t);
+        items.push_back(std::move(*t));
       }
-      return (*buffer)[cur + index];
+      return &items[at - buffer->offset];
     }
 
-    bool eof() { return !operator[](0); }
+    bool eof() { return !at(0); }
+
+    bool bounded() const { return buffer->bounded; }
+    // the values read and not released
+    size_t buffered() const { return buffer->items.size(); }
+
+    // releases what is before this position if the stream is bounded
+    void commit() {
+      if (!buffer->bounded || cur <= buffer->offset) {
+        return;
+      }
+      auto&& items = buffer->items;
+      auto n = std::min<size_t>(cur - buffer->offset, items.size());
+      items.erase(items.begin(), items.begin() + n);
+      buffer->offset += n;
+      std::erase_if(buffer->memo, [&](auto&& entry) {
+        return entry.first.position < buffer->offset;
+        });
+    }
+
+    // turns memoizing on or off for all the copies, forgetting what was
+    // remembered
+    void memoize(bool on = true) {
+      buffer->memoizing = on;
+      buffer->memo.clear();
+    }
+    bool memoizing() const { return buffer->memoizing; }
+    size_t memoized() const { return buffer->memo.size(); }
+
+    // what the parser numbered `parser` remembered at this position, or
+    // null if it did not or remembered something else than an R
+    template <typename R> const R* recall(size_t parser) const {
+      auto it = buffer->memo.find({ parser, cur });
+      return it == buffer->memo.end() ? nullptr
+        : std::any_cast<R>(&it->second);
+    }
+    template <typename R> void remember(size_t parser, R result) {
+      buffer->memo.insert_or_assign({ parser, cur }, std::move(result));
+    }
 
     IStream& operator+=(std::ptrdiff_t index) {
       cur += index;
@@ -68,8 +140,31 @@ namespace r5rs {
     std::list<T> list() { return operator std::list<T>(); }
 
   private:
+    struct Key {
+      size_t parser;
+      std::ptrdiff_t position;
+
+      bool operator==(const Key&) const = default;
+    };
+
+    struct Hash {
+      size_t operator()(const Key& key) const {
+        return std::hash<size_t>()(key.parser * 0x9e3779b97f4a7c15 ^
+          size_t(key.position));
+      }
+    };
+
+    struct Buffer {
+      std::vector<T> items;
+      // the position of the first of the items
+      std::ptrdiff_t offset = 0;
+      bool bounded = false;
+      bool memoizing = false;
+      std::unordered_map<Key, std::any, Hash> memo{};
+    };
+
     function_ptr<Try<T>> func;
-    std::shared_ptr<std::vector<T>> buffer;
+    std::shared_ptr<Buffer> buffer;
     std::ptrdiff_t cur = 0;
   };
 } // namespace r5rs
@@ -1,7 +1,9 @@
 #ifndef R5RS_TOKEN_H
 #define R5RS_TOKEN_H
 
+#include <cstddef>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <variant>
 
@@ -51,6 +53,11 @@
   R5RS_KEYWORD_ACCESS(letrec, "letrec")                                        \
   R5RS_KEYWORD_ACCESS(Do, "do")                                                \
   R5RS_KEYWORD_ACCESS(delay, "delay")                                          \
+  R5RS_KEYWORD_ACCESS(delay_force, "delay-force")                              \
+  R5RS_KEYWORD_ACCESS(stream_cons, "stream-cons")                              \
+  R5RS_KEYWORD_ACCESS(stream_lambda, "stream-lambda")                          \
+  R5RS_KEYWORD_ACCESS(future, "future")                                        \
+  R5RS_KEYWORD_ACCESS(guard, "guard")                                          \
                                                                                \
   R5RS_KEYWORD_ACCESS(quasiquote, "quasiquote")
 
@@ -73,9 +80,12 @@ namespace r5rs {
   const std::unordered_map<std::string, TokenType>& typeTokens();
   const std::unordered_map<std::string, Keyword>& keywords();
 
+  // The text of an identifier or string is a view when the lexer's source
+  // outlives its tokens, and a copy otherwise.
   class Token final {
   public:
-    using value_t = std::variant<nullptr_t, bool, char, int64_t, std::string>;
+    using value_t = std::variant<nullptr_t, bool, char, int64_t, std::string,
+      std::string_view>;
     TokenType type = TokenType::err;
     value_t value = nullptr;
     size_t row = 0;
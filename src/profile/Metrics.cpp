@@ -0,0 +1,74 @@
+#include "Metrics.h"
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Expressions.h"
+
+using namespace r5rs;
+using namespace r5rs::metrics;
+
+static_assert(std::size(kinds) ==
+  std::variant_size_v<expression::Exp::exp_t>);
+
+namespace {
+  double average(const Counters& of) {
+    auto calls = of.closure_calls + of.primitive_calls;
+    return calls ? double(of.arguments) / calls : 0;
+  }
+
+  // the counters other than the evaluations, by their JSON names
+  std::vector<std::pair<const char*, GCValue>> totals(const Counters& of) {
+    return { { "closure_calls", int64_t(of.closure_calls) },
+      { "primitive_calls", int64_t(of.primitive_calls) },
+      { "arguments", int64_t(of.arguments) },
+      { "average_arguments", average(of) },
+      { "frames", int64_t(of.frames) },
+      { "max_depth", int64_t(of.max_depth) } };
+  }
+} // namespace
+
+void r5rs::metrics::reset() {
+  counters = Counters{ .depth = counters.depth,
+    .max_depth = counters.depth };
+}
+
+void r5rs::metrics::json(std::ostream& out, const Counters& of) {
+  out << "{\"evaluations\":{";
+  for (size_t i = 0; i < std::size(kinds); ++i) {
+    out << (i ? "," : "") << '"' << kinds[i] << "\":" << of.evaluations[i];
+  }
+  out << '}';
+  for (auto&& [name, value] : totals(of)) {
+    out << ",\"" << name << "\":";
+    std::visit([&](auto&& v) {
+      if constexpr (std::is_arithmetic_v<std::decay_t<decltype(v)>>) {
+        out << v;
+      }
+    }, value);
+  }
+  out << '}' << std::endl;
+}
+
+GCRef r5rs::metrics::evaluator_metrics(std::span<const GCRef>) {
+  auto of = counters;
+  auto symbol = [](std::string name) {
+    std::replace(name.begin(), name.end(), '_', '-');
+    return GCRef(Symbol{ std::move(name) });
+  };
+
+  GCRef res = nullptr;
+  auto all = totals(of);
+  for (auto it = all.rbegin(); it != all.rend(); ++it) {
+    res = Pair{ Pair{ symbol(it->first), GCRef(std::move(it->second)) }, res };
+  }
+  GCRef evaluations = nullptr;
+  for (size_t i = std::size(kinds); i-- > 0;) {
+    evaluations = Pair{ Pair{ symbol(kinds[i]),
+      GCRef(int64_t(of.evaluations[i])) }, evaluations };
+  }
+  return Pair{ Pair{ symbol("evaluations"), evaluations }, res };
+}
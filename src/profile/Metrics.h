@@ -0,0 +1,104 @@
+#ifndef R5RS_METRICS_H
+#define R5RS_METRICS_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+#include <span>
+
+#include "GC.h"
+
+// The R5RS_METRICS CMake option sets it to 0 to compile the counters out,
+// which leaves them all zero.
+#ifndef R5RS_METRICS
+#define R5RS_METRICS 1
+#endif
+
+namespace r5rs {
+  namespace metrics {
+    constexpr bool compiled = R5RS_METRICS;
+
+    // the kinds of expression, in the order of Exp::exp_t
+    inline constexpr const char* kinds[] = { "variable", "literal", "call",
+      "lambda", "conditional", "assignment", "and", "or", "cond", "case",
+      "let", "do" };
+
+    // What the interpreter did on this thread since they were last reset.
+    // Named let loops count as closure calls, inlined ones as well.
+    struct Counters {
+      std::array<uint64_t, std::size(kinds)> evaluations{};
+      uint64_t closure_calls = 0;
+      uint64_t primitive_calls = 0;
+      // the arguments of all the calls
+      uint64_t arguments = 0;
+      uint64_t frames = 0;
+      // the closure calls in progress, tail calls taking the place of the
+      // one that made them, and the most there have been
+      uint64_t depth = 0;
+      uint64_t max_depth = 0;
+    };
+
+    inline thread_local Counters counters;
+
+    inline void evaluated(size_t kind) {
+      if constexpr (compiled) {
+        ++counters.evaluations[kind];
+      }
+    }
+
+    inline void called(bool closure, size_t arguments) {
+      if constexpr (compiled) {
+        ++(closure ? counters.closure_calls : counters.primitive_calls);
+        counters.arguments += arguments;
+      }
+    }
+
+    inline void framed() {
+      if constexpr (compiled) {
+        ++counters.frames;
+      }
+    }
+
+    // The closure call one C++ frame of the interpreter is in, counted in
+    // the depth until the frame goes.
+    class Depth {
+    public:
+      Depth() = default;
+      Depth(const Depth&) = delete;
+      Depth& operator=(const Depth&) = delete;
+
+      ~Depth() {
+        if constexpr (compiled) {
+          counters.depth -= entered;
+        }
+      }
+
+      void enter() {
+        if constexpr (compiled) {
+          if (!entered) {
+            entered = true;
+            counters.max_depth = std::max(counters.max_depth,
+              ++counters.depth);
+          }
+        }
+      }
+
+    private:
+      bool entered = false;
+    };
+
+    // zeroes the counters but the depth of the calls in progress
+    void reset();
+    // the counters as one line of JSON
+    void json(std::ostream& out, const Counters& of = counters);
+
+    // (evaluator-metrics) is the counters as an association list, keyed by
+    // symbols spelt as in the JSON with dashes for underscores
+    GCRef evaluator_metrics(std::span<const GCRef> args);
+  } // namespace metrics
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,171 @@
+#include "Profiler.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "Expressions.h"
+
+using namespace r5rs;
+using namespace r5rs::profile;
+
+namespace {
+  // The samples taken, each its depth followed by its frames. The handler
+  // only appends to it, and drops what does not fit.
+  constexpr size_t capacity = 1 << 20;
+  std::unique_ptr<uintptr_t[]> cells;
+  std::atomic<size_t> used = 0;
+  std::atomic<size_t> taken = 0;
+  std::atomic<size_t> dropped = 0;
+
+  void sample(int) {
+    auto depth = std::min(stack.depth.load(std::memory_order_relaxed), limit);
+    std::atomic_signal_fence(std::memory_order_acquire);
+    auto at = used.load(std::memory_order_relaxed);
+    if (at + depth + 1 > capacity) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    cells[at] = depth;
+    for (size_t i = 0; i < depth; ++i) {
+      cells[at + 1 + i] = reinterpret_cast<uintptr_t>(
+        stack.frames[i].load(std::memory_order_relaxed));
+    }
+    used.store(at + depth + 1, std::memory_order_relaxed);
+    taken.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  using Stack = std::vector<const expression::Lambda*>;
+
+  std::vector<Stack> stacks() {
+    std::vector<Stack> res;
+    auto end = used.load();
+    for (size_t at = 0; at < end; at += cells[at] + 1) {
+      auto&& stack = res.emplace_back();
+      for (size_t i = 0; i < cells[at]; ++i) {
+        stack.push_back(
+          reinterpret_cast<const expression::Lambda*>(cells[at + 1 + i]));
+      }
+    }
+    return res;
+  }
+
+  // its name and where it starts, or lambda for an anonymous procedure
+  std::string name(const expression::Lambda* lambda) {
+    auto res = lambda->name.empty() ? "lambda" : lambda->name;
+    if (lambda->line) {
+      res += " (" + std::to_string(lambda->line) + ":" +
+        std::to_string(lambda->col + 1) + ")";
+    }
+    return res;
+  }
+} // namespace
+
+r5rs::profile::Profiler::Profiler(std::chrono::microseconds interval) {
+  cells = std::make_unique<uintptr_t[]>(capacity);
+  used = 0;
+  taken = 0;
+  dropped = 0;
+
+  struct sigaction action {};
+  action.sa_handler = sample;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (::sigaction(SIGPROF, &action, &saved) < 0) {
+    throw std::runtime_error("cannot handle SIGPROF!");
+  }
+
+  // a timer on the CPU time of this thread alone, signalling only it, so
+  // pool workers neither take samples nor count towards them
+  sigevent event{};
+  event.sigev_notify = SIGEV_THREAD_ID;
+  event.sigev_signo = SIGPROF;
+  event._sigev_un._tid = ::gettid();
+  itimerspec spec{};
+  spec.it_interval.tv_sec = interval.count() / 1000000;
+  spec.it_interval.tv_nsec = interval.count() % 1000000 * 1000;
+  spec.it_value = spec.it_interval;
+  if (::timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) < 0) {
+    ::sigaction(SIGPROF, &saved, nullptr);
+    throw std::runtime_error("cannot create the profiling timer!");
+  }
+  ::timer_settime(timer, 0, &spec, nullptr);
+}
+
+r5rs::profile::Profiler::~Profiler() { stop(); }
+
+void r5rs::profile::Profiler::stop() {
+  if (!running) {
+    return;
+  }
+  ::timer_delete(timer);
+  ::sigaction(SIGPROF, &saved, nullptr);
+  running = false;
+}
+
+size_t r5rs::profile::Profiler::samples() const { return taken; }
+
+void r5rs::profile::Profiler::folded(std::ostream& out) const {
+  std::map<std::string, size_t> counts;
+  for (auto&& stack : stacks()) {
+    std::string line;
+    for (auto&& frame : stack) {
+      line += (line.empty() ? "" : ";") + name(frame);
+    }
+    ++counts[line.empty() ? "(top level)" : line];
+  }
+  for (auto&& [line, count] : counts) {
+    out << line << ' ' << count << '\n';
+  }
+}
+
+void r5rs::profile::Profiler::report(std::ostream& out, size_t top) const {
+  struct Times {
+    size_t self = 0;
+    size_t total = 0;
+  };
+  std::unordered_map<const expression::Lambda*, Times> times;
+  auto all = stacks();
+  for (auto&& stack : all) {
+    if (!stack.empty()) {
+      ++times[stack.back()].self;
+    }
+    // a recursive procedure counts once for each sample it is in
+    std::sort(stack.begin(), stack.end());
+    auto end = std::unique(stack.begin(), stack.end());
+    for (auto it = stack.begin(); it != end; ++it) {
+      ++times[*it].total;
+    }
+  }
+
+  std::vector<std::pair<const expression::Lambda*, Times>> rows(
+    times.begin(), times.end());
+  std::sort(rows.begin(), rows.end(), [](auto&& a, auto&& b) {
+    return std::tie(a.second.self, a.second.total) >
+      std::tie(b.second.self, b.second.total);
+    });
+  rows.resize(std::min(rows.size(), top));
+
+  out << all.size() << " samples";
+  if (dropped) {
+    out << ", " << dropped << " dropped";
+  }
+  out << '\n' << std::setw(8) << "self" << std::setw(8) << "total"
+    << "  procedure\n";
+  auto percent = [&](size_t n) {
+    return 100.0 * n / std::max<size_t>(all.size(), 1);
+  };
+  for (auto&& [lambda, time] : rows) {
+    out << std::fixed << std::setprecision(1) << std::setw(7)
+      << percent(time.self) << '%' << std::setw(7) << percent(time.total)
+      << "%  " << name(lambda) << '\n';
+  }
+}
@@ -0,0 +1,104 @@
+#ifndef R5RS_PROFILER_H
+#define R5RS_PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+#include <signal.h>
+#include <time.h>
+
+namespace r5rs {
+  namespace expression {
+    class Lambda;
+  }
+
+  namespace profile {
+    // Whether the interpreter keeps the stacks of Scheme procedures samples
+    // are taken of. Set before evaluation starts; while it is off a call
+    // costs no more than testing it.
+    inline bool enabled = false;
+
+    // deeper frames are counted but not recorded
+    constexpr size_t limit = 256;
+
+    // The procedures running on one thread, outermost first. The signal
+    // handler reads it in the middle of any update, so a frame is written
+    // before the depth that takes it in.
+    struct Stack {
+      std::atomic<const expression::Lambda*> frames[limit];
+      std::atomic<size_t> depth;
+    };
+
+    inline thread_local Stack stack;
+
+    // The procedure one C++ frame of the interpreter is running, taken off
+    // the stack when the frame goes. A tail call replaces it in place.
+    class Frame {
+    public:
+      Frame() = default;
+      Frame(const Frame&) = delete;
+      Frame& operator=(const Frame&) = delete;
+
+      ~Frame() {
+        if (pushed) {
+          stack.depth.store(stack.depth.load(std::memory_order_relaxed) - 1,
+            std::memory_order_relaxed);
+        }
+      }
+
+      void enter(const expression::Lambda* lambda) {
+        if (!enabled) {
+          return;
+        }
+        auto depth = stack.depth.load(std::memory_order_relaxed);
+        if (pushed) {
+          if (depth <= limit) {
+            stack.frames[depth - 1].store(lambda, std::memory_order_relaxed);
+          }
+          return;
+        }
+        if (depth < limit) {
+          stack.frames[depth].store(lambda, std::memory_order_relaxed);
+        }
+        std::atomic_signal_fence(std::memory_order_release);
+        stack.depth.store(depth + 1, std::memory_order_relaxed);
+        pushed = true;
+      }
+
+    private:
+      bool pushed = false;
+    };
+
+    // Samples the stack of the thread that makes it every `interval` of
+    // that thread's CPU time, from a SIGPROF timer, until stopped. One
+    // runs at a time, and the procedures it saw must outlive the reports.
+    class Profiler {
+    public:
+      explicit Profiler(
+        std::chrono::microseconds interval = std::chrono::milliseconds(1));
+      Profiler(const Profiler&) = delete;
+      Profiler& operator=(const Profiler&) = delete;
+      ~Profiler();
+
+      void stop();
+      size_t samples() const;
+
+      // one line for each stack sampled, its procedures outermost first
+      // and separated by semicolons, and then the number of samples, as
+      // flamegraph tools read
+      void folded(std::ostream& out) const;
+      // the `top` procedures by samples taken in them, their self time,
+      // with the samples taken anywhere under them, their total time
+      void report(std::ostream& out, size_t top = 20) const;
+
+    private:
+      timer_t timer;
+      struct sigaction saved;
+      bool running = true;
+    };
+  } // namespace profile
+} // namespace r5rs
+
+#endif
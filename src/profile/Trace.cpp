@@ -0,0 +1,98 @@
+#include "Trace.h"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace r5rs;
+using namespace r5rs::trace;
+
+namespace {
+  struct Event {
+    const char* name;
+    int64_t ns;
+    bool begin;
+  };
+
+  constexpr size_t capacity = 1 << 16;
+
+  // One thread's events. Only that thread writes them, but json() reads
+  // them from another, so both take the lock, which is never contended
+  // while nobody exports.
+  struct Ring {
+    std::mutex mutex;
+    size_t tid;
+    std::vector<Event> events;
+    // the events ever written, the latest `capacity` of them kept
+    size_t written = 0;
+  };
+
+  std::mutex registered;
+  // every thread's ring, kept after the thread exits
+  std::vector<std::shared_ptr<Ring>> rings;
+
+  Ring& ring() {
+    thread_local auto res = [] {
+      auto ring = std::make_shared<Ring>();
+      ring->events.resize(capacity);
+      std::lock_guard lock(registered);
+      ring->tid = rings.size() + 1;
+      rings.push_back(ring);
+      return ring;
+    }();
+    return *res;
+  }
+
+  int64_t now() {
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - epoch).count();
+  }
+
+  // the clock is read once the ring is there, so making it is not timed
+  void record(const char* name, bool begin) {
+    auto&& ring = ::ring();
+    std::lock_guard lock(ring.mutex);
+    ring.events[ring.written++ % capacity] = { name, now(), begin };
+  }
+} // namespace
+
+void r5rs::trace::begin(const char* name) { record(name, true); }
+
+void r5rs::trace::end(const char* name) { record(name, false); }
+
+void r5rs::trace::json(std::ostream& out) {
+  std::lock_guard lock(registered);
+  out << "{\"traceEvents\":[";
+  auto first = true;
+  for (auto&& ring : rings) {
+    std::lock_guard lock(ring->mutex);
+    auto from = ring->written > capacity ? ring->written - capacity : 0;
+    size_t depth = 0;
+    for (auto i = from; i < ring->written; ++i) {
+      auto&& event = ring->events[i % capacity];
+      if (!event.begin && depth == 0) {
+        continue;
+      }
+      depth += event.begin ? 1 : -1;
+      out << (first ? "" : ",") << "\n{\"name\":\"" << event.name
+        << "\",\"cat\":\"r5rs\",\"ph\":\"" << (event.begin ? 'B' : 'E')
+        << "\",\"ts\":" << event.ns / 1000 << '.' << std::setfill('0')
+        << std::setw(3) << event.ns % 1000 << std::setfill(' ')
+        << ",\"pid\":1,\"tid\":" << ring->tid << '}';
+      first = false;
+    }
+  }
+  out << "\n]}" << std::endl;
+}
+
+void r5rs::trace::clear() {
+  std::lock_guard lock(registered);
+  for (auto&& ring : rings) {
+    std::lock_guard lock(ring->mutex);
+    ring->written = 0;
+  }
+}
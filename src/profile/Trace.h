@@ -0,0 +1,48 @@
+#ifndef R5RS_TRACE_H
+#define R5RS_TRACE_H
+
+#include <atomic>
+#include <ostream>
+
+namespace r5rs {
+  namespace trace {
+    // Whether spans are recorded. Any thread may switch it at any time; a
+    // span begun while it was on still ends.
+    inline std::atomic<bool> enabled = false;
+
+    // Each thread keeps its latest events in a ring of its own, which
+    // overwrites the oldest once full. The name must be a string literal.
+    void begin(const char* name);
+    void end(const char* name);
+
+    // a phase of work, from its construction to the end of its scope
+    class Span {
+    public:
+      explicit Span(const char* name)
+        : name(enabled.load(std::memory_order_relaxed) ? name : nullptr) {
+        if (this->name) {
+          begin(this->name);
+        }
+      }
+      Span(const Span&) = delete;
+      Span& operator=(const Span&) = delete;
+
+      ~Span() {
+        if (name) {
+          end(name);
+        }
+      }
+
+    private:
+      const char* name;
+    };
+
+    // Writes the events of every thread that recorded any as Chrome
+    // trace-event JSON, which Perfetto and chrome://tracing read. An end
+    // whose begin was overwritten is left out.
+    void json(std::ostream& out);
+    void clear();
+  } // namespace trace
+} // namespace r5rs
+
+#endif
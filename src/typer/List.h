@@ -4,14 +4,21 @@
 #include <mutex>
 
 namespace r5rs {
+  // An intrusive list with one global head per element type and thread:
+  // each thread allocates into and collects only its own heap. The heads
+  // start unlinked, so they need no dynamic initialization and cost no
+  // guard on each access; the first add links them.
   template <typename T> class List {
   public:
+    List() = default;
+    constexpr explicit List(nullptr_t) : prev(nullptr), next(nullptr) {}
+
     static void add(List<T>* element);
     static List* rem(List<T>* element);
     static bool exist(List<T>* element);
 
-    inline static List global;
-    inline static size_t size;
+    inline static thread_local List global{ nullptr };
+    inline static thread_local size_t size;
 
     mutable List* prev = this;
     mutable List* next = this;
@@ -24,6 +31,9 @@ namespace r5rs {
 
     ++size;
 
+    if (!global.next) {
+      global.prev = global.next = &global;
+    }
     auto next = global.next;
 
     element->next = next;
@@ -33,6 +33,10 @@ std::string r5rs::String::operator()(const std::string& value) {
   return '"' + value + '"';
 }
 
+std::string r5rs::String::operator()(std::string_view value) {
+  return operator()(std::string(value));
+}
+
 std::string r5rs::String::operator()(const Symbol& value) {
   return "'" + value.name;
 }
@@ -60,10 +64,38 @@ std::string r5rs::String::operator()(const Vector& value) {
   return "#";
 }
 
+std::string r5rs::String::operator()(const Promise& value) {
+  return "#<promise>";
+}
+
+std::string r5rs::String::operator()(const Future& value) {
+  return "#<future>";
+}
+
 std::string r5rs::String::operator()(const ClosureLambda& value) {
   return std::string();
 }
 
+std::string r5rs::String::operator()(const ClosureFunction& value) {
+  return std::string();
+}
+
+std::string r5rs::String::operator()(const ClosureCompiled& value) {
+  return std::string();
+}
+
+std::string r5rs::String::operator()(const Continuation& value) {
+  return std::string();
+}
+
+std::string r5rs::String::operator()(const Channel& value) {
+  return "#<channel>";
+}
+
+std::string r5rs::String::operator()(const Condition& value) {
+  return "#<error " + (*this)(value.message) + ">";
+}
+
 std::string r5rs::String::operator()(const Primitive& value) {
   return std::string();
 }
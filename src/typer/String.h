@@ -4,6 +4,7 @@
 #include <iomanip>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <variant>
 
 #include "Type.h"
@@ -18,10 +19,18 @@ namespace r5rs {
     std::string operator()(int64_t value);
     std::string operator()(double value);
     std::string operator()(const std::string& value);
+    std::string operator()(std::string_view value);
     std::string operator()(const Symbol& value);
     std::string operator()(const Pair& value);
     std::string operator()(const Vector& value);
+    std::string operator()(const Promise& value);
+    std::string operator()(const Future& value);
     std::string operator()(const ClosureLambda& value);
+    std::string operator()(const ClosureFunction& value);
+    std::string operator()(const ClosureCompiled& value);
+    std::string operator()(const Continuation& value);
+    std::string operator()(const Channel& value);
+    std::string operator()(const Condition& value);
     std::string operator()(const Primitive& value);
     // std::string operator()(auto value);
   };
@@ -32,11 +32,17 @@ namespace r5rs {
 
     operator bool() { return std::holds_alternative<T>(value); }
 
-    T operator*() {
+    T& operator*() & {
       assert(*this);
       return std::get<T>(value);
     }
 
+    // a Try about to go gives its value up rather than a copy
+    T operator*() && {
+      assert(*this);
+      return std::get<T>(std::move(value));
+    }
+
     T* operator->() {
       assert(*this);
       return &std::get<T>(value);
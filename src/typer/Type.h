@@ -6,6 +6,9 @@
 #include <cstdint>
 #include <functional>
 #include <list>
+#include <memory>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <type_traits>
 #include <utility>
@@ -134,14 +137,96 @@ namespace r5rs
     std::shared_ptr<Env> env;
   };
 
-  using Primitive = GCRef(*)(std::list<GCRef> &);
+  namespace vm
+  {
+    struct Function;
+    class Frame;
+    struct Activation;
+    struct Mailbox;
+  }
+
+  class ClosureFunction
+  {
+  public:
+    const vm::Function * function;
+    std::shared_ptr<vm::Frame> frame;
+  };
+
+  namespace closure
+  {
+    struct Lambda;
+  }
+
+  class ClosureCompiled
+  {
+  public:
+    const closure::Lambda * lambda;
+    std::shared_ptr<vm::Frame> frame;
+  };
+
+  namespace parallel
+  {
+    class Job;
+  }
+
+  // a value some pool worker may still be computing, made by future
+  class Future
+  {
+  public:
+    std::shared_ptr<parallel::Job> job;
+  };
+
+  // the rest of a vm computation, captured by call/cc
+  class Continuation
+  {
+  public:
+    std::shared_ptr<vm::Activation> activation;
+  };
+
+  // a channel between the green threads of a vm, made by make-channel
+  class Channel
+  {
+  public:
+    std::shared_ptr<vm::Mailbox> mailbox;
+  };
+
+  // A built-in procedure called with its arguments in place on the caller's
+  // argument stack. `arity` is the exact number of arguments it takes, or
+  // `variadic`; callers check it so the procedure itself does not have to.
+  class Primitive
+  {
+  public:
+    static constexpr size_t variadic = -1;
+
+    GCRef (*fn)(std::span<const GCRef> args) = nullptr;
+    size_t arity = variadic;
+
+    bool accepts(size_t n) const
+    {
+      return arity == variadic || n == arity;
+    }
+
+    void check(size_t n) const
+    {
+      if (!accepts(n))
+      {
+        throw std::runtime_error("Argument number error!");
+      }
+    }
+
+    bool operator==(const Primitive &) const = default;
+  };
 
   using Vector = std::vector<InternalGCRef>;
 
+  class Promise;
+  class Condition;
+
   using GCValue = std::variant<
     // std::monostate,
     nullptr_t, bool, char, int64_t, double, std::string, Symbol, Pair, Vector,
-    ClosureLambda, Primitive>;
+    Promise, Future, ClosureLambda, ClosureFunction, ClosureCompiled, Continuation,
+    Channel, Condition, Primitive>;
 
   template <typename Ret, typename... Args>
   using function_ptr = std::shared_ptr<std::function<Ret(Args...)>>;
@@ -0,0 +1,31 @@
+#include "Bytecode.h"
+
+#include <sstream>
+
+using namespace r5rs;
+using namespace r5rs::vm;
+
+std::string r5rs::vm::to_string(Op op) {
+  static const std::unordered_map<Op, std::string> names{
+#define R5RS_OPCODE_ACCESS(id) {Op::id, #id},
+#define R5RS_BUILTIN_ACCESS(id, n) {Op::id, #id},
+      R5RS_OPCODE R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+#undef R5RS_OPCODE_ACCESS
+  };
+
+  return names.at(op);
+}
+
+std::string r5rs::vm::Function::print() const {
+  std::stringstream stream;
+  stream << name << " (" << fixed << (rest ? "+" : "") << "):\n";
+  for (size_t pc = 0; pc != code.size(); ++pc) {
+    stream << "  " << pc << "\t" << to_string(opcode(code[pc])) << "\t"
+      << operand(code[pc]) << "\n";
+  }
+  for (auto&& function : functions) {
+    stream << function->print();
+  }
+  return stream.str();
+}
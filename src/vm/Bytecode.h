@@ -0,0 +1,97 @@
+#ifndef R5RS_BYTECODE_H
+#define R5RS_BYTECODE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Frame.h"
+#include "GC.h"
+#include "Primitives.h"
+#include "Type.h"
+
+// Every instruction is a single 32 bit word: the opcode in the low 8 bits and
+// its operand in the high 24 bits. After these come one opcode per
+// R5RS_BUILTIN, which applies the builtin inline to the operands on the stack
+// while globals[arg & GLOBAL_MASK] still holds it, and otherwise makes an
+// ordinary call (a tail call if arg has TAIL_FLAG set).
+#define R5RS_OPCODE                                                            \
+  R5RS_OPCODE_ACCESS(constant)       /* push constants[arg]            */      \
+  R5RS_OPCODE_ACCESS(nil)            /* push ()                        */      \
+  R5RS_OPCODE_ACCESS(local)          /* push frame[arg]                */      \
+  R5RS_OPCODE_ACCESS(upvalue)        /* push frame^depth[index]        */      \
+  R5RS_OPCODE_ACCESS(global)         /* push globals[arg]              */      \
+  R5RS_OPCODE_ACCESS(set_local)      /* frame[arg] = pop               */      \
+  R5RS_OPCODE_ACCESS(set_upvalue)    /* frame^depth[index] = pop       */      \
+  R5RS_OPCODE_ACCESS(set_global)     /* globals[arg] = pop             */      \
+  R5RS_OPCODE_ACCESS(define_local)   /* frame[arg] := pop, growing it  */      \
+  R5RS_OPCODE_ACCESS(define_global)  /* globals[arg] := pop            */      \
+  R5RS_OPCODE_ACCESS(pop)                                                      \
+  R5RS_OPCODE_ACCESS(dup)            /* push the top again             */      \
+  R5RS_OPCODE_ACCESS(swap)           /* exchange the top two           */      \
+  R5RS_OPCODE_ACCESS(jump)           /* pc = arg                       */      \
+  R5RS_OPCODE_ACCESS(jump_false)     /* if (!pop) pc = arg             */      \
+  R5RS_OPCODE_ACCESS(dispatch)       /* pc = tables[arg] entry for pop */      \
+  R5RS_OPCODE_ACCESS(closure)        /* push closure of functions[arg] */      \
+  R5RS_OPCODE_ACCESS(call)           /* call with arg operands         */      \
+  R5RS_OPCODE_ACCESS(tail_call)      /* call replacing this activation */      \
+  R5RS_OPCODE_ACCESS(ret)
+
+namespace r5rs {
+  namespace vm {
+    enum class Op : uint8_t {
+#define R5RS_OPCODE_ACCESS(id) id,
+#define R5RS_BUILTIN_ACCESS(id, n) id,
+      R5RS_OPCODE R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+#undef R5RS_OPCODE_ACCESS
+    };
+
+    std::string to_string(Op op);
+
+    constexpr uint32_t ARG_LIMIT = 1 << 24;
+    constexpr uint32_t DEPTH_SHIFT = 16;
+    constexpr uint32_t INDEX_MASK = (1 << DEPTH_SHIFT) - 1;
+    constexpr uint32_t TAIL_FLAG = ARG_LIMIT >> 1;
+    constexpr uint32_t GLOBAL_MASK = TAIL_FLAG - 1;
+
+    constexpr uint32_t encode(Op op, uint32_t arg = 0) {
+      return static_cast<uint32_t>(op) | arg << 8;
+    }
+    constexpr Op opcode(uint32_t word) { return static_cast<Op>(word & 0xff); }
+    constexpr uint32_t operand(uint32_t word) { return word >> 8; }
+
+    // Machine code for a function: runs it from `pc` on the activation in
+    // `context` and returns the pc of the first instruction the VM has to
+    // execute itself.
+    using Native = uint32_t (*)(void* context, uint32_t pc);
+
+    // The jump of a case expression: the pc of each clause in order and
+    // then of the else clause, chosen by the clause the key selects.
+    struct Table {
+      std::shared_ptr<const expression::Dispatch> dispatch;
+      std::vector<uint32_t> targets;
+    };
+
+    // compiled lambda body or top level form
+    struct Function {
+      std::string name;
+      size_t fixed = 0;
+      bool rest = false;
+      std::vector<std::string> locals;
+      std::vector<uint32_t> code;
+      std::vector<GCRef> constants;
+      std::vector<std::unique_ptr<Function>> functions;
+      std::vector<Table> tables;
+
+      // times entered, and its native code once the jit compiled it
+      mutable uint32_t calls = 0;
+      mutable Native native = nullptr;
+
+      std::string print() const;
+    };
+  } // namespace vm
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,507 @@
+#include "Compiler.h"
+
+#include <algorithm>
+
+using namespace r5rs;
+using namespace r5rs::vm;
+using namespace expression;
+
+std::unique_ptr<Function> r5rs::vm::Compiler::compile(expression::COD* cod) {
+  auto res = std::make_unique<Function>();
+  res->name = "toplevel";
+
+  function = res.get();
+  scope = nullptr;
+  tail = true;
+
+  std::invoke(*this, cod);
+  emit(Op::ret);
+
+  function = nullptr;
+  return res;
+}
+
+void r5rs::vm::Compiler::operator()(expression::COD* cod) {
+  auto type = cod->cod_type();
+  std::visit(*this, type);
+  if (std::holds_alternative<Definition*>(type)) {
+    emit(Op::nil);
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Definition* def) {
+  std::visit(*this, def->def_type());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Exp* exp) {
+  std::visit(*this, exp->exp_type());
+}
+
+void r5rs::vm::Compiler::operator()(expression::CODs* cods) {
+  if (cods->cods.empty()) {
+    emit(Op::nil);
+    return;
+  }
+
+  auto t = tail;
+  auto back = std::prev(cods->cods.end());
+  for (auto it = cods->cods.begin(); it != back; ++it) {
+    tail = false;
+    std::invoke(*this, it->get());
+    emit(Op::pop);
+  }
+  tail = t;
+  std::invoke(*this, back->get());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Define* def) {
+  auto t = tail;
+  tail = false;
+  std::invoke(*this, def->exp.get());
+  tail = t;
+
+  if (std::holds_alternative<Lambda*>(def->exp->exp_type())) {
+    function->functions.back()->name = def->variable;
+  }
+
+  if (!scope) {
+    emit(Op::define_global, globals.intern(def->variable));
+    return;
+  }
+
+  auto&& names = scope->names;
+  auto it = std::find(names.begin(), names.end(), def->variable);
+  assert(it != names.end());
+  emit(Op::define_local, it - names.begin());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Definitions* defs) {
+  for (auto&& def : defs->defs) {
+    std::invoke(*this, def.get());
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Variable* var) {
+  auto address = resolve(var->id, Op::local, Op::upvalue, Op::global);
+  emit(address.op, address.arg);
+}
+
+void r5rs::vm::Compiler::operator()(expression::Literal* literal) {
+  emit(Op::constant, constant(literal->constant()));
+}
+
+void r5rs::vm::Compiler::operator()(expression::Call* call) {
+  auto loop = std::find_if(loops.rbegin(), loops.rend(),
+    [&](const Loop& loop) { return loop.let == call->loop; });
+  if (loop != loops.rend()) {
+    // the next iteration: rebind the variables and go back to the body.
+    // Operands may hold loops of their own, so copy this one first.
+    auto [let, slots, start] = *loop;
+    auto t = tail;
+    tail = false;
+    for (auto&& operand : call->operands) {
+      std::invoke(*this, operand.get());
+    }
+    tail = t;
+    for (auto it = slots.rbegin(); it != slots.rend(); ++it) {
+      emit(Op::set_local, *it);
+    }
+    emit(Op::jump, start);
+    return;
+  }
+
+  auto inlined = builtin(call);
+
+  auto t = tail;
+  tail = false;
+  if (!inlined) {
+    std::invoke(*this, call->op.get());
+  }
+  for (auto&& operand : call->operands) {
+    std::invoke(*this, operand.get());
+  }
+  tail = t;
+
+  if (inlined) {
+    emit(inlined->op, inlined->arg | (tail ? TAIL_FLAG : 0));
+    return;
+  }
+  emit(tail ? Op::tail_call : Op::call, call->operands.size());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Lambda* lambda) {
+  auto res = std::make_unique<Function>();
+  res->fixed = lambda->formals->fixed.size();
+  res->rest = lambda->formals->binding.has_value();
+
+  Scope inner(scope);
+  for (auto&& name : lambda->formals->fixed) {
+    inner.names.push_back(name);
+  }
+  if (lambda->formals->binding) {
+    inner.names.push_back(*lambda->formals->binding);
+  }
+
+  auto f = function;
+  auto s = scope;
+  auto t = tail;
+
+  function = res.get();
+  scope = &inner;
+  tail = true;
+
+  std::invoke(*this, lambda->body.get());
+  emit(Op::ret);
+  res->locals = inner.names;
+
+  function = f;
+  scope = s;
+  tail = t;
+
+  function->functions.push_back(std::move(res));
+  emit(Op::closure, function->functions.size() - 1);
+}
+
+void r5rs::vm::Compiler::operator()(expression::Conditional* condition) {
+  auto t = tail;
+  tail = false;
+  std::invoke(*this, condition->test.get());
+  tail = t;
+
+  auto jump_false = label();
+  emit(Op::jump_false);
+
+  std::invoke(*this, condition->consequent.get());
+
+  auto jump = label();
+  emit(Op::jump);
+
+  patch(jump_false, label());
+  if (condition->alternate) {
+    std::invoke(*this, condition->alternate.get());
+  }
+  else {
+    emit(Op::nil);
+  }
+
+  patch(jump, label());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Assignment* assign) {
+  auto t = tail;
+  tail = false;
+  std::invoke(*this, assign->exp.get());
+  tail = t;
+
+  auto address =
+    resolve(assign->variable, Op::set_local, Op::set_upvalue, Op::set_global);
+  emit(address.op, address.arg);
+  emit(Op::nil);
+}
+
+// Each value but the last is duplicated for jump_false to test, so a false
+// one is left behind as the result when it jumps past the rest.
+void r5rs::vm::Compiler::operator()(expression::And* conjunction) {
+  auto&& exps = conjunction->exps;
+  if (exps.empty()) {
+    emit(Op::constant, constant(true));
+    return;
+  }
+
+  std::vector<size_t> exits;
+  auto t = tail;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    tail = false;
+    std::invoke(*this, it->get());
+    emit(Op::dup);
+    exits.push_back(label());
+    emit(Op::jump_false);
+    emit(Op::pop);
+  }
+  tail = t;
+  std::invoke(*this, back->get());
+
+  for (auto&& at : exits) {
+    patch(at, label());
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Or* disjunction) {
+  auto&& exps = disjunction->exps;
+  if (exps.empty()) {
+    emit(Op::constant, constant(false));
+    return;
+  }
+
+  std::vector<size_t> exits;
+  auto t = tail;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    tail = false;
+    std::invoke(*this, it->get());
+    emit(Op::dup);
+    auto next = label();
+    emit(Op::jump_false);
+    exits.push_back(label());
+    emit(Op::jump);
+    patch(next, label());
+    emit(Op::pop);
+  }
+  tail = t;
+  std::invoke(*this, back->get());
+
+  for (auto&& at : exits) {
+    patch(at, label());
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Cond* cond) {
+  std::vector<size_t> exits;
+  auto t = tail;
+  bool otherwise = false;
+  for (auto&& clause : cond->clauses) {
+    if (!clause.test) {
+      sequence(clause.exps);
+      otherwise = true;
+      break;
+    }
+
+    tail = false;
+    std::invoke(*this, clause.test.get());
+    tail = t;
+
+    if (!clause.exps.empty()) {
+      auto next = label();
+      emit(Op::jump_false);
+      sequence(clause.exps);
+      exits.push_back(label());
+      emit(Op::jump);
+      patch(next, label());
+      continue;
+    }
+
+    // the value of the test is the result, or the operand of the receiver
+    emit(Op::dup);
+    auto next = label();
+    emit(Op::jump_false);
+    if (clause.receiver) {
+      tail = false;
+      std::invoke(*this, clause.receiver.get());
+      tail = t;
+      emit(Op::swap);
+      emit(tail ? Op::tail_call : Op::call, 1);
+    }
+    exits.push_back(label());
+    emit(Op::jump);
+    patch(next, label());
+    emit(Op::pop);
+  }
+  if (!otherwise) {
+    emit(Op::nil);
+  }
+
+  for (auto&& at : exits) {
+    patch(at, label());
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Case* selection) {
+  auto t = tail;
+  tail = false;
+  std::invoke(*this, selection->key.get());
+  tail = t;
+
+  auto index = function->tables.size();
+  function->tables.push_back({ selection->dispatch, {} });
+  emit(Op::dispatch, index);
+
+  std::vector<uint32_t> targets;
+  std::vector<size_t> exits;
+  for (auto&& clause : selection->clauses) {
+    targets.push_back(label());
+    sequence(clause.exps);
+    exits.push_back(label());
+    emit(Op::jump);
+  }
+  targets.push_back(label());
+  sequence(selection->otherwise);
+
+  for (auto&& at : exits) {
+    patch(at, label());
+  }
+  function->tables[index].targets = std::move(targets);
+}
+
+void r5rs::vm::Compiler::operator()(expression::Let* let) {
+  if (!let->inlined) {
+    std::invoke(*this, let->core.get());
+    return;
+  }
+  if (!scope) {
+    function_of(let);
+    return;
+  }
+
+  // the variables take new slots of this frame, each bound as soon as its
+  // init is evaluated since no init can see them
+  std::vector<uint32_t> slots;
+  auto t = tail;
+  tail = false;
+  for (auto&& init : let->inits) {
+    std::invoke(*this, init.get());
+    slots.push_back(scope->names.size());
+    emit(Op::define_local, slots.back());
+    scope->names.emplace_back();
+  }
+  tail = t;
+
+  auto&& variables = let->lambda->formals->fixed;
+  auto slot = slots.begin();
+  for (auto&& name : variables) {
+    scope->names[*slot++] = name;
+  }
+  if (let->name) {
+    loops.push_back({ let, slots, label() });
+  }
+  sequence(let->lambda->body->exps);
+  if (let->name) {
+    loops.pop_back();
+  }
+  for (auto&& slot : slots) {
+    scope->unbind(slot);
+  }
+}
+
+void r5rs::vm::Compiler::operator()(expression::Do* loop) {
+  std::invoke(*this, loop->loop.get());
+}
+
+void r5rs::vm::Compiler::operator()(expression::Body* body) {
+  if (body->exps.empty()) {
+    throw std::runtime_error("empty body!");
+  }
+
+  for (auto&& def : body->defs) {
+    scope->declare(def.get());
+  }
+
+  auto t = tail;
+  tail = false;
+  for (auto&& def : body->defs) {
+    std::invoke(*this, def.get());
+  }
+  tail = t;
+  sequence(body->exps);
+}
+
+// Compiles `exp` as the body of a procedure of no arguments and calls it,
+// which gives an inlined let at top level a frame for its variables.
+void r5rs::vm::Compiler::function_of(expression::Exp* exp) {
+  auto res = std::make_unique<Function>();
+  res->name = "let";
+
+  Scope inner;
+  auto f = function;
+  auto s = scope;
+  auto t = tail;
+
+  function = res.get();
+  scope = &inner;
+  tail = true;
+
+  std::invoke(*this, exp);
+  emit(Op::ret);
+  res->locals = inner.names;
+
+  function = f;
+  scope = s;
+  tail = t;
+
+  function->functions.push_back(std::move(res));
+  emit(Op::closure, function->functions.size() - 1);
+  emit(tail ? Op::tail_call : Op::call, 0);
+}
+
+// Leaves the value of the last of `exps`, or nil if there are none.
+void r5rs::vm::Compiler::sequence(const std::list<expression::ExpPtr>& exps) {
+  if (exps.empty()) {
+    emit(Op::nil);
+    return;
+  }
+
+  auto t = tail;
+  tail = false;
+  auto back = std::prev(exps.end());
+  for (auto it = exps.begin(); it != back; ++it) {
+    std::invoke(*this, it->get());
+    emit(Op::pop);
+  }
+  tail = t;
+  std::invoke(*this, back->get());
+}
+
+// The inline opcode for a call whose operator is a global bound to one of the
+// R5RS_BUILTIN primitives right now.
+std::optional<Compiler::Address>
+r5rs::vm::Compiler::builtin(expression::Call* call) {
+  auto type = call->op->exp_type();
+  auto var = std::get_if<expression::Variable*>(&type);
+  if (!var || (scope && scope->find((*var)->id))) {
+    return std::nullopt;
+  }
+  auto index = globals.intern((*var)->id);
+  auto&& value = globals.values[index];
+  if (!value || index > GLOBAL_MASK) {
+    return std::nullopt;
+  }
+  auto bound = std::get_if<Primitive>(&**value);
+  if (!bound) {
+    return std::nullopt;
+  }
+  auto n = call->operands.size();
+#define R5RS_BUILTIN_ACCESS(id, arity)                                         \
+  if (bound->fn == &primitive::id && n == arity) {                             \
+    return Address{ Op::id, index };                                           \
+  }
+  R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+  return std::nullopt;
+}
+
+Compiler::Address r5rs::vm::Compiler::resolve(const std::string& name,
+  Op local, Op upvalue, Op global) {
+  auto address = scope ? scope->find(name) : std::nullopt;
+  if (!address) {
+    return { global, globals.intern(name) };
+  }
+  if (address->depth == 0) {
+    return { local, address->index };
+  }
+  if (address->index > INDEX_MASK ||
+    address->depth >= ARG_LIMIT >> DEPTH_SHIFT) {
+    throw std::runtime_error("too many nested variables");
+  }
+  return { upvalue, address->depth << DEPTH_SHIFT | address->index };
+}
+
+void r5rs::vm::Compiler::emit(Op op, uint32_t arg) {
+  if (arg >= ARG_LIMIT) {
+    throw std::runtime_error("bytecode operand overflow");
+  }
+  function->code.push_back(encode(op, arg));
+}
+
+size_t r5rs::vm::Compiler::label() { return function->code.size(); }
+
+void r5rs::vm::Compiler::patch(size_t at, size_t target) {
+  if (target >= ARG_LIMIT) {
+    throw std::runtime_error("bytecode operand overflow");
+  }
+  function->code[at] = encode(opcode(function->code[at]), target);
+}
+
+uint32_t r5rs::vm::Compiler::constant(GCRef value) {
+  function->constants.push_back(std::move(value));
+  return function->constants.size() - 1;
+}
@@ -0,0 +1,82 @@
+#ifndef R5RS_COMPILER_H
+#define R5RS_COMPILER_H
+
+#include <memory>
+
+#include "Bytecode.h"
+#include "Expressions.h"
+
+namespace r5rs {
+  namespace vm {
+    // Translates expression trees into bytecode. Variables bound by a lambda
+    // are resolved to frame slots at compile time; everything else is a
+    // global looked up by index.
+    class Compiler {
+    public:
+      explicit Compiler(Globals& globals) : globals(globals) {}
+
+      std::unique_ptr<Function> compile(expression::COD* cod);
+
+      // forward
+      void operator()(expression::COD*);
+      void operator()(expression::Definition*);
+      void operator()(expression::Exp*);
+
+      // cods
+      void operator()(expression::CODs*);
+
+      // Definition
+      void operator()(expression::Define*);
+      void operator()(expression::Definitions*);
+
+      // Exp
+      void operator()(expression::Variable*);
+      void operator()(expression::Literal*);
+      void operator()(expression::Call*);
+      void operator()(expression::Lambda*);
+      void operator()(expression::Conditional*);
+      void operator()(expression::Assignment*);
+      void operator()(expression::And*);
+      void operator()(expression::Or*);
+      void operator()(expression::Cond*);
+      void operator()(expression::Case*);
+      void operator()(expression::Let*);
+      void operator()(expression::Do*);
+
+      void operator()(expression::Body*);
+
+    private:
+      struct Address {
+        Op op;
+        uint32_t arg;
+      };
+
+      // an inlined named let being compiled: the slots of its variables and
+      // the start of its body, where its iterations jump back to
+      struct Loop {
+        expression::Let* let;
+        std::vector<uint32_t> slots;
+        size_t start;
+      };
+
+      Address resolve(const std::string& name, Op local, Op upvalue,
+        Op global);
+      std::optional<Address> builtin(expression::Call* call);
+      void sequence(const std::list<expression::ExpPtr>& exps);
+      void function_of(expression::Exp* exp);
+
+      void emit(Op op, uint32_t arg = 0);
+      size_t label();
+      void patch(size_t at, size_t target);
+      uint32_t constant(GCRef value);
+
+      Globals& globals;
+      Function* function = nullptr;
+      Scope* scope = nullptr;
+      bool tail = false;
+      std::vector<Loop> loops;
+    };
+  } // namespace vm
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,49 @@
+#include "Frame.h"
+
+#include <algorithm>
+
+using namespace r5rs;
+using namespace r5rs::vm;
+using namespace expression;
+
+uint32_t r5rs::vm::Globals::intern(const std::string& name) {
+  auto it = index.find(name);
+  if (it != index.end()) {
+    return it->second;
+  }
+  uint32_t i = names.size();
+  index.emplace(name, i);
+  names.push_back(name);
+  values.emplace_back(std::nullopt);
+  return i;
+}
+
+std::optional<Scope::Address>
+r5rs::vm::Scope::find(const std::string& name) const {
+  uint32_t depth = 0;
+  for (auto s = this; s; s = s->parent, ++depth) {
+    auto it = std::find(s->names.rbegin(), s->names.rend(), name);
+    if (it != s->names.rend()) {
+      return Address{ depth, static_cast<uint32_t>(s->names.rend() - it - 1) };
+    }
+  }
+  return std::nullopt;
+}
+
+void r5rs::vm::Scope::declare(expression::Definition* def) {
+  auto visitor = overloaded{
+      [this](Define* define) {
+        if (std::find(names.begin(), names.end(), define->variable) !=
+          names.end()) {
+          throw std::runtime_error(
+            "redefine variable '" + define->variable + "'!");
+        }
+        names.push_back(define->variable);
+      },
+      [this](Definitions* defs) {
+        for (auto&& def : defs->defs) {
+          declare(def.get());
+        }
+      } };
+  std::visit(visitor, def->def_type());
+}
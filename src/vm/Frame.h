@@ -0,0 +1,75 @@
+#ifndef R5RS_FRAME_H
+#define R5RS_FRAME_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Expressions.h"
+#include "GC.h"
+#include "Type.h"
+
+namespace r5rs {
+  namespace vm {
+    // the variables bound by a lambda call
+    class Frame : public std::enable_shared_from_this<Frame> {
+    public:
+      // Binds slot `index`: the next one, or one past slots that were not
+      // reached yet, such as those of a let the code branched around.
+      void define(uint32_t index, GCRef value) {
+        while (slots.size() < index) {
+          slots.emplace_back(nullptr);
+        }
+        if (index < slots.size()) {
+          slots[index] = std::move(value);
+        }
+        else {
+          slots.push_back(std::move(value));
+        }
+      }
+
+      std::shared_ptr<Frame> parent;
+      const std::vector<std::string>* locals = nullptr;
+      std::vector<GCRef> slots;
+    };
+
+    // Top level variables by index. Values live in a deque so that their
+    // addresses stay valid while new globals are interned.
+    class Globals {
+    public:
+      uint32_t intern(const std::string& name);
+
+      std::unordered_map<std::string, uint32_t> index;
+      std::vector<std::string> names;
+      std::deque<std::optional<GCRef>> values;
+    };
+
+    // The variables of one lambda at compile time. A name bound `depth`
+    // lambdas out is found in slot `index` of the frame `depth` parents up.
+    // The variables of inlined lets take further slots of the same frame and
+    // shadow the earlier names while the let lasts.
+    class Scope {
+    public:
+      struct Address {
+        uint32_t depth;
+        uint32_t index;
+      };
+
+      explicit Scope(Scope* parent = nullptr) : parent(parent) {}
+
+      std::optional<Address> find(const std::string& name) const;
+      void declare(expression::Definition* def);
+      // the slot stays, but its name goes out of scope
+      void unbind(uint32_t index) { names[index].clear(); }
+
+      Scope* parent;
+      std::vector<std::string> names;
+    };
+  } // namespace vm
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,342 @@
+#include "Scheduler.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "VM.h"
+
+using namespace r5rs;
+using namespace r5rs::vm;
+
+namespace {
+  // input read past the last line returned, by file descriptor
+  thread_local std::unordered_map<int, std::string> buffered;
+
+  int64_t fixnum(const GCRef& value) {
+    auto res = std::get_if<int64_t>(&*value);
+    if (!res) {
+      throw std::runtime_error("Argument type error!");
+    }
+    return *res;
+  }
+
+  // Whether an operation on `fd` would go ahead now. Errors count as ready
+  // so that the operation itself reports them.
+  bool ready(int fd, short events) {
+    pollfd target{ fd, events, 0 };
+    return ::poll(&target, 1, 0) != 0;
+  }
+
+  // the next line of `fd` if it can be read without blocking
+  std::optional<GCRef> line(int fd) {
+    auto&& buffer = buffered[fd];
+    while (true) {
+      auto end = buffer.find('\n');
+      if (end != std::string::npos) {
+        GCRef res = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        return res;
+      }
+      if (!ready(fd, POLLIN)) {
+        return std::nullopt;
+      }
+      char chunk[4096];
+      auto n = ::read(fd, chunk, sizeof(chunk));
+      if (n > 0) {
+        buffer.append(chunk, n);
+      }
+      else if (n == 0) {
+        if (buffer.empty()) {
+          return GCRef(false);
+        }
+        GCRef res = std::move(buffer);
+        buffer.clear();
+        return res;
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return std::nullopt;
+      }
+      else if (errno != EINTR) {
+        throw std::runtime_error("read-line failed!");
+      }
+    }
+  }
+
+  // writes what it can of `text` without blocking, true once all of it is
+  bool flush(int fd, std::string& text) {
+    while (!text.empty()) {
+      if (!ready(fd, POLLOUT)) {
+        return false;
+      }
+      auto n = ::write(fd, text.data(), text.size());
+      if (n >= 0) {
+        text.erase(0, n);
+      }
+      else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return false;
+      }
+      else if (errno != EINTR) {
+        throw std::runtime_error("write-string failed!");
+      }
+    }
+    return true;
+  }
+} // namespace
+
+r5rs::vm::Scheduler::~Scheduler() {
+  if (epoll >= 0) {
+    ::close(epoll);
+  }
+}
+
+void r5rs::vm::Scheduler::ready(std::shared_ptr<Activation> thread,
+  std::optional<GCRef> value) {
+  queue.emplace_back(std::move(thread), std::move(value));
+}
+
+// The fds get a turn every so often even while threads are runnable, so a
+// busy thread that yields cannot keep those waiting on input from it.
+std::shared_ptr<Activation> r5rs::vm::Scheduler::next() {
+  if (!timers.empty() || (!waiting.empty() && ++switches == 64)) {
+    poll(0);
+  }
+  while (queue.empty()) {
+    if (timers.empty() && waiting.empty()) {
+      throw std::runtime_error("all threads are blocked!");
+    }
+    auto timeout = -1;
+    if (!timers.empty()) {
+      auto left = timers.top().at - Clock::now();
+      timeout = std::max<int64_t>(0,
+        std::chrono::ceil<std::chrono::milliseconds>(left).count());
+    }
+    poll(timeout);
+  }
+
+  auto [thread, value] = std::move(queue.front());
+  queue.pop_front();
+  if (value) {
+    thread->stack.push_back(std::move(*value));
+  }
+  return thread;
+}
+
+void r5rs::vm::Scheduler::reset() {
+  queue.clear();
+  timers = {};
+  for (auto&& [fd, waiters] : waiting) {
+    ::epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+  }
+  waiting.clear();
+  switches = 0;
+  ++epoch;
+}
+
+std::optional<GCRef>
+r5rs::vm::Scheduler::yield(std::shared_ptr<Activation> thread) {
+  ready(std::move(thread), GCRef(nullptr));
+  return std::nullopt;
+}
+
+std::optional<GCRef>
+r5rs::vm::Scheduler::sleep(std::shared_ptr<Activation> thread, int64_t ms) {
+  auto at = Clock::now() + std::chrono::milliseconds(ms);
+  timers.push({ at, timed++, std::move(thread) });
+  return std::nullopt;
+}
+
+std::optional<GCRef>
+r5rs::vm::Scheduler::send(std::shared_ptr<Activation> thread,
+  Mailbox& mailbox, GCRef value) {
+  settle(mailbox);
+  if (!mailbox.receivers.empty()) {
+    ready(std::move(mailbox.receivers.front()), std::move(value));
+    mailbox.receivers.pop_front();
+    return GCRef(nullptr);
+  }
+  if (mailbox.values.size() < mailbox.capacity) {
+    mailbox.values.push_back(std::move(value));
+    return GCRef(nullptr);
+  }
+  mailbox.senders.emplace_back(std::move(thread), std::move(value));
+  return std::nullopt;
+}
+
+// A sender blocked on a full channel moves its value into the room the
+// receiver leaves, so values arrive in the order they were sent.
+std::optional<GCRef>
+r5rs::vm::Scheduler::receive(std::shared_ptr<Activation> thread,
+  Mailbox& mailbox) {
+  settle(mailbox);
+  std::optional<GCRef> res;
+  if (!mailbox.values.empty()) {
+    res = std::move(mailbox.values.front());
+    mailbox.values.pop_front();
+  }
+  if (!mailbox.senders.empty()) {
+    auto [sender, value] = std::move(mailbox.senders.front());
+    mailbox.senders.pop_front();
+    if (res) {
+      mailbox.values.push_back(std::move(value));
+    }
+    else {
+      res = std::move(value);
+    }
+    ready(std::move(sender), GCRef(nullptr));
+  }
+  if (!res) {
+    mailbox.receivers.push_back(std::move(thread));
+  }
+  return res;
+}
+
+std::optional<GCRef>
+r5rs::vm::Scheduler::read_line(std::shared_ptr<Activation> thread, int fd) {
+  auto res = line(fd);
+  if (!res) {
+    wait(fd, { std::move(thread), false, {} });
+  }
+  return res;
+}
+
+std::optional<GCRef>
+r5rs::vm::Scheduler::write(std::shared_ptr<Activation> thread, int fd,
+  std::string text) {
+  if (flush(fd, text)) {
+    return GCRef(nullptr);
+  }
+  wait(fd, { std::move(thread), true, std::move(text) });
+  return std::nullopt;
+}
+
+void r5rs::vm::Scheduler::settle(Mailbox& mailbox) {
+  if (mailbox.epoch != epoch) {
+    mailbox.senders.clear();
+    mailbox.receivers.clear();
+    mailbox.epoch = epoch;
+  }
+}
+
+void r5rs::vm::Scheduler::wait(int fd, Waiter waiter) {
+  if (epoll < 0) {
+    epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) {
+      throw std::runtime_error("epoll_create1 failed!");
+    }
+  }
+  waiting[fd].push_back(std::move(waiter));
+  watch(fd);
+}
+
+void r5rs::vm::Scheduler::poll(int timeout) {
+  switches = 0;
+  if (waiting.empty()) {
+    if (timeout > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+    }
+  }
+  else {
+    epoll_event events[64];
+    auto n = ::epoll_wait(epoll, events, 64, timeout);
+    if (n < 0 && errno != EINTR) {
+      throw std::runtime_error("epoll_wait failed!");
+    }
+    for (int i = 0; i < n; ++i) {
+      auto fd = events[i].data.fd;
+      auto&& waiters = waiting[fd];
+      for (auto it = waiters.begin(); it != waiters.end();) {
+        std::optional<GCRef> res;
+        if (!it->write) {
+          res = line(fd);
+        }
+        else if (flush(fd, it->text)) {
+          res = GCRef(nullptr);
+        }
+        if (!res) {
+          ++it;
+          continue;
+        }
+        ready(std::move(it->thread), std::move(res));
+        it = waiters.erase(it);
+      }
+      watch(fd);
+    }
+  }
+
+  auto now = Clock::now();
+  while (!timers.empty() && timers.top().at <= now) {
+    ready(timers.top().thread, GCRef(nullptr));
+    timers.pop();
+  }
+}
+
+// registers `fd` for what its waiters wait on, or drops it if none is left
+void r5rs::vm::Scheduler::watch(int fd) {
+  auto&& waiters = waiting[fd];
+  epoll_event event{};
+  event.data.fd = fd;
+  for (auto&& waiter : waiters) {
+    event.events |= waiter.write ? EPOLLOUT : EPOLLIN;
+  }
+  if (!event.events) {
+    ::epoll_ctl(epoll, EPOLL_CTL_DEL, fd, nullptr);
+    waiting.erase(fd);
+    return;
+  }
+  if (::epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &event) < 0 &&
+    (errno != ENOENT || ::epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) < 0)) {
+    throw std::runtime_error("cannot wait on file descriptor!");
+  }
+}
+
+GCRef r5rs::vm::make_channel(std::span<const GCRef> args) {
+  if (args.size() > 1) {
+    throw std::runtime_error("Argument number error!");
+  }
+  auto mailbox = std::make_shared<Mailbox>();
+  if (!args.empty()) {
+    auto capacity = fixnum(args[0]);
+    if (capacity < 0) {
+      throw std::runtime_error("Argument type error!");
+    }
+    mailbox->capacity = capacity;
+  }
+  return Channel{ std::move(mailbox) };
+}
+
+GCRef r5rs::vm::is_channel(std::span<const GCRef> args) {
+  return std::holds_alternative<Channel>(*args[0]);
+}
+
+GCRef r5rs::vm::pipe(std::span<const GCRef>) {
+  int fds[2];
+  if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0) {
+    throw std::runtime_error("pipe failed!");
+  }
+  return Pair{ int64_t{ fds[0] }, int64_t{ fds[1] } };
+}
+
+GCRef r5rs::vm::open_input_file(std::span<const GCRef> args) {
+  auto name = std::get_if<std::string>(&*args[0]);
+  if (!name) {
+    throw std::runtime_error("Argument type error!");
+  }
+  auto fd = ::open(name->c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("cannot open " + *name + "!");
+  }
+  return int64_t{ fd };
+}
+
+GCRef r5rs::vm::close_port(std::span<const GCRef> args) {
+  auto fd = fixnum(args[0]);
+  buffered.erase(fd);
+  ::close(fd);
+  return nullptr;
+}
@@ -0,0 +1,126 @@
+#ifndef R5RS_SCHEDULER_H
+#define R5RS_SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <span>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "GC.h"
+#include "Type.h"
+
+namespace r5rs {
+  namespace vm {
+    struct Activation;
+
+    // A channel's values and the threads blocked on it. A send waits once
+    // `capacity` values are queued, so with none it waits for a receiver.
+    struct Mailbox {
+      size_t capacity = 0;
+      std::deque<GCRef> values;
+      std::deque<std::pair<std::shared_ptr<Activation>, GCRef>> senders;
+      std::deque<std::shared_ptr<Activation>> receivers;
+      // the scheduler's reset these threads were parked after
+      uint64_t epoch = 0;
+    };
+
+    // The green threads of one vm, each the activation it is suspended in.
+    // A thread runs until it blocks, yields or ends, and then the vm goes on
+    // with the one next() picks; a thread's activation never holds the C++
+    // stack, so switching is no more than loading another activation.
+    //
+    // The operations below take the calling thread and return what its call
+    // evaluates to, or nothing after parking it, in which case the scheduler
+    // completes the call later and readies the thread with its result.
+    class Scheduler {
+    public:
+      Scheduler() = default;
+      Scheduler(const Scheduler&) = delete;
+      Scheduler& operator=(const Scheduler&) = delete;
+      ~Scheduler();
+
+      // runs `thread` once those before it have had their turn, its pending
+      // call returning `value` if it has one
+      void ready(std::shared_ptr<Activation> thread,
+        std::optional<GCRef> value);
+
+      // Pushes the value of the next thread's pending call onto its stack
+      // and returns it, waiting for a timer or file descriptor while no
+      // thread can run. Throws when none ever will.
+      std::shared_ptr<Activation> next();
+      // Forgets every thread, as when an error ends the form they run in:
+      // none is resumed, whether it was ready, sleeping, waiting on a file
+      // descriptor or parked on a channel.
+      void reset();
+
+      std::optional<GCRef> yield(std::shared_ptr<Activation> thread);
+      std::optional<GCRef> sleep(std::shared_ptr<Activation> thread,
+        int64_t ms);
+      std::optional<GCRef> send(std::shared_ptr<Activation> thread,
+        Mailbox& mailbox, GCRef value);
+      std::optional<GCRef> receive(std::shared_ptr<Activation> thread,
+        Mailbox& mailbox);
+      // a line without its newline, or #f at the end of the input
+      std::optional<GCRef> read_line(std::shared_ptr<Activation> thread,
+        int fd);
+      std::optional<GCRef> write(std::shared_ptr<Activation> thread, int fd,
+        std::string text);
+
+    private:
+      using Clock = std::chrono::steady_clock;
+
+      struct Timer {
+        Clock::time_point at;
+        uint64_t order;
+        std::shared_ptr<Activation> thread;
+
+        bool operator>(const Timer& other) const {
+          return std::tie(at, order) > std::tie(other.at, other.order);
+        }
+      };
+
+      // a read or write some thread waits on, with what is left to write
+      struct Waiter {
+        std::shared_ptr<Activation> thread;
+        bool write;
+        std::string text;
+      };
+
+      // drops the threads parked on `mailbox` before the last reset
+      void settle(Mailbox& mailbox);
+      void wait(int fd, Waiter waiter);
+      // readies the threads whose timers are due and, waiting up to
+      // `timeout` ms or for good if it is negative, those whose fd is ready
+      void poll(int timeout);
+      void watch(int fd);
+
+      std::deque<std::pair<std::shared_ptr<Activation>, std::optional<GCRef>>>
+        queue;
+      std::priority_queue<Timer, std::vector<Timer>, std::greater<>> timers;
+      uint64_t timed = 0;
+      std::unordered_map<int, std::vector<Waiter>> waiting;
+      int epoll = -1;
+      // switches since the fds were last polled
+      uint32_t switches = 0;
+      uint64_t epoch = 0;
+    };
+
+    // (make-channel [capacity]), channel?
+    GCRef make_channel(std::span<const GCRef> args);
+    GCRef is_channel(std::span<const GCRef> args);
+    // File descriptors as ports: (pipe) is (read-end . write-end), both
+    // non-blocking, and (open-input-file name) one for reading a file.
+    GCRef pipe(std::span<const GCRef> args);
+    GCRef open_input_file(std::span<const GCRef> args);
+    GCRef close_port(std::span<const GCRef> args);
+  } // namespace vm
+} // namespace r5rs
+
+#endif
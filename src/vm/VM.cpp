@@ -0,0 +1,1045 @@
+#include "VM.h"
+
+#include <array>
+#include <exception>
+
+#include "Lex.h"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define R5RS_VM_THREADED 1
+#else
+#define R5RS_VM_THREADED 0
+#endif
+
+using namespace r5rs;
+using namespace r5rs::vm;
+
+namespace {
+  bool truthy(const GCValue& value) {
+    auto visitor = overloaded{
+        [](nullptr_t) -> bool { return false; },
+        [](bool b) -> bool { return b; },
+        [](auto&&) -> bool { return true; },
+    };
+    return std::visit(visitor, value);
+  }
+
+  GCRef pop(std::vector<GCRef>& stack) {
+    GCRef res = std::move(stack.back());
+    stack.pop_back();
+    return res;
+  }
+
+  void drop(std::vector<GCRef>& stack, size_t n) {
+    stack.erase(stack.end() - n, stack.end());
+  }
+
+  // whether an inlined builtin's global still holds it
+  bool inlined(const std::optional<GCRef>& value,
+    GCRef(*fn)(std::span<const GCRef>)) {
+    if (!value) {
+      return false;
+    }
+    auto primitive = std::get_if<Primitive>(&**value);
+    return primitive && primitive->fn == fn;
+  }
+
+  // replaces the top N values with f applied to them
+  template <size_t N, typename F> void apply(std::vector<GCRef>& stack, F f) {
+    auto args = stack.end() - N;
+    auto res = [&]<size_t... I>(std::index_sequence<I...>) {
+      return f(args[I]...);
+    }(std::make_index_sequence<N>());
+    drop(stack, N);
+    stack.push_back(std::move(res));
+  }
+
+  // calls `primitive` on the top `n` values in place and replaces them and
+  // the operator below them with its result
+  void apply(Primitive primitive, std::vector<GCRef>& stack, size_t n) {
+    primitive.check(n);
+    auto res = std::invoke(primitive.fn,
+      std::span<const GCRef>(stack.data() + stack.size() - n, n));
+    drop(stack, n + 1);
+    stack.push_back(std::move(res));
+  }
+
+  Frame* up(Frame* frame, uint32_t arg) {
+    for (auto depth = arg >> DEPTH_SHIFT; depth; --depth) {
+      frame = frame->parent.get();
+    }
+    if ((arg & INDEX_MASK) >= frame->slots.size()) {
+      throw std::runtime_error("variable " +
+        (*frame->locals)[arg & INDEX_MASK] + " is not defined!");
+    }
+    return frame;
+  }
+
+  // Control primitives. The vm intercepts calls to these before they reach
+  // the function, which only runs if one is called from another engine.
+  GCRef control(std::span<const GCRef>) {
+    throw std::runtime_error("continuations are only supported by the vm");
+  }
+  GCRef call_cc(std::span<const GCRef> args) { return control(args); }
+  GCRef get_winders(std::span<const GCRef> args) { return control(args); }
+  GCRef set_winders(std::span<const GCRef> args) { return control(args); }
+
+  GCRef threads(std::span<const GCRef>) {
+    throw std::runtime_error("green threads are only supported by the vm");
+  }
+  GCRef spawn_thread(std::span<const GCRef> args) { return threads(args); }
+  GCRef yield_thread(std::span<const GCRef> args) { return threads(args); }
+  GCRef sleep_thread(std::span<const GCRef> args) { return threads(args); }
+  GCRef exit_thread(std::span<const GCRef> args) { return threads(args); }
+  GCRef channel_send(std::span<const GCRef> args) { return threads(args); }
+  GCRef channel_receive(std::span<const GCRef> args) {
+    return threads(args);
+  }
+  GCRef read_line(std::span<const GCRef> args) { return threads(args); }
+  GCRef write_string(std::span<const GCRef> args) { return threads(args); }
+
+  // the argument as a T, or a type error
+  template <typename T> const T& as(const GCRef& value) {
+    auto res = std::get_if<T>(&*value);
+    if (!res) {
+      throw std::runtime_error("Argument type error!");
+    }
+    return *res;
+  }
+
+  // the primitives that may switch to another green thread
+  bool switches(GCRef (*fn)(std::span<const GCRef>)) {
+    return fn == &spawn_thread || fn == &yield_thread ||
+      fn == &sleep_thread || fn == &exit_thread || fn == &channel_send ||
+      fn == &channel_receive || fn == &read_line || fn == &write_string;
+  }
+
+  // dynamic-wind pushes a (before . after) pair on the winders for the
+  // extent of its thunk; %travel runs the handlers between two winders,
+  // installing the winders each one belongs in, and then resumes k.
+  const char* const prelude = R"(
+(define dynamic-wind
+  ((lambda (cons winders set-winders!)
+     (lambda (before thunk after)
+       (before)
+       ((lambda (outer)
+          (set-winders! (cons (cons before after) outer))
+          ((lambda (result) (set-winders! outer) (after) result) (thunk)))
+        (winders))))
+   cons %winders %set-winders!))
+(define %travel
+  ((lambda (car cdr empty? set-winders!)
+     (define (travel steps to k v)
+       (if (empty? steps)
+           ((lambda () (set-winders! to) (k v)))
+           ((lambda ()
+              (set-winders! (cdr (car steps)))
+              ((car (car steps)))
+              (travel (cdr steps) to k v)))))
+     travel)
+   car cdr empty? %set-winders!))
+(define (%thread thunk) (thunk) (%exit))
+)";
+
+  bool same(const InternalGCRef& a, const InternalGCRef& b) {
+    return a.obj == b.obj || (std::holds_alternative<nullptr_t>(*a) &&
+      std::holds_alternative<nullptr_t>(*b));
+  }
+
+  const InternalGCRef& rest(const InternalGCRef& list) {
+    return std::get<Pair>(*list).second;
+  }
+
+  size_t length(const InternalGCRef* list) {
+    size_t n = 0;
+    for (; std::holds_alternative<Pair>(**list); list = &rest(*list)) {
+      ++n;
+    }
+    return n;
+  }
+
+  // The handlers to run going from winders `from` to `to` as a list of
+  // (thunk . winders): the after thunks of the extents left, innermost
+  // first, then the before thunks of those entered, outermost first.
+  GCRef path(const InternalGCRef& from, const InternalGCRef& to) {
+    std::vector<const InternalGCRef*> left, entered;
+    auto a = &from;
+    auto b = &to;
+    auto m = length(a);
+    auto n = length(b);
+    for (; m > n; --m, a = &rest(*a)) {
+      left.push_back(a);
+    }
+    for (; n > m; --n, b = &rest(*b)) {
+      entered.push_back(b);
+    }
+    for (; !same(*a, *b); a = &rest(*a), b = &rest(*b)) {
+      left.push_back(a);
+      entered.push_back(b);
+    }
+
+    GCRef steps = nullptr;
+    for (auto&& w : entered) {
+      auto&& handlers = std::get<Pair>(*std::get<Pair>(**w).first);
+      steps = Pair{ Pair{ handlers.first, rest(*w) }, steps };
+    }
+    for (auto it = left.rbegin(); it != left.rend(); ++it) {
+      auto&& handlers = std::get<Pair>(*std::get<Pair>(***it).first);
+      steps = Pair{ Pair{ handlers.second, rest(**it) }, steps };
+    }
+    return steps;
+  }
+
+  // The activation native code runs on. An exception must not unwind through
+  // jit code, so helpers leave it here for the vm to rethrow.
+  struct Context {
+    Globals& globals;
+    Activation& current;
+    std::exception_ptr error;
+  };
+
+  // One instruction run from native code, like its handler in execute.
+  // Returns 0 when done and 1 when the vm has to run it instead.
+  namespace step {
+    uint32_t constant(Context& c, uint32_t arg) {
+      c.current.stack.push_back(c.current.function->constants[arg]);
+      return 0;
+    }
+
+    uint32_t nil(Context& c, uint32_t) {
+      c.current.stack.push_back(nullptr);
+      return 0;
+    }
+
+    uint32_t local(Context& c, uint32_t arg) {
+      auto&& frame = *c.current.frame;
+      if (arg >= frame.slots.size()) {
+        throw std::runtime_error(
+          "variable " + (*frame.locals)[arg] + " is not defined!");
+      }
+      c.current.stack.push_back(frame.slots[arg]);
+      return 0;
+    }
+
+    uint32_t upvalue(Context& c, uint32_t arg) {
+      c.current.stack.push_back(
+        up(c.current.frame.get(), arg)->slots[arg & INDEX_MASK]);
+      return 0;
+    }
+
+    uint32_t global(Context& c, uint32_t arg) {
+      auto&& value = c.globals.values[arg];
+      if (!value) {
+        throw std::runtime_error(
+          "variable " + c.globals.names[arg] + " is not defined!");
+      }
+      c.current.stack.push_back(*value);
+      return 0;
+    }
+
+    uint32_t set_local(Context& c, uint32_t arg) {
+      auto&& frame = *c.current.frame;
+      if (arg >= frame.slots.size()) {
+        throw std::runtime_error("variable not found");
+      }
+      frame.slots[arg] = c.current.stack.back();
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t set_upvalue(Context& c, uint32_t arg) {
+      up(c.current.frame.get(), arg)->slots[arg & INDEX_MASK] =
+        c.current.stack.back();
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t set_global(Context& c, uint32_t arg) {
+      auto&& value = c.globals.values[arg];
+      if (!value) {
+        throw std::runtime_error("variable not found");
+      }
+      *value = c.current.stack.back();
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t define_local(Context& c, uint32_t arg) {
+      c.current.frame->define(arg, std::move(c.current.stack.back()));
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t define_global(Context& c, uint32_t arg) {
+      auto&& value = c.globals.values[arg];
+      if (value) {
+        throw std::runtime_error(
+          "redefine variable '" + c.globals.names[arg] + "'!");
+      }
+      value = std::move(c.current.stack.back());
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t pop(Context& c, uint32_t) {
+      c.current.stack.pop_back();
+      return 0;
+    }
+
+    uint32_t dup(Context& c, uint32_t) {
+      GCRef top = c.current.stack.back();
+      c.current.stack.push_back(std::move(top));
+      return 0;
+    }
+
+    uint32_t swap(Context& c, uint32_t) {
+      auto&& stack = c.current.stack;
+      std::swap(stack.end()[-1], stack.end()[-2]);
+      return 0;
+    }
+
+    // 1 when the jump is taken
+    uint32_t jump_false(Context& c, uint32_t) {
+      auto taken = !truthy(*c.current.stack.back());
+      c.current.stack.pop_back();
+      return taken;
+    }
+
+    // the pc to jump to plus 3, to keep clear of the codes above
+    uint32_t dispatch(Context& c, uint32_t arg) {
+      auto&& table = c.current.function->tables[arg];
+      auto target = table.targets[(*table.dispatch)(*c.current.stack.back())];
+      c.current.stack.pop_back();
+      return target + 3;
+    }
+
+    uint32_t closure(Context& c, uint32_t arg) {
+      c.current.stack.push_back(ClosureFunction{
+        c.current.function->functions[arg].get(), c.current.frame });
+      return 0;
+    }
+
+    // primitives are applied in place, anything that switches activations
+    // is left to the vm
+    uint32_t call(Context& c, uint32_t arg) {
+      auto&& stack = c.current.stack;
+      auto primitive = std::get_if<Primitive>(&**(stack.end() - arg - 1));
+      if (!primitive || primitive->fn == &call_cc ||
+        primitive->fn == &get_winders || primitive->fn == &set_winders ||
+        switches(primitive->fn)) {
+        return 1;
+      }
+      apply(*primitive, stack, arg);
+      return 0;
+    }
+
+#define R5RS_BUILTIN_ACCESS(id, n)                                             \
+  uint32_t id(Context& c, uint32_t arg) {                                      \
+    if (!inlined(c.globals.values[arg & GLOBAL_MASK], &primitive::id)) {       \
+      return 1;                                                                \
+    }                                                                          \
+    apply<n>(c.current.stack, &primitive::inlined::id);                        \
+    return 0;                                                                  \
+  }
+    R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+
+    // The fixnum operands of the instructions at code[0] and code[1], each a
+    // local or a constant, while the builtin at code[2] still holds its
+    // global. False leaves all three to the vm.
+    bool fixnums(Context& c, const uint32_t* code, int64_t& x, int64_t& y) {
+      auto fetch = [&](uint32_t word) -> const int64_t* {
+        auto arg = operand(word);
+        if (opcode(word) == Op::constant) {
+          return std::get_if<int64_t>(&*c.current.function->constants[arg]);
+        }
+        auto&& slots = c.current.frame->slots;
+        return arg < slots.size() ? std::get_if<int64_t>(&*slots[arg])
+                                  : nullptr;
+      };
+      auto a = fetch(code[0]);
+      auto b = fetch(code[1]);
+      if (!a || !b) {
+        return false;
+      }
+      auto&& value = c.globals.values[operand(code[2]) & GLOBAL_MASK];
+      switch (opcode(code[2])) {
+#define R5RS_BUILTIN_ACCESS(id, n)                                             \
+  case Op::id:                                                                 \
+    if (!inlined(value, &primitive::id)) {                                     \
+      return false;                                                            \
+    }                                                                          \
+    break;
+        R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+      default:
+        return false;
+      }
+      x = *a;
+      y = *b;
+      return true;
+    }
+
+    // two operands and the add, sub or mul after them at pc, pushing only
+    // the result
+    uint32_t arithmetic(Context& c, uint32_t pc) {
+      auto code = c.current.function->code.data() + pc;
+      int64_t x, y;
+      if (!fixnums(c, code, x, y)) {
+        return 1;
+      }
+      auto op = opcode(code[2]);
+      c.current.stack.push_back(
+        op == Op::add ? x + y : op == Op::sub ? x - y : x * y);
+      return 0;
+    }
+
+    // two operands, the <, > or = after them and the jump_false after that
+    // at pc, pushing nothing; 1 when the jump is taken
+    uint32_t branch(Context& c, uint32_t pc) {
+      auto code = c.current.function->code.data() + pc;
+      int64_t x, y;
+      if (!fixnums(c, code, x, y)) {
+        return 2;
+      }
+      auto op = opcode(code[2]);
+      return !(op == Op::less ? x < y : op == Op::greater ? x > y : x == y);
+    }
+  } // namespace step
+
+  template <uint32_t (*F)(Context&, uint32_t)>
+  uint32_t helper(void* context, uint32_t arg) {
+    auto&& c = *static_cast<Context*>(context);
+    try {
+      return F(c, arg);
+    }
+    catch (...) {
+      c.error = std::current_exception();
+      return 2;
+    }
+  }
+
+  // jump is compiled to a native jump; ret has no helper
+  std::array<jit::Helper, 256> helpers() {
+    std::array<jit::Helper, 256> res{};
+    auto set = [&](Op op, jit::Helper helper) {
+      res[static_cast<uint8_t>(op)] = helper;
+    };
+    set(Op::constant, &helper<&step::constant>);
+    set(Op::nil, &helper<&step::nil>);
+    set(Op::local, &helper<&step::local>);
+    set(Op::upvalue, &helper<&step::upvalue>);
+    set(Op::global, &helper<&step::global>);
+    set(Op::set_local, &helper<&step::set_local>);
+    set(Op::set_upvalue, &helper<&step::set_upvalue>);
+    set(Op::set_global, &helper<&step::set_global>);
+    set(Op::define_local, &helper<&step::define_local>);
+    set(Op::define_global, &helper<&step::define_global>);
+    set(Op::pop, &helper<&step::pop>);
+    set(Op::dup, &helper<&step::dup>);
+    set(Op::swap, &helper<&step::swap>);
+    set(Op::jump_false, &helper<&step::jump_false>);
+    set(Op::dispatch, &helper<&step::dispatch>);
+    set(Op::closure, &helper<&step::closure>);
+    set(Op::call, &helper<&step::call>);
+    set(Op::tail_call, &helper<&step::call>);
+#define R5RS_BUILTIN_ACCESS(id, n) set(Op::id, &helper<&step::id>);
+    R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+    return res;
+  }
+} // namespace
+
+r5rs::vm::VM::VM(const Env& env) {
+  // only the primitives carry over; the library is evaluated again here
+  for (auto&& [name, value] : env.variables) {
+    if (std::holds_alternative<Primitive>(*value)) {
+      globals.values[globals.intern(name)] = value;
+    }
+  }
+  globals.values[globals.intern("call-with-current-continuation")] =
+    Primitive{ &call_cc, 1 };
+  globals.values[globals.intern("call/cc")] = Primitive{ &call_cc, 1 };
+  globals.values[globals.intern("%winders")] = Primitive{ &get_winders, 0 };
+  globals.values[globals.intern("%set-winders!")] =
+    Primitive{ &set_winders, 1 };
+
+  globals.values[globals.intern("spawn")] = Primitive{ &spawn_thread, 1 };
+  globals.values[globals.intern("yield")] = Primitive{ &yield_thread, 0 };
+  globals.values[globals.intern("sleep")] = Primitive{ &sleep_thread, 1 };
+  globals.values[globals.intern("%exit")] = Primitive{ &exit_thread, 0 };
+  globals.values[globals.intern("make-channel")] = Primitive{ &make_channel };
+  globals.values[globals.intern("channel?")] = Primitive{ &is_channel, 1 };
+  globals.values[globals.intern("channel-send")] =
+    Primitive{ &channel_send, 2 };
+  globals.values[globals.intern("channel-receive")] =
+    Primitive{ &channel_receive, 1 };
+  globals.values[globals.intern("pipe")] = Primitive{ &vm::pipe, 0 };
+  globals.values[globals.intern("open-input-file")] =
+    Primitive{ &open_input_file, 1 };
+  globals.values[globals.intern("close-port")] = Primitive{ &close_port, 1 };
+  globals.values[globals.intern("read-line")] = Primitive{ &read_line, 1 };
+  globals.values[globals.intern("write-string")] =
+    Primitive{ &write_string, 2 };
+
+  for (auto source : { prelude, primitive::library }) {
+    auto stream = ast(tokens(source));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0])) {
+      std::invoke(*this, cod->get());
+      stream += 1;
+    }
+  }
+  travel = *globals.values[globals.intern("%travel")];
+  thread = *globals.values[globals.intern("%thread")];
+}
+
+void r5rs::vm::VM::enable_jit(uint32_t threshold) {
+  if (!jit::Jit::supported()) {
+    return;
+  }
+  jit = std::make_unique<jit::Jit>(helpers(),
+    jit::Fused{ &helper<&step::arithmetic>, &helper<&step::branch> });
+  this->threshold = threshold;
+}
+
+// A form that made no closure and captured no continuation leaves nothing
+// pointing into its code once it is done, so the code goes with it.
+GCRef r5rs::vm::VM::operator()(expression::COD* cod) {
+  auto function = compile(cod);
+  auto captured = captures;
+  auto res = execute(function);
+  if (function->functions.empty() && captures == captured &&
+    programs.back().get() == function) {
+    programs.pop_back();
+  }
+  return res;
+}
+
+const Function* r5rs::vm::VM::compile(expression::COD* cod) {
+  programs.push_back(compiler.compile(cod));
+  return programs.back().get();
+}
+
+std::shared_ptr<Activation>
+r5rs::vm::VM::activation(const Function* function, std::shared_ptr<Frame> frame,
+  std::shared_ptr<Activation> caller) {
+  std::shared_ptr<Activation> res;
+  if (activations.empty()) {
+    res = std::make_shared<Activation>();
+  }
+  else {
+    res = std::move(activations.back());
+    activations.pop_back();
+  }
+  res->caller = std::move(caller);
+  res->function = function;
+  res->pc = 0;
+  res->frame = std::move(frame);
+  return res;
+}
+
+std::shared_ptr<Frame> r5rs::vm::VM::bind(const ClosureFunction& closure,
+  std::vector<GCRef>& stack, size_t n) {
+  auto function = closure.function;
+  if (n < function->fixed) {
+    throw std::runtime_error("Insufficient number of parameters");
+  }
+  if (!function->rest && n > function->fixed) {
+    throw std::runtime_error("redundant arguments");
+  }
+
+  std::shared_ptr<Frame> res;
+  if (frames.empty()) {
+    res = std::make_shared<Frame>();
+  }
+  else {
+    res = std::move(frames.back());
+    frames.pop_back();
+  }
+  res->parent = closure.frame;
+  res->locals = &function->locals;
+  res->slots.reserve(function->locals.size());
+
+  auto args = stack.end() - n;
+  res->slots.insert(res->slots.end(), args, args + function->fixed);
+
+  if (function->rest) {
+    GCRef head = nullptr;
+    for (auto it = stack.end(); it != args + function->fixed; --it) {
+      head = Pair{ *std::prev(it), head };
+    }
+    res->slots.push_back(std::move(head));
+  }
+
+  drop(stack, n + 1);
+  return res;
+}
+
+std::shared_ptr<Activation> r5rs::vm::VM::copy(const Activation& from) {
+  auto res = activation(from.function, from.frame, from.caller);
+  res->pc = from.pc;
+  res->stack = from.stack;
+  return res;
+}
+
+// Turns (call/cc f) on top of the stack into (f k), where k resumes a copy
+// of the current activation taken after popping the call.
+void r5rs::vm::VM::capture(std::shared_ptr<Activation>& current,
+  std::vector<GCRef>& stack) {
+  GCRef f = stack.back();
+  drop(stack, 2);
+  auto k = copy(*current);
+  k->winders = winders;
+  ++captures;
+  stack.push_back(std::move(f));
+  stack.push_back(Continuation{ std::move(k) });
+}
+
+// Calling a continuation with the top `n` values: returns the activation to
+// continue in, or nullptr after rewriting the call into one of %travel when
+// dynamic-wind handlers have to run first.
+std::shared_ptr<Activation> r5rs::vm::VM::resume(std::vector<GCRef>& stack,
+  size_t n) {
+  if (n > 1) {
+    throw std::runtime_error("redundant arguments");
+  }
+  GCRef k = *(stack.end() - n - 1);
+  GCRef value = nullptr;
+  if (n) {
+    value = stack.back();
+  }
+  drop(stack, n + 1);
+
+  auto&& target = std::get<Continuation>(*k).activation;
+  if (!same(winders, target->winders)) {
+    stack.push_back(travel);
+    stack.push_back(path(winders, target->winders));
+    stack.push_back(target->winders);
+    stack.push_back(std::move(k));
+    stack.push_back(std::move(value));
+    return nullptr;
+  }
+
+  auto res = copy(*target);
+  res->stack.push_back(std::move(value));
+  return res;
+}
+
+// The winders primitives, applied in place like any other primitive.
+bool r5rs::vm::VM::control(const Primitive& primitive,
+  std::vector<GCRef>& stack, size_t n) {
+  if (primitive.fn == &get_winders) {
+    primitive.check(n);
+    drop(stack, 1);
+    stack.push_back(winders);
+    return true;
+  }
+  if (primitive.fn == &set_winders) {
+    primitive.check(n);
+    winders = stack.back();
+    drop(stack, 2);
+    stack.push_back(nullptr);
+    return true;
+  }
+  return false;
+}
+
+// The green thread primitives, called with `current` saved where the call
+// returns to. Either the call's value ends up on the stack, or `current` has
+// blocked or ended and the next thread to run takes its place; each thread
+// keeps its own dynamic-wind handlers across the switch.
+void r5rs::vm::VM::schedule(const Primitive& primitive,
+  std::shared_ptr<Activation>& current, size_t n) {
+  primitive.check(n);
+  auto&& stack = current->stack;
+  auto args = std::span<const GCRef>(stack.data() + stack.size() - n, n);
+  auto fn = primitive.fn;
+
+  std::optional<GCRef> res;
+  if (fn == &spawn_thread) {
+    auto&& closure = std::get<ClosureFunction>(*thread);
+    std::vector<GCRef> call{ thread, args[0] };
+    auto started =
+      activation(closure.function, bind(closure, call, 1), nullptr);
+    started->winders = GCRef(nullptr);
+    scheduler.ready(std::move(started), std::nullopt);
+    res = GCRef(nullptr);
+  }
+  else if (fn == &yield_thread) {
+    res = scheduler.yield(current);
+  }
+  else if (fn == &sleep_thread) {
+    res = scheduler.sleep(current, as<int64_t>(args[0]));
+  }
+  else if (fn == &channel_send) {
+    res = scheduler.send(current, *as<Channel>(args[0]).mailbox, args[1]);
+  }
+  else if (fn == &channel_receive) {
+    res = scheduler.receive(current, *as<Channel>(args[0]).mailbox);
+  }
+  else if (fn == &read_line) {
+    res = scheduler.read_line(current, as<int64_t>(args[0]));
+  }
+  else if (fn == &write_string) {
+    res = scheduler.write(current, as<int64_t>(args[0]),
+      as<std::string>(args[1]));
+  }
+  // %exit leaves no value and no one to resume the thread
+
+  drop(stack, n + 1);
+  if (res) {
+    stack.push_back(std::move(*res));
+    return;
+  }
+  current->winders = winders;
+  current = scheduler.next();
+  winders = current->winders;
+}
+
+// Activations and frames nobody else refers to any more go back to a pool
+// so that calls reuse their storage instead of allocating.
+void r5rs::vm::VM::release(std::shared_ptr<Activation> activation) {
+  if (activation.use_count() != 1) {
+    return;
+  }
+  activation->caller = nullptr;
+  activation->stack.clear();
+  release(std::move(activation->frame));
+  activations.push_back(std::move(activation));
+}
+
+void r5rs::vm::VM::release(std::shared_ptr<Frame> frame) {
+  if (!frame || frame.use_count() != 1) {
+    return;
+  }
+  frame->parent = nullptr;
+  frame->slots.clear();
+  frames.push_back(std::move(frame));
+}
+
+// An error leaves the form's threads where they were parked, and none of
+// them may be resumed by a later form.
+GCRef r5rs::vm::VM::execute(const Function* function) {
+  try {
+    return run(function);
+  }
+  catch (...) {
+    scheduler.reset();
+    throw;
+  }
+}
+
+GCRef r5rs::vm::VM::run(const Function* function) {
+  auto current = activation(function, nullptr, nullptr);
+
+  const Function* fn = nullptr;
+  const uint32_t* code = nullptr;
+  size_t pc = 0;
+  std::vector<GCRef>* stack = nullptr;
+  Frame* frame = nullptr;
+  uint32_t arg = 0;
+  uint32_t argc = 0;
+
+  auto load = [&] {
+    fn = current->function;
+    code = fn->code.data();
+    pc = current->pc;
+    stack = &current->stack;
+    frame = current->frame.get();
+    if (!jit) {
+      return;
+    }
+    // run natively up to the first instruction native code leaves to us
+    if (!fn->native && ++fn->calls == threshold) {
+      fn->native = jit->compile(*fn);
+    }
+    if (fn->native) {
+      Context context{ globals, *current, nullptr };
+      pc = fn->native(&context, pc);
+      if (context.error) {
+        std::rethrow_exception(context.error);
+      }
+    }
+  };
+  load();
+
+#if R5RS_VM_THREADED
+  static void* const labels[] = {
+#define R5RS_OPCODE_ACCESS(id) &&op_##id,
+#define R5RS_BUILTIN_ACCESS(id, n) &&op_##id,
+      R5RS_OPCODE R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+#undef R5RS_OPCODE_ACCESS
+  };
+#define NEXT()                                                                 \
+  do {                                                                         \
+    arg = operand(code[pc]);                                                   \
+    goto* labels[code[pc++] & 0xff];                                           \
+  } while (0)
+#define CASE(id) op_##id:
+  NEXT();
+#else
+#define NEXT() continue
+#define CASE(id) case Op::id:
+  while (true) {
+    arg = operand(code[pc]);
+    switch (opcode(code[pc++])) {
+#endif
+
+  // A computed goto does not run the destructors of the scope it leaves, so
+  // every handler keeps its locals inside the block before dispatching.
+
+  CASE(constant) {
+    stack->push_back(fn->constants[arg]);
+  }
+  NEXT();
+
+  CASE(nil) {
+    stack->push_back(nullptr);
+  }
+  NEXT();
+
+  CASE(local) {
+    if (arg >= frame->slots.size()) {
+      throw std::runtime_error(
+        "variable " + fn->locals[arg] + " is not defined!");
+    }
+    stack->push_back(frame->slots[arg]);
+  }
+  NEXT();
+
+  CASE(upvalue) {
+    stack->push_back(up(frame, arg)->slots[arg & INDEX_MASK]);
+  }
+  NEXT();
+
+  CASE(global) {
+    auto&& value = globals.values[arg];
+    if (!value) {
+      throw std::runtime_error(
+        "variable " + globals.names[arg] + " is not defined!");
+    }
+    stack->push_back(*value);
+  }
+  NEXT();
+
+  CASE(set_local) {
+    if (arg >= frame->slots.size()) {
+      throw std::runtime_error("variable not found");
+    }
+    frame->slots[arg] = stack->back();
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(set_upvalue) {
+    up(frame, arg)->slots[arg & INDEX_MASK] = stack->back();
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(set_global) {
+    auto&& value = globals.values[arg];
+    if (!value) {
+      throw std::runtime_error("variable not found");
+    }
+    *value = stack->back();
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(define_local) {
+    frame->define(arg, pop(*stack));
+  }
+  NEXT();
+
+  CASE(define_global) {
+    auto&& value = globals.values[arg];
+    if (value) {
+      throw std::runtime_error(
+        "redefine variable '" + globals.names[arg] + "'!");
+    }
+    value = pop(*stack);
+  }
+  NEXT();
+
+  CASE(pop) {
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(dup) {
+    GCRef top = stack->back();
+    stack->push_back(std::move(top));
+  }
+  NEXT();
+
+  CASE(swap) {
+    std::swap(stack->end()[-1], stack->end()[-2]);
+  }
+  NEXT();
+
+  CASE(jump) {
+    pc = arg;
+  }
+  NEXT();
+
+  CASE(jump_false) {
+    if (!truthy(*stack->back())) {
+      pc = arg;
+    }
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(dispatch) {
+    auto&& table = fn->tables[arg];
+    pc = table.targets[(*table.dispatch)(*stack->back())];
+    stack->pop_back();
+  }
+  NEXT();
+
+  CASE(closure) {
+    stack->push_back(
+      ClosureFunction{ fn->functions[arg].get(), current->frame });
+  }
+  NEXT();
+
+  CASE(call)
+  generic_call: {
+    auto&& op = *(stack->end() - arg - 1);
+    if (auto primitive = std::get_if<Primitive>(&*op)) {
+      if (primitive->fn == &call_cc) {
+        primitive->check(arg);
+        current->pc = pc;
+        capture(current, *stack);
+        goto generic_call;
+      }
+      if (switches(primitive->fn)) {
+        current->pc = pc;
+        schedule(*primitive, current, arg);
+        load();
+      }
+      else if (!control(*primitive, *stack, arg)) {
+        apply(*primitive, *stack, arg);
+      }
+    }
+    else if (std::holds_alternative<ClosureFunction>(*op)) {
+      auto closure = std::get<ClosureFunction>(*op);
+      auto callee = bind(closure, *stack, arg);
+      current->pc = pc;
+      current = activation(closure.function, std::move(callee), current);
+      load();
+    }
+    else if (std::holds_alternative<Continuation>(*op)) {
+      auto next = resume(*stack, arg);
+      if (!next) {
+        arg = 4;
+        goto generic_call;
+      }
+      release(std::move(current));
+      current = std::move(next);
+      load();
+    }
+    else {
+      throw std::runtime_error("expression is not a function");
+    }
+  }
+  NEXT();
+
+  CASE(tail_call)
+  generic_tail_call: {
+    auto&& op = *(stack->end() - arg - 1);
+    if (auto primitive = std::get_if<Primitive>(&*op)) {
+      if (primitive->fn == &call_cc) {
+        primitive->check(arg);
+        current->pc = pc;
+        capture(current, *stack);
+        goto generic_tail_call;
+      }
+      // the following ret returns the result
+      if (switches(primitive->fn)) {
+        current->pc = pc;
+        schedule(*primitive, current, arg);
+        load();
+      }
+      else if (!control(*primitive, *stack, arg)) {
+        apply(*primitive, *stack, arg);
+      }
+    }
+    else if (std::holds_alternative<ClosureFunction>(*op)) {
+      auto closure = std::get<ClosureFunction>(*op);
+      auto callee = bind(closure, *stack, arg);
+      auto caller = current->caller;
+      release(std::move(current));
+      current =
+        activation(closure.function, std::move(callee), std::move(caller));
+      load();
+    }
+    else if (std::holds_alternative<Continuation>(*op)) {
+      auto next = resume(*stack, arg);
+      if (!next) {
+        arg = 4;
+        goto generic_tail_call;
+      }
+      release(std::move(current));
+      current = std::move(next);
+      load();
+    }
+    else {
+      throw std::runtime_error("expression is not a function");
+    }
+  }
+  NEXT();
+
+  CASE(ret) {
+    auto res = pop(*stack);
+    auto caller = current->caller;
+    release(std::move(current));
+    if (!caller) {
+      return res;
+    }
+    // a caller a continuation still refers to is resumed as a copy
+    current = caller.use_count() == 1 ? std::move(caller) : copy(*caller);
+    current->stack.push_back(std::move(res));
+    load();
+  }
+  NEXT();
+
+#define R5RS_BUILTIN_ACCESS(id, n)                                             \
+  CASE(id) {                                                                   \
+    if (!inlined(globals.values[arg & GLOBAL_MASK], &primitive::id)) {         \
+      argc = n;                                                                \
+      goto rebound;                                                            \
+    }                                                                          \
+    apply<n>(*stack, &primitive::inlined::id);                                 \
+  }                                                                            \
+  NEXT();
+  R5RS_BUILTIN
+#undef R5RS_BUILTIN_ACCESS
+
+  // The global of an inlined builtin holds something else now: put it under
+  // the operands and make the call the compiler would have emitted.
+rebound: {
+    auto&& value = globals.values[arg & GLOBAL_MASK];
+    if (!value) {
+      throw std::runtime_error(
+        "variable " + globals.names[arg & GLOBAL_MASK] + " is not defined!");
+    }
+    stack->insert(stack->end() - argc, *value);
+    auto tail = arg & TAIL_FLAG;
+    arg = argc;
+    if (tail) {
+      goto generic_tail_call;
+    }
+    goto generic_call;
+  }
+
+#if !R5RS_VM_THREADED
+    }
+  }
+#endif
+#undef NEXT
+#undef CASE
+}
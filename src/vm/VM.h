@@ -0,0 +1,97 @@
+#ifndef R5RS_VM_H
+#define R5RS_VM_H
+
+#include <memory>
+#include <vector>
+
+#include "Bytecode.h"
+#include "Compiler.h"
+#include "Env.h"
+#include "Expressions.h"
+#include "GC.h"
+#include "Jit.h"
+#include "Scheduler.h"
+
+namespace r5rs {
+  namespace vm {
+    // A suspended call: the function being run, where to resume it and the
+    // operands it has pushed so far. Activations are linked to their caller
+    // on the heap, so Scheme calls never consume C++ stack.
+    //
+    // A continuation is a copy of the running activation that shares its
+    // chain of callers, so capturing one copies no more than the top. An
+    // activation still shared with a continuation is copied before it is
+    // resumed, leaving the captured one as it was.
+    struct Activation {
+      std::shared_ptr<Activation> caller;
+      const Function* function = nullptr;
+      size_t pc = 0;
+      std::shared_ptr<Frame> frame;
+      std::vector<GCRef> stack;
+
+      // dynamic-wind handlers in effect, for a captured activation
+      GCRef winders = nullptr;
+    };
+
+    class VM {
+    public:
+      // Starts with a copy of the bindings in `env`, so the VM shares the
+      // primitives registered by the interpreter.
+      explicit VM(const Env& env);
+
+      GCRef operator()(expression::COD* cod);
+      const Function* compile(expression::COD* cod);
+      GCRef execute(const Function* function);
+
+      // Compiles functions to machine code once they have been entered
+      // `threshold` times. Does nothing where the jit is not supported.
+      void enable_jit(uint32_t threshold = 100);
+
+      Globals globals;
+      std::vector<std::unique_ptr<Function>> programs;
+
+    private:
+      GCRef run(const Function* function);
+      std::shared_ptr<Activation> activation(const Function* function,
+        std::shared_ptr<Frame> frame, std::shared_ptr<Activation> caller);
+      std::shared_ptr<Frame> bind(const ClosureFunction& closure,
+        std::vector<GCRef>& stack, size_t n);
+
+      // call/cc and dynamic-wind
+      std::shared_ptr<Activation> copy(const Activation& activation);
+      void capture(std::shared_ptr<Activation>& current,
+        std::vector<GCRef>& stack);
+      std::shared_ptr<Activation> resume(std::vector<GCRef>& stack, size_t n);
+      bool control(const Primitive& primitive, std::vector<GCRef>& stack,
+        size_t n);
+      // green threads
+      void schedule(const Primitive& primitive,
+        std::shared_ptr<Activation>& current, size_t n);
+
+      void release(std::shared_ptr<Activation> activation);
+      void release(std::shared_ptr<Frame> frame);
+
+      Compiler compiler{ globals };
+
+      // the dynamic-wind handlers in effect as a list of (before . after),
+      // innermost first, and the prelude procedure that runs them on a jump
+      GCRef winders = nullptr;
+      GCRef travel = nullptr;
+      // continuations captured so far
+      uint64_t captures = 0;
+
+      // the threads spawned besides the one running, and the prelude
+      // procedure each of them starts in
+      Scheduler scheduler;
+      GCRef thread = nullptr;
+
+      std::unique_ptr<jit::Jit> jit;
+      uint32_t threshold = 0;
+
+      std::vector<std::shared_ptr<Activation>> activations;
+      std::vector<std::shared_ptr<Frame>> frames;
+    };
+  } // namespace vm
+} // namespace r5rs
+
+#endif
@@ -0,0 +1,135 @@
+#include <string>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+#include "VM.h"
+
+#include "output.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  std::vector<std::string> run(std::string source, bool jit)
+  {
+    vm::VM machine(*Interpreter().env);
+    if (jit)
+    {
+      machine.enable_jit(1);
+    }
+    std::vector<std::string> results;
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(std::visit(String(), *machine(cod->get())));
+      stream += 1;
+    }
+    return results;
+  }
+
+  // the same results with and without the jit
+  std::vector<std::string> run(std::string source)
+  {
+    auto results = run(source, false);
+    REQUIRE(run(source, true) == results);
+    return results;
+  }
+}
+
+TEST_CASE("call/cc")
+{
+  SECTION("escape")
+  {
+    REQUIRE(run("(call/cc (lambda (k) (+ 1 (k 42))))") ==
+      std::vector<std::string>{ "42" });
+    REQUIRE(run("(+ 1 (call-with-current-continuation (lambda (k) 1)))") ==
+      std::vector<std::string>{ "2" });
+    REQUIRE(run(
+      "(define (find p l) (call/cc (lambda (return)"
+      "  (define (walk l)"
+      "    (if (empty? l) #f (if (p (car l)) (return (car l)) (walk (cdr l)))))"
+      "  (walk l))))"
+      "(find (lambda (x) (> x 3)) '(1 2 5 7))") ==
+      std::vector<std::string>{ "nullptr", "5" });
+  }
+
+  SECTION("re-entry")
+  {
+    REQUIRE(run(
+      "(define (make-gen lst)"
+      "  (define return #f)"
+      "  (define resume #f)"
+      "  (define (walk l)"
+      "    (if (empty? l)"
+      "        (return (- 1))"
+      "        ((lambda ()"
+      "           (call/cc (lambda (k) (set! resume k) (return (car l))))"
+      "           (walk (cdr l))))))"
+      "  (lambda ()"
+      "    (call/cc (lambda (r)"
+      "      (set! return r)"
+      "      (if resume (resume #f) (walk lst))))))"
+      "(define g (make-gen '(1 2 3 4)))"
+      "(define (drain acc) ((lambda (v) (if (< v 0) acc (drain (+ acc v)))) (g)))"
+      "(drain 0)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "10" });
+  }
+
+  SECTION("captured frames are not changed by later returns")
+  {
+    REQUIRE(run(
+      "(define k #f)"
+      "(define n 0)"
+      "(define (f) (+ 10 (call/cc (lambda (c) (set! k c) 1))))"
+      "(define (g) (set! n (+ n 1)) (if (< n 3) (k n) n))"
+      "((lambda (x) (g)) (f))") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "3" });
+  }
+}
+
+TEST_CASE("dynamic-wind")
+{
+  const std::string log =
+    "(define log '())"
+    "(define (note x) (set! log (cons x log)))";
+
+  SECTION("normal return")
+  {
+    REQUIRE(run(log +
+      "(dynamic-wind (lambda () (note 1)) (lambda () (note 2) 7)"
+      "  (lambda () (note 3)))"
+      "(car log) (car (cdr log)) (car (cdr (cdr log)))") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "7", "3", "2", "1" });
+  }
+
+  SECTION("escape runs after")
+  {
+    REQUIRE(run(log +
+      "(call/cc (lambda (k)"
+      "  (dynamic-wind (lambda () (note 1)) (lambda () (k 5))"
+      "    (lambda () (note 2)))))"
+      "(car log) (car (cdr log))") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "5", "2", "1" });
+  }
+
+  SECTION("re-entry runs before again")
+  {
+    REQUIRE(run(log +
+      "(define k #f)"
+      "(define (body) (dynamic-wind (lambda () (note 1))"
+      "  (lambda () (call/cc (lambda (c) (set! k c) 0)))"
+      "  (lambda () (note 2))))"
+      "(define (twice) ((lambda (v) (if (< v 1) (k 1) v)) (body)))"
+      "(twice)"
+      "(car log) (car (cdr log)) (car (cdr (cdr log)))"
+      "(car (cdr (cdr (cdr log))))") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "nullptr", "1", "2", "1", "2", "1" });
+  }
+}
@@ -0,0 +1,680 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Closure.h"
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "Pool.h"
+#include "String.h"
+#include "VM.h"
+
+#include "output.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  using Engine = std::function<GCRef(expression::COD *)>;
+
+  Engine interpreter()
+  {
+    auto interpreter = std::make_shared<Interpreter>();
+    return [=](expression::COD * cod) { return std::invoke(*interpreter, cod); };
+  }
+
+  Engine machine()
+  {
+    auto machine = std::make_shared<vm::VM>(*Interpreter().env);
+    return [=](expression::COD * cod) { return std::invoke(*machine, cod); };
+  }
+
+  // the vm compiling every function the first time it is entered
+  Engine compiled()
+  {
+    auto machine = std::make_shared<vm::VM>(*Interpreter().env);
+    machine->enable_jit(1);
+    return [=](expression::COD * cod) { return std::invoke(*machine, cod); };
+  }
+
+  Engine evaluator()
+  {
+    auto evaluator = std::make_shared<closure::Evaluator>(*Interpreter().env);
+    return [=](expression::COD * cod) { return std::invoke(*evaluator, cod); };
+  }
+
+  // every engine, by name
+  const std::vector<std::pair<std::string, std::function<Engine()>>> engines{
+    { "ast", interpreter },
+    { "vm", machine },
+    { "jit", compiled },
+    { "closure", evaluator },
+  };
+
+  expression::CODPtr parse(std::string source)
+  {
+    return *ast(tokens(stringIStream(std::move(source))))[0];
+  }
+
+  std::vector<std::string> run(Engine eval, std::string source)
+  {
+    std::vector<std::string> results;
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(std::visit(String(), *eval(cod->get())));
+      stream += 1;
+    }
+    return results;
+  }
+
+  struct Case
+  {
+    std::string source;
+    std::vector<std::string> expect;
+  };
+
+  const std::vector<Case> cases{
+    { "(+ 1 2) (* 2 3 4)", { "3", "24" } },
+    { "(define x 5) (+ x 2)", { "nullptr", "7" } },
+    { "(if #f 1 2) (if 0 1 2) (if '() 1 2)", { "2", "1", "2" } },
+    { "((lambda (a . r) (car r)) 1 2 3)", { "2" } },
+    { "((lambda x (cdr x)) 1)", { "nullptr" } },
+    {
+      "(define (f x) (define y 2) (define (g z) (* x y z)) (g 3)) (f 7)",
+      { "nullptr", "42" }
+    },
+    {
+      "(define (mk) (define n 0) (lambda () (set! n (+ n 1)) n))"
+      "(define c (mk)) (c) (c)",
+      { "nullptr", "nullptr", "1", "2" }
+    },
+    {
+      "(define (loop i n) (if (< i n) (loop (+ i 1) n) i)) (loop 0 1000000)",
+      { "nullptr", "1000000" }
+    },
+    {
+      "(define (tree d m) (if (< d m) (+ (tree (+ d 1) m) (tree (+ d 1) m)) 1))"
+      "(tree 0 10)",
+      { "nullptr", "1024" }
+    },
+    { "(car '(1 2)) (car (car (cdr '(1 (2 3))))) \"s\"", { "1", "2", "\"s\"" } },
+    { "(begin (+ 1 2) (* 2 5))", { "10" } },
+    {
+      "(define (f a b) (if (< a b) (+ a b) 0)) (f 2 3) (set! + *) (f 2 3)",
+      { "nullptr", "5", "nullptr", "6" }
+    },
+    {
+      "(- 10 3) (- 5) (- 10 1 2) (= 2 2) (if (= 2 3) 1 2) (eqv? 4 4)",
+      { "7", "-5", "7", "true", "2", "true" }
+    },
+    {
+      "(define (f l) (if (< (car l) 3) (cons (- (car l) 1) (cdr l)) l))"
+      "(car (f '(1 5))) (car (f '(4)))",
+      { "nullptr", "0", "4" }
+    },
+    {
+      "(define (h l) (car (car l))) (h '((1 2) 3)) (set! car cdr) (h '((1 2) 3))",
+      { "nullptr", "1", "nullptr", "nullptr" }
+    },
+    {
+      "(define (g a b) (+ a b)) (g 1 2) (set! + (lambda (a b) (* a b))) (g 4 5)",
+      { "nullptr", "3", "nullptr", "20" }
+    },
+    {
+      "(and) (or) (and 1 2) (and 1 '() (car 1)) (or #f 3 (car 1)) (or #f '())",
+      { "true", "false", "2", "nullptr", "3", "nullptr" }
+    },
+    {
+      "(define (f x) (and (eqv? (car x) 1) (car (cdr x)))) (f '(1 2)) (f '(2))",
+      { "nullptr", "2", "false" }
+    },
+    {
+      "(define (sign n) (cond ((< n 0) '-) ((= n 0) (+ 1 1) 'zero) (else '+)))"
+      "(sign (- 3)) (sign 0) (sign 4) (cond (#f 1)) (cond (5))"
+      "(cond ((car '(4)) => (lambda (x) (* x x))))",
+      { "nullptr", "'-", "'zero", "'+", "nullptr", "5", "16" }
+    },
+    {
+      "(define (kind x) (case x ((1 2 3) 'low) ((4 5 2) 'mid) ((a b) 'sym)"
+      "((#\\a) 'char) ((()) 'nil) ((#f) 'no) (else 'other)))"
+      "(kind 2) (kind 5) (kind 9) (kind 'b) (kind #\\a) (kind '()) (kind #f)"
+      "(case 1000000 ((1 1000 1000000) 'sparse)) (case 7 ((1) 'one))",
+      { "nullptr", "'low", "'mid", "'other", "'sym", "'char", "'nil", "'no",
+        "'sparse", "nullptr" }
+    },
+    {
+      "(let ((x 1) (y 2)) (+ x y)) (let* ((x 1) (y (+ x 1))) (* y 5))"
+      "(letrec ((ev (lambda (n) (if (= n 0) #t (od (- n 1)))))"
+      "(od (lambda (n) (if (= n 0) #f (ev (- n 1)))))) (ev 11))"
+      "(let loop ((i 0) (a 0)) (if (= i 3) a (loop (+ i 1) (+ (* a 10) i))))",
+      { "3", "10", "false", "12" }
+    },
+    {
+      "(do ((i 0 (+ i 1)) (s 0 (+ s i))) ((= i 5) s))"
+      "(define n 0) (do ((i 0 (+ i 1))) ((= i 1000000)) (set! n i)) n",
+      { "10", "nullptr", "nullptr", "999999" }
+    },
+    {
+      "(define (swap n) (let loop ((a 1) (b 2) (k n))"
+      "(if (= k 0) (- (* a 10) b) (loop b a (- k 1)))))"
+      "(define (grid n) (let rows ((i 0)) (let cols ((j 0))"
+      "(cond ((< j 3) (cols (+ j 1))) ((< i n) (rows (+ i 1))) (else i)))))"
+      "(define (nest n) (do ((i 0 (+ i 1)) (s 0 (do ((j 0 (+ j 1)) (t s (+ t 1)))"
+      "((= j i) t)))) ((= i n) s)))"
+      "(define (fresh n) (let loop ((i 0) (f 0)) (if (= i n) (f) (loop (+ i 1)"
+      "(lambda () i)))))"
+      "(define (skip b) (if b (let ((p 1)) p) (let ((q 5)) (let loop ((k q))"
+      "(if (= k 0) q (loop (- k 1)))))))"
+      "(swap 3) (grid 4) (nest 10) (fresh 3) (skip #f) (skip #t)"
+      "(let loop ((loop 3)) loop)",
+      { "nullptr", "nullptr", "nullptr", "nullptr", "nullptr", "19", "4", "45",
+        "2", "5", "1", "3" }
+    },
+    {
+      "(define n 0) (define p (delay (let () (set! n (+ n 1)) n)))"
+      "(force p) (force p) n (force (make-promise 5)) (promise? (delay 1))"
+      "(define (down k) (delay-force (if (= k 0) (delay 'done) (down (- k 1)))))"
+      "(force (down 100000))",
+      { "nullptr", "nullptr", "1", "1", "1", "5", "true", "nullptr", "'done" }
+    },
+    {
+      "(define (ints k) (stream-cons k (ints (+ k 1))))"
+      "(stream-ref (ints 0) 10)"
+      "(stream-fold + 0 (stream-take 100 (stream-filter (lambda (x) (> x 50))"
+      "(stream-from 1))))"
+      "(stream-car (stream-drop 3 (stream-map (lambda (x) (* x x))"
+      "(list->stream '(1 2 3 4 5)))))"
+      "(stream-null? (stream-drop 5 (list->stream '(1 2))))"
+      "(car (cdr (stream->list (stream-take 3 (stream-from 5 5)))))"
+      "(define evens (stream-lambda (k) (stream-cons k (evens (+ k 2)))))"
+      "(stream-ref (evens 0) 4)",
+      { "nullptr", "10", "10050", "16", "true", "10", "nullptr", "8" }
+    },
+  };
+}
+
+TEST_CASE("engines")
+{
+  for (auto && [name, make] : engines)
+  {
+    for (auto && c : cases)
+    {
+      INFO(name << ": " << c.source);
+      auto results = run(make(), c.source);
+      INFO(results);
+      REQUIRE(results == c.expect);
+    }
+  }
+}
+
+TEST_CASE("special forms short-circuit")
+{
+  const std::string source =
+    "(define n 0) (and 1 #f (set! n 1)) (or #f 2 (set! n 2))"
+    "(cond (#f (set! n 3)) (#t 3) ((set! n 4) 4))"
+    "(case 5 ((1) (set! n 5)) ((5) 5) (else (set! n 6))) n";
+  const std::vector<std::string> expect{ "nullptr", "false", "2", "3", "5",
+    "0" };
+
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    REQUIRE(run(make(), source) == expect);
+  }
+}
+
+TEST_CASE("case dispatches through a table")
+{
+  auto cod = parse("(case x ((1 2 3) 'low) ((4 5 2) 'mid) ((a b) 'sym)"
+    "((#\\a) 'char) (else 'other))");
+  auto exp = std::get<expression::Exp *>(cod->cod_type());
+  auto selection = std::get<expression::Case *>(exp->exp_type());
+  REQUIRE(selection->dispatch);
+
+  auto && dispatch = *selection->dispatch;
+  REQUIRE(dispatch(int64_t(2)) == 0);
+  REQUIRE(dispatch(int64_t(5)) == 1);
+  REQUIRE(dispatch(Symbol{ "b" }) == 2);
+  REQUIRE(dispatch('a') == 3);
+  REQUIRE(dispatch(int64_t(9)) == 4);
+  REQUIRE(dispatch(std::string("a")) == 4);
+
+  vm::VM machine(*Interpreter().env);
+  REQUIRE(machine.compile(cod.get())->tables.size() == 1);
+}
+
+TEST_CASE("loops are inlined")
+{
+  auto inlined = [](std::string source) {
+    auto cod = parse(std::move(source));
+    auto exp = std::get<expression::Exp *>(cod->cod_type());
+    auto type = exp->exp_type();
+    if (auto loop = std::get_if<expression::Do *>(&type))
+    {
+      return (*loop)->loop->inlined;
+    }
+    return std::get<expression::Let *>(type)->inlined;
+  };
+
+  REQUIRE(inlined("(let loop ((i 0)) (if (< i 3) (loop (+ i 1)) i))"));
+  REQUIRE(inlined("(do ((i 0 (+ i 1))) ((= i 3) i) (display i))"));
+  REQUIRE(inlined("(let ((x 1)) (let loop ((i x)) (and i (loop #f))))"));
+  REQUIRE_FALSE(inlined("(let loop ((i 0)) (+ 1 (loop i)))"));
+  REQUIRE_FALSE(inlined("(let loop ((i 0)) (loop))"));
+  REQUIRE_FALSE(inlined("(let loop ((i 0)) (lambda () i))"));
+  REQUIRE_FALSE(inlined("(let loop ((i 0)) (map loop '(1)))"));
+  REQUIRE_FALSE(inlined("(let loop ((i 0)) (define j i) j)"));
+}
+
+TEST_CASE("set! leaves constants alone")
+{
+  const std::string source =
+    "(define (make-counter) (let ((n 0)) (lambda () (set! n (+ n 1)) n)))"
+    "(define c1 (make-counter)) (define c2 (make-counter))"
+    "(c1) (c1) (c2) (c1)"
+    "(define (g) 7) (define z (g)) (set! z 8) (g) z";
+  const std::vector<std::string> expect{ "nullptr", "nullptr", "nullptr",
+    "1", "2", "1", "3", "nullptr", "nullptr", "nullptr", "7", "8" };
+
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    REQUIRE(run(make(), source) == expect);
+  }
+}
+
+TEST_CASE("the interpreter loops in tail position through every form")
+{
+  const std::string source =
+    "(define n 1000000)"
+    "(define (by-if i) (if (= i 0) 'if (by-if (- i 1)))) (by-if n)"
+    "(define (by-and i) (and #t (if (= i 0) 'and (by-and (- i 1)))))"
+    "(by-and n)"
+    "(define (by-or i) (or #f (if (= i 0) 'or (by-or (- i 1))))) (by-or n)"
+    "(define (by-cond i) (cond ((= i 0) 'cond) (else (by-cond (- i 1)))))"
+    "(by-cond n)"
+    "(define (by-case i) (case i ((0) 'case) (else (by-case (- i 1)))))"
+    "(by-case n)"
+    "(define (by-let i) (let ((j (- i 1))) (if (< j 0) 'let (by-let j))))"
+    "(by-let n)"
+    "(define (by-body i) (define j (- i 1)) (if (< j 0) 'body (by-body j)))"
+    "(by-body n)"
+    "(let loop ((i n)) (if (= i 0) 'named-let (loop (- i 1))))"
+    "(define (by-do i) (do () (#t (if (= i 0) 'do (by-do (- i 1))))))"
+    "(by-do n)"
+    "(begin (define (by-cod i) (if (= i 0) 'cod (by-cod (- i 1))))"
+    "(by-cod n))";
+  const std::vector<std::string> expect{ "nullptr", "nullptr", "'if",
+    "nullptr", "'and", "nullptr", "'or", "nullptr", "'cond", "nullptr",
+    "'case", "nullptr", "'let", "nullptr", "'body", "'named-let", "nullptr",
+    "'do", "'cod" };
+
+  REQUIRE(run(interpreter(), source) == expect);
+}
+
+TEST_CASE("the jit agrees with the vm on arithmetic")
+{
+  const std::string source =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(fib 20)"
+    "(define (gcd a b) (if (= b 0) a (if (> a b) (gcd (- a b) b)"
+    "(gcd a (- b a)))))"
+    "(gcd 1071 462) (gcd 12 18)"
+    "(define (sum i n acc) (if (> i n) acc (sum (+ i 1) n (+ acc (* i i)))))"
+    "(sum 1 10000 0) (sum (- 50) 49 0)"
+    "(define (f a b) (if (< a b) (- a b) (* a b))) (f 3 4) (f 4 3)"
+    "(set! < >) (set! * +) (f 3 4) (f 4 3) (fib 5)";
+  const std::vector<std::string> expect{ "nullptr", "6765", "nullptr", "21",
+    "6", "nullptr", "333383335000", "83350", "nullptr", "-1", "12", "nullptr",
+    "nullptr", "7", "1", "5" };
+
+  auto vm = run(machine(), source);
+  auto jit = run(compiled(), source);
+  INFO(jit);
+  REQUIRE(jit == vm);
+  REQUIRE(vm == expect);
+}
+
+TEST_CASE("inlined loops stay in their frame")
+{
+  vm::VM machine(*Interpreter().env);
+  auto procedure = [&](std::string source) {
+    auto cod = parse(std::move(source));
+    return machine.compile(cod.get())->functions.front().get();
+  };
+
+  auto sum = procedure("(lambda (n) (let loop ((i 0) (s 0))"
+    "(if (< i n) (loop (+ i 1) (+ s i)) s)))");
+  REQUIRE(sum->locals.size() == 3);
+  REQUIRE(sum->functions.empty());
+
+  auto count = procedure("(lambda (n) (do ((i 0 (+ i 1))) ((= i n) i)))");
+  REQUIRE(count->locals.size() == 2);
+  REQUIRE(count->functions.empty());
+
+  auto escapes = procedure("(lambda (n) (let loop ((i n)) (lambda () i)))");
+  REQUIRE_FALSE(escapes->functions.empty());
+}
+
+TEST_CASE("evaluated forms are let go of")
+{
+  auto encloses = [](std::string source) {
+    return expression::encloses(parse(std::move(source)).get());
+  };
+  REQUIRE_FALSE(encloses("(+ 1 2)"));
+  REQUIRE_FALSE(encloses("(define x (car '(1 2)))"));
+  REQUIRE_FALSE(encloses("(let loop ((i 0)) (if (< i 3) (loop (+ i 1)) i))"));
+  REQUIRE_FALSE(encloses("(begin (define y 1) (set! y (cond (y => car))))"));
+  REQUIRE(encloses("(define (f) 1)"));
+  REQUIRE(encloses("(car (list (lambda (x) x)))"));
+  REQUIRE(encloses("(delay 1)"));
+  REQUIRE(encloses("(let loop ((i 0)) (map loop '()))"));
+  REQUIRE(encloses("(begin 1 (let ((g (lambda () 1))) (g)))"));
+
+  SECTION("the interpreter keeps only the forms that made procedures")
+  {
+    std::string source = "(define (twice x) (* x 2))";
+    for (int i = 0; i < 1000; ++i)
+    {
+      source += "(car (cons (twice " + std::to_string(i) + ") '(a b)))";
+    }
+    source += "(twice 21)";
+
+    Interpreter interpreter;
+    auto stream = ast(tokens(stringIStream(source, true)));
+    std::vector<expression::CODPtr> program;
+    std::vector<std::weak_ptr<expression::COD>> released;
+    Try<expression::CODPtr> cod;
+    std::string last;
+    while ((cod = stream[0]))
+    {
+      last = std::visit(String(), *interpreter(cod->get()));
+      if (expression::encloses(cod->get()))
+      {
+        program.push_back(*cod);
+      }
+      else
+      {
+        released.push_back(*cod);
+      }
+      cod = {};
+      stream += 1;
+      stream.commit();
+    }
+    REQUIRE(program.size() == 1);
+    REQUIRE(released.size() == 1001);
+    REQUIRE(last == "42");
+    REQUIRE(std::all_of(released.begin(), released.end(),
+      [](auto && form) { return form.expired(); }));
+  }
+
+  SECTION("the vm keeps only the code closures and continuations run in")
+  {
+    vm::VM machine(*Interpreter().env);
+    auto library = machine.programs.size();
+    std::string source = "(define (twice x) (* x 2)) (define k #f)";
+    for (int i = 0; i < 1000; ++i)
+    {
+      source += "(car (cons (twice " + std::to_string(i) + ") '(a b)))";
+    }
+    source += "(set! k (call/cc call/cc)) (+ 1 2) (k 7) k";
+    auto results = run(
+      [&](expression::COD * cod) { return machine(cod); }, source);
+    REQUIRE(results.back() == "7");
+    REQUIRE(machine.programs.size() == library + 2);
+  }
+}
+
+TEST_CASE("quoted constants are built once")
+{
+  auto cod = parse("'(1 (2 \"s\") #(3))");
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    auto eval = make();
+    REQUIRE(eval(cod.get()).obj == eval(cod.get()).obj);
+  }
+}
+
+TEST_CASE("promises are forced once")
+{
+  const std::string source =
+    "(define n 0) (define (tick) (set! n (+ n 1)) n)"
+    "(define p (delay (tick))) (force p) (force p) n"
+    "(define s (stream-cons (tick) (stream-cons (tick) stream-null)))"
+    "(stream-car s) (stream-car s) (stream-car (stream-cdr s))"
+    "(stream-car (stream-cdr s)) n";
+  const std::vector<std::string> expect{ "nullptr", "nullptr", "nullptr", "1",
+    "1", "1", "nullptr", "2", "2", "3", "3", "3" };
+
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    REQUIRE(run(make(), source) == expect);
+  }
+}
+
+TEST_CASE("primitive arity")
+{
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    REQUIRE_THROWS(run(make(), "(car '(1) '(2))"));
+    REQUIRE_THROWS(run(make(), "(define (f x) (cons x)) (f 1)"));
+    REQUIRE_THROWS(run(make(), "(define (f x) (+ x 1)) (f '())"));
+    REQUIRE_THROWS(run(make(), "(define (f x) (car x)) (f 1)"));
+    REQUIRE(run(make(), "(+) (+ 1 2 3 4 5)") ==
+      std::vector<std::string>{ "0", "15" });
+  }
+}
+
+TEST_CASE("isolates run on their own threads")
+{
+  const std::string source =
+    "(define (build i n acc) (if (< i n) (build (+ i 1) n (cons i acc)) acc))"
+    "(define (sum l acc) (if (empty? l) acc (sum (cdr l) (+ acc (car l)))))"
+    "(stream-ref (stream-from 0 2) 100) (sum (build 0 5000 '()) 0)";
+  const std::vector<std::string> expect{ "nullptr", "nullptr", "200",
+    "12497500" };
+
+  std::vector<std::vector<std::string>> results(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    threads.emplace_back([&, i] {
+      results[i] = run(engines[i % engines.size()].second(), source);
+    });
+  }
+  for (auto && thread : threads)
+  {
+    thread.join();
+  }
+  for (auto && result : results)
+  {
+    REQUIRE(result == expect);
+  }
+}
+
+TEST_CASE("futures")
+{
+  const std::string source =
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"
+    "(define (sum l acc) (if (empty? l) acc (sum (cdr l) (+ acc (car l)))))"
+    "(define f (future (fib 15)))"
+    "(touch f) (touch 5) (future? 5)"
+    "(sum (parallel-map (lambda (x) (* x x)) '(1 2 3 4 5)) 0)"
+    "(sum (vector->list (parallel-map fib '#(10 11 12))) 0)"
+    "(parallel-map fib '())";
+  const std::vector<std::string> expect{ "nullptr", "nullptr", "nullptr",
+    "610", "5", "false", "55", "288", "nullptr" };
+
+  for (auto && [name, make] : engines)
+  {
+    INFO(name);
+    REQUIRE(run(make(), source) == expect);
+  }
+  REQUIRE_THROWS(run(interpreter(), "(touch (future (lambda (x) x)))"));
+}
+
+TEST_CASE("idle workers steal tasks")
+{
+  // four tasks that only finish once all of them run at the same time
+  parallel::Pool pool(4);
+  std::atomic<int> started = 0;
+  std::atomic<bool> together = true;
+  auto meet = [&] {
+    ++started;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (started < 4)
+    {
+      if (std::chrono::steady_clock::now() > deadline)
+      {
+        together = false;
+        return;
+      }
+      std::this_thread::yield();
+    }
+  };
+
+  // those a worker submits go on its own deque, where only the others
+  // stealing them can run them while it waits
+  std::vector<std::shared_ptr<parallel::Task>> tasks;
+  auto outer = std::make_shared<parallel::Task>([&] {
+    for (int i = 0; i < 3; ++i)
+    {
+      tasks.push_back(std::make_shared<parallel::Task>(meet));
+      pool.submit(tasks.back());
+    }
+    meet();
+  });
+  pool.submit(outer);
+  outer->wait(false);
+  for (auto && task : tasks)
+  {
+    task->wait(false);
+  }
+  REQUIRE(together);
+}
+
+TEST_CASE("guard")
+{
+  const std::string source =
+    "(define (safe-car x) (guard (e (#t (error-object-message e))) (car x)))"
+    "(safe-car 1) (safe-car (cons 5 6))"
+    "(guard (e ((error-object? e) 1) (#t e)) (raise 7))"
+    "(guard (e (#t (car (cdr (error-object-irritants e)))))"
+    "  (error \"bad\" 1 2))"
+    "(with-exception-handler (lambda (c) 42)"
+    "  (lambda () (+ 1 (raise-continuable 'oops))))"
+    "(guard (e (#t (error-object-message e)))"
+    "  (with-exception-handler (lambda (c) 42) (lambda () (raise 'oops))))"
+    "(guard (e (#t (error-object-message e))) (undefined))"
+    "(guard (e (#t (error-object-message e))) ((lambda (x) x)))"
+    "(guard (e (#t (error-object-message e))) (vector->list 1))"
+    "(guard (e ((= e 2) 20)) (guard (e ((= e 1) 10)) (raise 2)))"
+    "(define (count n acc)"
+    "  (if (= n 0) acc (count (- n 1) (+ acc (guard (e (#t 1)) (car n))))))"
+    "(count 1000 0)";
+  const std::vector<std::string> expect{ "nullptr", "\"Argument type error!\"",
+    "5", "7", "2", "43", "\"handler returned from non-continuable raise\"",
+    "\"variable undefined is not defined!\"",
+    "\"Insufficient number of parameters\"", "\"Argument type error!\"",
+    "20", "nullptr", "1000" };
+
+  REQUIRE(run(interpreter(), source) == expect);
+  REQUIRE_THROWS(run(interpreter(), "(guard (e ((= e 1) 10)) (raise 2))"));
+  REQUIRE_THROWS(run(interpreter(), "(error \"uncaught\")"));
+  REQUIRE_THROWS(run(machine(), "(guard (e (#t 1)) (raise 2))"));
+}
+
+TEST_CASE("failures unwind to the caller's environment")
+{
+  Interpreter interpreter;
+  auto program = ast(tokens(stringIStream("(define x 1) (define (f x) (car x))"
+    "(guard (e (#t x)) (f 5)) (f 5) x (f '(7))")));
+  auto eval = [&](std::ptrdiff_t i) {
+    return std::visit(String(), *interpreter((*program[i]).get()));
+  };
+
+  eval(0);
+  eval(1);
+  REQUIRE(eval(2) == "1");
+  REQUIRE_THROWS(eval(3));
+  REQUIRE(eval(4) == "1");
+  REQUIRE(eval(5) == "7");
+}
+
+TEST_CASE("budgets")
+{
+  auto evaluate = [](std::string source, Interpreter::Budget budget)
+  {
+    Interpreter interpreter;
+    std::vector<std::string> results;
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(
+        std::visit(String(), *interpreter(cod->get(), budget)));
+      stream += 1;
+    }
+    return results;
+  };
+  const std::string count =
+    "(define (count n) (if (= n 0) 0 (count (- n 1))))";
+  const std::string spin = "(define (spin) (spin))";
+
+  REQUIRE(evaluate(count + "(count 99)", { 100 }) ==
+    std::vector<std::string>{ "nullptr", "0" });
+  REQUIRE_THROWS(evaluate(count + "(count 100)", { 100 }));
+  REQUIRE_THROWS(evaluate("(do ((i 0 (+ i 1))) (#f))", { 1000 }));
+  REQUIRE_THROWS(evaluate(spin + "(guard (e (#t 1)) (spin))", { 1000 }));
+
+  auto start = std::chrono::steady_clock::now();
+  auto deadline = start + std::chrono::milliseconds(50);
+  REQUIRE_THROWS(evaluate(spin + "(spin)", { std::nullopt, deadline }));
+  REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(5));
+
+  SECTION("a spent budget is not caught")
+  {
+    Interpreter interpreter;
+    // the procedures defined point into their forms
+    std::vector<expression::CODPtr> program;
+    auto eval = [&](std::string source, Interpreter::Budget budget) {
+      program.push_back(parse(std::move(source)));
+      return std::visit(String(),
+        *interpreter(program.back().get(), budget));
+    };
+    eval(spin, {});
+    eval("(define caught '())", {});
+    auto soon = std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(20);
+    const std::vector<std::pair<std::string, Interpreter::Budget>> runs{
+      { "(guard (e (#t (set! caught (cons 'guard caught)))) (spin))",
+        { 1000 } },
+      { "(with-exception-handler"
+        "  (lambda (e) (set! caught (cons 'handler caught)))"
+        "  (lambda () (spin)))",
+        { 1000 } },
+      { "(guard (e (#t (set! caught (cons 'deadline caught)))) (spin))",
+        { std::nullopt, soon } },
+    };
+    for (auto && [source, budget] : runs)
+    {
+      INFO(source);
+      REQUIRE_THROWS(eval(source, budget));
+    }
+    REQUIRE(eval("caught", {}) == "nullptr");
+    // a guard still catches errors once the budget is back
+    REQUIRE(eval("(guard (e (#t 'caught)) (car 1))", { 1000 }) == "'caught");
+  }
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Combinators.h"
+#include "Expressions.h"
+#include "Lex.h"
+#include "Optimizer.h"
+#include "String.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  // every token up to the end or the first error, with where it starts
+  std::vector<std::string> dump(IStream<Token> stream)
+  {
+    std::vector<std::string> results;
+    for (size_t i = 0; stream[i]; ++i)
+    {
+      auto token = *stream[i];
+      auto value = std::visit(overloaded{
+          [](nullptr_t) -> std::string { return ""; },
+          [](char c) -> std::string { return std::string(1, c); },
+          [](const std::string& s) { return s; },
+          [](std::string_view s) { return std::string(s); },
+          [](auto v) { return std::to_string(v); },
+        }, token.value);
+      results.push_back(to_string(token.type) + " " + value + " " +
+        std::to_string(token.row) + ":" + std::to_string(token.col));
+    }
+    return results;
+  }
+
+  // the tokens lex::token() finds, as tokens() found them before it was
+  // written by hand
+  IStream<Token> combinators(std::string source)
+  {
+    auto parser = select<1>(lex::intertoken_space(), lex::token() ||
+      lex::eof());
+    return IStream<Token>(make_function(
+      [input = stringIStream(std::move(source)), parser]() mutable
+      -> Try<Token>
+      {
+        auto&& res = std::invoke(*parser, input);
+        if (!res)
+        {
+          return Error{ "error." };
+        }
+        input = res->second;
+        return res->first;
+      }));
+  }
+
+  // the source written to a file and mapped
+  std::shared_ptr<const MappedFile> mapped(const std::string& source)
+  {
+    auto path = std::filesystem::temp_directory_path() / "r5rs_lex_test.scm";
+    std::ofstream(path, std::ios::binary) << source;
+    auto file = std::make_shared<const MappedFile>(path.string());
+    std::filesystem::remove(path);
+    return file;
+  }
+
+  // the same tokens from the combinators, an IStream, a string and a file
+  std::vector<std::string> lexed(std::string source)
+  {
+    auto results = dump(combinators(source));
+    REQUIRE(dump(tokens(stringIStream(source))) == results);
+    REQUIRE(dump(tokens(source)) == results);
+    REQUIRE(dump(tokens(mapped(source))) == results);
+    return results;
+  }
+
+  // the forms of the source, written out
+  std::vector<std::string> parsed(std::string source, bool memoizing)
+  {
+    auto toks = tokens(source);
+    toks.memoize(memoizing);
+    std::vector<std::string> results;
+    for (auto forms = ast(toks); forms[0]; forms += 1)
+    {
+      results.push_back(optimize::to_string(forms[0]->get()));
+    }
+    return results;
+  }
+}
+
+TEST_CASE("lexer")
+{
+  SECTION("as the combinators lex")
+  {
+    lexed("(define (f x) (+ x 1))");
+    lexed("'(a . b) `(1 ,x ,@y) #(1 2)");
+    lexed("#t #f #\\a #\\space #\\newline #\\( #\\) \"a\\\"b\\\\c\"");
+    lexed("... .. + - +5 -x a.b ->x x->y 12abc <=? !$%&*/:<=>?^_~x");
+    lexed("; comment\n(f)\n  ;another\n\t\r\n x \"two\nlines\" y");
+    lexed(std::string(40, ' ') + "\"" + std::string(50, 'x') + "\\\"" +
+      std::string(20, 'y') + "\"\n" + std::string(33, '\n') + "(z)");
+    lexed(";" + std::string(100, '-') + "\n" + std::string(17, '\t') + "q");
+    lexed("");
+  }
+
+  SECTION("stopping where the combinators do")
+  {
+    lexed("(a \"unterminated");
+    lexed("(a #\\spacex)");
+    lexed("(a \"bad \\n escape\")");
+    lexed("(a @b)");
+    lexed(std::string("(a \0 b)", 7));
+  }
+
+  SECTION("positions and values")
+  {
+    REQUIRE(lexed("(f\n  \"s\" 42 #\\x)") == std::vector<std::string>{
+      "left_paren  1:0", "identifier f 1:1", "string s 2:2", "number 42 2:6",
+      "character x 2:9", "right_paren  2:12", "eof  2:13" });
+  }
+
+  SECTION("a comment at the very end still ends in eof")
+  {
+    auto results = std::vector<std::string>{ "identifier x 1:0", "eof  1:7" };
+    REQUIRE(dump(tokens("x ; end")) == results);
+    REQUIRE(dump(tokens(stringIStream("x ; end"))) == results);
+  }
+
+  SECTION("numbers too large for a fixnum")
+  {
+    REQUIRE_THROWS(dump(tokens("123456789012345678901234567890")));
+  }
+}
+
+TEST_CASE("mapped files")
+{
+  SECTION("point into the file for text without escapes")
+  {
+    auto file = mapped("(define s \"plain\")\n\"a\\\"b\"");
+    auto stream = tokens(file);
+    auto text = file->text();
+    auto view = std::get<std::string_view>(stream[1]->value);
+    REQUIRE(view == "define");
+    REQUIRE(view.data() == text.data() + 1);
+    view = std::get<std::string_view>(stream[3]->value);
+    REQUIRE(view == "plain");
+    REQUIRE(view.data() == text.data() + 11);
+    REQUIRE(std::get<std::string>(stream[5]->value) == "a\"b");
+    REQUIRE(stream.bounded());
+  }
+
+  SECTION("parse as strings do")
+  {
+    std::string source = "(define (f x) (g \"s\" 'y))\n(f \"a\\\\b\")";
+    std::vector<std::string> forms;
+    for (auto stream = ast(tokens(source)); stream[0]; stream += 1)
+    {
+      forms.push_back(optimize::to_string(stream[0]->get()));
+    }
+    auto stream = ast(tokens(mapped(source)));
+    for (auto&& form : forms)
+    {
+      REQUIRE(optimize::to_string(stream[0]->get()) == form);
+      stream += 1;
+    }
+    REQUIRE(!stream[0]);
+  }
+
+  SECTION("that are empty or missing")
+  {
+    REQUIRE(lexed("") == std::vector<std::string>{ "eof  1:0" });
+    REQUIRE_THROWS_AS(MappedFile("/nonexistent/r5rs.scm"),
+      std::runtime_error);
+  }
+}
+
+TEST_CASE("combinators")
+{
+  using namespace combinators;
+
+  auto digit = leaf<char>([](IStream<char>& in) -> std::optional<int>
+    {
+      auto c = in.at(0);
+      if (!c || *c < '0' || *c > '9')
+      {
+        return std::nullopt;
+      }
+      in += 1;
+      return *c - '0';
+    });
+  auto is = [](char want)
+  {
+    return leaf<char>([want](IStream<char>& in) -> std::optional<char>
+      {
+        auto c = in.at(0);
+        if (!c || *c != want)
+        {
+          return std::nullopt;
+        }
+        in += 1;
+        return want;
+      });
+  };
+  auto chars = [](std::string s)
+  {
+    return IStream<char>(std::vector<char>(s.begin(), s.end()));
+  };
+
+  SECTION("a parser that fails leaves the stream where it was")
+  {
+    auto pair = combine([](int a, char, int b) { return a * 10 + b; },
+      digit, is(','), digit);
+    auto in = chars("1,x");
+    REQUIRE(!pair(in));
+    REQUIRE(in.current() == 0);
+    REQUIRE((pair || digit)(in) == 1);
+    REQUIRE(in.current() == 1);
+  }
+
+  SECTION("outputs compose")
+  {
+    auto list = select<1>(is('('), digit.some(), is(')'))
+      .map([](std::list<int> digits) { return digits.size(); });
+    auto in = chars("(123)()");
+    REQUIRE(list(in) == 3u);
+    REQUIRE(!list(in));
+    auto maybe = list.maybe()(in);
+    REQUIRE(maybe);
+    REQUIRE(!*maybe);
+    REQUIRE(digit.otherwise(7)(in) == 7);
+    REQUIRE(in.current() == 5);
+  }
+}
+
+TEST_CASE("bounded streams")
+{
+  auto counting = [](bool bounded)
+  {
+    return IStream<int>(make_function([n = 0]() mutable -> Try<int>
+      {
+        return n++;
+      }), bounded);
+  };
+
+  SECTION("commit releases what is before it")
+  {
+    auto stream = counting(true);
+    auto start = stream;
+    REQUIRE(*stream[9] == 9);
+    stream += 5;
+    stream.commit();
+    REQUIRE(stream.buffered() == 5);
+    REQUIRE(*stream[0] == 5);
+    REQUIRE(!start[0]);
+    REQUIRE(!(stream - 1)[0]);
+  }
+
+  SECTION("unless the stream is unbounded")
+  {
+    auto stream = counting(false);
+    auto start = stream;
+    REQUIRE(*stream[9] == 9);
+    stream += 5;
+    stream.commit();
+    REQUIRE(stream.buffered() == 10);
+    REQUIRE(*start[0] == 0);
+  }
+
+  SECTION("parsing holds no more than the form being read")
+  {
+    std::string source;
+    for (int i = 0; i < 2000; ++i)
+    {
+      source += "(define (f" + std::to_string(i) + " x) (+ x \"one\" 1))\n";
+    }
+    auto chars = stringIStream(source, true);
+    auto toks = tokens(chars);
+    auto forms = ast(toks);
+    REQUIRE(forms.bounded());
+
+    size_t n = 0;
+    size_t most = 0;
+    while (forms[0])
+    {
+      most = std::max({ most, chars.buffered(), toks.buffered() });
+      forms += 1;
+      forms.commit();
+      ++n;
+    }
+    REQUIRE(n == 2000);
+    REQUIRE(most < 64);
+    REQUIRE(forms.buffered() == 0);
+  }
+}
+
+TEST_CASE("packrat parsing")
+{
+  auto nest = [](std::string inside, int i)
+  {
+    return "(cond (" + inside + " " + std::to_string(i) + "))";
+  };
+  // a clause is tried as an arrow before it is taken for a plain one, both
+  // starting with the cond inside, which doubles the parsing at each level
+  // without memoizing
+  std::string nested = "(cond (x => f))";
+  for (int i = 0; i < 12; ++i)
+  {
+    nested = nest(nested, i);
+  }
+  std::string source = "(define (f x) (if x (g x) 'none))\n"
+    "(begin (define a 1) (define b (lambda (y) (let ((z y)) z))))\n"
+    "(begin (define c 2) (f c))\n" + nested;
+
+  SECTION("gives the forms that parsing without it does")
+  {
+    memo_stats = {};
+    auto plain = parsed(source, false);
+    REQUIRE(memo_stats.lookups == 0);
+    REQUIRE(plain.size() == 4);
+    REQUIRE(parsed(source, true) == plain);
+    REQUIRE(memo_stats.hits > 0);
+    REQUIRE(memo_stats.rate() > 0);
+  }
+
+  SECTION("parses each position once")
+  {
+    memo_stats = {};
+    parsed(nested, true);
+    auto lookups = memo_stats.lookups;
+    nested = nest(nested, 12);
+    memo_stats = {};
+    parsed(nested, true);
+    // one more level adds a few lookups rather than doubling them
+    REQUIRE(memo_stats.lookups < lookups * 3 / 2);
+  }
+
+  SECTION("commit forgets what was remembered before it")
+  {
+    std::string forms;
+    for (int i = 0; i < 100; ++i)
+    {
+      forms += "(f (g " + std::to_string(i) + "))\n";
+    }
+    for (auto bounded : { false, true })
+    {
+      auto toks = tokens(stringIStream(forms, bounded));
+      toks.memoize();
+      auto stream = ast(toks);
+      for (size_t i = 0; i < 10; ++i)
+      {
+        REQUIRE(bool(stream[0]));
+        stream += 1;
+      }
+      REQUIRE((toks.memoized() == 0) == bounded);
+    }
+  }
+}
@@ -0,0 +1,139 @@
+#include <string>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "Optimizer.h"
+#include "String.h"
+
+#include "output.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  std::vector<std::string> dump(std::string source)
+  {
+    std::vector<std::string> results;
+    auto stream =
+      optimize::optimize(ast(tokens(stringIStream(std::move(source)))));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(optimize::to_string(cod->get()));
+      stream += 1;
+    }
+    return results;
+  }
+
+  std::vector<std::string> run(std::string source, bool optimized)
+  {
+    Interpreter interpreter;
+    std::vector<std::string> results;
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    if (optimized)
+    {
+      stream = optimize::optimize(stream);
+    }
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(std::visit(String(), *interpreter(cod->get())));
+      stream += 1;
+    }
+    return results;
+  }
+}
+
+TEST_CASE("optimizer rewrites")
+{
+  REQUIRE(dump("(* 2 3) (if #t 1 2) (if '() 1) (car '((1 2) 3))") ==
+    std::vector<std::string>{ "6", "1", "'()", "'(1 2)" });
+  REQUIRE(dump("((lambda (x) (+ x 1)) 5) ((lambda (x y) (x y)) car y)") ==
+    std::vector<std::string>{ "6", "(car y)" });
+  REQUIRE(dump("(define k 3) (define (inc x) (+ x k)) (inc 4) (lambda (y) (inc y))") ==
+    std::vector<std::string>{ "(define k 3)", "(define inc (lambda (x) (+ x 3)))",
+      "7", "(lambda (y) (+ y 3))" });
+  REQUIRE(dump("(lambda (n) (if (< 1 2) 5 n) 7 n)") ==
+    std::vector<std::string>{ "(lambda (n) n)" });
+  REQUIRE(dump("(and 1 x y) (or #f x) (and x #f y) (or)"
+    "(cond (#f 1) ((car x) 2) (#t 3) (else 4)) (let ((x 1)) (+ x 1))") ==
+    std::vector<std::string>{ "(and x y)", "x", "(and x #f)", "#f",
+      "(cond ((car x) 2) (#t 3))", "2" });
+}
+
+TEST_CASE("optimizer respects bindings")
+{
+  SECTION("assigned primitives are not folded")
+  {
+    REQUIRE(dump("(define (k) (+ 1 2)) (set! + *)")[0] ==
+      "(define k (lambda () (+ 1 2)))");
+  }
+
+  SECTION("shadowed primitives are not folded")
+  {
+    REQUIRE(dump("(lambda (+) (+ 1 2))")[0] == "(lambda (+) (+ 1 2))");
+    REQUIRE(dump("(lambda () (define (car x) x) (car '(1)))")[0] ==
+      "(lambda () (define car (lambda (x) x)) (car '(1)))");
+  }
+
+  SECTION("assigned variables are not propagated")
+  {
+    REQUIRE(dump("(define n 1) (set! n 2) n")[2] == "n");
+    REQUIRE(dump("((lambda (x) (set! x 2) x) 1)")[0] ==
+      "((lambda (x) (set! x 2) x) 1)");
+  }
+
+  SECTION("substitution does not capture")
+  {
+    REQUIRE(dump("(lambda (y) ((lambda (x) (lambda (y) x)) y))")[0] ==
+      "(lambda (y) ((lambda (x) (lambda (y) x)) y))");
+    REQUIRE(dump("(define (f x) (+ x k)) (lambda (k) (f 1))")[1] ==
+      "(lambda (k) (f 1))");
+  }
+
+  SECTION("operands with effects are not substituted")
+  {
+    REQUIRE(dump("((lambda (x) 1) (car 2))")[0] == "((lambda (x) 1) (car 2))");
+  }
+
+  SECTION("operands that may fail are not dropped or reordered")
+  {
+    const std::string program =
+      "(define (k2 x y) x) (define (bad) (k2 1 undefined-thing)) (bad)";
+    REQUIRE(dump(program)[1] ==
+      "(define bad (lambda () (k2 1 undefined-thing)))");
+    REQUIRE_THROWS(run(program, false));
+    REQUIRE_THROWS(run(program, true));
+    REQUIRE(dump("((lambda (x y) (y x)) a b)")[0] ==
+      "((lambda (x y) (y x)) a b)");
+    REQUIRE(dump("((lambda (x) (if x x 1)) a)")[0] ==
+      "((lambda (x) (if x x 1)) a)");
+  }
+}
+
+TEST_CASE("optimized programs")
+{
+  const std::vector<std::string> programs{
+    "(define (f a b) (if (< a b) (+ a b) 0)) (f 2 3) (set! + *) (f 2 3)",
+    "(define (k) (+ 1 2)) (k) (set! + *) (k)",
+    "(define (f +) (+ 1 2)) (f *)",
+    "(define (sq x) (* x x)) (define (sum a b) (+ (sq a) (sq b))) (sum 3 4)",
+    "(define (mk) (define n 0) (lambda () (set! n (+ n 1)) n))"
+    "(define c (mk)) (c) (c)",
+    "(define (loop i n) (if (< i n) (loop (+ i 1) n) i)) (loop 0 1000)",
+    "(car ((lambda (x y) (if (= x y) '(same) '(different))) 1 1))",
+    "(define (f n) (let loop ((i 0) (s 0)) (if (< i n) (loop (+ i 1) (+ s i)) s)))"
+    "(f 10) (do ((i 0 (+ i 1)) (s 1 (* s 2))) ((= i 4) s))",
+    "(define (k x) (case (car x) ((1) (and x 'one)) (else (or '() 'other))))"
+    "(k '(1)) (k '(2)) (let* ((a 1) (b (+ a 1))) (cond ((= b 2) => (lambda (t) (and t b))) (else b)))",
+  };
+
+  for (auto && program : programs)
+  {
+    INFO(program);
+    REQUIRE(run(program, true) == run(program, false));
+  }
+}
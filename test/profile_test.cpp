@@ -0,0 +1,164 @@
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Expressions.h"
+#include "GC.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "Metrics.h"
+#include "Profiler.h"
+#include "String.h"
+#include "Trace.h"
+
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  // the forms evaluated, which the procedures sampled point into
+  std::vector<expression::CODPtr> program;
+
+  std::string run(Interpreter& interpreter, std::string source)
+  {
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    std::string res;
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      program.push_back(*cod);
+      res = std::visit(String(), *interpreter(cod->get()));
+      stream += 1;
+    }
+    return res;
+  }
+}
+
+TEST_CASE("profiler")
+{
+  Interpreter interpreter;
+  run(interpreter,
+    "(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))\n"
+    "(define (spin n) (if (= n 0) 0 (spin (- n 1))))");
+
+  SECTION("off, the interpreter keeps no stack")
+  {
+    run(interpreter, "(fib 10)");
+    REQUIRE(profile::stack.depth == 0);
+  }
+
+  SECTION("samples name the procedures and where they start")
+  {
+    profile::enabled = true;
+    profile::Profiler profiler;
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (profiler.samples() < 50 && std::chrono::steady_clock::now() < until)
+    {
+      run(interpreter, "(fib 15) (spin 1000)");
+    }
+    profiler.stop();
+    profile::enabled = false;
+    REQUIRE(profile::stack.depth == 0);
+    REQUIRE(profiler.samples() >= 50);
+
+    std::ostringstream folded;
+    profiler.folded(folded);
+    REQUIRE(folded.str().find("fib (1:9);fib (1:9)") != std::string::npos);
+    // tail calls replace the frame rather than pile up
+    REQUIRE(folded.str().find("spin (2:9);spin") == std::string::npos);
+
+    std::ostringstream report;
+    profiler.report(report);
+    REQUIRE(report.str().find("fib (1:9)") != std::string::npos);
+  }
+}
+
+TEST_CASE("metrics")
+{
+  // built without R5RS_METRICS they stay zero
+  if (!metrics::compiled)
+  {
+    return;
+  }
+  Interpreter interpreter;
+  run(interpreter,
+    "(define (add x y) (+ x y))\n"
+    "(define (down n) (if (= n 0) 0 (+ 1 (down (- n 1)))))\n"
+    "(define (spin n) (if (= n 0) 0 (spin (- n 1))))");
+
+  SECTION("calls and evaluations")
+  {
+    metrics::reset();
+    run(interpreter, "(add 1 2)");
+    auto&& counters = metrics::counters;
+    REQUIRE(counters.evaluations[2] == 2);
+    REQUIRE(counters.evaluations[0] == 4);
+    REQUIRE(counters.evaluations[1] == 2);
+    REQUIRE(counters.closure_calls == 1);
+    REQUIRE(counters.primitive_calls == 1);
+    REQUIRE(counters.arguments == 4);
+    REQUIRE(counters.frames == 1);
+    REQUIRE(counters.max_depth == 1);
+
+    std::ostringstream json;
+    metrics::json(json);
+    REQUIRE(json.str().find("\"call\":2,") != std::string::npos);
+    REQUIRE(json.str().find("\"average_arguments\":2,") != std::string::npos);
+  }
+
+  SECTION("tail calls do not nest")
+  {
+    metrics::reset();
+    run(interpreter, "(down 10)");
+    REQUIRE(metrics::counters.max_depth == 11);
+    metrics::reset();
+    run(interpreter, "(spin 10)");
+    REQUIRE(metrics::counters.max_depth == 1);
+    REQUIRE(metrics::counters.depth == 0);
+  }
+
+  SECTION("read from Scheme")
+  {
+    metrics::reset();
+    run(interpreter,
+      "(define metrics ((lambda () (add 1 2) (evaluator-metrics))))");
+    REQUIRE(run(interpreter, "(car (car (cdr metrics)))") ==
+      "'closure-calls");
+    REQUIRE(run(interpreter, "(cdr (car (cdr metrics)))") == "2");
+    REQUIRE(run(interpreter, "(cdr (car (cdr (car metrics))))") == "5");
+  }
+}
+
+TEST_CASE("trace")
+{
+  Interpreter interpreter;
+  trace::clear();
+
+  SECTION("spans of every phase")
+  {
+    trace::enabled = true;
+    run(interpreter, "(define (f x) (* x 2)) (f 21)");
+    GC::mark_and_sweep();
+    trace::enabled = false;
+
+    std::ostringstream json;
+    trace::json(json);
+    for (auto name : { "lex", "parse", "eval", "gc" })
+    {
+      auto begin = "{\"name\":\"" + std::string(name) +
+        "\",\"cat\":\"r5rs\",\"ph\":\"B\"";
+      REQUIRE(json.str().find(begin) != std::string::npos);
+    }
+    REQUIRE(json.str().starts_with("{\"traceEvents\":["));
+  }
+
+  SECTION("nothing while off")
+  {
+    run(interpreter, "(define (f x) (* x 2)) (f 21)");
+    std::ostringstream json;
+    trace::json(json);
+    REQUIRE(json.str().find("\"name\"") == std::string::npos);
+  }
+}
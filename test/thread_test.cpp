@@ -0,0 +1,173 @@
+#include <string>
+#include <vector>
+
+#include "Expressions.h"
+#include "Interpreter.h"
+#include "Lex.h"
+#include "String.h"
+#include "VM.h"
+
+#include "output.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace r5rs;
+
+namespace
+{
+  std::vector<std::string> run(std::string source, bool jit)
+  {
+    vm::VM machine(*Interpreter().env);
+    if (jit)
+    {
+      machine.enable_jit(1);
+    }
+    std::vector<std::string> results;
+    auto stream = ast(tokens(stringIStream(std::move(source))));
+    Try<expression::CODPtr> cod;
+    while ((cod = stream[0]))
+    {
+      results.push_back(std::visit(String(), *machine(cod->get())));
+      stream += 1;
+    }
+    return results;
+  }
+
+  // the same results with and without the jit
+  std::vector<std::string> run(std::string source)
+  {
+    auto results = run(source, false);
+    REQUIRE(run(source, true) == results);
+    return results;
+  }
+
+  const std::string logging =
+    "(define log '())"
+    "(define (note x) (set! log (cons x log)))";
+}
+
+TEST_CASE("green threads")
+{
+  SECTION("yield takes turns")
+  {
+    REQUIRE(run(logging +
+      "(spawn (lambda () (note 1) (yield) (note 3)))"
+      "(spawn (lambda () (note 2) (yield) (note 4)))"
+      "(yield) (car log) (yield) (car log) (car (cdr (cdr (cdr log))))") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "nullptr", "2", "nullptr", "4", "1" });
+  }
+
+  SECTION("sleep wakes the earliest first")
+  {
+    REQUIRE(run(logging +
+      "(define done (make-channel 3))"
+      "(define (worker ms) (sleep ms) (note ms) (channel-send done ms))"
+      "(spawn (lambda () (worker 30)))"
+      "(spawn (lambda () (worker 10)))"
+      "(spawn (lambda () (worker 20)))"
+      "(channel-receive done) (channel-receive done) (channel-receive done)"
+      "(car log)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "nullptr", "nullptr", "nullptr", "10", "20", "30", "30" });
+  }
+
+  SECTION("dynamic-wind handlers belong to their thread")
+  {
+    REQUIRE(run(logging +
+      "(spawn (lambda () (dynamic-wind (lambda () (note 1))"
+      "  (lambda () (yield)) (lambda () (note 2)))))"
+      "(call/cc (lambda (k) (yield) (k 0)))"
+      "(car log) (yield) (car log)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "0", "1",
+        "nullptr", "2" });
+  }
+
+  SECTION("an error forgets the threads of its form")
+  {
+    vm::VM machine(*Interpreter().env);
+    auto program = ast(tokens(stringIStream(
+      "(define ch (make-channel)) (spawn (lambda () (car 1)))"
+      "(+ 100 ((lambda () (yield) 5))) (channel-receive ch)"
+      "(spawn (lambda () (channel-send ch 7))) (channel-receive ch)")));
+    auto eval = [&](std::ptrdiff_t i) {
+      return std::visit(String(), *machine((*program[i]).get()));
+    };
+
+    eval(0);
+    eval(1);
+    REQUIRE_THROWS(eval(2));
+    REQUIRE_THROWS(eval(3));
+    eval(4);
+    REQUIRE(eval(5) == "7");
+  }
+
+  SECTION("blocked for good")
+  {
+    REQUIRE_THROWS(run("(channel-receive (make-channel))", false));
+  }
+}
+
+TEST_CASE("channels")
+{
+  SECTION("rendezvous")
+  {
+    REQUIRE(run(
+      "(define ch (make-channel))"
+      "(define (produce i n) (if (< i n)"
+      "  ((lambda () (channel-send ch i) (produce (+ i 1) n)))"
+      "  (channel-send ch (- 1))))"
+      "(define (consume acc) ((lambda (v)"
+      "  (if (< v 0) acc (consume (+ acc v)))) (channel-receive ch)))"
+      "(spawn (lambda () (produce 0 100)))"
+      "(consume 0) (channel? ch) (channel? 1)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "4950", "true", "false" });
+  }
+
+  SECTION("a full buffer blocks the sender")
+  {
+    REQUIRE(run(logging +
+      "(define ch (make-channel 2))"
+      "(spawn (lambda () (channel-send ch 1) (channel-send ch 2)"
+      "  (channel-send ch 3) (note 3)))"
+      "(yield) log (channel-receive ch) (yield) (car log)"
+      "(channel-receive ch) (channel-receive ch)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+        "nullptr", "nullptr", "1", "nullptr", "3", "2", "3" });
+  }
+
+  SECTION("thousands of threads")
+  {
+    REQUIRE(run(
+      "(define ch (make-channel))"
+      "(define (start i) (if (< i 5000)"
+      "  ((lambda () (spawn (lambda () (channel-send ch i))) (start (+ i 1))))"
+      "  #t))"
+      "(define (collect i acc)"
+      "  (if (< i 5000) (collect (+ i 1) (+ acc (channel-receive ch))) acc))"
+      "(start 0) (collect 0 0)") ==
+      std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "true",
+        "12497500" });
+  }
+}
+
+TEST_CASE("non-blocking ports")
+{
+  REQUIRE(run(
+    "(define p (pipe))"
+    "(spawn (lambda () (sleep 10) (write-string (cdr p) \"one\ntwo\")"
+    "  (close-port (cdr p))))"
+    "(read-line (car p)) (read-line (car p)) (read-line (car p))"
+    "(close-port (car p))") ==
+    std::vector<std::string>{ "nullptr", "nullptr", "\"one\"", "\"two\"",
+      "false", "nullptr" });
+
+  // a thread waiting on a port leaves the others to run meanwhile
+  REQUIRE(run(logging +
+    "(define p (pipe))"
+    "(spawn (lambda () (note (read-line (car p)))))"
+    "(yield) (note 'main) (write-string (cdr p) \"line\n\") (sleep 10)"
+    "(car log) (car (cdr log))") ==
+    std::vector<std::string>{ "nullptr", "nullptr", "nullptr", "nullptr",
+      "nullptr", "nullptr", "nullptr", "nullptr", "\"line\"", "'main" });
+}